@@ -2689,6 +2689,71 @@ test_conversation_full(void)
                                0x0d);
 }
 
+static bool
+test_server_busy(void)
+{
+        struct harness *harness = create_harness_no_start();
+
+        if (harness == NULL)
+                return false;
+
+        bool ret = true;
+
+        vsx_connection_set_conversation_id(harness->connection,
+                                           UINT64_C(0xfedcba9876543210));
+
+        if (!start_connection(harness) ||
+            !read_ws_request(harness) ||
+            !write_string(harness, "\r\n\r\n")) {
+                ret = false;
+                goto out;
+        }
+
+        const uint8_t expected_data[] =
+                "\x82\x15\x8d\x10\x32\x54\x76\x98\xba\xdc\xfe" "test_player\0";
+
+        if (!expect_data(harness, expected_data, (sizeof expected_data) - 1)) {
+                ret = false;
+                goto out;
+        }
+
+        harness->expected_error_domain = &vsx_connection_error;
+        harness->expected_error_code = VSX_CONNECTION_ERROR_SERVER_BUSY;
+        harness->expected_error_message =
+                "The server is too busy to accept new players";
+
+        static const uint8_t command[] = { 0x82, 0x01, 0x0e };
+
+        if (!write_data(harness, command, sizeof command)) {
+                ret = false;
+                goto out;
+        }
+
+        if (harness->expected_error_message != NULL) {
+                fprintf(stderr,
+                        "No error received after sending server busy "
+                        "message\n");
+                ret = false;
+                goto out;
+        }
+
+        /* The connection should try again but not immediately */
+        if (harness->wakeup_time < vsx_monotonic_get() + 15000000) {
+                fprintf(stderr,
+                        "Expected connection to delay for at least 15 "
+                        "seconds after server busy but only %f are "
+                        "requested\n",
+                        (harness->wakeup_time - vsx_monotonic_get()) /
+                        1000000.0);
+                ret = false;
+                goto out;
+        }
+
+out:
+        free_harness(harness);
+        return ret;
+}
+
 static bool
 test_connection_is_blocking_for_config(struct harness *harness)
 {
@@ -3169,6 +3234,9 @@ main(int argc, char **argv)
         if (!test_conversation_full())
                 ret = EXIT_FAILURE;
 
+        if (!test_server_busy())
+                ret = EXIT_FAILURE;
+
         if (!test_leak_pendings())
                 ret = EXIT_FAILURE;
 
@@ -817,6 +817,41 @@ handle_conversation_full(struct vsx_connection *connection,
         return true;
 }
 
+static bool
+handle_server_busy(struct vsx_connection *connection,
+                   const uint8_t *payload,
+                   size_t payload_length,
+                   struct vsx_error **error)
+{
+        if (!vsx_proto_read_payload(payload + 1,
+                                    payload_length - 1,
+
+                                    VSX_PROTO_TYPE_NONE)) {
+                vsx_set_error(error,
+                              &vsx_connection_error,
+                              VSX_CONNECTION_ERROR_BAD_DATA,
+                              "The server sent an invalid server busy "
+                              "command");
+                return false;
+        }
+
+        /* Unlike the other errors, this one is temporary so it is
+         * reported as a failure in order to make the connection close
+         * and try again with the usual increasing reconnect delay.
+         * The first retry shouldn’t be immediate because that would
+         * just add to the load on the server.
+         */
+        if (connection->reconnect_timeout == 0)
+                connection->reconnect_timeout = VSX_CONNECTION_INITIAL_TIMEOUT;
+
+        vsx_set_error(error,
+                      &vsx_connection_error,
+                      VSX_CONNECTION_ERROR_SERVER_BUSY,
+                      "The server is too busy to accept new players");
+
+        return false;
+}
+
 static bool
 process_message(struct vsx_connection *connection,
                 const uint8_t *payload,
@@ -887,6 +922,10 @@ process_message(struct vsx_connection *connection,
                 return handle_conversation_full(connection,
                                                 payload, payload_length,
                                                 error);
+        case VSX_PROTO_SERVER_BUSY:
+                return handle_server_busy(connection,
+                                          payload, payload_length,
+                                          error);
         }
 
         return true;
@@ -142,6 +142,7 @@ enum vsx_connection_error {
         VSX_CONNECTION_ERROR_BAD_PLAYER_ID,
         VSX_CONNECTION_ERROR_BAD_CONVERSATION_ID,
         VSX_CONNECTION_ERROR_CONVERSATION_FULL,
+        VSX_CONNECTION_ERROR_SERVER_BUSY,
 };
 
 extern struct vsx_error_domain
@@ -0,0 +1,1335 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Simulates lots of players connecting to a server in order to
+ * benchmark it. Each player is a regular vsx_connection with its own
+ * socket. The players are spread over a few threads that each run an
+ * epoll loop. Every player performs random actions at the configured
+ * rates and the time until the server sends back the change that the
+ * action caused is recorded as the round trip time for that command.
+ * Only one of each type of command can be waiting for a reply at a
+ * time so that the replies can be matched up with the commands.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "vsx-connection.h"
+#include "vsx-game-state.h"
+#include "vsx-board.h"
+#include "vsx-monotonic.h"
+#include "vsx-netaddress.h"
+#include "vsx-buffer.h"
+#include "vsx-util.h"
+
+/* Time in microseconds to wait for the reply to a command before
+ * counting it as lost. The server silently ignores some commands,
+ * such as a shout while someone else is shouting.
+ */
+#define LOADGEN_REPLY_TIMEOUT (10 * 1000 * 1000)
+
+/* Time in microseconds to wait for the players to leave at the end */
+#define LOADGEN_LEAVE_TIMEOUT (2 * 1000 * 1000)
+
+#define LOADGEN_MAX_EVENTS 256
+
+enum loadgen_command {
+        LOADGEN_COMMAND_JOIN,
+        LOADGEN_COMMAND_RECONNECT,
+        LOADGEN_COMMAND_MOVE_TILE,
+        LOADGEN_COMMAND_TURN,
+        LOADGEN_COMMAND_SEND_MESSAGE,
+        LOADGEN_COMMAND_SHOUT,
+};
+
+#define LOADGEN_N_COMMANDS (LOADGEN_COMMAND_SHOUT + 1)
+
+static const char * const
+command_names[LOADGEN_N_COMMANDS] = {
+        [LOADGEN_COMMAND_JOIN] = "join",
+        [LOADGEN_COMMAND_RECONNECT] = "reconnect",
+        [LOADGEN_COMMAND_MOVE_TILE] = "move_tile",
+        [LOADGEN_COMMAND_TURN] = "turn",
+        [LOADGEN_COMMAND_SEND_MESSAGE] = "send_message",
+        [LOADGEN_COMMAND_SHOUT] = "shout",
+};
+
+struct loadgen_pending {
+        /* Monotonic time that the command was sent, or zero if it
+         * isn’t waiting for a reply.
+         */
+        int64_t start_time;
+        /* Details of the command to recognise the reply */
+        int tile_num, x, y;
+        int message_num;
+};
+
+struct loadgen_command_stats {
+        uint64_t n_sent;
+        uint64_t n_lost;
+        /* Array of int64_t round trip times in microseconds */
+        struct vsx_buffer rtts;
+};
+
+struct loadgen_thread;
+
+struct loadgen_player {
+        struct loadgen_thread *thread;
+        int num;
+
+        struct vsx_connection *connection;
+        struct vsx_listener event_listener;
+
+        /* The poll state that was last requested by the connection */
+        int fd;
+        short events;
+        int64_t wakeup_time;
+
+        int64_t start_time;
+        bool started;
+        bool running;
+        /* True if the server has accepted the player since the last
+         * time it connected.
+         */
+        bool connected;
+        int64_t next_action_time;
+
+        /* What the player knows about its game */
+        int self_num;
+        bool has_turn;
+        int n_players;
+        int n_tiles;
+        int n_tiles_in_play;
+
+        int next_message_num;
+
+        struct loadgen_pending pending[LOADGEN_N_COMMANDS];
+};
+
+struct loadgen_thread {
+        pthread_t thread;
+        bool thread_created;
+        int epoll_fd;
+        unsigned seed;
+
+        struct loadgen_player *players;
+        int n_players;
+
+        /* The earliest time that one of the players needs attention */
+        int64_t next_scan_time;
+
+        int n_running;
+
+        struct loadgen_command_stats stats[LOADGEN_N_COMMANDS];
+        uint64_t n_errors;
+        char *last_error;
+
+        /* These are also read by the main thread for the progress
+         * reports.
+         */
+        atomic_uint_fast64_t n_answered;
+        atomic_uint_fast64_t n_events;
+        atomic_int n_connected;
+};
+
+static const char options[] = "-hs:p:n:g:j:d:J:m:t:c:S:r:";
+
+static const char *option_server = "127.0.0.1";
+static int option_port = 5144;
+static int option_n_players = 1000;
+static int option_game_size = 4;
+static int option_n_threads = 1;
+static double option_duration = 30.0;
+static double option_join_rate = 200.0;
+
+/* Rates of each random action per player per second */
+static double option_move_rate = 0.5;
+static double option_turn_rate = 0.5;
+static double option_message_rate = 0.05;
+static double option_shout_rate = 0.01;
+static double option_reconnect_rate = 0.005;
+
+static struct vsx_netaddress server_address;
+static int64_t start_time;
+static int64_t end_time;
+static char room_prefix[32];
+
+static void
+usage(void)
+{
+        printf("vsx-loadgen - Simulates players to benchmark a "
+               "verda-sxtelo server\n"
+               "usage: vsx-loadgen [options]...\n"
+               " -h                   Show this help message\n"
+               " -s <address>         The server address "
+               "(default 127.0.0.1)\n"
+               " -p <port>            The server port (default 5144)\n"
+               " -n <players>         Number of players (default 1000)\n"
+               " -g <size>            Players in each game (default 4)\n"
+               " -j <threads>         Number of threads (default 1)\n"
+               " -d <seconds>         Time to run for (default 30)\n"
+               " -J <rate>            New players per second "
+               "(default 200)\n"
+               "\n"
+               "Rates of each action per player per second:\n"
+               " -m <rate>            Tile moves (default 0.5)\n"
+               " -t <rate>            Turns when it is the player’s "
+               "turn (default 0.5)\n"
+               " -c <rate>            Chat messages (default 0.05)\n"
+               " -S <rate>            Shouts (default 0.01)\n"
+               " -r <rate>            Reconnects (default 0.005)\n");
+}
+
+static bool
+parse_int(const char *arg,
+          char opt,
+          int min,
+          int max,
+          int *value_out)
+{
+        char *tail;
+
+        errno = 0;
+        long value = strtol(arg, &tail, 10);
+
+        if (errno || *tail || tail == arg || value < min || value > max) {
+                fprintf(stderr,
+                        "invalid value for -%c, expected a number from "
+                        "%i to %i\n",
+                        opt,
+                        min, max);
+                return false;
+        }
+
+        *value_out = value;
+
+        return true;
+}
+
+static bool
+parse_double(const char *arg,
+             char opt,
+             double *value_out)
+{
+        char *tail;
+
+        errno = 0;
+        double value = strtod(arg, &tail);
+
+        if (errno || *tail || tail == arg || !isfinite(value) || value < 0) {
+                fprintf(stderr,
+                        "invalid value for -%c, expected a positive "
+                        "number\n",
+                        opt);
+                return false;
+        }
+
+        *value_out = value;
+
+        return true;
+}
+
+static bool
+process_arguments(int argc, char **argv)
+{
+        int opt;
+
+        opterr = false;
+
+        while ((opt = getopt(argc, argv, options)) != -1) {
+                switch (opt) {
+                case ':':
+                case '?':
+                        fprintf(stderr, "invalid option '%c'\n", optopt);
+                        return false;
+
+                case '\1':
+                        fprintf(stderr, "unexpected argument \"%s\"\n", optarg);
+                        return false;
+
+                case 'h':
+                        usage();
+                        return false;
+
+                case 's':
+                        option_server = optarg;
+                        break;
+
+                case 'p':
+                        if (!parse_int(optarg, opt, 1, 65535, &option_port))
+                                return false;
+                        break;
+
+                case 'n':
+                        if (!parse_int(optarg, opt,
+                                       1, 1000000,
+                                       &option_n_players))
+                                return false;
+                        break;
+
+                case 'g':
+                        if (!parse_int(optarg, opt,
+                                       1, VSX_BOARD_N_PLAYER_SPACES,
+                                       &option_game_size))
+                                return false;
+                        break;
+
+                case 'j':
+                        if (!parse_int(optarg, opt,
+                                       1, 1024,
+                                       &option_n_threads))
+                                return false;
+                        break;
+
+                case 'd':
+                        if (!parse_double(optarg, opt, &option_duration))
+                                return false;
+                        break;
+
+                case 'J':
+                        if (!parse_double(optarg, opt, &option_join_rate))
+                                return false;
+                        break;
+
+                case 'm':
+                        if (!parse_double(optarg, opt, &option_move_rate))
+                                return false;
+                        break;
+
+                case 't':
+                        if (!parse_double(optarg, opt, &option_turn_rate))
+                                return false;
+                        break;
+
+                case 'c':
+                        if (!parse_double(optarg, opt, &option_message_rate))
+                                return false;
+                        break;
+
+                case 'S':
+                        if (!parse_double(optarg, opt, &option_shout_rate))
+                                return false;
+                        break;
+
+                case 'r':
+                        if (!parse_double(optarg,
+                                          opt,
+                                          &option_reconnect_rate))
+                                return false;
+                        break;
+                }
+        }
+
+        if (option_join_rate <= 0.0) {
+                fprintf(stderr, "the join rate must be greater than zero\n");
+                return false;
+        }
+
+        if (option_n_threads > option_n_players)
+                option_n_threads = option_n_players;
+
+        return true;
+}
+
+static bool
+raise_file_limit(void)
+{
+        struct rlimit limit;
+
+        if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+                fprintf(stderr, "getrlimit failed: %s\n", strerror(errno));
+                return false;
+        }
+
+        if (limit.rlim_cur < limit.rlim_max) {
+                limit.rlim_cur = limit.rlim_max;
+                setrlimit(RLIMIT_NOFILE, &limit);
+        }
+
+        /* Leave some space for stdio and the epoll descriptors */
+        rlim_t needed = option_n_players + option_n_threads + 16;
+
+        if (limit.rlim_cur < needed) {
+                fprintf(stderr,
+                        "%i players need %" PRIu64 " file descriptors but "
+                        "the limit is %" PRIu64 "\n",
+                        option_n_players,
+                        (uint64_t) needed,
+                        (uint64_t) limit.rlim_cur);
+                return false;
+        }
+
+        return true;
+}
+
+static double
+random_double(struct loadgen_thread *thread)
+{
+        return rand_r(&thread->seed) / (RAND_MAX + 1.0);
+}
+
+static int64_t
+random_delay(struct loadgen_thread *thread,
+             double rate)
+{
+        /* Exponentially distributed so that the actions form a
+         * Poisson process.
+         */
+        return -log(1.0 - random_double(thread)) / rate * 1e6;
+}
+
+static void
+schedule(struct loadgen_thread *thread,
+         int64_t time)
+{
+        if (time < thread->next_scan_time)
+                thread->next_scan_time = time;
+}
+
+static double
+get_total_action_rate(void)
+{
+        return (option_move_rate +
+                option_turn_rate +
+                option_message_rate +
+                option_shout_rate +
+                option_reconnect_rate);
+}
+
+static void
+schedule_next_action(struct loadgen_player *player,
+                     int64_t now)
+{
+        double rate = get_total_action_rate();
+
+        if (rate <= 0.0) {
+                player->next_action_time = INT64_MAX;
+                return;
+        }
+
+        player->next_action_time = now + random_delay(player->thread, rate);
+        schedule(player->thread, player->next_action_time);
+}
+
+static void
+start_command(struct loadgen_player *player,
+              enum loadgen_command command,
+              int64_t now)
+{
+        player->pending[command].start_time = now;
+        player->thread->stats[command].n_sent++;
+        schedule(player->thread, now + LOADGEN_REPLY_TIMEOUT);
+}
+
+static void
+finish_command(struct loadgen_player *player,
+               enum loadgen_command command)
+{
+        struct loadgen_pending *pending = player->pending + command;
+
+        if (pending->start_time == 0)
+                return;
+
+        struct loadgen_thread *thread = player->thread;
+        int64_t rtt = vsx_monotonic_get() - pending->start_time;
+
+        vsx_buffer_append(&thread->stats[command].rtts, &rtt, sizeof rtt);
+        atomic_fetch_add_explicit(&thread->n_answered,
+                                  1,
+                                  memory_order_relaxed);
+
+        pending->start_time = 0;
+}
+
+static void
+lose_command(struct loadgen_player *player,
+             enum loadgen_command command)
+{
+        struct loadgen_pending *pending = player->pending + command;
+
+        if (pending->start_time == 0)
+                return;
+
+        player->thread->stats[command].n_lost++;
+        pending->start_time = 0;
+}
+
+static void
+set_connected(struct loadgen_player *player,
+              bool connected)
+{
+        if (player->connected == connected)
+                return;
+
+        player->connected = connected;
+
+        atomic_fetch_add_explicit(&player->thread->n_connected,
+                                  connected ? 1 : -1,
+                                  memory_order_relaxed);
+}
+
+static void
+handle_disconnect(struct loadgen_player *player)
+{
+        set_connected(player, false);
+
+        /* Any replies that were on the way are lost with the socket.
+         * The join is kept so that it can be completed if the
+         * connection library manages to reconnect.
+         */
+        for (int i = 0; i < LOADGEN_N_COMMANDS; i++) {
+                if (i != LOADGEN_COMMAND_JOIN)
+                        lose_command(player, i);
+        }
+}
+
+static void
+handle_poll_changed(struct loadgen_player *player,
+                    const struct vsx_connection_event *event)
+{
+        struct loadgen_thread *thread = player->thread;
+        int fd = event->poll_changed.fd;
+        short events = event->poll_changed.events;
+
+        player->wakeup_time = event->poll_changed.wakeup_time;
+        schedule(thread, player->wakeup_time);
+
+        if (fd == -1) {
+                /* The connection closes the socket before reporting
+                 * the change so it has already been removed from the
+                 * epoll set.
+                 */
+                player->fd = -1;
+                return;
+        }
+
+        if (fd == player->fd && events == player->events)
+                return;
+
+        struct epoll_event epoll_event = {
+                .events = (((events & POLLIN) ? EPOLLIN : 0) |
+                           ((events & POLLOUT) ? EPOLLOUT : 0)),
+                .data.ptr = player,
+        };
+
+        int op = fd == player->fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+        if (epoll_ctl(thread->epoll_fd, op, fd, &epoll_event) == -1) {
+                fprintf(stderr,
+                        "epoll_ctl failed: %s\n",
+                        strerror(errno));
+        }
+
+        player->fd = fd;
+        player->events = events;
+}
+
+static void
+handle_error(struct loadgen_player *player,
+             const struct vsx_connection_event *event)
+{
+        struct loadgen_thread *thread = player->thread;
+
+        thread->n_errors++;
+
+        vsx_free(thread->last_error);
+        thread->last_error = vsx_strdup(event->error.error->message);
+
+        handle_disconnect(player);
+}
+
+static void
+handle_header(struct loadgen_player *player,
+              const struct vsx_connection_event *event)
+{
+        player->self_num = event->header.self_num;
+
+        finish_command(player, LOADGEN_COMMAND_JOIN);
+        finish_command(player, LOADGEN_COMMAND_RECONNECT);
+
+        if (!player->connected) {
+                set_connected(player, true);
+                schedule_next_action(player, vsx_monotonic_get());
+        }
+}
+
+static void
+handle_tile_changed(struct loadgen_player *player,
+                    const struct vsx_connection_event *event)
+{
+        int num = event->tile_changed.num;
+
+        if (num >= player->n_tiles_in_play) {
+                player->n_tiles_in_play = num + 1;
+
+                /* Only the player with the turn can add a tile */
+                if (event->synced)
+                        finish_command(player, LOADGEN_COMMAND_TURN);
+        }
+
+        struct loadgen_pending *move =
+                player->pending + LOADGEN_COMMAND_MOVE_TILE;
+
+        if (event->synced &&
+            move->start_time != 0 &&
+            num == move->tile_num &&
+            event->tile_changed.last_player_moved == player->self_num &&
+            event->tile_changed.x == move->x &&
+            event->tile_changed.y == move->y)
+                finish_command(player, LOADGEN_COMMAND_MOVE_TILE);
+}
+
+static void
+handle_message(struct loadgen_player *player,
+               const struct vsx_connection_event *event)
+{
+        struct loadgen_pending *pending =
+                player->pending + LOADGEN_COMMAND_SEND_MESSAGE;
+
+        if (!event->synced ||
+            pending->start_time == 0 ||
+            event->message.player_num != player->self_num)
+                return;
+
+        char expected[32];
+
+        snprintf(expected, sizeof expected, "lg%i", pending->message_num);
+
+        if (!strcmp(event->message.message, expected))
+                finish_command(player, LOADGEN_COMMAND_SEND_MESSAGE);
+}
+
+static void
+event_cb(struct vsx_listener *listener,
+         void *data)
+{
+        struct loadgen_player *player =
+                vsx_container_of(listener,
+                                 struct loadgen_player,
+                                 event_listener);
+        const struct vsx_connection_event *event = data;
+
+        switch (event->type) {
+        case VSX_CONNECTION_EVENT_TYPE_POLL_CHANGED:
+                handle_poll_changed(player, event);
+                return;
+
+        case VSX_CONNECTION_EVENT_TYPE_RUNNING_STATE_CHANGED:
+                player->running = event->running_state_changed.running;
+                player->thread->n_running += player->running ? 1 : -1;
+                if (!player->running)
+                        handle_disconnect(player);
+                return;
+
+        case VSX_CONNECTION_EVENT_TYPE_ERROR:
+                handle_error(player, event);
+                return;
+
+        case VSX_CONNECTION_EVENT_TYPE_HEADER:
+                handle_header(player, event);
+                break;
+
+        case VSX_CONNECTION_EVENT_TYPE_PLAYER_NAME_CHANGED:
+                if (event->player_name_changed.player_num >= player->n_players)
+                        player->n_players =
+                                event->player_name_changed.player_num + 1;
+                break;
+
+        case VSX_CONNECTION_EVENT_TYPE_PLAYER_FLAGS_CHANGED:
+                if (event->player_flags_changed.player_num == player->self_num)
+                        player->has_turn =
+                                !!(event->player_flags_changed.flags &
+                                   VSX_GAME_STATE_PLAYER_FLAG_NEXT_TURN);
+                break;
+
+        case VSX_CONNECTION_EVENT_TYPE_PLAYER_SHOUTED:
+                if (event->synced &&
+                    event->player_shouted.player_num == player->self_num)
+                        finish_command(player, LOADGEN_COMMAND_SHOUT);
+                break;
+
+        case VSX_CONNECTION_EVENT_TYPE_N_TILES_CHANGED:
+                player->n_tiles = event->n_tiles_changed.n_tiles;
+                break;
+
+        case VSX_CONNECTION_EVENT_TYPE_TILE_CHANGED:
+                handle_tile_changed(player, event);
+                break;
+
+        case VSX_CONNECTION_EVENT_TYPE_MESSAGE:
+                handle_message(player, event);
+                break;
+
+        case VSX_CONNECTION_EVENT_TYPE_CONVERSATION_ID:
+        case VSX_CONNECTION_EVENT_TYPE_LANGUAGE_CHANGED:
+        case VSX_CONNECTION_EVENT_TYPE_END:
+                break;
+        }
+
+        /* Everything that gets here was sent by the server */
+        atomic_fetch_add_explicit(&player->thread->n_events,
+                                  1,
+                                  memory_order_relaxed);
+}
+
+static void
+start_player(struct loadgen_player *player,
+             int64_t now)
+{
+        char buf[64];
+
+        player->started = true;
+
+        vsx_connection_set_address(player->connection, &server_address);
+
+        snprintf(buf, sizeof buf, "lg%i", player->num);
+        vsx_connection_set_player_name(player->connection, buf);
+
+        snprintf(buf,
+                 sizeof buf,
+                 "%s%i",
+                 room_prefix,
+                 player->num / option_game_size);
+        vsx_connection_set_room(player->connection, buf);
+
+        start_command(player, LOADGEN_COMMAND_JOIN, now);
+
+        vsx_connection_set_running(player->connection, true);
+}
+
+static bool
+has_pending_command(struct loadgen_player *player)
+{
+        for (int i = 0; i < LOADGEN_N_COMMANDS; i++) {
+                if (player->pending[i].start_time)
+                        return true;
+        }
+
+        return false;
+}
+
+static void
+move_tile(struct loadgen_player *player,
+          int64_t now)
+{
+        struct loadgen_thread *thread = player->thread;
+        struct loadgen_pending *pending =
+                player->pending + LOADGEN_COMMAND_MOVE_TILE;
+
+        if (player->n_tiles_in_play <= 0 || pending->start_time)
+                return;
+
+        pending->tile_num = rand_r(&thread->seed) % player->n_tiles_in_play;
+        pending->x = (rand_r(&thread->seed) %
+                      (VSX_BOARD_WIDTH - VSX_BOARD_TILE_SIZE));
+        pending->y = (rand_r(&thread->seed) %
+                      (VSX_BOARD_HEIGHT - VSX_BOARD_TILE_SIZE));
+
+        start_command(player, LOADGEN_COMMAND_MOVE_TILE, now);
+
+        vsx_connection_move_tile(player->connection,
+                                 pending->tile_num,
+                                 pending->x,
+                                 pending->y);
+}
+
+static void
+turn(struct loadgen_player *player,
+     int64_t now)
+{
+        if (player->pending[LOADGEN_COMMAND_TURN].start_time ||
+            player->n_tiles_in_play >= player->n_tiles ||
+            /* Wait for everyone to join before starting the game so
+             * that they all end up in the same one.
+             */
+            player->n_players < option_game_size)
+                return;
+
+        /* The first turn can be taken by anyone so leave it to the
+         * first player in order to know whose turn it was.
+         */
+        if (player->n_tiles_in_play == 0 ?
+            player->self_num != 0 :
+            !player->has_turn)
+                return;
+
+        start_command(player, LOADGEN_COMMAND_TURN, now);
+
+        vsx_connection_turn(player->connection);
+}
+
+static void
+send_message(struct loadgen_player *player,
+             int64_t now)
+{
+        struct loadgen_pending *pending =
+                player->pending + LOADGEN_COMMAND_SEND_MESSAGE;
+
+        if (pending->start_time)
+                return;
+
+        char message[32];
+
+        pending->message_num = player->next_message_num++;
+        snprintf(message, sizeof message, "lg%i", pending->message_num);
+
+        start_command(player, LOADGEN_COMMAND_SEND_MESSAGE, now);
+
+        vsx_connection_send_message(player->connection, message);
+}
+
+static void
+shout(struct loadgen_player *player,
+      int64_t now)
+{
+        if (player->pending[LOADGEN_COMMAND_SHOUT].start_time)
+                return;
+
+        start_command(player, LOADGEN_COMMAND_SHOUT, now);
+
+        vsx_connection_shout(player->connection);
+}
+
+static void
+reconnect(struct loadgen_player *player,
+          int64_t now)
+{
+        /* Only drop the connection when nothing is waiting for a reply
+         * so that it doesn’t count as lost.
+         */
+        if (has_pending_command(player))
+                return;
+
+        vsx_connection_set_running(player->connection, false);
+
+        start_command(player, LOADGEN_COMMAND_RECONNECT, now);
+
+        vsx_connection_set_running(player->connection, true);
+}
+
+static void
+do_random_action(struct loadgen_player *player,
+                 int64_t now)
+{
+        double choice = random_double(player->thread) * get_total_action_rate();
+
+        if ((choice -= option_move_rate) < 0.0)
+                move_tile(player, now);
+        else if ((choice -= option_turn_rate) < 0.0)
+                turn(player, now);
+        else if ((choice -= option_message_rate) < 0.0)
+                send_message(player, now);
+        else if ((choice -= option_shout_rate) < 0.0)
+                shout(player, now);
+        else
+                reconnect(player, now);
+}
+
+static int64_t
+service_player(struct loadgen_player *player,
+               int64_t now)
+{
+        if (!player->started) {
+                if (now < player->start_time)
+                        return player->start_time;
+
+                start_player(player, now);
+        }
+
+        if (player->wakeup_time <= now)
+                vsx_connection_wake_up(player->connection, 0);
+
+        int64_t next_time = player->wakeup_time;
+
+        for (int i = 0; i < LOADGEN_N_COMMANDS; i++) {
+                struct loadgen_pending *pending = player->pending + i;
+
+                if (pending->start_time == 0)
+                        continue;
+
+                int64_t timeout_time =
+                        pending->start_time + LOADGEN_REPLY_TIMEOUT;
+
+                if (timeout_time <= now)
+                        lose_command(player, i);
+                else if (timeout_time < next_time)
+                        next_time = timeout_time;
+        }
+
+        if (player->connected && now < end_time) {
+                if (player->next_action_time <= now) {
+                        do_random_action(player, now);
+                        schedule_next_action(player, now);
+                }
+
+                if (player->next_action_time < next_time)
+                        next_time = player->next_action_time;
+        }
+
+        return next_time;
+}
+
+static void
+service_players(struct loadgen_thread *thread,
+                int64_t now)
+{
+        int64_t next_time = INT64_MAX;
+
+        /* Any changes while servicing the players are included in the
+         * return values instead.
+         */
+        thread->next_scan_time = INT64_MAX;
+
+        for (int i = 0; i < thread->n_players; i++) {
+                int64_t player_time = service_player(thread->players + i, now);
+
+                if (player_time < next_time)
+                        next_time = player_time;
+        }
+
+        schedule(thread, next_time);
+}
+
+static void
+leave_all(struct loadgen_thread *thread)
+{
+        for (int i = 0; i < thread->n_players; i++) {
+                struct loadgen_player *player = thread->players + i;
+
+                if (player->connected)
+                        vsx_connection_leave(player->connection);
+                else
+                        vsx_connection_set_running(player->connection, false);
+        }
+}
+
+static void
+dispatch_events(const struct epoll_event *events,
+                int n_events)
+{
+        for (int i = 0; i < n_events; i++) {
+                struct loadgen_player *player = events[i].data.ptr;
+                short poll_events = 0;
+
+                if ((events[i].events & EPOLLIN))
+                        poll_events |= POLLIN;
+                if ((events[i].events & EPOLLOUT))
+                        poll_events |= POLLOUT;
+                if ((events[i].events & EPOLLERR))
+                        poll_events |= POLLERR;
+                if ((events[i].events & EPOLLHUP))
+                        poll_events |= POLLHUP;
+
+                vsx_connection_wake_up(player->connection, poll_events);
+        }
+}
+
+static void *
+thread_func(void *user_data)
+{
+        struct loadgen_thread *thread = user_data;
+        struct epoll_event events[LOADGEN_MAX_EVENTS];
+        bool leaving = false;
+        int64_t leave_time = end_time + LOADGEN_LEAVE_TIMEOUT;
+
+        while (true) {
+                int64_t now = vsx_monotonic_get();
+
+                if (!leaving && now >= end_time) {
+                        leave_all(thread);
+                        leaving = true;
+                }
+
+                if (leaving && (thread->n_running <= 0 || now >= leave_time))
+                        break;
+
+                if (now >= thread->next_scan_time)
+                        service_players(thread, now);
+
+                int64_t wait_time = leaving ? leave_time : end_time;
+
+                if (thread->next_scan_time < wait_time)
+                        wait_time = thread->next_scan_time;
+
+                int timeout = (wait_time <= now ?
+                               0 :
+                               (wait_time - now + 999) / 1000);
+
+                int n_events = epoll_wait(thread->epoll_fd,
+                                          events,
+                                          VSX_N_ELEMENTS(events),
+                                          timeout);
+
+                if (n_events == -1) {
+                        if (errno == EINTR)
+                                continue;
+
+                        fprintf(stderr,
+                                "epoll_wait failed: %s\n",
+                                strerror(errno));
+                        break;
+                }
+
+                dispatch_events(events, n_events);
+        }
+
+        /* Anything still waiting now won’t get a reply */
+        for (int i = 0; i < thread->n_players; i++) {
+                for (int j = 0; j < LOADGEN_N_COMMANDS; j++)
+                        lose_command(thread->players + i, j);
+        }
+
+        return NULL;
+}
+
+static void
+init_thread(struct loadgen_thread *thread,
+            int thread_num)
+{
+        thread->seed = thread_num * 7919 + 1;
+        thread->next_scan_time = start_time;
+        thread->last_error = NULL;
+
+        for (int i = 0; i < LOADGEN_N_COMMANDS; i++)
+                vsx_buffer_init(&thread->stats[i].rtts);
+
+        /* The players are shared out so that the players in a game
+         * end up on different threads.
+         */
+        thread->n_players = ((option_n_players - thread_num +
+                              option_n_threads - 1) /
+                             option_n_threads);
+        thread->players = vsx_calloc(thread->n_players *
+                                     sizeof *thread->players);
+
+        for (int i = 0; i < thread->n_players; i++) {
+                struct loadgen_player *player = thread->players + i;
+
+                player->thread = thread;
+                player->num = i * option_n_threads + thread_num;
+                player->fd = -1;
+                player->wakeup_time = INT64_MAX;
+                player->next_action_time = INT64_MAX;
+                player->start_time = (start_time +
+                                      player->num * 1e6 / option_join_rate);
+
+                player->connection = vsx_connection_new();
+                player->event_listener.notify = event_cb;
+                vsx_signal_add(vsx_connection_get_event_signal(player->
+                                                               connection),
+                               &player->event_listener);
+        }
+}
+
+static void
+destroy_thread(struct loadgen_thread *thread)
+{
+        for (int i = 0; i < thread->n_players; i++)
+                vsx_connection_free(thread->players[i].connection);
+
+        vsx_free(thread->players);
+
+        for (int i = 0; i < LOADGEN_N_COMMANDS; i++)
+                vsx_buffer_destroy(&thread->stats[i].rtts);
+
+        vsx_free(thread->last_error);
+
+        if (thread->epoll_fd != -1)
+                vsx_close(thread->epoll_fd);
+}
+
+static void
+print_progress(struct loadgen_thread *threads,
+               int64_t now,
+               uint64_t *last_answered,
+               uint64_t *last_events,
+               int64_t *last_time)
+{
+        uint64_t n_answered = 0, n_events = 0;
+        int n_connected = 0;
+
+        for (int i = 0; i < option_n_threads; i++) {
+                n_answered += atomic_load_explicit(&threads[i].n_answered,
+                                                   memory_order_relaxed);
+                n_events += atomic_load_explicit(&threads[i].n_events,
+                                                 memory_order_relaxed);
+                n_connected += atomic_load_explicit(&threads[i].n_connected,
+                                                    memory_order_relaxed);
+        }
+
+        double interval = (now - *last_time) / 1e6;
+
+        printf("%6.1fs  connected %-7i  replies/s %-9.1f  events/s %.1f\n",
+               (now - start_time) / 1e6,
+               n_connected,
+               (n_answered - *last_answered) / interval,
+               (n_events - *last_events) / interval);
+
+        fflush(stdout);
+
+        *last_answered = n_answered;
+        *last_events = n_events;
+        *last_time = now;
+}
+
+static void
+wait_for_threads(struct loadgen_thread *threads)
+{
+        uint64_t last_answered = 0, last_events = 0;
+        int64_t last_time = start_time;
+
+        while (true) {
+                int64_t now = vsx_monotonic_get();
+
+                if (now >= end_time)
+                        break;
+
+                int64_t next_time = now + 1000000;
+
+                if (next_time > end_time)
+                        next_time = end_time;
+
+                usleep(next_time - now);
+
+                print_progress(threads,
+                               vsx_monotonic_get(),
+                               &last_answered,
+                               &last_events,
+                               &last_time);
+        }
+
+        for (int i = 0; i < option_n_threads; i++) {
+                if (threads[i].thread_created)
+                        pthread_join(threads[i].thread, NULL);
+        }
+}
+
+static int
+compare_rtt(const void *pa,
+            const void *pb)
+{
+        int64_t a = *(const int64_t *) pa;
+        int64_t b = *(const int64_t *) pb;
+
+        return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static double
+get_percentile(const int64_t *rtts,
+               size_t n_rtts,
+               int per_mille)
+{
+        size_t index = n_rtts * per_mille / 1000;
+
+        if (index >= n_rtts)
+                index = n_rtts - 1;
+
+        return rtts[index] / 1000.0;
+}
+
+static void
+print_report(struct loadgen_thread *threads)
+{
+        double duration = (end_time - start_time) / 1e6;
+        uint64_t n_answered = 0, n_events = 0, n_errors = 0;
+        const char *last_error = NULL;
+
+        for (int i = 0; i < option_n_threads; i++) {
+                n_answered += atomic_load(&threads[i].n_answered);
+                n_events += atomic_load(&threads[i].n_events);
+                n_errors += threads[i].n_errors;
+                if (threads[i].last_error)
+                        last_error = threads[i].last_error;
+        }
+
+        printf("\n"
+               "players:          %i\n"
+               "duration:         %.1f s\n"
+               "replies:          %" PRIu64 " (%.1f/s)\n"
+               "events received:  %" PRIu64 " (%.1f/s)\n"
+               "errors:           %" PRIu64 "\n",
+               option_n_players,
+               duration,
+               n_answered,
+               n_answered / duration,
+               n_events,
+               n_events / duration,
+               n_errors);
+
+        if (last_error)
+                printf("last error:       %s\n", last_error);
+
+        printf("\n"
+               "%-13s %8s %8s %6s %8s %8s %8s %8s\n",
+               "command",
+               "sent",
+               "replies",
+               "lost",
+               "p50 ms",
+               "p90 ms",
+               "p99 ms",
+               "max ms");
+
+        struct vsx_buffer rtts = VSX_BUFFER_STATIC_INIT;
+
+        for (int command = 0; command < LOADGEN_N_COMMANDS; command++) {
+                uint64_t n_sent = 0, n_lost = 0;
+
+                vsx_buffer_set_length(&rtts, 0);
+
+                for (int i = 0; i < option_n_threads; i++) {
+                        const struct loadgen_command_stats *stats =
+                                threads[i].stats + command;
+
+                        n_sent += stats->n_sent;
+                        n_lost += stats->n_lost;
+
+                        if (stats->rtts.length > 0) {
+                                vsx_buffer_append(&rtts,
+                                                  stats->rtts.data,
+                                                  stats->rtts.length);
+                        }
+                }
+
+                int64_t *values = (int64_t *) rtts.data;
+                size_t n_values = rtts.length / sizeof *values;
+
+                printf("%-13s %8" PRIu64 " %8zu %6" PRIu64,
+                       command_names[command],
+                       n_sent,
+                       n_values,
+                       n_lost);
+
+                if (n_values == 0) {
+                        fputc('\n', stdout);
+                        continue;
+                }
+
+                qsort(values, n_values, sizeof *values, compare_rtt);
+
+                printf(" %8.2f %8.2f %8.2f %8.2f\n",
+                       get_percentile(values, n_values, 500),
+                       get_percentile(values, n_values, 900),
+                       get_percentile(values, n_values, 990),
+                       values[n_values - 1] / 1000.0);
+        }
+
+        vsx_buffer_destroy(&rtts);
+}
+
+int
+main(int argc, char **argv)
+{
+        int ret = EXIT_SUCCESS;
+
+        if (!process_arguments(argc, argv))
+                return EXIT_FAILURE;
+
+        if (!vsx_netaddress_from_string(&server_address,
+                                        option_server,
+                                        option_port)) {
+                fprintf(stderr, "invalid address: %s\n", option_server);
+                return EXIT_FAILURE;
+        }
+
+        if (!raise_file_limit())
+                return EXIT_FAILURE;
+
+        /* Use a different room name for every run so that the
+         * players don’t end up in games left over from a previous
+         * one.
+         */
+        snprintf(room_prefix,
+                 sizeof room_prefix,
+                 "loadgen-%i-",
+                 (int) getpid());
+
+        start_time = vsx_monotonic_get();
+        end_time = start_time + option_duration * 1e6;
+
+        struct loadgen_thread *threads =
+                vsx_calloc(option_n_threads * sizeof *threads);
+
+        for (int i = 0; i < option_n_threads; i++) {
+                threads[i].epoll_fd = -1;
+                init_thread(threads + i, i);
+        }
+
+        for (int i = 0; i < option_n_threads; i++) {
+                struct loadgen_thread *thread = threads + i;
+
+                thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+                if (thread->epoll_fd == -1) {
+                        fprintf(stderr,
+                                "epoll_create failed: %s\n",
+                                strerror(errno));
+                        ret = EXIT_FAILURE;
+                        break;
+                }
+
+                int create_ret = pthread_create(&thread->thread,
+                                                NULL,
+                                                thread_func,
+                                                thread);
+
+                if (create_ret) {
+                        fprintf(stderr,
+                                "pthread_create failed: %s\n",
+                                strerror(create_ret));
+                        ret = EXIT_FAILURE;
+                        break;
+                }
+
+                thread->thread_created = true;
+        }
+
+        if (ret == EXIT_SUCCESS) {
+                wait_for_threads(threads);
+                print_report(threads);
+        } else {
+                /* Make the threads that did start finish straight
+                 * away.
+                 */
+                end_time = start_time;
+
+                for (int i = 0; i < option_n_threads; i++) {
+                        if (threads[i].thread_created)
+                                pthread_join(threads[i].thread, NULL);
+                }
+        }
+
+        for (int i = 0; i < option_n_threads; i++)
+                destroy_thread(threads + i);
+
+        vsx_free(threads);
+
+        return ret;
+}
@@ -0,0 +1,382 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compares the hash table with the chained table that it replaced.
+ * The IDs are either random, like the person and conversation IDs,
+ * or sequential, like the glyph codes.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "vsx-hash-table.h"
+#include "vsx-util.h"
+
+/* The previous implementation, kept here only for comparison */
+
+struct chained_entry {
+        uint64_t id;
+        struct chained_entry *next;
+};
+
+struct chained_table {
+        int n_entries;
+        int table_size;
+        struct chained_entry **entries;
+};
+
+static void
+chained_init(struct chained_table *table)
+{
+        table->n_entries = 0;
+        table->table_size = 8;
+        table->entries = vsx_calloc(table->table_size *
+                                    sizeof *table->entries);
+}
+
+static void
+chained_add_to_hash(struct chained_table *table,
+                    struct chained_entry *entry)
+{
+        int pos = entry->id % table->table_size;
+
+        entry->next = table->entries[pos];
+        table->entries[pos] = entry;
+}
+
+static void
+chained_grow(struct chained_table *table)
+{
+        struct chained_entry *entry_list;
+        struct chained_entry **prev = &entry_list;
+
+        for (unsigned i = 0; i < table->table_size; i++) {
+                for (struct chained_entry *e = table->entries[i];
+                     e;
+                     e = e->next) {
+                        *prev = e;
+                        prev = &e->next;
+                }
+        }
+
+        *prev = NULL;
+
+        vsx_free(table->entries);
+
+        table->table_size *= 2;
+
+        table->entries = vsx_calloc(table->table_size *
+                                    sizeof *table->entries);
+
+        struct chained_entry *next;
+
+        for (struct chained_entry *entry = entry_list;
+             entry;
+             entry = next) {
+                next = entry->next;
+                chained_add_to_hash(table, entry);
+        }
+}
+
+static struct chained_entry *
+chained_get(struct chained_table *table,
+            uint64_t key)
+{
+        int pos = key % table->table_size;
+
+        for (struct chained_entry *entry = table->entries[pos];
+             entry;
+             entry = entry->next) {
+                if (entry->id == key)
+                        return entry;
+        }
+
+        return NULL;
+}
+
+static void
+chained_add(struct chained_table *table,
+            struct chained_entry *entry)
+{
+        if ((table->n_entries + 1) > table->table_size * 3 / 4)
+                chained_grow(table);
+
+        chained_add_to_hash(table, entry);
+
+        table->n_entries++;
+}
+
+static void
+chained_remove(struct chained_table *table,
+               struct chained_entry *entry)
+{
+        int pos = entry->id % table->table_size;
+        struct chained_entry **prev = table->entries + pos;
+
+        while (*prev != entry)
+                prev = &(*prev)->next;
+
+        *prev = entry->next;
+
+        table->n_entries--;
+}
+
+static void
+chained_destroy(struct chained_table *table)
+{
+        vsx_free(table->entries);
+}
+
+static uint64_t
+get_time_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static uint64_t
+random_id(uint64_t *state)
+{
+        /* splitmix64 */
+        uint64_t z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+        z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+        return z ^ (z >> 31);
+}
+
+struct timings {
+        uint64_t add, hit, miss, remove;
+};
+
+static void
+print_timings(const char *name,
+              const char *keys,
+              int n_entries,
+              const struct timings *timings)
+{
+        printf("%-8s %-10s %9i: add %6.1fns, hit %6.1fns, "
+               "miss %6.1fns, remove %6.1fns\n",
+               name,
+               keys,
+               n_entries,
+               timings->add / (double) n_entries,
+               timings->hit / (double) n_entries,
+               timings->miss / (double) n_entries,
+               timings->remove / (double) n_entries);
+}
+
+static void
+fill_ids(uint64_t *ids,
+         int n_entries,
+         bool sequential,
+         uint64_t seed)
+{
+        for (int i = 0; i < n_entries; i++)
+                ids[i] = sequential ? (uint64_t) i : random_id(&seed);
+}
+
+static int
+run_open(const uint64_t *ids,
+         const uint64_t *lookup_ids,
+         const uint64_t *missing_ids,
+         int n_entries,
+         struct timings *timings)
+{
+        struct vsx_hash_table_entry *entries =
+                vsx_alloc(n_entries * sizeof *entries);
+        struct vsx_hash_table table;
+        int n_found = 0;
+
+        vsx_hash_table_init(&table);
+
+        uint64_t start = get_time_ns();
+
+        for (int i = 0; i < n_entries; i++) {
+                entries[i].id = ids[i];
+                vsx_hash_table_add(&table, entries + i);
+        }
+
+        uint64_t end = get_time_ns();
+        timings->add = end - start;
+
+        start = end;
+        for (int i = 0; i < n_entries; i++)
+                n_found += vsx_hash_table_get(&table, lookup_ids[i]) != NULL;
+        end = get_time_ns();
+        timings->hit = end - start;
+
+        start = end;
+        for (int i = 0; i < n_entries; i++)
+                n_found += vsx_hash_table_get(&table, missing_ids[i]) != NULL;
+        end = get_time_ns();
+        timings->miss = end - start;
+
+        start = end;
+        for (int i = 0; i < n_entries; i++)
+                vsx_hash_table_remove(&table, entries + i);
+        end = get_time_ns();
+        timings->remove = end - start;
+
+        vsx_hash_table_destroy(&table);
+        vsx_free(entries);
+
+        return n_found;
+}
+
+static int
+run_chained(const uint64_t *ids,
+            const uint64_t *lookup_ids,
+            const uint64_t *missing_ids,
+            int n_entries,
+            struct timings *timings)
+{
+        struct chained_entry *entries =
+                vsx_alloc(n_entries * sizeof *entries);
+        struct chained_table table;
+        int n_found = 0;
+
+        chained_init(&table);
+
+        uint64_t start = get_time_ns();
+
+        for (int i = 0; i < n_entries; i++) {
+                entries[i].id = ids[i];
+                chained_add(&table, entries + i);
+        }
+
+        uint64_t end = get_time_ns();
+        timings->add = end - start;
+
+        start = end;
+        for (int i = 0; i < n_entries; i++)
+                n_found += chained_get(&table, lookup_ids[i]) != NULL;
+        end = get_time_ns();
+        timings->hit = end - start;
+
+        start = end;
+        for (int i = 0; i < n_entries; i++)
+                n_found += chained_get(&table, missing_ids[i]) != NULL;
+        end = get_time_ns();
+        timings->miss = end - start;
+
+        start = end;
+        for (int i = 0; i < n_entries; i++)
+                chained_remove(&table, entries + i);
+        end = get_time_ns();
+        timings->remove = end - start;
+
+        chained_destroy(&table);
+        vsx_free(entries);
+
+        return n_found;
+}
+
+static void
+run_size(int n_entries,
+         bool sequential)
+{
+        uint64_t *ids = vsx_alloc(n_entries * sizeof *ids);
+        uint64_t *lookup_ids = vsx_alloc(n_entries * sizeof *lookup_ids);
+        uint64_t *missing_ids = vsx_alloc(n_entries * sizeof *missing_ids);
+        const char *keys = sequential ? "sequential" : "random";
+        struct timings timings;
+
+        fill_ids(ids, n_entries, sequential, 1);
+
+        /* Look the IDs up in a different order from how they were
+         * added so that the entries aren’t just read sequentially */
+        uint64_t seed = 2;
+
+        for (int i = 0; i < n_entries; i++)
+                lookup_ids[i] = ids[i];
+
+        for (int i = n_entries - 1; i > 0; i--) {
+                int j = random_id(&seed) % (i + 1);
+                uint64_t tmp = lookup_ids[i];
+                lookup_ids[i] = lookup_ids[j];
+                lookup_ids[j] = tmp;
+        }
+
+        /* IDs that aren’t in the table */
+        for (int i = 0; i < n_entries; i++) {
+                missing_ids[i] = (sequential ?
+                                  (uint64_t) (n_entries + i) :
+                                  ids[i] ^ UINT64_C(0x8000000000000001));
+        }
+
+        int n_found = run_chained(ids,
+                                  lookup_ids,
+                                  missing_ids,
+                                  n_entries,
+                                  &timings);
+        print_timings("chained", keys, n_entries, &timings);
+
+        if (n_found != n_entries)
+                fprintf(stderr, "chained table found %i entries\n", n_found);
+
+        n_found = run_open(ids,
+                           lookup_ids,
+                           missing_ids,
+                           n_entries,
+                           &timings);
+        print_timings("open", keys, n_entries, &timings);
+
+        if (n_found != n_entries)
+                fprintf(stderr, "open table found %i entries\n", n_found);
+
+        vsx_free(missing_ids);
+        vsx_free(lookup_ids);
+        vsx_free(ids);
+}
+
+int
+main(int argc, char **argv)
+{
+        static const int default_sizes[] = { 10000, 1000000, 10000000 };
+
+        if (argc > 1) {
+                for (int i = 1; i < argc; i++) {
+                        int n_entries = atoi(argv[i]);
+
+                        if (n_entries <= 0) {
+                                fprintf(stderr,
+                                        "usage: bench-hash-table "
+                                        "[n_entries]...\n");
+                                return EXIT_FAILURE;
+                        }
+
+                        run_size(n_entries, false);
+                        run_size(n_entries, true);
+                }
+        } else {
+                for (int i = 0; i < VSX_N_ELEMENTS(default_sizes); i++) {
+                        run_size(default_sizes[i], false);
+                        run_size(default_sizes[i], true);
+                }
+        }
+
+        return EXIT_SUCCESS;
+}
@@ -106,37 +106,55 @@ remove_entry(struct harness *harness,
         vsx_free(test_entry);
 }
 
+/* Returns the position that the entry would ideally be in */
+static size_t
+get_home_pos(struct harness *harness,
+             struct test_entry *entry)
+{
+        const struct vsx_hash_table_slots *slots =
+                &harness->hash_table.current;
+
+        for (size_t i = 0; i < slots->size; i++) {
+                if (slots->slots[i].entry == &entry->entry)
+                        return slots->slots[i].hash & (slots->size - 1);
+        }
+
+        return SIZE_MAX;
+}
+
 static bool
 test_collision(struct harness *harness, bool reverse_remove)
 {
         if (!check_all_entries(harness))
                 return false;
 
-        struct test_entry *eight = add_entry(harness, 8);
+        struct test_entry *a = add_entry(harness, 8);
+        size_t home = get_home_pos(harness, a);
 
-        if (!check_all_entries(harness))
-                return false;
+        /* Find another ID that starts at the same position */
+        uint64_t other_id = 9;
 
-        /* Add an entry that should share the same position */
-        struct test_entry *sixteen = add_entry(harness, 16);
+        while (true) {
+                struct test_entry *tmp = add_entry(harness, other_id);
+                bool collided = get_home_pos(harness, tmp) == home;
 
-        if (!check_all_entries(harness))
-                return false;
+                remove_entry(harness, tmp);
 
-        if (sixteen->entry.next != &eight->entry) {
-                fprintf(stderr,
-                        "The test failed to make a hash collision.\n");
-                return false;
+                if (collided)
+                        break;
+
+                other_id++;
         }
 
-        struct test_entry *a, *b;
+        struct test_entry *b = add_entry(harness, other_id);
+
+        if (!check_all_entries(harness))
+                return false;
 
         if (reverse_remove) {
-                a = sixteen;
-                b = eight;
-        } else {
-                a = eight;
-                b = sixteen;
+                struct test_entry *tmp = a;
+                a = b;
+                b = tmp;
         }
 
         remove_entry(harness, a);
@@ -197,6 +215,128 @@ test_add_many(struct harness *harness)
         return true;
 }
 
+static bool
+check_iteration(struct harness *harness)
+{
+        struct test_entry *entry;
+        int n_entries = 0;
+
+        vsx_list_for_each(entry, &harness->entries, link) {
+                /* Use the ID to mark whether the entry has been seen */
+                entry->entry.id ^= UINT64_C(1) << 63;
+                n_entries++;
+        }
+
+        struct vsx_hash_table_iter iter;
+        struct vsx_hash_table_entry *table_entry;
+        int n_seen = 0;
+
+        vsx_hash_table_iter_init(&iter, &harness->hash_table);
+
+        while ((table_entry = vsx_hash_table_iter_next(&iter))) {
+                if ((table_entry->id & (UINT64_C(1) << 63)) == 0) {
+                        fprintf(stderr,
+                                "Iteration returned entry 0x%" PRIx64 " "
+                                "twice\n",
+                                table_entry->id);
+                        return false;
+                }
+
+                table_entry->id ^= UINT64_C(1) << 63;
+                n_seen++;
+        }
+
+        if (n_seen != n_entries) {
+                fprintf(stderr,
+                        "Iteration returned %i entries but there are %i\n",
+                        n_seen,
+                        n_entries);
+                return false;
+        }
+
+        uint64_t id;
+
+        n_seen = 0;
+        vsx_hash_table_iter_init(&iter, &harness->hash_table);
+
+        while (vsx_hash_table_iter_next_id(&iter, &id)) {
+                table_entry = vsx_hash_table_get(&harness->hash_table, id);
+
+                if (table_entry == NULL || table_entry->id != id) {
+                        fprintf(stderr,
+                                "Iteration returned unknown ID 0x%" PRIx64
+                                "\n",
+                                id);
+                        return false;
+                }
+
+                n_seen++;
+        }
+
+        if (n_seen != n_entries) {
+                fprintf(stderr,
+                        "Iteration returned %i IDs but there are %i\n",
+                        n_seen,
+                        n_entries);
+                return false;
+        }
+
+        return true;
+}
+
+static bool
+test_resize(struct harness *harness)
+{
+        const int n_entries = 10000;
+
+        /* Check the iteration in the middle of the resizes while
+         * some entries are still in the old slots */
+        for (int i = 0; i < n_entries; i++) {
+                add_entry(harness, (uint64_t) i << 32);
+
+                if (i % 997 == 0 && !check_iteration(harness))
+                        return false;
+        }
+
+        if (!check_all_entries(harness) || !check_iteration(harness))
+                return false;
+
+        size_t big_size = harness->hash_table.current.size;
+
+        for (int i = 0; i < n_entries - 10; i++) {
+                struct test_entry *entry =
+                        vsx_container_of(harness->entries.next,
+                                         struct test_entry,
+                                         link);
+                remove_entry(harness, entry);
+
+                if (i % 997 == 0 && !check_iteration(harness))
+                        return false;
+        }
+
+        if (!check_all_entries(harness) || !check_iteration(harness))
+                return false;
+
+        if (harness->hash_table.current.size >= big_size / 64) {
+                fprintf(stderr,
+                        "Hash table didn’t shrink after removing entries "
+                        "(%zu slots for %i entries)\n",
+                        harness->hash_table.current.size,
+                        harness->hash_table.n_entries);
+                return false;
+        }
+
+        while (!vsx_list_empty(&harness->entries)) {
+                struct test_entry *entry =
+                        vsx_container_of(harness->entries.next,
+                                         struct test_entry,
+                                         link);
+                remove_entry(harness, entry);
+        }
+
+        return check_all_entries(harness) && check_iteration(harness);
+}
+
 static bool
 run_tests(struct harness *harness)
 {
@@ -209,6 +349,9 @@ run_tests(struct harness *harness)
         if (!test_add_many(harness))
                 return false;
 
+        if (!test_resize(harness))
+                return false;
+
         return true;
 }
 
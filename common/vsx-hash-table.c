@@ -21,110 +21,219 @@
 #include "vsx-hash-table.h"
 
 #include <assert.h>
+#include <stdbool.h>
 
 #include "vsx-util.h"
 
-static int
-get_hash_pos(struct vsx_hash_table *hash_table,
-             uint64_t id)
+#define VSX_HASH_TABLE_MIN_SIZE 8
+
+/* Maximum number of old slots to look at for each addition or
+ * removal while a resize is in progress */
+#define VSX_HASH_TABLE_MOVE_STEP 32
+
+/* Put in the old slots in place of an entry that has been moved or
+ * removed so that lookups still probe past it */
+static struct vsx_hash_table_entry tombstone;
+
+static uint64_t
+mix_id(uint64_t id)
 {
-        return id % hash_table->table_size;
+        /* The finalizer from MurmurHash3. Every step can be reversed
+         * so different IDs never get the same hash.
+         */
+        id ^= id >> 33;
+        id *= UINT64_C(0xff51afd7ed558ccd);
+        id ^= id >> 33;
+        id *= UINT64_C(0xc4ceb9fe1a85ec53);
+        id ^= id >> 33;
+
+        return id;
 }
 
-void
-vsx_hash_table_destroy(struct vsx_hash_table *hash_table)
+static uint64_t
+unmix_id(uint64_t hash)
 {
-        vsx_free(hash_table->entries);
+        /* Each step of mix_id in reverse. The multipliers are the
+         * inverses of the ones above modulo 2⁶⁴.
+         */
+        hash ^= hash >> 33;
+        hash *= UINT64_C(0x9cb4b2f8129337db);
+        hash ^= hash >> 33;
+        hash *= UINT64_C(0x4f74430c22a54005);
+        hash ^= hash >> 33;
+
+        return hash;
 }
 
-void
-vsx_hash_table_remove(struct vsx_hash_table *hash_table,
-                      struct vsx_hash_table_entry *entry)
+static bool
+find_slot(const struct vsx_hash_table_slots *slots,
+          uint64_t hash,
+          size_t *pos_out)
 {
-        int pos = get_hash_pos(hash_table, entry->id);
-        struct vsx_hash_table_entry **prev = hash_table->entries + pos;
+        if (slots->n_entries == 0)
+                return false;
 
-        while (true) {
-                assert(*prev);
+        size_t mask = slots->size - 1;
+
+        for (size_t pos = hash & mask; ; pos = (pos + 1) & mask) {
+                const struct vsx_hash_table_slot *slot = slots->slots + pos;
 
-                if (*prev == entry)
-                        break;
+                if (slot->entry == NULL)
+                        return false;
 
-                prev = &(*prev)->next;
+                if (slot->hash == hash && slot->entry != &tombstone) {
+                        *pos_out = pos;
+                        return true;
+                }
         }
+}
+
+static void
+insert_slot(struct vsx_hash_table_slots *slots,
+            struct vsx_hash_table_entry *entry,
+            uint64_t hash)
+{
+        size_t mask = slots->size - 1;
+        size_t pos = hash & mask;
 
-        *prev = entry->next;
+        while (slots->slots[pos].entry)
+                pos = (pos + 1) & mask;
 
-        hash_table->n_entries--;
+        slots->slots[pos].hash = hash;
+        slots->slots[pos].entry = entry;
+        slots->n_entries++;
 }
 
-void
-vsx_hash_table_init(struct vsx_hash_table *hash_table)
+static void
+remove_slot(struct vsx_hash_table_slots *slots,
+            size_t pos)
 {
-        hash_table->n_entries = 0;
-        hash_table->table_size = 8;
-        hash_table->entries = vsx_calloc(hash_table->table_size *
-                                         sizeof *hash_table->entries);
+        size_t mask = slots->size - 1;
+
+        /* Move back any following entries that would no longer be
+         * found once there is a gap in front of them */
+        for (size_t next = (pos + 1) & mask;
+             slots->slots[next].entry;
+             next = (next + 1) & mask) {
+                size_t home = slots->slots[next].hash & mask;
+
+                if (((next - home) & mask) >= ((next - pos) & mask)) {
+                        slots->slots[pos] = slots->slots[next];
+                        pos = next;
+                }
+        }
+
+        slots->slots[pos].entry = NULL;
+        slots->n_entries--;
+}
+
+static void
+alloc_slots(struct vsx_hash_table_slots *slots,
+            size_t size)
+{
+        slots->size = size;
+        slots->n_entries = 0;
+        slots->slots = vsx_calloc(size * sizeof *slots->slots);
 }
 
 static void
-add_entry_to_hash(struct vsx_hash_table *hash_table,
-                  struct vsx_hash_table_entry *entry)
+free_slots(struct vsx_hash_table_slots *slots)
+{
+        vsx_free(slots->slots);
+        slots->slots = NULL;
+        slots->size = 0;
+        slots->n_entries = 0;
+}
+
+static bool
+is_full(const struct vsx_hash_table_slots *slots,
+        size_t pos)
 {
-        int pos = get_hash_pos(hash_table, entry->id);
+        const struct vsx_hash_table_entry *entry = slots->slots[pos].entry;
 
-        entry->next = hash_table->entries[pos];
-        hash_table->entries[pos] = entry;
+        return entry && entry != &tombstone;
 }
 
 static void
-grow_hash_table(struct vsx_hash_table *hash_table)
-{
-        struct vsx_hash_table_entry *entry_list;
-        struct vsx_hash_table_entry **prev = &entry_list;
-
-        /* Gather all the entries into a list */
-        for (unsigned i = 0; i < hash_table->table_size; i++) {
-                for (struct vsx_hash_table_entry *e = hash_table->entries[i];
-                     e;
-                     e = e->next) {
-                        *prev = e;
-                        prev = &e->next;
+move_old_entries(struct vsx_hash_table *hash_table,
+                 struct vsx_hash_table_slots *dest,
+                 size_t max_slots)
+{
+        struct vsx_hash_table_slots *old = &hash_table->old;
+
+        while (max_slots > 0 && old->n_entries > 0) {
+                struct vsx_hash_table_slot *slot =
+                        old->slots + hash_table->move_pos++;
+
+                if (is_full(old, slot - old->slots)) {
+                        insert_slot(dest, slot->entry, slot->hash);
+                        /* Nothing is added to the old slots so they
+                         * don’t need to be moved back like in
+                         * remove_slot */
+                        slot->entry = &tombstone;
+                        old->n_entries--;
                 }
+
+                max_slots--;
         }
 
-        *prev = NULL;
+        if (old->size > 0 && old->n_entries == 0) {
+                free_slots(old);
+                hash_table->move_pos = 0;
+        }
+}
 
-        vsx_free(hash_table->entries);
+static void
+resize(struct vsx_hash_table *hash_table,
+       size_t n_entries)
+{
+        size_t size = VSX_HASH_TABLE_MIN_SIZE;
 
-        hash_table->table_size *= 2;
+        /* Leave room to add as many entries again before the next
+         * resize */
+        while (size * 3 / 8 < n_entries)
+                size *= 2;
 
-        hash_table->entries = vsx_calloc(hash_table->table_size *
-                                         sizeof *hash_table->entries);
+        struct vsx_hash_table_slots slots;
 
-        struct vsx_hash_table_entry *next;
+        alloc_slots(&slots, size);
 
-        for (struct vsx_hash_table_entry *entry = entry_list;
-             entry;
-             entry = next) {
-                next = entry->next;
+        /* Finish any resize that is already in progress */
+        move_old_entries(hash_table, &slots, SIZE_MAX);
 
-                add_entry_to_hash(hash_table, entry);
+        if (hash_table->current.n_entries > 0) {
+                hash_table->old = hash_table->current;
+                hash_table->move_pos = 0;
+        } else {
+                free_slots(&hash_table->current);
         }
+
+        hash_table->current = slots;
+}
+
+void
+vsx_hash_table_init(struct vsx_hash_table *hash_table)
+{
+        hash_table->n_entries = 0;
+        hash_table->move_pos = 0;
+        alloc_slots(&hash_table->current, VSX_HASH_TABLE_MIN_SIZE);
+        hash_table->old.size = 0;
+        hash_table->old.n_entries = 0;
+        hash_table->old.slots = NULL;
 }
 
 struct vsx_hash_table_entry *
 vsx_hash_table_get(struct vsx_hash_table *hash_table,
                    uint64_t key)
 {
-        int pos = get_hash_pos(hash_table, key);
+        uint64_t hash = mix_id(key);
+        size_t pos;
 
-        for (struct vsx_hash_table_entry *entry = hash_table->entries[pos];
-             entry;
-             entry = entry->next) {
-                if (entry->id == key)
-                        return entry;
-        }
+        if (find_slot(&hash_table->current, hash, &pos))
+                return hash_table->current.slots[pos].entry;
+
+        if (find_slot(&hash_table->old, hash, &pos))
+                return hash_table->old.slots[pos].entry;
 
         return NULL;
 }
@@ -133,10 +242,108 @@ void
 vsx_hash_table_add(struct vsx_hash_table *hash_table,
                    struct vsx_hash_table_entry *entry)
 {
-        if ((hash_table->n_entries + 1) > hash_table->table_size * 3 / 4)
-                grow_hash_table(hash_table);
+        struct vsx_hash_table_slots *current = &hash_table->current;
 
-        add_entry_to_hash(hash_table, entry);
+        move_old_entries(hash_table, current, VSX_HASH_TABLE_MOVE_STEP);
+
+        /* The entries that haven’t been moved yet are counted too so
+         * that the current slots never get too full while they are
+         * moved over.
+         */
+        if (hash_table->n_entries + 1 > current->size * 3 / 4)
+                resize(hash_table, hash_table->n_entries + 1);
+
+        insert_slot(current, entry, mix_id(entry->id));
 
         hash_table->n_entries++;
 }
+
+void
+vsx_hash_table_remove(struct vsx_hash_table *hash_table,
+                      struct vsx_hash_table_entry *entry)
+{
+        uint64_t hash = mix_id(entry->id);
+        size_t pos;
+
+        if (find_slot(&hash_table->current, hash, &pos)) {
+                assert(hash_table->current.slots[pos].entry == entry);
+                remove_slot(&hash_table->current, pos);
+        } else {
+                struct vsx_hash_table_slots *old = &hash_table->old;
+                bool found = find_slot(old, hash, &pos);
+
+                assert(found);
+                assert(old->slots[pos].entry == entry);
+                old->slots[pos].entry = &tombstone;
+                old->n_entries--;
+        }
+
+        hash_table->n_entries--;
+
+        move_old_entries(hash_table,
+                         &hash_table->current,
+                         VSX_HASH_TABLE_MOVE_STEP);
+
+        if (hash_table->current.size > VSX_HASH_TABLE_MIN_SIZE &&
+            hash_table->n_entries < hash_table->current.size / 16)
+                resize(hash_table, hash_table->n_entries);
+}
+
+void
+vsx_hash_table_iter_init(struct vsx_hash_table_iter *iter,
+                         const struct vsx_hash_table *hash_table)
+{
+        iter->hash_table = hash_table;
+        iter->slots = &hash_table->current;
+        iter->pos = 0;
+}
+
+static const struct vsx_hash_table_slot *
+next_slot(struct vsx_hash_table_iter *iter)
+{
+        while (true) {
+                const struct vsx_hash_table_slots *slots = iter->slots;
+
+                while (iter->pos < slots->size) {
+                        size_t pos = iter->pos++;
+
+                        if (is_full(slots, pos))
+                                return slots->slots + pos;
+                }
+
+                if (slots == &iter->hash_table->old)
+                        return NULL;
+
+                iter->slots = &iter->hash_table->old;
+                iter->pos = 0;
+        }
+}
+
+struct vsx_hash_table_entry *
+vsx_hash_table_iter_next(struct vsx_hash_table_iter *iter)
+{
+        const struct vsx_hash_table_slot *slot = next_slot(iter);
+
+        return slot ? slot->entry : NULL;
+}
+
+bool
+vsx_hash_table_iter_next_id(struct vsx_hash_table_iter *iter,
+                            uint64_t *id_out)
+{
+        const struct vsx_hash_table_slot *slot = next_slot(iter);
+
+        if (slot == NULL)
+                return false;
+
+        *id_out = unmix_id(slot->hash);
+
+        return true;
+}
+
+void
+vsx_hash_table_destroy(struct vsx_hash_table *hash_table)
+{
+        free_slots(&hash_table->current);
+        free_slots(&hash_table->old);
+}
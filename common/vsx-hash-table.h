@@ -20,16 +20,54 @@
 #define VSX_HASH_TABLE_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* An open-addressing hash table using linear probing. The entries
+ * are embedded in the structs that are stored and the table keeps a
+ * pointer to them alongside a hash of the ID. The hash is a
+ * reversible mix of the ID so it can be compared instead of the ID and
+ * a lookup normally only needs to touch one cache line of the table.
+ *
+ * The table grows when it is 3/4 full and shrinks when it is less than
+ * 1/16 full. When it is resized, the old slots are kept until the
+ * entries have been moved over a few at a time by the following
+ * additions and removals, so that no single operation has to move
+ * everything.
+ */
 
 struct vsx_hash_table_entry {
         uint64_t id;
-        struct vsx_hash_table_entry *next;
+};
+
+struct vsx_hash_table_slot {
+        uint64_t hash;
+        /* NULL if the slot is empty */
+        struct vsx_hash_table_entry *entry;
+};
+
+struct vsx_hash_table_slots {
+        /* Always a power of two, or zero if nothing is allocated */
+        size_t size;
+        size_t n_entries;
+        struct vsx_hash_table_slot *slots;
 };
 
 struct vsx_hash_table {
         int n_entries;
-        int table_size;
-        struct vsx_hash_table_entry **entries;
+        /* New entries are always added here */
+        struct vsx_hash_table_slots current;
+        /* While a resize is in progress, these are the slots that
+         * still have entries to move to the new slots. Everything
+         * before move_pos has already been moved. */
+        struct vsx_hash_table_slots old;
+        size_t move_pos;
+};
+
+struct vsx_hash_table_iter {
+        const struct vsx_hash_table *hash_table;
+        const struct vsx_hash_table_slots *slots;
+        size_t pos;
 };
 
 void
@@ -39,6 +77,7 @@ struct vsx_hash_table_entry *
 vsx_hash_table_get(struct vsx_hash_table *hash_table,
                    uint64_t key);
 
+/* There must not already be an entry with the same ID */
 void
 vsx_hash_table_add(struct vsx_hash_table *hash_table,
                    struct vsx_hash_table_entry *entry);
@@ -47,6 +86,24 @@ void
 vsx_hash_table_remove(struct vsx_hash_table *hash_table,
                       struct vsx_hash_table_entry *entry);
 
+/* Iterates over the entries in no particular order. The table must
+ * not be modified until the iteration is finished. */
+void
+vsx_hash_table_iter_init(struct vsx_hash_table_iter *iter,
+                         const struct vsx_hash_table *hash_table);
+
+/* Returns NULL once all of the entries have been returned */
+struct vsx_hash_table_entry *
+vsx_hash_table_iter_next(struct vsx_hash_table_iter *iter);
+
+/* Gets the ID of the next entry from its hash without touching the
+ * entry itself, so collecting all of the IDs only reads the table’s
+ * own memory. Returns false once all of the IDs have been returned.
+ */
+bool
+vsx_hash_table_iter_next_id(struct vsx_hash_table_iter *iter,
+                            uint64_t *id_out);
+
 void
 vsx_hash_table_destroy(struct vsx_hash_table *hash_table);
 
@@ -75,6 +75,7 @@
 #define VSX_PROTO_BAD_CONVERSATION_ID 0x0b
 #define VSX_PROTO_LANGUAGE 0x0c
 #define VSX_PROTO_CONVERSATION_FULL 0x0d
+#define VSX_PROTO_SERVER_BUSY 0x0e
 
 enum vsx_proto_type {
         VSX_PROTO_TYPE_UINT8,
@@ -0,0 +1,174 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures joining public rooms by name while lots of other rooms are
+ * waiting for players. The time to join should stay the same however
+ * many rooms there are. The linear scan that the set used to do is
+ * timed as well for comparison.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vsx-conversation-set.h"
+#include "vsx-main-context.h"
+#include "vsx-util.h"
+
+/* The linear scan is too slow to do a lookup for every room */
+#define N_SCAN_LOOKUPS 1000
+
+static double
+get_time (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *
+make_room_name (int num)
+{
+  char buf[32];
+
+  snprintf (buf, sizeof buf, "eo:room%i", num);
+
+  return vsx_strdup (buf);
+}
+
+static void
+run_bench (int n_rooms)
+{
+  VsxConversationSet *set = vsx_conversation_set_new ();
+  struct vsx_netaddress addr = { .family = AF_INET };
+  char **room_names = vsx_alloc (n_rooms * sizeof *room_names);
+  int *order = vsx_alloc (n_rooms * sizeof *order);
+  unsigned int seed = 42;
+
+  for (int i = 0; i < n_rooms; i++)
+    {
+      room_names[i] = make_room_name (i);
+      order[i] = i;
+    }
+
+  /* Join the rooms in a different order from how they were created */
+  for (int i = n_rooms - 1; i > 0; i--)
+    {
+      int j = rand_r (&seed) % (i + 1);
+      int tmp = order[i];
+      order[i] = order[j];
+      order[j] = tmp;
+    }
+
+  double start = get_time ();
+
+  for (int i = 0; i < n_rooms; i++)
+    {
+      VsxConversation *conversation =
+        vsx_conversation_set_get_pending_conversation (set,
+                                                       room_names[i],
+                                                       &addr);
+      vsx_object_unref (conversation);
+    }
+
+  double create_time = get_time () - start;
+
+  start = get_time ();
+
+  for (int i = 0; i < n_rooms; i++)
+    {
+      VsxConversation *conversation =
+        vsx_conversation_set_get_pending_conversation (set,
+                                                       room_names[order[i]],
+                                                       &addr);
+      vsx_object_unref (conversation);
+    }
+
+  double join_time = get_time () - start;
+
+  int n_scan_lookups = MIN (n_rooms, N_SCAN_LOOKUPS);
+  int n_found = 0;
+
+  start = get_time ();
+
+  for (int i = 0; i < n_scan_lookups; i++)
+    {
+      const char *room_name = room_names[order[i]];
+
+      for (int j = 0; j < n_rooms; j++)
+        {
+          if (!strcmp (room_names[j], room_name))
+            {
+              n_found++;
+              break;
+            }
+        }
+    }
+
+  double scan_time = get_time () - start;
+
+  printf ("%7i rooms: create %7.1fns, join %7.1fns, "
+          "linear scan %10.1fns\n",
+          n_rooms,
+          create_time * 1e9 / n_rooms,
+          join_time * 1e9 / n_rooms,
+          scan_time * 1e9 / n_found);
+
+  for (int i = 0; i < n_rooms; i++)
+    vsx_free (room_names[i]);
+
+  vsx_free (order);
+  vsx_free (room_names);
+  vsx_object_unref (set);
+}
+
+int
+main (int argc, char **argv)
+{
+  static const int default_sizes[] = { 1000, 10000, 100000 };
+
+  if (argc > 1)
+    {
+      for (int i = 1; i < argc; i++)
+        {
+          int n_rooms = atoi (argv[i]);
+
+          if (n_rooms < 1)
+            {
+              fprintf (stderr, "usage: bench-conversation-set [n_rooms]...\n");
+              return EXIT_FAILURE;
+            }
+
+          run_bench (n_rooms);
+        }
+    }
+  else
+    {
+      for (int i = 0; i < VSX_N_ELEMENTS (default_sizes); i++)
+        run_bench (default_sizes[i]);
+    }
+
+  vsx_main_context_free (vsx_main_context_get_default (NULL /* error */));
+
+  return EXIT_SUCCESS;
+}
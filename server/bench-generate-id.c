@@ -0,0 +1,103 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures how many IDs per second vsx_generate_id can make. The
+ * previous method of reading each ID from /dev/urandom is timed as well
+ * for comparison.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "vsx-generate-id.h"
+#include "vsx-util.h"
+
+static double
+get_time (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+generate_id_from_urandom (void)
+{
+  uint64_t id = 0;
+  int fd = open ("/dev/urandom", O_RDONLY);
+
+  if (fd != -1)
+    {
+      if (read (fd, &id, sizeof id) == -1)
+        id = 0;
+
+      vsx_close (fd);
+    }
+
+  return id;
+}
+
+int
+main (int argc, char **argv)
+{
+  int n_ids = argc > 1 ? atoi (argv[1]) : 1000000;
+
+  if (n_ids < 1)
+    {
+      fprintf (stderr, "usage: bench-generate-id [n_ids]\n");
+      return EXIT_FAILURE;
+    }
+
+  struct vsx_netaddress addr = { .family = AF_INET, .port = 1234 };
+  uint64_t sum = 0;
+
+  double start = get_time ();
+
+  for (int i = 0; i < n_ids; i++)
+    sum += vsx_generate_id (&addr);
+
+  double elapsed = get_time () - start;
+
+  printf ("chacha20: %.0f IDs per second, %.1fns per ID\n",
+          n_ids / elapsed,
+          elapsed * 1e9 / n_ids);
+
+  start = get_time ();
+
+  for (int i = 0; i < n_ids; i++)
+    sum += generate_id_from_urandom ();
+
+  elapsed = get_time () - start;
+
+  printf ("urandom:  %.0f IDs per second, %.1fns per ID\n",
+          n_ids / elapsed,
+          elapsed * 1e9 / n_ids);
+
+  /* Make sure the IDs aren’t optimised away */
+  if (sum == 0)
+    printf ("All of the IDs added up to zero\n");
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,253 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compares the main context backends with a load that looks like the
+ * server’s: lots of idle sockets and a few that wake up, read a
+ * message, briefly poll for writing and then go back to only
+ * reading.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "vsx-main-context.h"
+#include "vsx-socket.h"
+#include "vsx-util.h"
+
+typedef struct
+{
+  int fds[2];
+  VsxMainContextSource *source;
+} BenchSocket;
+
+typedef struct
+{
+  int n_sockets;
+  BenchSocket *sockets;
+  int n_events;
+} BenchData;
+
+static void
+socket_cb (VsxMainContextSource *source,
+           int fd,
+           VsxMainContextPollFlags flags,
+           void *user_data)
+{
+  BenchData *data = user_data;
+
+  if ((flags & VSX_MAIN_CONTEXT_POLL_IN))
+    {
+      char byte;
+
+      if (read (fd, &byte, 1) == 1)
+        {
+          data->n_events++;
+          /* Pretend that there is a reply to write */
+          vsx_main_context_modify_poll (source,
+                                        VSX_MAIN_CONTEXT_POLL_IN
+                                        | VSX_MAIN_CONTEXT_POLL_OUT);
+        }
+    }
+  else if ((flags & VSX_MAIN_CONTEXT_POLL_OUT))
+    {
+      vsx_main_context_modify_poll (source, VSX_MAIN_CONTEXT_POLL_IN);
+    }
+}
+
+static double
+get_time (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+run_bench (VsxMainContextBackend backend,
+           int n_sockets,
+           int n_rounds,
+           int batch_size)
+{
+  struct vsx_error *error = NULL;
+  VsxMainContext *mc = vsx_main_context_new_for_backend (backend, &error);
+
+  if (mc == NULL)
+    {
+      fprintf (stderr, "%s\n", error->message);
+      vsx_error_free (error);
+      return;
+    }
+
+  const char *name =
+    vsx_main_context_get_backend (mc) == VSX_MAIN_CONTEXT_BACKEND_IO_URING
+    ? "io_uring"
+    : "epoll";
+
+  BenchData data = {
+    .n_sockets = n_sockets,
+    .sockets = vsx_calloc (n_sockets * sizeof (BenchSocket)),
+    .n_events = 0,
+  };
+
+  for (int i = 0; i < n_sockets; i++)
+    {
+      BenchSocket *sock = data.sockets + i;
+
+      if (socketpair (AF_UNIX, SOCK_STREAM, 0, sock->fds) == -1)
+        vsx_fatal ("socketpair failed: %s", strerror (errno));
+
+      if (!vsx_socket_set_nonblock (sock->fds[0], &error))
+        vsx_fatal ("%s", error->message);
+
+      sock->source = vsx_main_context_add_poll (mc,
+                                                sock->fds[0],
+                                                VSX_MAIN_CONTEXT_POLL_IN,
+                                                socket_cb,
+                                                &data);
+    }
+
+  /* Let the initial registrations settle before timing */
+  for (int i = 0; i < 3; i++)
+    {
+      write (data.sockets[0].fds[1], "x", 1);
+
+      int target = data.n_events + 1;
+
+      while (data.n_events < target)
+        vsx_main_context_poll (mc);
+    }
+
+  data.n_events = 0;
+  int n_polls = 0;
+  unsigned int seed = 42;
+  double start = get_time ();
+
+  for (int round = 0; round < n_rounds; round++)
+    {
+      for (int i = 0; i < batch_size; i++)
+        {
+          BenchSocket *sock = data.sockets + rand_r (&seed) % n_sockets;
+          write (sock->fds[1], "x", 1);
+        }
+
+      int target = (round + 1) * batch_size;
+
+      /* Wait for all of the messages to be read and for the sockets
+       * to stop polling for writing again. */
+      do
+        {
+          vsx_main_context_poll (mc);
+          n_polls++;
+        }
+      while (data.n_events < target);
+
+      vsx_main_context_poll (mc);
+      n_polls++;
+    }
+
+  double elapsed = get_time () - start;
+
+  printf ("%-8s %i sockets, %i events: %.3fs, %.2fµs per event, "
+          "%.2f events per poll, %" PRIu64 " poll updates avoided\n",
+          name,
+          n_sockets,
+          data.n_events,
+          elapsed,
+          elapsed * 1e6 / data.n_events,
+          data.n_events / (double) n_polls,
+          vsx_main_context_get_n_poll_updates_avoided (mc));
+
+  for (int i = 0; i < n_sockets; i++)
+    {
+      vsx_main_context_remove_source (data.sockets[i].source);
+      vsx_close (data.sockets[i].fds[0]);
+      vsx_close (data.sockets[i].fds[1]);
+    }
+
+  vsx_free (data.sockets);
+
+  vsx_main_context_free (mc);
+}
+
+/* Returns the number of sockets that will actually fit */
+static int
+raise_file_limit (int n_sockets)
+{
+  struct rlimit limit;
+
+  if (getrlimit (RLIMIT_NOFILE, &limit) == -1)
+    return n_sockets;
+
+  rlim_t needed = n_sockets * 2 + 64;
+
+  if (limit.rlim_cur < needed)
+    {
+      limit.rlim_cur = MIN (needed, limit.rlim_max);
+
+      if (setrlimit (RLIMIT_NOFILE, &limit) == -1
+          || getrlimit (RLIMIT_NOFILE, &limit) == -1)
+        return n_sockets;
+    }
+
+  if (limit.rlim_cur < needed)
+    {
+      n_sockets = (limit.rlim_cur - 64) / 2;
+      fprintf (stderr,
+               "File limit is too low, using %i sockets instead\n",
+               n_sockets);
+    }
+
+  return n_sockets;
+}
+
+int
+main (int argc, char **argv)
+{
+  int n_sockets = argc > 1 ? atoi (argv[1]) : 10000;
+  int n_rounds = argc > 2 ? atoi (argv[2]) : 2000;
+  int batch_size = argc > 3 ? atoi (argv[3]) : 32;
+
+  if (n_sockets < 1 || n_rounds < 1 || batch_size < 1)
+    {
+      fprintf (stderr,
+               "usage: bench-main-context [n_sockets] [n_rounds] "
+               "[batch_size]\n");
+      return EXIT_FAILURE;
+    }
+
+  n_sockets = raise_file_limit (n_sockets);
+
+  run_bench (VSX_MAIN_CONTEXT_BACKEND_EPOLL, n_sockets, n_rounds, batch_size);
+  run_bench (VSX_MAIN_CONTEXT_BACKEND_IO_URING,
+             n_sockets,
+             n_rounds,
+             batch_size);
+
+  return EXIT_SUCCESS;
+}
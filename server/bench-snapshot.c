@@ -0,0 +1,297 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures saving and restoring a snapshot of lots of games. Each
+ * game has two players, some tiles in play and a few messages. The
+ * save is timed once from scratch, once with nothing changed so that
+ * every record is copied from the previous snapshot and once with a
+ * small fraction of the games changed. Then the save is done in steps
+ * like the server does to see how long the main loop would be held
+ * up for.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "vsx-snapshot.h"
+#include "vsx-conversation.h"
+#include "vsx-person.h"
+#include "vsx-buffer.h"
+#include "vsx-main-context.h"
+#include "vsx-util.h"
+
+/* Percentage of the games that change between the incremental
+ * snapshots */
+#define CHANGED_PERCENT 5
+
+/* Time in microseconds for each step of a stepped save. This is the
+ * same as the server uses. */
+#define STEP_TIME 2000
+
+static double
+get_time (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+save (VsxSnapshot *snapshot,
+      VsxConversationSet *conversation_set,
+      VsxPersonSet *person_set)
+{
+  struct vsx_error *error = NULL;
+
+  if (!vsx_snapshot_save (snapshot, conversation_set, person_set, &error))
+    {
+      fprintf (stderr, "Error saving snapshot: %s\n", error->message);
+      exit (EXIT_FAILURE);
+    }
+}
+
+/* Returns the longest time that the main loop would be blocked */
+static double
+save_in_steps (VsxSnapshot *snapshot,
+               VsxConversationSet *conversation_set,
+               VsxPersonSet *person_set,
+               int *n_steps_out)
+{
+  struct vsx_error *error = NULL;
+  double start = get_time ();
+
+  vsx_snapshot_begin_save (snapshot, conversation_set, person_set);
+
+  double max_time = get_time () - start;
+  int n_steps = 0;
+
+  while (vsx_snapshot_is_saving (snapshot))
+    {
+      start = get_time ();
+
+      if (!vsx_snapshot_continue_save (snapshot, STEP_TIME, &error))
+        {
+          fprintf (stderr, "Error saving snapshot: %s\n", error->message);
+          exit (EXIT_FAILURE);
+        }
+
+      double step_time = get_time () - start;
+
+      if (step_time > max_time)
+        max_time = step_time;
+
+      n_steps++;
+    }
+
+  *n_steps_out = n_steps;
+
+  return max_time;
+}
+
+static VsxSnapshot *
+open_snapshot (const char *prefix)
+{
+  struct vsx_error *error = NULL;
+  VsxSnapshot *snapshot = vsx_snapshot_new (prefix, 0, 1, &error);
+
+  if (snapshot == NULL)
+    {
+      fprintf (stderr, "Error opening snapshot: %s\n", error->message);
+      exit (EXIT_FAILURE);
+    }
+
+  return snapshot;
+}
+
+static void
+remove_files (const char *prefix)
+{
+  for (char slot = 'a'; slot <= 'b'; slot++)
+    {
+      struct vsx_buffer buf = VSX_BUFFER_STATIC_INIT;
+
+      vsx_buffer_append_printf (&buf, "%s.0.%c", prefix, slot);
+      unlink ((const char *) buf.data);
+      vsx_buffer_destroy (&buf);
+    }
+}
+
+static void
+run_bench (const char *prefix,
+           int n_games)
+{
+  VsxConversationSet *conversation_set = vsx_conversation_set_new ();
+  VsxPersonSet *person_set = vsx_person_set_new ();
+  struct vsx_netaddress addr = { .family = AF_INET };
+  VsxConversation **conversations =
+    vsx_alloc (n_games * sizeof *conversations);
+
+  for (int i = 0; i < n_games; i++)
+    {
+      VsxConversation *conversation =
+        vsx_conversation_set_generate_conversation (conversation_set,
+                                                    "eo",
+                                                    &addr);
+
+      for (int j = 0; j < 2; j++)
+        {
+          vsx_object_unref (vsx_person_set_generate_person (person_set,
+                                                            "Zamenhof",
+                                                            &addr,
+                                                            conversation));
+        }
+
+      vsx_conversation_start (conversation);
+
+      for (int j = 0; j < 20; j++)
+        {
+          vsx_conversation_turn (conversation, j % 2);
+          vsx_conversation_move_tile (conversation, j % 2, j, j * 10, j);
+        }
+
+      for (int j = 0; j < 4; j++)
+        vsx_conversation_add_message (conversation, j % 2, "saluton", 7);
+
+      conversations[i] = conversation;
+    }
+
+  remove_files (prefix);
+
+  VsxSnapshot *snapshot = open_snapshot (prefix);
+
+  double start = get_time ();
+  save (snapshot, conversation_set, person_set);
+  double full_time = get_time () - start;
+
+  start = get_time ();
+  save (snapshot, conversation_set, person_set);
+  double unchanged_time = get_time () - start;
+
+  for (int i = 0; i < n_games; i += 100 / CHANGED_PERCENT)
+    vsx_conversation_move_tile (conversations[i], 0, 0, i % 1000, 5);
+
+  start = get_time ();
+  save (snapshot, conversation_set, person_set);
+  double changed_time = get_time () - start;
+
+  for (int i = 0; i < n_games; i += 100 / CHANGED_PERCENT)
+    vsx_conversation_move_tile (conversations[i], 0, 0, i % 1000, 6);
+
+  int n_steps;
+  double max_step_time = save_in_steps (snapshot,
+                                        conversation_set,
+                                        person_set,
+                                        &n_steps);
+
+  vsx_snapshot_free (snapshot);
+
+  VsxConversationSet *restored_conversation_set = vsx_conversation_set_new ();
+  VsxPersonSet *restored_person_set = vsx_person_set_new ();
+  VsxSnapshotRestoreStats stats;
+
+  snapshot = open_snapshot (prefix);
+
+  start = get_time ();
+  vsx_snapshot_restore (snapshot,
+                        restored_conversation_set,
+                        restored_person_set,
+                        &stats,
+                        NULL);
+  double restore_time = get_time () - start;
+
+  vsx_snapshot_free (snapshot);
+
+  printf ("%7i games: full save %7.1fms, unchanged %7.1fms, "
+          "%i%% changed %7.1fms, longest of %i steps %5.1fms, "
+          "restore %7.1fms (%i games, %i people)\n",
+          n_games,
+          full_time * 1e3,
+          unchanged_time * 1e3,
+          CHANGED_PERCENT,
+          changed_time * 1e3,
+          n_steps,
+          max_step_time * 1e3,
+          restore_time * 1e3,
+          stats.n_conversations,
+          stats.n_people);
+
+  remove_files (prefix);
+
+  vsx_object_unref (restored_person_set);
+  vsx_object_unref (restored_conversation_set);
+
+  for (int i = 0; i < n_games; i++)
+    vsx_object_unref (conversations[i]);
+
+  vsx_free (conversations);
+  vsx_object_unref (person_set);
+  vsx_object_unref (conversation_set);
+}
+
+int
+main (int argc, char **argv)
+{
+  static const int default_sizes[] = { 1000, 10000, 100000 };
+  char prefix[] = "/tmp/bench-snapshot-XXXXXX";
+  int fd = mkstemp (prefix);
+
+  if (fd == -1)
+    {
+      perror ("mkstemp");
+      return EXIT_FAILURE;
+    }
+
+  /* The temporary file is only used to reserve a unique prefix */
+  vsx_close (fd);
+
+  if (argc > 1)
+    {
+      for (int i = 1; i < argc; i++)
+        {
+          int n_games = atoi (argv[i]);
+
+          if (n_games < 1)
+            {
+              fprintf (stderr, "usage: bench-snapshot [n_games]...\n");
+              unlink (prefix);
+              return EXIT_FAILURE;
+            }
+
+          run_bench (prefix, n_games);
+        }
+    }
+  else
+    {
+      for (int i = 0; i < VSX_N_ELEMENTS (default_sizes); i++)
+        run_bench (prefix, default_sizes[i]);
+    }
+
+  unlink (prefix);
+
+  vsx_main_context_free (vsx_main_context_get_default (NULL /* error */));
+
+  return EXIT_SUCCESS;
+}
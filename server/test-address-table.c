@@ -0,0 +1,275 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "vsx-address-table.h"
+#include "vsx-netaddress.h"
+
+static struct vsx_netaddress
+make_address (const char *str)
+{
+  struct vsx_netaddress address;
+  bool ret = vsx_netaddress_from_string (&address, str, 5144);
+
+  if (!ret)
+    {
+      fprintf (stderr, "Invalid address %s\n", str);
+      abort ();
+    }
+
+  return address;
+}
+
+static bool
+test_connection_limit (void)
+{
+  VsxAddressTable *table =
+    vsx_address_table_new (16, /* size */
+                           2, /* max_connections */
+                           0 /* max_messages_per_second */);
+  struct vsx_netaddress a = make_address ("192.168.1.1");
+  struct vsx_netaddress b = make_address ("192.168.1.2");
+  /* These are in the same /64 */
+  struct vsx_netaddress c = make_address ("[2001:db8::1]");
+  struct vsx_netaddress d = make_address ("[2001:db8::2:3]");
+  /* This is the IPv4-mapped version of a */
+  struct vsx_netaddress e = make_address ("[::ffff:192.168.1.1]");
+  bool tracked;
+  bool ret = true;
+
+  if (!vsx_address_table_add_connection (table, &a, &tracked)
+      || !vsx_address_table_add_connection (table, &e, &tracked)
+      || !vsx_address_table_add_connection (table, &b, &tracked)
+      || !vsx_address_table_add_connection (table, &c, &tracked)
+      || !vsx_address_table_add_connection (table, &d, &tracked))
+    {
+      fprintf (stderr, "Connection refused before reaching the limit\n");
+      ret = false;
+    }
+  else if (vsx_address_table_add_connection (table, &a, &tracked)
+           || vsx_address_table_add_connection (table, &c, &tracked))
+    {
+      fprintf (stderr, "Connection allowed after reaching the limit\n");
+      ret = false;
+    }
+  else
+    {
+      vsx_address_table_remove_connection (table, &e);
+
+      if (!vsx_address_table_add_connection (table, &a, &tracked))
+        {
+          fprintf (stderr,
+                   "Connection refused after another one was closed\n");
+          ret = false;
+        }
+    }
+
+  VsxAddressTableStats stats;
+
+  vsx_address_table_get_stats (table, &stats);
+
+  if (ret && stats.n_refused_connections != 2)
+    {
+      fprintf (stderr,
+               "Expected 2 refused connections but got %i\n",
+               (int) stats.n_refused_connections);
+      ret = false;
+    }
+
+  vsx_address_table_free (table);
+
+  return ret;
+}
+
+static bool
+test_message_rate (void)
+{
+  VsxAddressTable *table =
+    vsx_address_table_new (16, /* size */
+                           0, /* max_connections */
+                           10 /* max_messages_per_second */);
+  struct vsx_netaddress a = make_address ("10.0.0.1");
+  struct vsx_netaddress b = make_address ("10.0.0.2");
+  int64_t now = 1000000;
+  bool tracked;
+  bool ret = true;
+
+  vsx_address_table_add_connection (table, &a, &tracked);
+  vsx_address_table_add_connection (table, &b, &tracked);
+
+  /* A second’s worth of messages in a burst is allowed */
+  if (!vsx_address_table_add_messages (table, &a, 10, now))
+    {
+      fprintf (stderr, "Burst of messages was rate limited\n");
+      ret = false;
+      goto out;
+    }
+
+  if (vsx_address_table_add_messages (table, &a, 1, now))
+    {
+      fprintf (stderr, "Message over the burst wasn’t rate limited\n");
+      ret = false;
+      goto out;
+    }
+
+  /* The other address has its own rate */
+  if (!vsx_address_table_add_messages (table, &b, 10, now))
+    {
+      fprintf (stderr, "Other address was rate limited\n");
+      ret = false;
+      goto out;
+    }
+
+  /* A flood of rejected messages shouldn’t push the limit any further
+   * into the future */
+  for (int i = 0; i < 1000; i++)
+    vsx_address_table_add_messages (table, &a, 1, now);
+
+  if (!vsx_address_table_add_messages (table, &a, 1, now + 200000))
+    {
+      fprintf (stderr, "Rejected messages extended the rate limit\n");
+      ret = false;
+      goto out;
+    }
+
+  /* Sending at the steady rate is allowed once the address has
+   * caught up */
+  now += 2000000;
+
+  for (int i = 0; i < 100; i++)
+    {
+      now += 100000;
+
+      if (!vsx_address_table_add_messages (table, &a, 1, now))
+        {
+          fprintf (stderr, "Message at the steady rate was rate limited\n");
+          ret = false;
+          goto out;
+        }
+    }
+
+ out:
+  vsx_address_table_free (table);
+
+  return ret;
+}
+
+static bool
+test_eviction (void)
+{
+  VsxAddressTable *table =
+    vsx_address_table_new (2, /* size */
+                           1, /* max_connections */
+                           1 /* max_messages_per_second */);
+  struct vsx_netaddress a = make_address ("10.0.0.1");
+  struct vsx_netaddress b = make_address ("10.0.0.2");
+  struct vsx_netaddress c = make_address ("10.0.0.3");
+  bool tracked;
+  bool ret = true;
+
+  vsx_address_table_add_connection (table, &a, &tracked);
+  vsx_address_table_add_connection (table, &b, &tracked);
+
+  /* The table is full of addresses with connections so this one
+   * isn’t tracked */
+  for (int i = 0; i < 2; i++)
+    {
+      if (!vsx_address_table_add_connection (table, &c, &tracked))
+        {
+          fprintf (stderr, "Untracked address was refused\n");
+          ret = false;
+          goto out;
+        }
+
+      if (tracked)
+        {
+          fprintf (stderr, "Connection was tracked in a full table\n");
+          ret = false;
+          goto out;
+        }
+    }
+
+  /* Use up a’s rate and then close its connection. Its entry should
+   * be kept until something else needs it. */
+  vsx_address_table_add_messages (table, &a, 1, 0);
+  vsx_address_table_remove_connection (table, &a);
+
+  if (vsx_address_table_add_messages (table, &a, 1, 0))
+    {
+      fprintf (stderr, "Rate was forgotten after closing connection\n");
+      ret = false;
+      goto out;
+    }
+
+  /* This should reuse a’s entry. The untracked connections from
+   * before don’t count towards the limit. */
+  if (!vsx_address_table_add_connection (table, &c, &tracked)
+      || !tracked
+      || vsx_address_table_add_connection (table, &c, &tracked))
+    {
+      fprintf (stderr, "The new address wasn’t tracked\n");
+      ret = false;
+      goto out;
+    }
+
+  if (!vsx_address_table_add_messages (table, &a, 1, 0))
+    {
+      fprintf (stderr, "Evicted address is still rate limited\n");
+      ret = false;
+      goto out;
+    }
+
+  VsxAddressTableStats stats;
+
+  vsx_address_table_get_stats (table, &stats);
+
+  if (stats.n_evicted != 1)
+    {
+      fprintf (stderr,
+               "Expected 1 eviction but got %i\n",
+               (int) stats.n_evicted);
+      ret = false;
+    }
+
+ out:
+  vsx_address_table_free (table);
+
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  int ret = EXIT_SUCCESS;
+
+  if (!test_connection_limit ())
+    ret = EXIT_FAILURE;
+
+  if (!test_message_rate ())
+    ret = EXIT_FAILURE;
+
+  if (!test_eviction ())
+    ret = EXIT_FAILURE;
+
+  return ret;
+}
@@ -28,6 +28,8 @@
 #include "vsx-proto.h"
 #include "vsx-buffer.h"
 #include "vsx-util.h"
+#include "vsx-shard.h"
+#include "vsx-metrics.h"
 
 typedef struct
 {
@@ -1436,6 +1438,12 @@ test_send_one_message (Harness *harness,
     {
       ret = false;
     }
+  else if (!read_message (harness->conn,
+                          0, /* expected_player_num */
+                          expected_message))
+    {
+      ret = false;
+    }
   else if (was_typing
            && !read_player (harness->conn,
                             0, /* expected_player_num */
@@ -1443,12 +1451,6 @@ test_send_one_message (Harness *harness,
     {
       ret = false;
     }
-  else if (!read_message (harness->conn,
-                          0, /* expected_player_num */
-                          expected_message))
-    {
-      ret = false;
-    }
 
   vsx_buffer_destroy (&buf);
 
@@ -1620,6 +1622,8 @@ test_typing_commands (Harness *harness, VsxPerson *person)
       { VSX_PROTO_START_TYPING, true },
     };
 
+  bool was_typing = false;
+
   for (int i = 0; i < VSX_N_ELEMENTS (typing_commands); i++)
     {
       struct vsx_error *error = NULL;
@@ -1648,6 +1652,22 @@ test_typing_commands (Harness *harness, VsxPerson *person)
                    i);
           return false;
         }
+
+      /* Every change of state should be sent to the client */
+      if (typing_commands[i].typing_result != was_typing)
+        {
+          int expected_flags = VSX_PLAYER_CONNECTED;
+
+          if (typing_commands[i].typing_result)
+            expected_flags |= VSX_PLAYER_TYPING;
+
+          if (!read_player (harness->conn,
+                            0, /* expected_player_num */
+                            expected_flags))
+            return false;
+
+          was_typing = typing_commands[i].typing_result;
+        }
     }
 
   return true;
@@ -1796,19 +1816,19 @@ test_turn_and_move_commands (Harness *harness, VsxPerson *person)
       return false;
     }
 
-  /* When a tile is turned the player flags will change to update the
-   * current player.
+  int tile_num, tile_x, tile_y, tile_player;
+
+  if (!read_tile (harness->conn, &tile_num, &tile_x, &tile_y, &tile_player))
+    return false;
+
+  /* After the tile is turned the player flags will change to update
+   * the current player.
    */
   if (!read_player (harness->conn,
                     0, /* expected_player_num */
                     VSX_PLAYER_CONNECTED | VSX_PLAYER_NEXT_TURN))
     return false;
 
-  int tile_num, tile_x, tile_y, tile_player;
-
-  if (!read_tile (harness->conn, &tile_num, &tile_x, &tile_y, &tile_player))
-    return false;
-
   if (tile_num != 0)
     {
       fprintf (stderr,
@@ -2289,19 +2309,6 @@ test_turn_all_tiles (void)
           goto out;
         }
 
-      /* When the first and last tiles are turned the player flags
-       * will change to update the current player.
-       */
-      if ((i == 0 || i == 121)
-          && !read_player (harness->conn,
-                           0, /* expected_player_num */
-                           VSX_PLAYER_CONNECTED |
-                           (i == 0 ? VSX_PLAYER_NEXT_TURN : 0)))
-        {
-          ret = false;
-          goto out;
-        }
-
       int tile_num;
 
       if (!read_tile (harness->conn, &tile_num, NULL, NULL, NULL))
@@ -2319,6 +2326,19 @@ test_turn_all_tiles (void)
           ret = false;
           goto out;
         }
+
+      /* When the first and last tiles are turned the player flags
+       * will change to update the current player.
+       */
+      if ((i == 0 || i == 121)
+          && !read_player (harness->conn,
+                           0, /* expected_player_num */
+                           VSX_PLAYER_CONNECTED |
+                           (i == 0 ? VSX_PLAYER_NEXT_TURN : 0)))
+        {
+          ret = false;
+          goto out;
+        }
     }
 
  out:
@@ -2942,81 +2962,929 @@ test_full_private_conversation (void)
   return ret;
 }
 
-int
-main (int argc, char **argv)
+static bool
+check_memory_usage (VsxConnection *conn,
+                    bool expect_idle,
+                    const char *when)
 {
-  int ret = EXIT_SUCCESS;
+  size_t usage = vsx_connection_get_memory_usage (conn);
+  bool is_idle = usage <= VSX_CONNECTION_IDLE_MEMORY_BUDGET;
 
-  if (!test_frame_errors ())
-    ret = EXIT_FAILURE;
+  if (is_idle != expect_idle)
+    {
+      fprintf (stderr,
+               "Connection uses %zu bytes %s but the idle budget is %i "
+               "and it was expected to be %s it\n",
+               usage,
+               when,
+               VSX_CONNECTION_IDLE_MEMORY_BUDGET,
+               expect_idle ? "within" : "over");
+      return false;
+    }
 
-  if (!test_eof_before_ws ())
-    ret = EXIT_FAILURE;
+  return true;
+}
 
-  if (!test_close_in_frame ())
-    ret = EXIT_FAILURE;
+static bool
+parse_bytes (VsxConnection *conn,
+             const uint8_t *data,
+             size_t length)
+{
+  struct vsx_error *error = NULL;
 
-  if (!test_new_player ())
-    ret = EXIT_FAILURE;
+  if (!vsx_connection_parse_data (conn, data, length, &error))
+    {
+      fprintf (stderr,
+               "Unexpected error parsing data: %s\n",
+               error->message);
+      vsx_error_free (error);
+      return false;
+    }
 
-  if (!test_reconnect ())
-    ret = EXIT_FAILURE;
+  return true;
+}
 
-  if (!test_keep_alive ())
-    ret = EXIT_FAILURE;
+static bool
+test_idle_memory (void)
+{
+  Harness *harness = create_negotiated_harness ();
 
-  if (!test_leave ())
-    ret = EXIT_FAILURE;
+  if (harness == NULL)
+    return false;
 
-  if (!test_send_message ())
-    ret = EXIT_FAILURE;
+  bool ret = true;
 
-  if (!test_typing ())
-    ret = EXIT_FAILURE;
+  if (!create_player (harness,
+                      "default:eo", "Zamenhof",
+                      NULL /* person_out */))
+    {
+      ret = false;
+      goto out;
+    }
 
-  if (!test_turn_and_move ())
-    ret = EXIT_FAILURE;
+  /* Drain everything that the connection wants to send */
+  uint8_t buf[1024];
 
-  if (!test_shout ())
-    ret = EXIT_FAILURE;
+  while (vsx_connection_fill_output_buffer (harness->conn,
+                                            buf,
+                                            sizeof buf) > 0);
 
-  if (!test_set_n_tiles ())
-    ret = EXIT_FAILURE;
+  if (!check_memory_usage (harness->conn, true, "after joining"))
+    {
+      ret = false;
+      goto out;
+    }
 
-  if (!test_set_language ())
-    ret = EXIT_FAILURE;
+  /* Half of a keep-alive frame needs to be buffered */
+  static const uint8_t keep_alive[] = { 0x82, 0x01, 0x83 };
 
-  if (!test_set_unknown_language ())
-    ret = EXIT_FAILURE;
+  if (!parse_bytes (harness->conn, keep_alive, 1)
+      || !check_memory_usage (harness->conn, false, "with a partial frame")
+      || !parse_bytes (harness->conn, keep_alive + 1, sizeof keep_alive - 1)
+      || !check_memory_usage (harness->conn, true, "after a whole frame"))
+    {
+      ret = false;
+      goto out;
+    }
 
-  if (!test_sync ())
-    ret = EXIT_FAILURE;
+  /* The first fragment of a message needs to be kept */
+  static const uint8_t first_fragment[] = { 0x02, 0x01, 0x83 };
+  static const uint8_t last_fragment[] = { 0x80, 0x00 };
 
-  if (!test_turn_all_tiles ())
-    ret = EXIT_FAILURE;
+  if (!parse_bytes (harness->conn, first_fragment, sizeof first_fragment)
+      || !check_memory_usage (harness->conn,
+                              false,
+                              "with a partial message")
+      || !parse_bytes (harness->conn, last_fragment, sizeof last_fragment)
+      || !check_memory_usage (harness->conn, true, "after a whole message"))
+    {
+      ret = false;
+      goto out;
+    }
 
-  if (!test_ping ())
-    ret = EXIT_FAILURE;
+ out:
+  free_harness (harness);
 
-  if (!test_bad_player_id ())
-    ret = EXIT_FAILURE;
+  return ret;
+}
 
-  if (!test_bad_conversation_id ())
-    ret = EXIT_FAILURE;
+static bool
+test_log_backlog (void)
+{
+  Harness *harness = create_negotiated_harness ();
 
-  if (!test_join_public_conversation_by_id ())
-    ret = EXIT_FAILURE;
+  if (harness == NULL)
+    return false;
 
-  if (!test_private_conversation ())
-    ret = EXIT_FAILURE;
+  VsxPerson *person;
+  bool ret = true;
 
-  if (!test_full_public_conversation ())
-    ret = EXIT_FAILURE;
+  if (!create_player (harness,
+                      "default:eo", "Zamenhof",
+                      &person))
+    {
+      ret = false;
+      goto out_harness;
+    }
 
-  if (!test_full_private_conversation ())
-    ret = EXIT_FAILURE;
+  /* Add enough messages without reading them that the connection
+   * will fall too far behind in the frame log and will have to
+   * resend them from the message list instead.
+   */
+  const int n_messages = 100;
+  char text[VSX_PROTO_MAX_MESSAGE_LENGTH + 1];
 
-  vsx_main_context_free (vsx_main_context_get_default (NULL /* error */));
+  for (int i = 0; i < n_messages; i++)
+    {
+      memset (text, 'a' + i % 26, VSX_PROTO_MAX_MESSAGE_LENGTH);
+      text[VSX_PROTO_MAX_MESSAGE_LENGTH] = '\0';
+      vsx_conversation_add_message (person->conversation,
+                                    person->player->num,
+                                    text,
+                                    VSX_PROTO_MAX_MESSAGE_LENGTH);
+    }
+
+  /* The resync sends the player state again before the messages */
+  if (!read_player (harness->conn,
+                    0, /* expected_player_num */
+                    VSX_PLAYER_CONNECTED))
+    {
+      ret = false;
+      goto out;
+    }
+
+  for (int i = 0; i < n_messages; i++)
+    {
+      memset (text, 'a' + i % 26, VSX_PROTO_MAX_MESSAGE_LENGTH);
+      text[VSX_PROTO_MAX_MESSAGE_LENGTH] = '\0';
+
+      if (!read_message (harness->conn,
+                         0, /* expected_player_num */
+                         text))
+        {
+          ret = false;
+          goto out;
+        }
+    }
+
+  if (!read_sync (harness->conn))
+    {
+      ret = false;
+    }
+  else if (vsx_connection_has_data (harness->conn))
+    {
+      fprintf (stderr,
+               "Connection still has data after reading all of the "
+               "messages\n");
+      ret = false;
+    }
+
+ out:
+  vsx_object_unref (person);
+ out_harness:
+  free_harness (harness);
+
+  return ret;
+}
+
+static bool
+test_shard_handoff (void)
+{
+  struct vsx_netaddress address;
+  bool ret = true;
+
+  bool addr_ret = vsx_netaddress_from_string (&address, "127.0.0.1", 5344);
+  assert (addr_ret);
+
+  VsxPersonSet *person_sets[2];
+  VsxConversationSet *conversation_sets[2];
+
+  for (int i = 0; i < 2; i++)
+    {
+      person_sets[i] = vsx_person_set_new_for_shard (i, 2);
+      conversation_sets[i] = vsx_conversation_set_new_for_shard (i, 2);
+    }
+
+  /* Find a room name that is pinned to the second shard */
+  char room_name[32];
+
+  for (int i = 0; ; i++)
+    {
+      snprintf (room_name, sizeof room_name, "shard%i:eo", i);
+
+      if (vsx_shard_for_room_name (room_name, 2) == 1)
+        break;
+    }
+
+  VsxConnection *conn_a = vsx_connection_new (&address,
+                                              conversation_sets[1],
+                                              person_sets[1]);
+  vsx_connection_set_shard (conn_a, 1, 2);
+
+  VsxConnection *conn_b = vsx_connection_new (&address,
+                                              conversation_sets[0],
+                                              person_sets[0]);
+  vsx_connection_set_shard (conn_b, 0, 2);
+
+  VsxPerson *person = NULL;
+
+  if (!negotiate_connection (conn_a)
+      || !negotiate_connection (conn_b)
+      || !create_player_for_connection (conn_a,
+                                        person_sets[1],
+                                        room_name,
+                                        "Zamenhof",
+                                        0, /* player_num */
+                                        &person))
+    {
+      ret = false;
+      goto out;
+    }
+
+  if (vsx_connection_get_handoff_shard (conn_a) != -1)
+    {
+      fprintf (stderr,
+               "Connection was handed off even though it was on the "
+               "right shard\n");
+      ret = false;
+      goto out;
+    }
+
+  uint64_t conversation_id = person->conversation->hash_entry.id;
+
+  if (vsx_shard_for_id (conversation_id, 2) != 1)
+    {
+      fprintf (stderr,
+               "Conversation ID %" PRIx64 " is not pinned to its shard\n",
+               conversation_id);
+      ret = false;
+      goto out;
+    }
+
+  /* The join command should only be counted once even though it is
+   * processed on both shards */
+  vsx_metrics_enable ();
+
+  atomic_uint_fast64_t *join_count =
+    vsx_metrics_get_thread ()->commands
+    + VSX_PROTO_JOIN_GAME
+    - VSX_METRICS_FIRST_COMMAND;
+  uint64_t n_joins_before = atomic_load (join_count);
+
+  struct vsx_buffer buf = VSX_BUFFER_STATIC_INIT;
+
+  vsx_buffer_append_c (&buf, 0x82);
+  vsx_buffer_append_c (&buf, sizeof conversation_id + 10);
+  vsx_buffer_append_c (&buf, 0x8d);
+  uint64_t le_id = VSX_UINT64_TO_LE (conversation_id);
+  vsx_buffer_append (&buf, &le_id, sizeof le_id);
+  vsx_buffer_append_string (&buf, "Zamenhof");
+  vsx_buffer_append_c (&buf, 0);
+
+  struct vsx_error *error = NULL;
+
+  bool parse_ret = vsx_connection_parse_data (conn_b,
+                                              buf.data,
+                                              buf.length,
+                                              &error);
+
+  vsx_buffer_destroy (&buf);
+
+  if (!parse_ret)
+    {
+      fprintf (stderr,
+               "Unexpected error while joining a game on another shard: %s\n",
+               error->message);
+      vsx_error_free (error);
+      ret = false;
+      goto out;
+    }
+
+  if (vsx_connection_get_handoff_shard (conn_b) != 1)
+    {
+      fprintf (stderr,
+               "Expected handoff to shard 1 but got %i\n",
+               vsx_connection_get_handoff_shard (conn_b));
+      ret = false;
+      goto out;
+    }
+
+  vsx_connection_detach (conn_b);
+
+  if (!vsx_connection_attach (conn_b,
+                              conversation_sets[1],
+                              person_sets[1],
+                              1, /* shard_num */
+                              &error))
+    {
+      fprintf (stderr,
+               "Unexpected error after handing off connection: %s\n",
+               error->message);
+      vsx_error_free (error);
+      ret = false;
+      goto out;
+    }
+
+  if (!check_new_player (conn_b,
+                         person_sets[1],
+                         "Zamenhof",
+                         1, /* player_num */
+                         NULL /* person_out */))
+    ret = false;
+
+  if (atomic_load (join_count) != n_joins_before + 1)
+    {
+      fprintf (stderr,
+               "Join command was counted %" PRIu64 " times\n",
+               (uint64_t) (atomic_load (join_count) - n_joins_before));
+      ret = false;
+    }
+
+ out:
+  if (person)
+    vsx_object_unref (person);
+
+  vsx_connection_free (conn_b);
+  vsx_connection_free (conn_a);
+
+  for (int i = 0; i < 2; i++)
+    {
+      vsx_object_unref (conversation_sets[i]);
+      vsx_object_unref (person_sets[i]);
+    }
+
+  return ret;
+}
+
+static void
+append_new_player_frame (struct vsx_buffer *buf,
+                         const char *room_name,
+                         const char *player_name)
+{
+  vsx_buffer_append_c (buf, 0x82);
+  vsx_buffer_append_c (buf, 1 + strlen (room_name) + strlen (player_name) + 2);
+  vsx_buffer_append_c (buf, 0x80);
+  vsx_buffer_append_string (buf, room_name);
+  vsx_buffer_append_c (buf, 0);
+  vsx_buffer_append_string (buf, player_name);
+  vsx_buffer_append_c (buf, 0);
+}
+
+static bool
+check_handoff_shard (VsxConnection *conn,
+                     int expected_shard)
+{
+  int shard = vsx_connection_get_handoff_shard (conn);
+
+  if (shard != expected_shard)
+    {
+      fprintf (stderr,
+               "Expected handoff to shard %i but got %i\n",
+               expected_shard,
+               shard);
+      return false;
+    }
+
+  return true;
+}
+
+static bool
+test_second_handoff (void)
+{
+  struct vsx_netaddress address;
+  bool ret = true;
+
+  bool addr_ret = vsx_netaddress_from_string (&address, "127.0.0.1", 5344);
+  assert (addr_ret);
+
+  VsxPersonSet *person_sets[3];
+  VsxConversationSet *conversation_sets[3];
+
+  for (int i = 0; i < 3; i++)
+    {
+      person_sets[i] = vsx_person_set_new_for_shard (i, 3);
+      conversation_sets[i] = vsx_conversation_set_new_for_shard (i, 3);
+    }
+
+  /* A player ID that doesn’t exist on the second shard and a room
+   * on the third */
+  uint64_t player_id;
+
+  for (player_id = 1; vsx_shard_for_id (player_id, 3) != 1; player_id++);
+
+  char room_name[32];
+
+  for (int i = 0; ; i++)
+    {
+      snprintf (room_name, sizeof room_name, "shard%i:eo", i);
+
+      if (vsx_shard_for_room_name (room_name, 3) == 2)
+        break;
+    }
+
+  VsxConnection *conn = vsx_connection_new (&address,
+                                            conversation_sets[0],
+                                            person_sets[0]);
+  vsx_connection_set_shard (conn, 0, 3);
+
+  struct vsx_error *error = NULL;
+  struct vsx_buffer buf = VSX_BUFFER_STATIC_INIT;
+
+  if (!negotiate_connection (conn))
+    {
+      ret = false;
+      goto out;
+    }
+
+  /* The reconnect fails on the second shard and then the new player
+   * needs to move the connection again */
+  uint64_t le_id = VSX_UINT64_TO_LE (player_id);
+  vsx_buffer_append_c (&buf, 0x82);
+  vsx_buffer_append_c (&buf, 1 + sizeof (uint64_t) + sizeof (uint16_t));
+  vsx_buffer_append_c (&buf, 0x81);
+  vsx_buffer_append (&buf, &le_id, sizeof le_id);
+  vsx_buffer_append_c (&buf, 0);
+  vsx_buffer_append_c (&buf, 0);
+  append_new_player_frame (&buf, room_name, "Zamenhof");
+
+  if (!vsx_connection_parse_data (conn, buf.data, buf.length, &error))
+    goto error;
+
+  if (!check_handoff_shard (conn, 1))
+    {
+      ret = false;
+      goto out;
+    }
+
+  vsx_connection_detach (conn);
+
+  if (!vsx_connection_attach (conn,
+                              conversation_sets[1],
+                              person_sets[1],
+                              1, /* shard_num */
+                              &error))
+    goto error;
+
+  if (!check_handoff_shard (conn, 2))
+    {
+      ret = false;
+      goto out;
+    }
+
+  vsx_connection_detach (conn);
+
+  if (!vsx_connection_attach (conn,
+                              conversation_sets[2],
+                              person_sets[2],
+                              2, /* shard_num */
+                              &error))
+    goto error;
+
+  if (!check_handoff_shard (conn, -1))
+    ret = false;
+
+  goto out;
+
+ error:
+  fprintf (stderr,
+           "Unexpected error while handing off twice: %s\n",
+           error->message);
+  vsx_error_free (error);
+  ret = false;
+
+ out:
+  vsx_buffer_destroy (&buf);
+  vsx_connection_free (conn);
+
+  for (int i = 0; i < 3; i++)
+    {
+      vsx_object_unref (conversation_sets[i]);
+      vsx_object_unref (person_sets[i]);
+    }
+
+  return ret;
+}
+
+static bool
+test_handoff_data_limit (void)
+{
+  struct vsx_netaddress address;
+  bool ret = true;
+
+  bool addr_ret = vsx_netaddress_from_string (&address, "127.0.0.1", 5344);
+  assert (addr_ret);
+
+  VsxPersonSet *person_set = vsx_person_set_new_for_shard (0, 2);
+  VsxConversationSet *conversation_set =
+    vsx_conversation_set_new_for_shard (0, 2);
+
+  char room_name[32];
+
+  for (int i = 0; ; i++)
+    {
+      snprintf (room_name, sizeof room_name, "shard%i:eo", i);
+
+      if (vsx_shard_for_room_name (room_name, 2) == 1)
+        break;
+    }
+
+  VsxConnection *conn = vsx_connection_new (&address,
+                                            conversation_set,
+                                            person_set);
+  vsx_connection_set_shard (conn, 0, 2);
+
+  struct vsx_error *error = NULL;
+  struct vsx_buffer buf = VSX_BUFFER_STATIC_INIT;
+
+  if (!negotiate_connection (conn))
+    {
+      ret = false;
+      goto out;
+    }
+
+  append_new_player_frame (&buf, room_name, "Zamenhof");
+
+  if (!vsx_connection_parse_data (conn, buf.data, buf.length, &error))
+    {
+      fprintf (stderr,
+               "Unexpected error while joining a game on another shard: %s\n",
+               error->message);
+      vsx_error_free (error);
+      ret = false;
+      goto out;
+    }
+
+  if (!check_handoff_shard (conn, 1))
+    {
+      ret = false;
+      goto out;
+    }
+
+  /* Keep sending data without letting the handoff finish */
+  vsx_buffer_set_length (&buf, 0);
+
+  for (int i = 0; i < 1024; i++)
+    vsx_buffer_append_c (&buf, 0x89);
+
+  for (int i = 0; i < 1024; i++)
+    {
+      if (!vsx_connection_parse_data (conn, buf.data, buf.length, &error))
+        {
+          if (error->domain != &vsx_connection_error
+              || error->code != VSX_CONNECTION_ERROR_INVALID_PROTOCOL)
+            {
+              fprintf (stderr,
+                       "Unexpected error for too much handoff data: %s\n",
+                       error->message);
+              ret = false;
+            }
+
+          vsx_error_free (error);
+          goto out;
+        }
+    }
+
+  fprintf (stderr, "No error after queuing 1MB of data during a handoff\n");
+  ret = false;
+
+ out:
+  vsx_buffer_destroy (&buf);
+  vsx_connection_free (conn);
+  vsx_object_unref (conversation_set);
+  vsx_object_unref (person_set);
+
+  return ret;
+}
+
+static bool
+test_server_busy (void)
+{
+  Harness *harness = create_negotiated_harness ();
+
+  if (harness == NULL)
+    return false;
+
+  VsxAdmission admission;
+
+  vsx_admission_init (&admission);
+  vsx_admission_set_limits (&admission,
+                            0, /* max_connections */
+                            1, /* max_people */
+                            0, /* max_conversations */
+                            100 /* soft_limit */);
+  vsx_person_set_set_admission (harness->person_set, &admission);
+  vsx_conversation_set_set_admission (harness->conversation_set, &admission);
+
+  bool ret = true;
+  VsxPerson *person = NULL;
+  VsxConnection *other_conn = NULL;
+
+  if (!create_player (harness, "default:eo", "Zamenhof", &person))
+    {
+      ret = false;
+      goto out;
+    }
+
+  if (atomic_load (&admission.n_people) != 1
+      || atomic_load (&admission.n_conversations) != 1)
+    {
+      fprintf (stderr,
+               "Expected 1 person and 1 conversation to be counted but "
+               "got %i and %i\n",
+               atomic_load (&admission.n_people),
+               atomic_load (&admission.n_conversations));
+      ret = false;
+      goto out;
+    }
+
+  other_conn = vsx_connection_new (&harness->socket_address,
+                                   harness->conversation_set,
+                                   harness->person_set);
+
+  if (!negotiate_connection (other_conn))
+    {
+      ret = false;
+      goto out;
+    }
+
+  const char new_player_frame[] = "\x82\x0e\x80" "default:eo\0" "Z\0";
+  struct vsx_error *error = NULL;
+
+  if (!vsx_connection_parse_data (other_conn,
+                                  (const uint8_t *) new_player_frame,
+                                  sizeof new_player_frame - 1,
+                                  &error))
+    {
+      fprintf (stderr,
+               "Unexpected error while creating a player on a busy "
+               "server: %s\n",
+               error->message);
+      vsx_error_free (error);
+      ret = false;
+      goto out;
+    }
+
+  if (!check_error_message (other_conn, "server_busy", 0x0e))
+    {
+      ret = false;
+      goto out;
+    }
+
+  if (atomic_load (&admission.n_shed_players) != 1)
+    {
+      fprintf (stderr,
+               "Expected 1 shed player but got %" PRIuFAST64 "\n",
+               (uint_fast64_t) atomic_load (&admission.n_shed_players));
+      ret = false;
+      goto out;
+    }
+
+  /* Existing players should still be able to reconnect */
+  if (!test_reconnect_ok (harness, person->hash_entry.id))
+    ret = false;
+
+ out:
+  if (other_conn)
+    vsx_connection_free (other_conn);
+  if (person)
+    vsx_object_unref (person);
+
+  free_harness (harness);
+
+  if (ret
+      && (atomic_load (&admission.n_people) != 0
+          || atomic_load (&admission.n_conversations) != 0))
+    {
+      fprintf (stderr,
+               "People or conversations are still counted after freeing "
+               "the sets\n");
+      ret = false;
+    }
+
+  return ret;
+}
+
+static bool
+test_save_state (void)
+{
+  Harness *harness = create_negotiated_harness ();
+
+  if (harness == NULL)
+    return false;
+
+  bool ret = true;
+  VsxPerson *person = NULL;
+  struct vsx_buffer state = VSX_BUFFER_STATIC_INIT;
+  struct vsx_error *error = NULL;
+
+  if (!create_player (harness, "default:eo", "Zamenhof", &person))
+    {
+      ret = false;
+      goto out;
+    }
+
+  /* Leave a pong waiting to be sent, the first fragment of a
+   * message and part of the next frame */
+  static const uint8_t partial_data[] =
+    "\x89\x02hi"
+    "\x02\x03\x85He"
+    "\x80\x04ll";
+
+  if (!parse_bytes (harness->conn, partial_data, sizeof partial_data - 1))
+    {
+      ret = false;
+      goto out;
+    }
+
+  if (!vsx_connection_save_state (harness->conn, &state))
+    {
+      fprintf (stderr, "Failed to save the connection state\n");
+      ret = false;
+      goto out;
+    }
+
+  /* Carry on with a new connection as if it was in a new process */
+  vsx_connection_free (harness->conn);
+  harness->conn = vsx_connection_new (&harness->socket_address,
+                                      harness->conversation_set,
+                                      harness->person_set);
+
+  if (!vsx_connection_load_state (harness->conn,
+                                  state.data,
+                                  state.length,
+                                  &error))
+    {
+      fprintf (stderr,
+               "Failed to load the connection state: %s\n",
+               error->message);
+      vsx_error_free (error);
+      ret = false;
+      goto out;
+    }
+
+  uint8_t pong[4];
+
+  if (vsx_connection_fill_output_buffer (harness->conn, pong, sizeof pong)
+      != sizeof pong
+      || memcmp (pong, "\x8a\x02hi", sizeof pong))
+    {
+      fprintf (stderr, "Pending pong was not sent after loading the state\n");
+      ret = false;
+      goto out;
+    }
+
+  if (!read_connect_header (harness->conn,
+                            "Zamenhof",
+                            0, /* player_num */
+                            NULL /* person_id_out */)
+      || !read_sync (harness->conn))
+    {
+      ret = false;
+      goto out;
+    }
+
+  /* Finish the message that was started before the state was saved */
+  static const uint8_t rest_data[] = "o\0";
+
+  if (!parse_bytes (harness->conn, rest_data, sizeof rest_data - 1))
+    {
+      ret = false;
+      goto out;
+    }
+
+  if (!check_expected_message (person, "Hello")
+      || !read_message (harness->conn,
+                        0, /* expected_player_num */
+                        "Hello"))
+    {
+      ret = false;
+      goto out;
+    }
+
+  /* A connection that hasn’t finished the handshake can’t be saved */
+  VsxConnection *new_conn = vsx_connection_new (&harness->socket_address,
+                                                harness->conversation_set,
+                                                harness->person_set);
+
+  if (vsx_connection_save_state (new_conn, &state))
+    {
+      fprintf (stderr,
+               "Saving the state of an unnegotiated connection "
+               "succeeded\n");
+      ret = false;
+    }
+
+  vsx_connection_free (new_conn);
+
+ out:
+  if (person)
+    vsx_object_unref (person);
+
+  vsx_buffer_destroy (&state);
+
+  free_harness (harness);
+
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  int ret = EXIT_SUCCESS;
+
+  if (!test_frame_errors ())
+    ret = EXIT_FAILURE;
+
+  if (!test_eof_before_ws ())
+    ret = EXIT_FAILURE;
+
+  if (!test_close_in_frame ())
+    ret = EXIT_FAILURE;
+
+  if (!test_new_player ())
+    ret = EXIT_FAILURE;
+
+  if (!test_reconnect ())
+    ret = EXIT_FAILURE;
+
+  if (!test_keep_alive ())
+    ret = EXIT_FAILURE;
+
+  if (!test_leave ())
+    ret = EXIT_FAILURE;
+
+  if (!test_send_message ())
+    ret = EXIT_FAILURE;
+
+  if (!test_typing ())
+    ret = EXIT_FAILURE;
+
+  if (!test_turn_and_move ())
+    ret = EXIT_FAILURE;
+
+  if (!test_shout ())
+    ret = EXIT_FAILURE;
+
+  if (!test_set_n_tiles ())
+    ret = EXIT_FAILURE;
+
+  if (!test_set_language ())
+    ret = EXIT_FAILURE;
+
+  if (!test_set_unknown_language ())
+    ret = EXIT_FAILURE;
+
+  if (!test_sync ())
+    ret = EXIT_FAILURE;
+
+  if (!test_turn_all_tiles ())
+    ret = EXIT_FAILURE;
+
+  if (!test_ping ())
+    ret = EXIT_FAILURE;
+
+  if (!test_bad_player_id ())
+    ret = EXIT_FAILURE;
+
+  if (!test_bad_conversation_id ())
+    ret = EXIT_FAILURE;
+
+  if (!test_join_public_conversation_by_id ())
+    ret = EXIT_FAILURE;
+
+  if (!test_private_conversation ())
+    ret = EXIT_FAILURE;
+
+  if (!test_full_public_conversation ())
+    ret = EXIT_FAILURE;
+
+  if (!test_full_private_conversation ())
+    ret = EXIT_FAILURE;
+
+  if (!test_log_backlog ())
+    ret = EXIT_FAILURE;
+
+  if (!test_idle_memory ())
+    ret = EXIT_FAILURE;
+
+  if (!test_shard_handoff ())
+    ret = EXIT_FAILURE;
+
+  if (!test_second_handoff ())
+    ret = EXIT_FAILURE;
+
+  if (!test_handoff_data_limit ())
+    ret = EXIT_FAILURE;
+
+  if (!test_server_busy ())
+    ret = EXIT_FAILURE;
+
+  if (!test_save_state ())
+    ret = EXIT_FAILURE;
+
+  vsx_main_context_free (vsx_main_context_get_default (NULL /* error */));
+
+  vsx_connection_flush_buffer_pool ();
 
   return ret;
 }
@@ -391,6 +391,62 @@ test_free_game(VsxConversationSet *set,
         return ret;
 }
 
+static bool
+test_many_rooms(VsxConversationSet *set,
+                const struct vsx_netaddress *addr)
+{
+        const int n_rooms = 1000;
+        VsxConversation **conversations =
+                vsx_alloc(n_rooms * sizeof *conversations);
+        bool ret = true;
+
+        char room_name[32];
+
+        for (int i = 0; i < n_rooms; i++) {
+                snprintf(room_name, sizeof room_name, "eo:room%i", i);
+                conversations[i] =
+                        vsx_conversation_set_get_pending_conversation(set,
+                                                                      room_name,
+                                                                      addr);
+        }
+
+        /* Start every third game so that it gets removed from the
+         * room name index */
+        for (int i = 0; i < n_rooms; i += 3)
+                vsx_conversation_start(conversations[i]);
+
+        for (int i = 0; i < n_rooms; i++) {
+                snprintf(room_name, sizeof room_name, "eo:room%i", i);
+
+                VsxConversation *other_conv =
+                        vsx_conversation_set_get_pending_conversation(set,
+                                                                      room_name,
+                                                                      addr);
+                bool started = i % 3 == 0;
+
+                if ((other_conv == conversations[i]) == started) {
+                        fprintf(stderr,
+                                "Joining room %i %s the same conversation%s\n",
+                                i,
+                                started ? "returned" : "didn’t return",
+                                started ? " after it started" : "");
+                        ret = false;
+                }
+
+                vsx_object_unref(other_conv);
+
+                if (!ret)
+                        break;
+        }
+
+        for (int i = 0; i < n_rooms; i++)
+                vsx_object_unref(conversations[i]);
+
+        vsx_free(conversations);
+
+        return ret;
+}
+
 struct check_tile_data_closure {
         const char *expected_language_code;
         bool received_changed_event;
@@ -638,6 +694,11 @@ run_tests(VsxConversationSet *set)
                 goto out;
         }
 
+        if (!test_many_rooms(set, &addr)) {
+                ret = false;
+                goto out;
+        }
+
 out:
         vsx_object_unref(conversation);
         return ret;
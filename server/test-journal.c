@@ -0,0 +1,276 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "vsx-journal.h"
+#include "vsx-main-context.h"
+#include "vsx-util.h"
+
+#define N_RECORDS 1000
+
+static bool
+check_record (const VsxJournalRecord *record,
+              const VsxJournalRecord *expected)
+{
+  if (record->type != expected->type
+      || record->timestamp != expected->timestamp
+      || record->connection_id != expected->connection_id
+      || record->conversation_id != expected->conversation_id
+      || record->payload_length != expected->payload_length
+      || (expected->payload_length > 0
+          && memcmp (record->payload,
+                     expected->payload,
+                     expected->payload_length)))
+    {
+      fprintf (stderr,
+               "Decoded record doesn’t match (type %i, "
+               "connection %" PRIu64 ")\n",
+               record->type,
+               record->connection_id);
+      return false;
+    }
+
+  return true;
+}
+
+static bool
+test_encoding (void)
+{
+  static const uint8_t payload[300] = { VSX_JOURNAL_RECORD_COMMAND, 1, 2 };
+  static const VsxJournalRecord records[] = {
+    { VSX_JOURNAL_RECORD_CONNECT, 0, 1, 0, NULL, 0 },
+    { VSX_JOURNAL_RECORD_COMMAND, 127, 128, UINT64_MAX, payload, 3 },
+    { VSX_JOURNAL_RECORD_COMMAND, UINT64_MAX, 300, 42, payload, 300 },
+    { VSX_JOURNAL_RECORD_DISCONNECT, 1 << 20, UINT64_MAX, 1, NULL, 0 },
+  };
+  struct vsx_buffer buffer = VSX_BUFFER_STATIC_INIT;
+  bool ret = true;
+
+  for (int i = 0; i < VSX_N_ELEMENTS (records); i++)
+    vsx_journal_encode_record (&buffer, records + i);
+
+  const uint8_t *p = buffer.data;
+  size_t length = buffer.length;
+
+  for (int i = 0; i < VSX_N_ELEMENTS (records); i++)
+    {
+      VsxJournalRecord record;
+
+      /* A truncated record shouldn’t be decoded */
+      size_t record_length = vsx_journal_decode_record (p, length, &record);
+
+      if (record_length == 0
+          || vsx_journal_decode_record (p,
+                                        record_length - 1,
+                                        &record) != 0)
+        {
+          fprintf (stderr, "Failed to decode record %i\n", i);
+          ret = false;
+          break;
+        }
+
+      vsx_journal_decode_record (p, length, &record);
+
+      if (!check_record (&record, records + i))
+        {
+          ret = false;
+          break;
+        }
+
+      p += record_length;
+      length -= record_length;
+    }
+
+  if (ret && length != 0)
+    {
+      fprintf (stderr, "Extra data after decoding the records\n");
+      ret = false;
+    }
+
+  vsx_buffer_destroy (&buffer);
+
+  return ret;
+}
+
+static bool
+check_journal_file (FILE *file)
+{
+  struct vsx_buffer buffer = VSX_BUFFER_STATIC_INIT;
+  bool ret = true;
+  size_t got;
+
+  do
+    {
+      vsx_buffer_ensure_size (&buffer, buffer.length + 4096);
+      got = fread (buffer.data + buffer.length,
+                   1,
+                   buffer.size - buffer.length,
+                   file);
+      buffer.length += got;
+    }
+  while (got > 0);
+
+  const uint8_t *p = buffer.data, *end = p + buffer.length;
+  VsxJournalRecord record;
+  size_t record_length;
+  int n_records = 0;
+  uint64_t last_timestamp = 0;
+
+  record_length = vsx_journal_decode_record (p, end - p, &record);
+
+  if (record_length == 0
+      || record.type != VSX_JOURNAL_RECORD_START
+      || record.payload_length < VSX_JOURNAL_MAGIC_LENGTH
+      || memcmp (record.payload,
+                 VSX_JOURNAL_MAGIC,
+                 VSX_JOURNAL_MAGIC_LENGTH))
+    {
+      fprintf (stderr, "Journal doesn’t start with a START record\n");
+      ret = false;
+      goto done;
+    }
+
+  p += record_length;
+
+  while ((record_length = vsx_journal_decode_record (p, end - p, &record)))
+    {
+      if (record.type != VSX_JOURNAL_RECORD_COMMAND
+          || record.connection_id != n_records
+          || record.conversation_id != n_records * UINT64_C (1000003)
+          || record.payload_length != n_records % 64
+          || record.timestamp < last_timestamp)
+        {
+          fprintf (stderr, "Unexpected record %i in journal\n", n_records);
+          ret = false;
+          goto done;
+        }
+
+      for (int i = 0; i < record.payload_length; i++)
+        {
+          if (record.payload[i] != (uint8_t) (n_records + i))
+            {
+              fprintf (stderr, "Payload of record %i is wrong\n", n_records);
+              ret = false;
+              goto done;
+            }
+        }
+
+      last_timestamp = record.timestamp;
+      n_records++;
+      p += record_length;
+    }
+
+  if (p != end)
+    {
+      fprintf (stderr, "Journal has a truncated record at the end\n");
+      ret = false;
+    }
+  else if (n_records != N_RECORDS)
+    {
+      fprintf (stderr,
+               "Journal has %i records but %i were added\n",
+               n_records,
+               N_RECORDS);
+      ret = false;
+    }
+
+ done:
+  vsx_buffer_destroy (&buffer);
+
+  return ret;
+}
+
+static bool
+test_file (void)
+{
+  char filename[] = "/tmp/test-journal-XXXXXX";
+  int fd = mkstemp (filename);
+
+  if (fd == -1)
+    {
+      perror ("mkstemp");
+      return false;
+    }
+
+  vsx_close (fd);
+
+  struct vsx_error *error = NULL;
+
+  if (!vsx_journal_set_file (filename, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      vsx_error_free (error);
+      unlink (filename);
+      return false;
+    }
+
+  vsx_journal_start ();
+
+  for (int i = 0; i < N_RECORDS; i++)
+    {
+      uint8_t payload[64];
+
+      for (int j = 0; j < sizeof payload; j++)
+        payload[j] = i + j;
+
+      vsx_journal_add (VSX_JOURNAL_RECORD_COMMAND,
+                       i, /* connection_id */
+                       i * UINT64_C (1000003), /* conversation_id */
+                       payload,
+                       i % 64);
+    }
+
+  vsx_journal_close ();
+
+  FILE *file = fopen (filename, "rb");
+  bool ret = true;
+
+  if (file == NULL || !check_journal_file (file))
+    ret = false;
+
+  if (file)
+    fclose (file);
+
+  unlink (filename);
+
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  int ret = EXIT_SUCCESS;
+
+  if (!test_encoding ())
+    ret = EXIT_FAILURE;
+
+  if (!test_file ())
+    ret = EXIT_FAILURE;
+
+  vsx_main_context_free (vsx_main_context_get_default (NULL /* error */));
+
+  return ret;
+}
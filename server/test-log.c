@@ -0,0 +1,200 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "vsx-log.h"
+#include "vsx-util.h"
+
+#define N_THREADS 4
+#define N_MESSAGES 2000
+
+static void *
+thread_func (void *user_data)
+{
+  int thread_num = (intptr_t) user_data;
+
+  for (int i = 0; i < N_MESSAGES; i++)
+    vsx_log ("thread %i message %i", thread_num, i);
+
+  return NULL;
+}
+
+static bool
+check_log (FILE *file)
+{
+  int next_message[N_THREADS] = { 0 };
+  int n_messages = 0;
+  int n_long_lines = 0;
+  uint64_t n_dropped = 0;
+  char line[2048];
+  bool ret = true;
+
+  while (fgets (line, sizeof line, file))
+    {
+      char *end = strchr (line, '\n');
+
+      if (end == NULL)
+        {
+          fprintf (stderr, "Log line isn’t terminated\n");
+          return false;
+        }
+
+      const char *message = strstr (line, "] ");
+
+      if (line[0] != '[' || message == NULL)
+        {
+          fprintf (stderr, "Log line has no timestamp: %s", line);
+          return false;
+        }
+
+      message += 2;
+
+      int thread_num, message_num;
+      uint64_t n;
+
+      if (sscanf (message, "thread %i message %i",
+                  &thread_num, &message_num) == 2)
+        {
+          if (thread_num < 0 || thread_num >= N_THREADS
+              || message_num < next_message[thread_num])
+            {
+              fprintf (stderr, "Unexpected log line: %s", line);
+              ret = false;
+              continue;
+            }
+
+          next_message[thread_num] = message_num + 1;
+          n_messages++;
+        }
+      else if (sscanf (message, "Dropped %" SCNu64, &n) == 1)
+        {
+          n_dropped += n;
+        }
+      else if (message[0] == 'x')
+        {
+          n_long_lines++;
+        }
+      else
+        {
+          fprintf (stderr, "Unexpected log line: %s", line);
+          ret = false;
+        }
+    }
+
+  if (n_long_lines != 1)
+    {
+      fprintf (stderr, "The truncated line wasn’t logged\n");
+      ret = false;
+    }
+
+  if (n_dropped != vsx_log_get_n_dropped ())
+    {
+      fprintf (stderr,
+               "%" PRIu64 " messages were reported as dropped but the "
+               "counter is %" PRIu64 "\n",
+               n_dropped,
+               vsx_log_get_n_dropped ());
+      ret = false;
+    }
+
+  /* Every message should either be in the log or counted as dropped */
+  if (n_messages + n_dropped != N_THREADS * N_MESSAGES)
+    {
+      fprintf (stderr,
+               "%i messages were logged and %" PRIu64 " were dropped but "
+               "%i were sent\n",
+               n_messages,
+               n_dropped,
+               N_THREADS * N_MESSAGES);
+      ret = false;
+    }
+
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  char filename[] = "/tmp/test-log-XXXXXX";
+  int fd = mkstemp (filename);
+
+  if (fd == -1)
+    {
+      perror ("mkstemp");
+      return EXIT_FAILURE;
+    }
+
+  vsx_close (fd);
+
+  struct vsx_error *error = NULL;
+
+  if (!vsx_log_set_file (filename, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      vsx_error_free (error);
+      unlink (filename);
+      return EXIT_FAILURE;
+    }
+
+  /* Log something before the thread starts */
+  char *long_line = vsx_alloc (4096);
+
+  memset (long_line, 'x', 4095);
+  long_line[4095] = '\0';
+  vsx_log ("%s", long_line);
+  vsx_free (long_line);
+
+  vsx_log_start ();
+
+  pthread_t threads[N_THREADS];
+
+  for (int i = 0; i < N_THREADS; i++)
+    {
+      pthread_create (threads + i,
+                      NULL, /* attr */
+                      thread_func,
+                      (void *) (intptr_t) i);
+    }
+
+  for (int i = 0; i < N_THREADS; i++)
+    pthread_join (threads[i], NULL);
+
+  vsx_log_close ();
+
+  FILE *file = fopen (filename, "r");
+  int ret = EXIT_SUCCESS;
+
+  if (file == NULL || !check_log (file))
+    ret = EXIT_FAILURE;
+
+  if (file)
+    fclose (file);
+
+  unlink (filename);
+
+  return ret;
+}
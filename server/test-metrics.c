@@ -0,0 +1,166 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "vsx-metrics.h"
+#include "vsx-util.h"
+
+#define N_THREADS 4
+#define N_ITERATIONS 1000
+
+static void *
+thread_func (void *user_data)
+{
+  for (int i = 0; i < N_ITERATIONS; i++)
+    {
+      vsx_metrics_add (VSX_METRICS_PLAIN_CONNECTIONS, 1);
+      vsx_metrics_add (VSX_METRICS_BYTES_SENT, 3);
+      vsx_metrics_count_command (VSX_PROTO_SEND_MESSAGE);
+      vsx_metrics_record (VSX_METRICS_BROADCAST_LATENCY, i);
+    }
+
+  return NULL;
+}
+
+static bool
+check_line (const char *text,
+            const char *line)
+{
+  size_t line_length = strlen (line);
+
+  for (const char *p = text; *p; p = strchr (p, '\n') + 1)
+    {
+      if (!strncmp (p, line, line_length) && p[line_length] == '\n')
+        return true;
+
+      if (strchr (p, '\n') == NULL)
+        break;
+    }
+
+  fprintf (stderr,
+           "Expected line not found: %s\n"
+           "%s\n",
+           line,
+           text);
+
+  return false;
+}
+
+static bool
+test_totals (void)
+{
+  pthread_t threads[N_THREADS];
+
+  for (int i = 0; i < N_THREADS; i++)
+    pthread_create (threads + i, NULL, thread_func, NULL);
+
+  for (int i = 0; i < N_THREADS; i++)
+    pthread_join (threads[i], NULL);
+
+  /* Removing the connections on a different thread should still
+   * bring the gauge back down. The threads have exited but their
+   * counts should be kept. */
+  vsx_metrics_add (VSX_METRICS_PLAIN_CONNECTIONS, -(N_ITERATIONS * 3 + 1));
+
+  /* Commands outside of the range shouldn’t be counted anywhere */
+  vsx_metrics_count_command (0);
+  vsx_metrics_count_command (0xff);
+
+  vsx_metrics_record (VSX_METRICS_LOOP_ITERATION, 50);
+  vsx_metrics_record (VSX_METRICS_LOOP_ITERATION, 51);
+  vsx_metrics_record (VSX_METRICS_LOOP_ITERATION, 2000000);
+  vsx_metrics_record (VSX_METRICS_LOOP_ITERATION, -5);
+
+  struct vsx_buffer buffer = VSX_BUFFER_STATIC_INIT;
+
+  vsx_metrics_append_all (&buffer);
+
+  const char *text = (const char *) buffer.data;
+  bool ret = true;
+
+  static const char *const expected_lines[] = {
+    "verda_sxtelo_connections{transport=\"plain\"} 999",
+    "verda_sxtelo_connections{transport=\"ssl\"} 0",
+    "verda_sxtelo_sent_bytes_total 12000",
+    "verda_sxtelo_commands_total{command=\"send_message\"} 4000",
+    "verda_sxtelo_commands_total{command=\"new_player\"} 0",
+    "# TYPE verda_sxtelo_loop_iteration_seconds histogram",
+    /* The bounds are inclusive and negative values count as zero */
+    "verda_sxtelo_loop_iteration_seconds_bucket{le=\"5e-05\"} 2",
+    "verda_sxtelo_loop_iteration_seconds_bucket{le=\"0.0001\"} 3",
+    "verda_sxtelo_loop_iteration_seconds_bucket{le=\"1\"} 3",
+    "verda_sxtelo_loop_iteration_seconds_bucket{le=\"+Inf\"} 4",
+    "verda_sxtelo_loop_iteration_seconds_sum 2.000101",
+    "verda_sxtelo_loop_iteration_seconds_count 4",
+    "verda_sxtelo_broadcast_latency_seconds_bucket{le=\"0.0001\"} 404",
+    "verda_sxtelo_broadcast_latency_seconds_bucket{le=\"0.001\"} 4000",
+    "verda_sxtelo_broadcast_latency_seconds_count 4000",
+    "verda_sxtelo_broadcast_latency_seconds_sum 1.998000",
+  };
+
+  for (int i = 0; i < VSX_N_ELEMENTS (expected_lines); i++)
+    {
+      if (!check_line (text, expected_lines[i]))
+        {
+          ret = false;
+          break;
+        }
+    }
+
+  vsx_buffer_destroy (&buffer);
+
+  return ret;
+}
+
+static bool
+test_disabled (void)
+{
+  /* Nothing should be recorded before the metrics are enabled */
+  vsx_metrics_add (VSX_METRICS_BYTES_RECEIVED, 10);
+  vsx_metrics_set_command_time (42);
+
+  if (vsx_metrics_thread != NULL || vsx_metrics_get_command_time () != 0)
+    {
+      fprintf (stderr, "Metrics were recorded while disabled\n");
+      return false;
+    }
+
+  return true;
+}
+
+int
+main (int argc, char **argv)
+{
+  int ret = EXIT_SUCCESS;
+
+  if (!test_disabled ())
+    ret = EXIT_FAILURE;
+
+  vsx_metrics_enable ();
+
+  if (!test_totals ())
+    ret = EXIT_FAILURE;
+
+  return ret;
+}
@@ -0,0 +1,197 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "vsx-output-chain.h"
+#include "vsx-util.h"
+
+/* Size of each chunk that is added. This is chosen so that the
+ * chunks don’t evenly divide the segments. */
+#define CHUNK_SIZE 1000
+#define N_CHUNKS 100
+#define TOTAL_SIZE (CHUNK_SIZE * N_CHUNKS)
+
+static bool
+check_contents (const VsxOutputChain *chain,
+                size_t offset)
+{
+  struct iovec iovecs[N_CHUNKS];
+  int n_iovecs = vsx_output_chain_get_iovecs (chain,
+                                              iovecs,
+                                              VSX_N_ELEMENTS (iovecs));
+  size_t total = 0;
+
+  for (int i = 0; i < n_iovecs; i++)
+    {
+      const uint8_t *data = iovecs[i].iov_base;
+
+      for (size_t j = 0; j < iovecs[i].iov_len; j++)
+        {
+          if (data[j] != (uint8_t) (offset + total + j))
+            {
+              fprintf (stderr,
+                       "Wrong byte at offset %zu\n",
+                       offset + total + j);
+              return false;
+            }
+        }
+
+      total += iovecs[i].iov_len;
+    }
+
+  if (total != vsx_output_chain_get_length (chain)
+      || total != TOTAL_SIZE - offset)
+    {
+      fprintf (stderr,
+               "Chain has %zu bytes but %i were expected\n",
+               total,
+               (int) (TOTAL_SIZE - offset));
+      return false;
+    }
+
+  return true;
+}
+
+static bool
+test_fill_and_drain (void)
+{
+  VsxOutputChain chain;
+  bool ret = true;
+
+  vsx_output_chain_init (&chain);
+
+  for (int i = 0; i < N_CHUNKS; i++)
+    {
+      size_t space;
+      uint8_t *buf = vsx_output_chain_reserve (&chain, CHUNK_SIZE, &space);
+
+      if (space < CHUNK_SIZE)
+        {
+          fprintf (stderr, "Not enough space was reserved\n");
+          ret = false;
+          goto out;
+        }
+
+      for (int j = 0; j < CHUNK_SIZE; j++)
+        buf[j] = i * CHUNK_SIZE + j;
+
+      vsx_output_chain_commit (&chain, CHUNK_SIZE);
+    }
+
+  size_t offset = 0;
+
+  if (!check_contents (&chain, offset))
+    {
+      ret = false;
+      goto out;
+    }
+
+  /* Consume in sizes that sometimes end exactly on a segment
+   * boundary and sometimes don’t */
+  static const size_t consume_sizes[] =
+    {
+      1,
+      VSX_OUTPUT_CHAIN_SEGMENT_SIZE - 1,
+      VSX_OUTPUT_CHAIN_SEGMENT_SIZE * 2 + 7,
+      12345,
+    };
+
+  for (int i = 0; offset < TOTAL_SIZE; i++)
+    {
+      size_t to_consume = consume_sizes[i % VSX_N_ELEMENTS (consume_sizes)];
+
+      if (to_consume > TOTAL_SIZE - offset)
+        to_consume = TOTAL_SIZE - offset;
+
+      vsx_output_chain_consume (&chain, to_consume);
+      offset += to_consume;
+
+      if (!check_contents (&chain, offset))
+        {
+          ret = false;
+          goto out;
+        }
+    }
+
+  /* An empty chain shouldn’t keep any segments */
+  if (chain.head != NULL || chain.tail != NULL)
+    {
+      fprintf (stderr, "Empty chain still has segments\n");
+      ret = false;
+    }
+
+ out:
+  vsx_output_chain_destroy (&chain);
+
+  return ret;
+}
+
+static bool
+test_head (void)
+{
+  VsxOutputChain chain;
+  size_t length;
+
+  vsx_output_chain_init (&chain);
+
+  if (vsx_output_chain_get_head (&chain, &length) != NULL || length != 0)
+    {
+      fprintf (stderr, "Empty chain has a head\n");
+      return false;
+    }
+
+  size_t space;
+  uint8_t *buf = vsx_output_chain_reserve (&chain, 5, &space);
+  memcpy (buf, "hello", 5);
+  vsx_output_chain_commit (&chain, 5);
+
+  vsx_output_chain_consume (&chain, 2);
+
+  const uint8_t *head = vsx_output_chain_get_head (&chain, &length);
+
+  bool ret = length == 3 && !memcmp (head, "llo", 3);
+
+  if (!ret)
+    fprintf (stderr, "Head of chain is wrong\n");
+
+  vsx_output_chain_destroy (&chain);
+
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  int ret = EXIT_SUCCESS;
+
+  if (!test_fill_and_drain ())
+    ret = EXIT_FAILURE;
+
+  if (!test_head ())
+    ret = EXIT_FAILURE;
+
+  vsx_output_chain_clear_pool ();
+
+  return ret;
+}
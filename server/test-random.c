@@ -0,0 +1,142 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "vsx-random.h"
+#include "vsx-util.h"
+
+static bool
+test_block (void)
+{
+  /* Test vector from section 2.3.2 of RFC 8439 */
+  static const uint8_t nonce[VSX_CHACHA20_NONCE_SIZE] = {
+    0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00,
+  };
+  static const uint8_t expected[VSX_CHACHA20_BLOCK_SIZE] = {
+    0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15,
+    0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+    0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03,
+    0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+    0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09,
+    0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+    0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9,
+    0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e,
+  };
+  uint8_t key[VSX_CHACHA20_KEY_SIZE];
+  uint8_t out[VSX_CHACHA20_BLOCK_SIZE];
+
+  for (int i = 0; i < sizeof key; i++)
+    key[i] = i;
+
+  vsx_chacha20_block (key, 1, nonce, out);
+
+  if (memcmp (out, expected, sizeof out))
+    {
+      fprintf (stderr, "ChaCha20 block doesn’t match the test vector\n");
+      return false;
+    }
+
+  return true;
+}
+
+static bool
+check_values_differ (const uint64_t *values,
+                     int n_values)
+{
+  for (int i = 0; i < n_values; i++)
+    {
+      for (int j = 0; j < i; j++)
+        {
+          if (values[i] == values[j])
+            {
+              fprintf (stderr,
+                       "Random values %i and %i are the same\n",
+                       j, i);
+              return false;
+            }
+        }
+    }
+
+  return true;
+}
+
+static bool
+test_fill (void)
+{
+  /* Enough values to cross several refills of the buffer */
+  uint64_t values[256];
+
+  for (int i = 0; i < VSX_N_ELEMENTS (values) / 2; i++)
+    values[i] = vsx_random_uint64 ();
+
+  /* Fill the rest with a size that doesn’t line up with the buffer */
+  vsx_random_fill (values + VSX_N_ELEMENTS (values) / 2,
+                   sizeof values / 2);
+
+  return check_values_differ (values, VSX_N_ELEMENTS (values));
+}
+
+static void *
+thread_func (void *user_data)
+{
+  uint64_t *value = user_data;
+
+  *value = vsx_random_uint64 ();
+
+  return NULL;
+}
+
+static bool
+test_threads (void)
+{
+  /* Each thread should get its own independently seeded stream */
+  uint64_t values[4];
+  pthread_t threads[VSX_N_ELEMENTS (values)];
+
+  for (int i = 0; i < VSX_N_ELEMENTS (values); i++)
+    pthread_create (threads + i, NULL, thread_func, values + i);
+
+  for (int i = 0; i < VSX_N_ELEMENTS (values); i++)
+    pthread_join (threads[i], NULL);
+
+  return check_values_differ (values, VSX_N_ELEMENTS (values));
+}
+
+int
+main (int argc, char **argv)
+{
+  int ret = EXIT_SUCCESS;
+
+  if (!test_block ())
+    ret = EXIT_FAILURE;
+
+  if (!test_fill ())
+    ret = EXIT_FAILURE;
+
+  if (!test_threads ())
+    ret = EXIT_FAILURE;
+
+  return ret;
+}
@@ -0,0 +1,690 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "vsx-snapshot.h"
+#include "vsx-conversation.h"
+#include "vsx-person.h"
+#include "vsx-buffer.h"
+#include "vsx-main-context.h"
+#include "vsx-util.h"
+
+#define N_GAMES 20
+
+typedef struct
+{
+  char dir[32];
+  char *prefix;
+  VsxConversationSet *conversation_set;
+  VsxPersonSet *person_set;
+  VsxPersonId person_ids[N_GAMES];
+} Harness;
+
+static void
+make_sets (Harness *harness)
+{
+  harness->conversation_set = vsx_conversation_set_new ();
+  harness->person_set = vsx_person_set_new ();
+}
+
+static void
+free_sets (Harness *harness)
+{
+  vsx_object_unref (harness->person_set);
+  vsx_object_unref (harness->conversation_set);
+}
+
+static bool
+init_harness (Harness *harness)
+{
+  strcpy (harness->dir, "/tmp/test-snapshot-XXXXXX");
+
+  if (mkdtemp (harness->dir) == NULL)
+    {
+      perror ("mkdtemp");
+      return false;
+    }
+
+  struct vsx_buffer buf = VSX_BUFFER_STATIC_INIT;
+
+  vsx_buffer_append_printf (&buf, "%s/snapshot", harness->dir);
+  harness->prefix = (char *) buf.data;
+
+  make_sets (harness);
+
+  return true;
+}
+
+static void
+remove_file (Harness *harness,
+             char slot)
+{
+  struct vsx_buffer buf = VSX_BUFFER_STATIC_INIT;
+
+  vsx_buffer_append_printf (&buf, "%s.0.%c", harness->prefix, slot);
+  unlink ((const char *) buf.data);
+  vsx_buffer_destroy (&buf);
+}
+
+static void
+destroy_harness (Harness *harness)
+{
+  free_sets (harness);
+
+  remove_file (harness, 'a');
+  remove_file (harness, 'b');
+  rmdir (harness->dir);
+
+  vsx_free (harness->prefix);
+}
+
+/* Adds some games with a mixture of states. Every even game is
+ * started and has some tiles and messages. */
+static void
+populate (Harness *harness)
+{
+  struct vsx_netaddress addr = { .family = AF_INET };
+
+  for (int i = 0; i < N_GAMES; i++)
+    {
+      char room_name[32];
+
+      snprintf (room_name, sizeof room_name, "eo:room%i", i);
+
+      VsxConversation *conversation =
+        vsx_conversation_set_get_pending_conversation
+        (harness->conversation_set, room_name, &addr);
+
+      VsxPerson *person =
+        vsx_person_set_generate_person (harness->person_set,
+                                        "Zamenhof",
+                                        &addr,
+                                        conversation);
+
+      harness->person_ids[i] = person->hash_entry.id;
+
+      if (i % 2 == 0)
+        {
+          vsx_object_unref (vsx_person_set_generate_person
+                            (harness->person_set,
+                             "Ludoviko",
+                             &addr,
+                             conversation));
+
+          vsx_conversation_start (conversation);
+
+          for (int j = 0; j < i / 2 + 1; j++)
+            {
+              vsx_conversation_turn (conversation, j % 2);
+              vsx_conversation_move_tile (conversation, 0, j, j * 3, -j);
+            }
+
+          vsx_conversation_add_message (conversation, 1, "saluton", 7);
+          vsx_conversation_add_message (conversation, 0, "ĝis", 4);
+        }
+
+      vsx_object_unref (person);
+      vsx_object_unref (conversation);
+    }
+}
+
+static bool
+compare_conversations (VsxConversation *a,
+                       VsxConversation *b)
+{
+  if (a->state != b->state
+      || a->tile_data != b->tile_data
+      || a->total_n_tiles != b->total_n_tiles
+      || a->n_tiles_in_play != b->n_tiles_in_play
+      || a->n_players != b->n_players
+      || a->n_connected_players != b->n_connected_players
+      || (vsx_conversation_get_n_messages (a)
+          != vsx_conversation_get_n_messages (b)))
+    {
+      fprintf (stderr, "Restored conversation has different state\n");
+      return false;
+    }
+
+  for (int i = 0; i < a->n_players; i++)
+    {
+      if (strcmp (a->players[i]->name, b->players[i]->name)
+          || a->players[i]->flags != b->players[i]->flags)
+        {
+          fprintf (stderr, "Restored player %i is different\n", i);
+          return false;
+        }
+    }
+
+  for (int i = 0; i < a->n_tiles_in_play; i++)
+    {
+      const VsxTile *ta = a->tiles + i, *tb = b->tiles + i;
+
+      if (ta->x != tb->x
+          || ta->y != tb->y
+          || ta->last_player != tb->last_player
+          || strcmp (ta->letter, tb->letter))
+        {
+          fprintf (stderr, "Restored tile %i is different\n", i);
+          return false;
+        }
+    }
+
+  for (int i = 0; i < vsx_conversation_get_n_messages (a); i++)
+    {
+      const VsxConversationMessage *ma = vsx_conversation_get_message (a, i);
+      const VsxConversationMessage *mb = vsx_conversation_get_message (b, i);
+
+      if (ma->player_num != mb->player_num || strcmp (ma->text, mb->text))
+        {
+          fprintf (stderr, "Restored message %i is different\n", i);
+          return false;
+        }
+    }
+
+  return true;
+}
+
+typedef struct
+{
+  VsxConversationSet *other_set;
+  bool result;
+} CompareData;
+
+static void
+compare_cb (VsxConversation *conversation,
+            const char *room_name,
+            void *user_data)
+{
+  CompareData *data = user_data;
+  VsxConversation *other =
+    vsx_conversation_set_get_conversation (data->other_set,
+                                           conversation->hash_entry.id);
+
+  if (other == NULL)
+    {
+      fprintf (stderr,
+               "Conversation %" PRIx64 " wasn’t restored\n",
+               conversation->hash_entry.id);
+      data->result = false;
+    }
+  else if (!compare_conversations (conversation, other))
+    {
+      data->result = false;
+    }
+}
+
+/* Saves the harness’s sets and restores them into a fresh pair of
+ * sets that replace them. The restored conversations are compared
+ * with the originals. */
+static bool
+save_and_restore (Harness *harness,
+                  VsxSnapshot *snapshot,
+                  int expected_n_conversations)
+{
+  struct vsx_error *error = NULL;
+
+  if (!vsx_snapshot_save (snapshot,
+                          harness->conversation_set,
+                          harness->person_set,
+                          &error))
+    {
+      fprintf (stderr, "Error saving snapshot: %s\n", error->message);
+      vsx_error_free (error);
+      return false;
+    }
+
+  VsxSnapshot *other_snapshot = vsx_snapshot_new (harness->prefix,
+                                                  0, /* shard_num */
+                                                  1, /* n_shards */
+                                                  &error);
+
+  if (other_snapshot == NULL)
+    {
+      fprintf (stderr, "Error opening snapshot: %s\n", error->message);
+      vsx_error_free (error);
+      return false;
+    }
+
+  Harness restored = *harness;
+  VsxSnapshotRestoreStats stats;
+  bool ret = true;
+
+  make_sets (&restored);
+
+  if (!vsx_snapshot_restore (other_snapshot,
+                             restored.conversation_set,
+                             restored.person_set,
+                             &stats,
+                             &error))
+    {
+      fprintf (stderr, "Error restoring snapshot: %s\n", error->message);
+      vsx_error_free (error);
+      ret = false;
+      goto out;
+    }
+
+  if (stats.n_conversations != expected_n_conversations
+      || stats.n_skipped != 0)
+    {
+      fprintf (stderr,
+               "Restored %i conversations with %i skipped records but "
+               "expected %i\n",
+               stats.n_conversations,
+               stats.n_skipped,
+               expected_n_conversations);
+      ret = false;
+      goto out;
+    }
+
+  CompareData data = {
+    .other_set = restored.conversation_set,
+    .result = true,
+  };
+
+  vsx_conversation_set_foreach (harness->conversation_set,
+                                compare_cb,
+                                &data);
+
+  if (!data.result)
+    {
+      ret = false;
+      goto out;
+    }
+
+  for (int i = 0; i < N_GAMES; i++)
+    {
+      VsxPerson *person = vsx_person_set_get_person (restored.person_set,
+                                                     harness->person_ids[i]);
+      VsxPerson *old_person = vsx_person_set_get_person (harness->person_set,
+                                                         harness->person_ids[i]);
+
+      if (person == NULL
+          || person->player->num != old_person->player->num
+          || person->message_offset != old_person->message_offset
+          || (person->conversation->hash_entry.id
+              != old_person->conversation->hash_entry.id))
+        {
+          fprintf (stderr, "Person %i wasn’t restored correctly\n", i);
+          ret = false;
+          goto out;
+        }
+    }
+
+ out:
+  vsx_snapshot_free (other_snapshot);
+
+  if (ret)
+    {
+      free_sets (harness);
+      harness->conversation_set = restored.conversation_set;
+      harness->person_set = restored.person_set;
+    }
+  else
+    {
+      free_sets (&restored);
+    }
+
+  return ret;
+}
+
+static bool
+test_round_trip (void)
+{
+  Harness harness;
+
+  if (!init_harness (&harness))
+    return false;
+
+  populate (&harness);
+
+  bool ret = true;
+  VsxSnapshot *snapshot = vsx_snapshot_new (harness.prefix, 0, 1, NULL);
+
+  if (!save_and_restore (&harness, snapshot, N_GAMES))
+    {
+      ret = false;
+      goto out;
+    }
+
+  /* Saving again without any changes should copy every record */
+  if (!save_and_restore (&harness, snapshot, N_GAMES))
+    {
+      ret = false;
+      goto out;
+    }
+
+  /* Change one game so that only it gets encoded again */
+  VsxPerson *person = vsx_person_set_get_person (harness.person_set,
+                                                 harness.person_ids[2]);
+
+  vsx_conversation_add_message (person->conversation, 0, "nova", 4);
+  vsx_conversation_move_tile (person->conversation, 0, 0, 100, 200);
+
+  if (!save_and_restore (&harness, snapshot, N_GAMES))
+    {
+      ret = false;
+      goto out;
+    }
+
+ out:
+  vsx_snapshot_free (snapshot);
+  destroy_harness (&harness);
+
+  return ret;
+}
+
+static bool
+test_stepped_save (void)
+{
+  Harness harness;
+
+  if (!init_harness (&harness))
+    return false;
+
+  populate (&harness);
+
+  bool ret = true;
+  struct vsx_error *error = NULL;
+  VsxSnapshot *snapshot = vsx_snapshot_new (harness.prefix, 0, 1, NULL);
+
+  vsx_snapshot_begin_save (snapshot,
+                           harness.conversation_set,
+                           harness.person_set);
+
+  /* Change one game and abandon another after the save has started.
+   * The changed game should be saved in its new state and the
+   * abandoned one should be left out. */
+  VsxPerson *changed = vsx_person_set_get_person (harness.person_set,
+                                                  harness.person_ids[2]);
+  VsxConversationId changed_id = changed->conversation->hash_entry.id;
+
+  vsx_conversation_add_message (changed->conversation, 0, "nova", 4);
+
+  VsxPerson *leaver = vsx_person_set_get_person (harness.person_set,
+                                                 harness.person_ids[1]);
+  VsxConversationId abandoned_id = leaver->conversation->hash_entry.id;
+
+  vsx_person_leave_conversation (leaver);
+
+  int n_steps = 0;
+
+  while (vsx_snapshot_is_saving (snapshot))
+    {
+      if (!vsx_snapshot_continue_save (snapshot, 0, &error))
+        {
+          fprintf (stderr, "Error saving snapshot: %s\n", error->message);
+          vsx_error_free (error);
+          ret = false;
+          goto out;
+        }
+
+      n_steps++;
+    }
+
+  if (n_steps < 2)
+    {
+      fprintf (stderr, "Save wasn’t split into steps\n");
+      ret = false;
+      goto out;
+    }
+
+  VsxSnapshot *other_snapshot = vsx_snapshot_new (harness.prefix, 0, 1, NULL);
+  VsxConversationSet *conversation_set = vsx_conversation_set_new ();
+  VsxPersonSet *person_set = vsx_person_set_new ();
+  VsxSnapshotRestoreStats stats;
+
+  vsx_snapshot_restore (other_snapshot,
+                        conversation_set,
+                        person_set,
+                        &stats,
+                        NULL);
+
+  VsxConversation *restored =
+    vsx_conversation_set_get_conversation (conversation_set, changed_id);
+
+  if (stats.n_conversations != N_GAMES - 1
+      || stats.n_skipped != 0
+      || vsx_conversation_set_get_conversation (conversation_set,
+                                                abandoned_id)
+      || restored == NULL
+      || vsx_conversation_get_n_messages (restored) != 3)
+    {
+      fprintf (stderr, "Stepped save didn’t restore the expected games\n");
+      ret = false;
+    }
+
+  vsx_object_unref (person_set);
+  vsx_object_unref (conversation_set);
+  vsx_snapshot_free (other_snapshot);
+
+ out:
+  vsx_snapshot_free (snapshot);
+  destroy_harness (&harness);
+
+  return ret;
+}
+
+static bool
+corrupt_byte (Harness *harness,
+              char slot,
+              long offset)
+{
+  struct vsx_buffer buf = VSX_BUFFER_STATIC_INIT;
+
+  vsx_buffer_append_printf (&buf, "%s.0.%c", harness->prefix, slot);
+
+  FILE *f = fopen ((const char *) buf.data, "r+b");
+
+  vsx_buffer_destroy (&buf);
+
+  if (f == NULL)
+    {
+      perror ("fopen");
+      return false;
+    }
+
+  fseek (f, offset, SEEK_SET);
+  int c = fgetc (f);
+  fseek (f, offset, SEEK_SET);
+  fputc (c ^ 0x55, f);
+  fclose (f);
+
+  return true;
+}
+
+static bool
+test_corrupt_slot (void)
+{
+  Harness harness;
+
+  if (!init_harness (&harness))
+    return false;
+
+  populate (&harness);
+
+  bool ret = true;
+  VsxSnapshot *snapshot = vsx_snapshot_new (harness.prefix, 0, 1, NULL);
+
+  /* Generation 1 goes in slot b and generation 2 in slot a */
+  vsx_snapshot_save (snapshot,
+                     harness.conversation_set,
+                     harness.person_set,
+                     NULL);
+
+  /* Add a game that is only in the second snapshot */
+  struct vsx_netaddress addr = { .family = AF_INET };
+  VsxConversation *conversation =
+    vsx_conversation_set_get_pending_conversation (harness.conversation_set,
+                                                   "eo:extra",
+                                                   &addr);
+  vsx_object_unref (vsx_person_set_generate_person (harness.person_set,
+                                                    "Extra",
+                                                    &addr,
+                                                    conversation));
+  vsx_object_unref (conversation);
+
+  vsx_snapshot_save (snapshot,
+                     harness.conversation_set,
+                     harness.person_set,
+                     NULL);
+
+  vsx_snapshot_free (snapshot);
+
+  /* Damage the newest snapshot so that the older one gets used */
+  if (!corrupt_byte (&harness, 'a', 100))
+    {
+      ret = false;
+      goto out;
+    }
+
+  VsxConversationSet *conversation_set = vsx_conversation_set_new ();
+  VsxPersonSet *person_set = vsx_person_set_new ();
+  VsxSnapshotRestoreStats stats;
+
+  snapshot = vsx_snapshot_new (harness.prefix, 0, 1, NULL);
+
+  vsx_snapshot_restore (snapshot,
+                        conversation_set,
+                        person_set,
+                        &stats,
+                        NULL);
+
+  if (stats.n_conversations != N_GAMES || stats.n_people != N_GAMES * 3 / 2)
+    {
+      fprintf (stderr,
+               "Restored %i conversations and %i people from the older "
+               "snapshot\n",
+               stats.n_conversations,
+               stats.n_people);
+      ret = false;
+    }
+
+  vsx_snapshot_free (snapshot);
+  vsx_object_unref (person_set);
+  vsx_object_unref (conversation_set);
+
+  /* Damaging both should make it restore nothing */
+  if (ret && corrupt_byte (&harness, 'b', 100))
+    {
+      conversation_set = vsx_conversation_set_new ();
+      person_set = vsx_person_set_new ();
+      snapshot = vsx_snapshot_new (harness.prefix, 0, 1, NULL);
+
+      vsx_snapshot_restore (snapshot,
+                            conversation_set,
+                            person_set,
+                            &stats,
+                            NULL);
+
+      if (stats.n_conversations != 0 || stats.n_people != 0)
+        {
+          fprintf (stderr, "Something was restored from corrupt files\n");
+          ret = false;
+        }
+
+      vsx_snapshot_free (snapshot);
+      vsx_object_unref (person_set);
+      vsx_object_unref (conversation_set);
+    }
+
+ out:
+  destroy_harness (&harness);
+
+  return ret;
+}
+
+static bool
+test_wrong_shards (void)
+{
+  Harness harness;
+
+  if (!init_harness (&harness))
+    return false;
+
+  populate (&harness);
+
+  VsxSnapshot *snapshot = vsx_snapshot_new (harness.prefix, 0, 1, NULL);
+
+  vsx_snapshot_save (snapshot,
+                     harness.conversation_set,
+                     harness.person_set,
+                     NULL);
+  vsx_snapshot_free (snapshot);
+
+  /* The IDs wouldn’t map to the right shards so a snapshot made with
+   * a different number shouldn’t be used */
+  VsxConversationSet *conversation_set =
+    vsx_conversation_set_new_for_shard (0, 2);
+  VsxPersonSet *person_set = vsx_person_set_new_for_shard (0, 2);
+  VsxSnapshotRestoreStats stats;
+  bool ret = true;
+
+  snapshot = vsx_snapshot_new (harness.prefix, 0, 2, NULL);
+
+  vsx_snapshot_restore (snapshot,
+                        conversation_set,
+                        person_set,
+                        &stats,
+                        NULL);
+
+  if (stats.n_conversations != 0 || stats.n_people != 0)
+    {
+      fprintf (stderr,
+               "A snapshot with a different number of shards was used\n");
+      ret = false;
+    }
+
+  vsx_snapshot_free (snapshot);
+  vsx_object_unref (person_set);
+  vsx_object_unref (conversation_set);
+
+  destroy_harness (&harness);
+
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  int ret = EXIT_SUCCESS;
+
+  if (!test_round_trip ())
+    ret = EXIT_FAILURE;
+
+  if (!test_stepped_save ())
+    ret = EXIT_FAILURE;
+
+  if (!test_corrupt_slot ())
+    ret = EXIT_FAILURE;
+
+  if (!test_wrong_shards ())
+    ret = EXIT_FAILURE;
+
+  vsx_main_context_free (vsx_main_context_get_default (NULL /* error */));
+
+  return ret;
+}
@@ -0,0 +1,273 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vsx-stall-detector.h"
+#include "vsx-util.h"
+
+#define THRESHOLD 1000
+#define REPORT_INTERVAL (60 * 1000000)
+
+static void
+static_callback (void)
+{
+}
+
+/* Checks that the report has the expected lines. A line in the
+ * expected list can have a “*” in it to match the part of a callback
+ * name that depends on how the executable was built. */
+static bool
+check_report (const struct vsx_buffer *buffer,
+              const char *const *expected_lines,
+              int n_expected_lines)
+{
+  const char *text = (const char *) buffer->data;
+  const char *line = text;
+
+  for (int i = 0; i < n_expected_lines; i++)
+    {
+      if (line == NULL)
+        goto error;
+
+      const char *end = strchr (line, '\n');
+      size_t line_length = end ? end - line : strlen (line);
+      const char *expected = expected_lines[i];
+      const char *star = strchr (expected, '*');
+
+      if (star == NULL)
+        {
+          if (strlen (expected) != line_length
+              || memcmp (line, expected, line_length))
+            goto error;
+        }
+      else
+        {
+          size_t prefix_length = star - expected;
+          size_t suffix_length = strlen (star + 1);
+
+          if (line_length < prefix_length + suffix_length
+              || memcmp (line, expected, prefix_length)
+              || memcmp (line + line_length - suffix_length,
+                         star + 1,
+                         suffix_length))
+            goto error;
+        }
+
+      line = end ? end + 1 : NULL;
+    }
+
+  if (line == NULL)
+    return true;
+
+ error:
+  fprintf (stderr,
+           "Report doesn’t match. Got:\n%s\nExpected:\n",
+           text ? text : "(empty)");
+
+  for (int i = 0; i < n_expected_lines; i++)
+    fprintf (stderr, "%s\n", expected_lines[i]);
+
+  return false;
+}
+
+static bool
+test_nothing_slow (void)
+{
+  VsxStallDetector detector;
+  struct vsx_buffer buffer = VSX_BUFFER_STATIC_INIT;
+  bool ret = true;
+
+  vsx_stall_detector_init (&detector, THRESHOLD, REPORT_INTERVAL, 0);
+
+  if (vsx_stall_detector_is_report_due (&detector, REPORT_INTERVAL - 1)
+      || !vsx_stall_detector_is_report_due (&detector, REPORT_INTERVAL))
+    {
+      fprintf (stderr, "Report isn’t due at the right time\n");
+      ret = false;
+    }
+
+  /* Exactly the threshold isn’t slow */
+  if (vsx_stall_detector_record_callback (&detector,
+                                          VSX_STALL_DETECTOR_POLL,
+                                          static_callback,
+                                          THRESHOLD))
+    {
+      fprintf (stderr, "Callback at the threshold counted as slow\n");
+      ret = false;
+    }
+
+  vsx_stall_detector_record_iteration (&detector, THRESHOLD);
+
+  if (vsx_stall_detector_take_report (&detector, REPORT_INTERVAL, &buffer)
+      || buffer.length != 0)
+    {
+      fprintf (stderr, "Report made when nothing was slow\n");
+      ret = false;
+    }
+
+  if (!vsx_stall_detector_is_report_due (&detector, REPORT_INTERVAL * 2)
+      || detector.totals[VSX_STALL_DETECTOR_POLL].count != 0)
+    {
+      fprintf (stderr, "Period wasn’t reset after the report\n");
+      ret = false;
+    }
+
+  vsx_buffer_destroy (&buffer);
+
+  return ret;
+}
+
+static bool
+test_report (void)
+{
+  VsxStallDetector detector;
+  struct vsx_buffer buffer = VSX_BUFFER_STATIC_INIT;
+  bool ret = true;
+
+  vsx_stall_detector_init (&detector, THRESHOLD, REPORT_INTERVAL, 0);
+
+  vsx_stall_detector_record_callback (&detector,
+                                      VSX_STALL_DETECTOR_POLL,
+                                      getpid,
+                                      3000);
+  vsx_stall_detector_record_callback (&detector,
+                                      VSX_STALL_DETECTOR_POLL,
+                                      getpid,
+                                      5000);
+  vsx_stall_detector_record_callback (&detector,
+                                      VSX_STALL_DETECTOR_POLL,
+                                      getpid,
+                                      100);
+  vsx_stall_detector_record_callback (&detector,
+                                      VSX_STALL_DETECTOR_TIMER,
+                                      static_callback,
+                                      10000);
+  vsx_stall_detector_record_callback (&detector,
+                                      VSX_STALL_DETECTOR_FLUSH,
+                                      static_callback,
+                                      20);
+  vsx_stall_detector_record_iteration (&detector, 20000);
+  vsx_stall_detector_record_iteration (&detector, 500);
+
+  /* The report is taken a bit late */
+  if (!vsx_stall_detector_take_report (&detector,
+                                       REPORT_INTERVAL + 2000000,
+                                       &buffer))
+    {
+      fprintf (stderr, "No report made for slow callbacks\n");
+      ret = false;
+    }
+  else
+    {
+      static const char *const expected_lines[] = {
+        "Stalls over 1.0ms in the last 62s:",
+        "  timer callback *: 1× max 10.0ms avg 10.0ms",
+        "  poll callback *getpid: 2× max 5.0ms avg 4.0ms",
+        "  1 slow iterations, max 20.0ms",
+        "  callback time by type: "
+        "poll 3× 8.1ms (max 5.0ms) "
+        "timer 1× 10.0ms (max 10.0ms) "
+        "flush 1× 0.0ms (max 0.0ms)",
+      };
+
+      if (!check_report (&buffer,
+                         expected_lines,
+                         VSX_N_ELEMENTS (expected_lines)))
+        ret = false;
+    }
+
+  vsx_buffer_destroy (&buffer);
+
+  return ret;
+}
+
+static bool
+test_many_offenders (void)
+{
+  VsxStallDetector detector;
+  struct vsx_buffer buffer = VSX_BUFFER_STATIC_INIT;
+  /* Any address will do to tell the callbacks apart */
+  static const char callbacks[VSX_STALL_DETECTOR_MAX_OFFENDERS + 4];
+  bool ret = true;
+
+  vsx_stall_detector_init (&detector, THRESHOLD, REPORT_INTERVAL, 0);
+
+  for (int i = 0; i < VSX_N_ELEMENTS (callbacks); i++)
+    {
+      vsx_stall_detector_record_callback (&detector,
+                                          VSX_STALL_DETECTOR_TIMER,
+                                          callbacks + i,
+                                          (i + 2) * 1000);
+    }
+
+  /* The same function as a different type of source is a different
+   * offender */
+  vsx_stall_detector_record_callback (&detector,
+                                      VSX_STALL_DETECTOR_POLL,
+                                      callbacks,
+                                      2000);
+
+  vsx_stall_detector_take_report (&detector, REPORT_INTERVAL, &buffer);
+
+  /* The ones that were added after the array was full aren’t
+   * tracked even though they were the slowest */
+  static const char *const expected_lines[] = {
+    "Stalls over 1.0ms in the last 60s:",
+    "  timer callback *: 1× max 17.0ms avg 17.0ms",
+    "  timer callback *: 1× max 16.0ms avg 16.0ms",
+    "  timer callback *: 1× max 15.0ms avg 15.0ms",
+    "  timer callback *: 1× max 14.0ms avg 14.0ms",
+    "  timer callback *: 1× max 13.0ms avg 13.0ms",
+    "  16 other slow callbacks",
+    "  callback time by type: "
+    "poll 1× 2.0ms (max 2.0ms) "
+    "timer 20× 230.0ms (max 21.0ms)",
+  };
+
+  if (!check_report (&buffer,
+                     expected_lines,
+                     VSX_N_ELEMENTS (expected_lines)))
+    ret = false;
+
+  vsx_buffer_destroy (&buffer);
+
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  int ret = EXIT_SUCCESS;
+
+  if (!test_nothing_slow ())
+    ret = EXIT_FAILURE;
+
+  if (!test_report ())
+    ret = EXIT_FAILURE;
+
+  if (!test_many_offenders ())
+    ret = EXIT_FAILURE;
+
+  return ret;
+}
@@ -0,0 +1,269 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "vsx-timer-wheel.h"
+#include "vsx-util.h"
+
+#define N_ENTRIES 1000
+
+typedef struct
+{
+  VsxTimerWheelEntry entry;
+  bool scheduled;
+  int64_t expires;
+} TestTimer;
+
+static int64_t
+random_delay (unsigned int *seed)
+{
+  /* Mix short delays with ones that will end up in the higher levels */
+  switch (rand_r (seed) % 4)
+    {
+    case 0:
+      return rand_r (seed) % 64;
+    case 1:
+      return rand_r (seed) % 5000;
+    case 2:
+      return rand_r (seed) % (10 * 60 * 1000);
+    default:
+      return (int64_t) rand_r (seed) * 1000;
+    }
+}
+
+static bool
+check_next_time (VsxTimerWheel *wheel,
+                 TestTimer *timers,
+                 int64_t now)
+{
+  int64_t min_expires = INT64_MAX;
+
+  for (int i = 0; i < N_ENTRIES; i++)
+    {
+      if (timers[i].scheduled && timers[i].expires < min_expires)
+        min_expires = timers[i].expires;
+    }
+
+  int64_t next_time = vsx_timer_wheel_get_next_time (wheel);
+
+  if (min_expires == INT64_MAX)
+    {
+      if (next_time != INT64_MAX)
+        {
+          fprintf (stderr,
+                   "Wheel has a next time of %" PRIi64 " but it should be "
+                   "empty\n",
+                   next_time);
+          return false;
+        }
+    }
+  else if (next_time <= now || next_time > min_expires)
+    {
+      fprintf (stderr,
+               "Next time is %" PRIi64 " but it should be between "
+               "%" PRIi64 " and %" PRIi64 "\n",
+               next_time,
+               now + 1,
+               min_expires);
+      return false;
+    }
+
+  return true;
+}
+
+static bool
+advance (VsxTimerWheel *wheel,
+         TestTimer *timers,
+         int64_t now)
+{
+  VsxTimerWheelEntry *entry;
+
+  while ((entry = vsx_timer_wheel_pop_expired (wheel, now)))
+    {
+      TestTimer *timer = vsx_container_of (entry, TestTimer, entry);
+
+      if (!timer->scheduled)
+        {
+          fprintf (stderr, "Timer %i expired but it wasn’t scheduled\n",
+                   (int) (timer - timers));
+          return false;
+        }
+
+      if (timer->expires > now)
+        {
+          fprintf (stderr,
+                   "Timer expired too early (%" PRIi64 " > %" PRIi64 ")\n",
+                   timer->expires,
+                   now);
+          return false;
+        }
+
+      timer->scheduled = false;
+    }
+
+  for (int i = 0; i < N_ENTRIES; i++)
+    {
+      if (timers[i].scheduled && timers[i].expires <= now)
+        {
+          fprintf (stderr,
+                   "Timer %i should have expired at %" PRIi64 " but it "
+                   "is still scheduled at %" PRIi64 "\n",
+                   i,
+                   timers[i].expires,
+                   now);
+          return false;
+        }
+    }
+
+  return check_next_time (wheel, timers, now);
+}
+
+static bool
+test_random (int64_t start_time)
+{
+  VsxTimerWheel wheel;
+  TestTimer *timers = vsx_calloc (N_ENTRIES * sizeof *timers);
+  unsigned int seed = 42;
+  int64_t now = start_time;
+  bool ret = true;
+
+  vsx_timer_wheel_init (&wheel, now);
+
+  for (int i = 0; i < N_ENTRIES; i++)
+    vsx_timer_wheel_entry_init (&timers[i].entry);
+
+  for (int round = 0; round < 5000; round++)
+    {
+      /* Add, move or remove some timers */
+      for (int i = 0; i < 10; i++)
+        {
+          TestTimer *timer = timers + rand_r (&seed) % N_ENTRIES;
+
+          if (timer->scheduled && rand_r (&seed) % 3 == 0)
+            {
+              vsx_timer_wheel_remove (&wheel, &timer->entry);
+              timer->scheduled = false;
+            }
+          else
+            {
+              timer->expires = now + random_delay (&seed);
+              timer->scheduled = true;
+              vsx_timer_wheel_add (&wheel, &timer->entry, timer->expires);
+            }
+        }
+
+      /* Sometimes jump straight to the next time, otherwise jump by
+       * a random amount */
+      int64_t next_time = vsx_timer_wheel_get_next_time (&wheel);
+
+      if (next_time != INT64_MAX && rand_r (&seed) % 2 == 0)
+        now = next_time;
+      else
+        now += random_delay (&seed);
+
+      if (!advance (&wheel, timers, now))
+        {
+          ret = false;
+          break;
+        }
+    }
+
+  /* Everything should eventually expire */
+  if (ret)
+    {
+      while (vsx_timer_wheel_get_next_time (&wheel) != INT64_MAX)
+        {
+          now = vsx_timer_wheel_get_next_time (&wheel);
+
+          if (!advance (&wheel, timers, now))
+            {
+              ret = false;
+              break;
+            }
+        }
+    }
+
+  vsx_free (timers);
+
+  return ret;
+}
+
+static bool
+test_readd_during_pop (void)
+{
+  VsxTimerWheel wheel;
+  VsxTimerWheelEntry a, b;
+
+  vsx_timer_wheel_init (&wheel, 100);
+  vsx_timer_wheel_entry_init (&a);
+  vsx_timer_wheel_entry_init (&b);
+
+  vsx_timer_wheel_add (&wheel, &a, 150);
+  vsx_timer_wheel_add (&wheel, &b, 150);
+
+  /* Popping one entry and then removing the other one that has
+   * already expired should work */
+  VsxTimerWheelEntry *entry = vsx_timer_wheel_pop_expired (&wheel, 200);
+  VsxTimerWheelEntry *other = entry == &a ? &b : &a;
+
+  if (entry != &a && entry != &b)
+    {
+      fprintf (stderr, "Expected an entry to expire\n");
+      return false;
+    }
+
+  vsx_timer_wheel_remove (&wheel, other);
+
+  /* Adding the popped entry again with a time in the past should
+   * make it expire immediately */
+  vsx_timer_wheel_add (&wheel, entry, 10);
+
+  if (vsx_timer_wheel_get_next_time (&wheel) > 200
+      || vsx_timer_wheel_pop_expired (&wheel, 200) != entry
+      || vsx_timer_wheel_pop_expired (&wheel, 200) != NULL)
+    {
+      fprintf (stderr, "Entry added in the past didn’t expire\n");
+      return false;
+    }
+
+  return true;
+}
+
+int
+main (int argc, char **argv)
+{
+  int ret = EXIT_SUCCESS;
+
+  if (!test_random (0))
+    ret = EXIT_FAILURE;
+
+  /* Start just before a boundary in every level */
+  if (!test_random ((INT64_C (1) << 42) - 3))
+    ret = EXIT_FAILURE;
+
+  if (!test_readd_during_pop ())
+    ret = EXIT_FAILURE;
+
+  return ret;
+}
@@ -0,0 +1,360 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "vsx-upgrade.h"
+#include "vsx-util.h"
+
+/* More than fits in one packet of each type */
+#define N_EXTRA_FDS 300
+#define DATA_SIZE (200 * 1024)
+
+#define TEST_N_SHARDS 3
+
+static uint8_t
+get_data_byte (size_t pos)
+{
+  return pos * 7 + (pos >> 10);
+}
+
+static bool
+check_fds (const VsxUpgradeState *state,
+           int expected_n_fds)
+{
+  int n_fds = vsx_upgrade_state_get_n_fds (state);
+  const int *fds = vsx_upgrade_state_get_fds (state);
+
+  if (n_fds != expected_n_fds)
+    {
+      fprintf (stderr,
+               "Expected %i fds but got %i\n",
+               expected_n_fds,
+               n_fds);
+      return false;
+    }
+
+  for (int i = 0; i < n_fds; i++)
+    {
+      int flags = fcntl (fds[i], F_GETFD);
+
+      if (flags == -1 || !(flags & FD_CLOEXEC))
+        {
+          fprintf (stderr, "Received fd %i is invalid or not CLOEXEC\n", i);
+          return false;
+        }
+    }
+
+  return true;
+}
+
+static bool
+check_sockets (const VsxUpgradeState *state)
+{
+  if (!check_fds (state, 1))
+    return false;
+
+  /* The listening socket is the write end of a pipe so the parent can
+   * check that it is the same file */
+  static const char message[] = "potato";
+
+  if (write (vsx_upgrade_state_get_fds (state)[0],
+             message,
+             sizeof message) != sizeof message)
+    {
+      fprintf (stderr, "Error writing to received pipe\n");
+      return false;
+    }
+
+  return true;
+}
+
+static bool
+check_state (const VsxUpgradeState *state)
+{
+  if (!check_fds (state, N_EXTRA_FDS))
+    return false;
+
+  if (state->data.length != DATA_SIZE)
+    {
+      fprintf (stderr,
+               "Expected %i bytes of data but got %zu\n",
+               DATA_SIZE,
+               state->data.length);
+      return false;
+    }
+
+  for (size_t i = 0; i < state->data.length; i++)
+    {
+      if (state->data.data[i] != get_data_byte (i))
+        {
+          fprintf (stderr, "Data differs at byte %zu\n", i);
+          return false;
+        }
+    }
+
+  return true;
+}
+
+static void
+run_new_process (int sock)
+{
+  struct vsx_error *error = NULL;
+  VsxUpgradeState sockets, state;
+  int ret = EXIT_FAILURE;
+
+  vsx_upgrade_state_init (&sockets);
+  vsx_upgrade_state_init (&state);
+
+  if (!vsx_upgrade_receive_sockets (sock, &sockets, &error))
+    goto error;
+
+  if (!check_sockets (&sockets))
+    goto out;
+
+  if (!vsx_upgrade_send_ready (sock, TEST_N_SHARDS, &error)
+      || !vsx_upgrade_receive (sock, &state, &error))
+    goto error;
+
+  if (!check_state (&state))
+    goto out;
+
+  if (!vsx_upgrade_send_ack (sock, &error))
+    goto error;
+
+  ret = EXIT_SUCCESS;
+  goto out;
+
+ error:
+  fprintf (stderr, "New process: %s\n", error->message);
+  vsx_error_free (error);
+
+ out:
+  vsx_upgrade_state_destroy (&state);
+  vsx_upgrade_state_destroy (&sockets);
+
+  _exit (ret);
+}
+
+static bool
+send_state (int sock,
+            int pipe_fd)
+{
+  struct vsx_error *error = NULL;
+  VsxUpgradeState state;
+  int n_shards;
+  bool ret = true;
+
+  vsx_upgrade_state_init (&state);
+
+  for (int i = 0; i < N_EXTRA_FDS; i++)
+    vsx_upgrade_state_add_fd (&state, open ("/dev/null", O_RDONLY));
+
+  for (size_t i = 0; i < DATA_SIZE; i++)
+    vsx_buffer_append_c (&state.data, get_data_byte (i));
+
+  if (!vsx_upgrade_send_sockets (sock, &pipe_fd, 1, &error)
+      || !vsx_upgrade_receive_ready (sock, &n_shards, &error)
+      || !vsx_upgrade_send (sock, &state, &error)
+      || !vsx_upgrade_receive_ack (sock, 10 * 1000, &error))
+    {
+      fprintf (stderr, "Old process: %s\n", error->message);
+      vsx_error_free (error);
+      ret = false;
+    }
+  else if (n_shards != TEST_N_SHARDS)
+    {
+      fprintf (stderr,
+               "Expected %i shards in READY but got %i\n",
+               TEST_N_SHARDS,
+               n_shards);
+      ret = false;
+    }
+
+  vsx_upgrade_state_destroy (&state);
+  vsx_close (pipe_fd);
+
+  return ret;
+}
+
+static bool
+test_transfer (void)
+{
+  int socks[2], pipe_fds[2];
+
+  if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, socks) == -1
+      || pipe (pipe_fds) == -1)
+    {
+      fprintf (stderr, "Error creating sockets: %s\n", strerror (errno));
+      return false;
+    }
+
+  pid_t pid = fork ();
+
+  if (pid == -1)
+    {
+      fprintf (stderr, "fork failed: %s\n", strerror (errno));
+      return false;
+    }
+
+  if (pid == 0)
+    {
+      vsx_close (socks[0]);
+      vsx_close (pipe_fds[0]);
+      vsx_close (pipe_fds[1]);
+      run_new_process (socks[1]);
+    }
+
+  vsx_close (socks[1]);
+
+  /* This closes our copy of the write end */
+  bool ret = send_state (socks[0], pipe_fds[1]);
+
+  vsx_close (socks[0]);
+
+  int status;
+
+  if (waitpid (pid, &status, 0) == -1
+      || !WIFEXITED (status)
+      || WEXITSTATUS (status) != EXIT_SUCCESS)
+    {
+      fprintf (stderr, "New process failed\n");
+      ret = false;
+    }
+
+  char buf[16];
+  ssize_t got = read (pipe_fds[0], buf, sizeof buf);
+
+  if (got != sizeof "potato" || memcmp (buf, "potato", got))
+    {
+      fprintf (stderr, "Message not received through the passed pipe\n");
+      ret = false;
+    }
+
+  vsx_close (pipe_fds[0]);
+
+  return ret;
+}
+
+static bool
+test_no_ack (void)
+{
+  int socks[2];
+
+  if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, socks) == -1)
+    {
+      fprintf (stderr, "Error creating sockets: %s\n", strerror (errno));
+      return false;
+    }
+
+  struct vsx_error *error = NULL;
+  bool ret = true;
+
+  /* The old process needs to give up if the new one doesn’t take
+   * over in time */
+  if (vsx_upgrade_receive_ack (socks[0], 10, &error))
+    {
+      fprintf (stderr, "Receiving an ACK that wasn’t sent succeeded\n");
+      ret = false;
+    }
+  else
+    {
+      vsx_error_free (error);
+      error = NULL;
+    }
+
+  /* …or if it quits */
+  vsx_close (socks[1]);
+
+  if (vsx_upgrade_receive_ack (socks[0], 10 * 1000, &error))
+    {
+      fprintf (stderr, "Receiving an ACK from a closed socket succeeded\n");
+      ret = false;
+    }
+  else
+    {
+      vsx_error_free (error);
+    }
+
+  vsx_close (socks[0]);
+
+  return ret;
+}
+
+static bool
+test_eof (void)
+{
+  int socks[2];
+
+  if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, socks) == -1)
+    {
+      fprintf (stderr, "Error creating sockets: %s\n", strerror (errno));
+      return false;
+    }
+
+  /* If the old process gives up then the new one should get an error
+   * instead of blocking */
+  vsx_close (socks[0]);
+
+  struct vsx_error *error = NULL;
+  VsxUpgradeState state;
+  bool ret = true;
+
+  vsx_upgrade_state_init (&state);
+
+  if (vsx_upgrade_receive (socks[1], &state, &error))
+    {
+      fprintf (stderr, "Receiving from a closed socket succeeded\n");
+      ret = false;
+    }
+  else
+    {
+      vsx_error_free (error);
+    }
+
+  vsx_upgrade_state_destroy (&state);
+  vsx_close (socks[1]);
+
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  int ret = EXIT_SUCCESS;
+
+  if (!test_transfer ())
+    ret = EXIT_FAILURE;
+
+  if (!test_no_ack ())
+    ret = EXIT_FAILURE;
+
+  if (!test_eof ())
+    ret = EXIT_FAILURE;
+
+  return ret;
+}
@@ -0,0 +1,314 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vsx-address-table.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <assert.h>
+
+#include "vsx-hash-table.h"
+#include "vsx-list.h"
+#include "vsx-util.h"
+
+/* Messages from an address can arrive this many microseconds ahead of
+ * their steady rate before it is considered to be over the limit */
+#define VSX_ADDRESS_TABLE_BURST_TIME ((int64_t) 1000000)
+
+typedef struct
+{
+  struct vsx_hash_table_entry hash_entry;
+  /* Link in the LRU list. This is only used when there are no
+   * connections open for the address. */
+  struct vsx_list lru_link;
+  int n_connections;
+  /* The time at which the address would have caught up with its
+   * rate if it stopped sending messages now. This is the “theoretical
+   * arrival time” of the generic cell rate algorithm. */
+  int64_t rate_time;
+} VsxAddressTableEntry;
+
+struct _VsxAddressTable
+{
+  pthread_mutex_t mutex;
+
+  int max_connections;
+  /* Time in microseconds that each message uses up, or zero if there
+   * is no rate limit */
+  int64_t message_interval;
+
+  struct vsx_hash_table hash_table;
+
+  /* Entries with no open connections in order of most recently
+   * used. Entries with connections can’t be reused so they aren’t in
+   * the list. */
+  struct vsx_list lru;
+
+  int size;
+  int n_used_entries;
+  VsxAddressTableEntry *entries;
+
+  VsxAddressTableStats stats;
+};
+
+VsxAddressTable *
+vsx_address_table_new (int size,
+                       int max_connections,
+                       int max_messages_per_second)
+{
+  assert (size > 0);
+
+  VsxAddressTable *table = vsx_calloc (sizeof *table);
+
+  pthread_mutex_init (&table->mutex, NULL /* attr */);
+
+  table->max_connections = max_connections;
+
+  if (max_messages_per_second > 0)
+    {
+      table->message_interval =
+        MAX (VSX_ADDRESS_TABLE_BURST_TIME / max_messages_per_second, 1);
+    }
+
+  vsx_hash_table_init (&table->hash_table);
+  vsx_list_init (&table->lru);
+
+  table->size = size;
+  table->entries = vsx_alloc (size * sizeof *table->entries);
+
+  return table;
+}
+
+static bool
+get_key (const struct vsx_netaddress *address,
+         uint64_t *key_out)
+{
+  uint32_t ipv4;
+  uint64_t key;
+
+  switch (address->family)
+    {
+    case AF_INET:
+      memcpy (&ipv4, &address->ipv4, sizeof ipv4);
+      break;
+
+    case AF_INET6:
+      if (IN6_IS_ADDR_V4MAPPED (&address->ipv6))
+        {
+          memcpy (&ipv4, address->ipv6.s6_addr + 12, sizeof ipv4);
+          break;
+        }
+
+      /* Use the /64 prefix. Nothing real is routed under ffff::/16 so
+       * this can’t clash with the IPv4 keys below. */
+      memcpy (&key, address->ipv6.s6_addr, sizeof key);
+      goto found;
+
+    default:
+      return false;
+    }
+
+  key = UINT64_C (0xffffffff00000000) | ipv4;
+
+ found:
+  *key_out = key;
+
+  return true;
+}
+
+static VsxAddressTableEntry *
+lookup_entry (VsxAddressTable *table,
+              uint64_t key)
+{
+  struct vsx_hash_table_entry *hash_entry =
+    vsx_hash_table_get (&table->hash_table, key);
+
+  if (hash_entry == NULL)
+    return NULL;
+
+  return vsx_container_of (hash_entry, VsxAddressTableEntry, hash_entry);
+}
+
+static VsxAddressTableEntry *
+new_entry (VsxAddressTable *table,
+           uint64_t key)
+{
+  VsxAddressTableEntry *entry;
+
+  if (table->n_used_entries < table->size)
+    {
+      entry = table->entries + table->n_used_entries++;
+    }
+  else if (!vsx_list_empty (&table->lru))
+    {
+      /* Reuse the least recently used entry */
+      entry = vsx_container_of (table->lru.prev,
+                                VsxAddressTableEntry,
+                                lru_link);
+      vsx_list_remove (&entry->lru_link);
+      vsx_hash_table_remove (&table->hash_table, &entry->hash_entry);
+      table->stats.n_evicted++;
+    }
+  else
+    {
+      /* Every entry has an open connection */
+      return NULL;
+    }
+
+  entry->hash_entry.id = key;
+  entry->n_connections = 0;
+  entry->rate_time = INT64_MIN;
+
+  vsx_hash_table_add (&table->hash_table, &entry->hash_entry);
+
+  return entry;
+}
+
+bool
+vsx_address_table_add_connection (VsxAddressTable *table,
+                                  const struct vsx_netaddress *address,
+                                  bool *tracked_out)
+{
+  uint64_t key;
+
+  *tracked_out = false;
+
+  if (!get_key (address, &key))
+    return true;
+
+  bool ret = true;
+
+  pthread_mutex_lock (&table->mutex);
+
+  VsxAddressTableEntry *entry = lookup_entry (table, key);
+
+  if (entry == NULL)
+    {
+      entry = new_entry (table, key);
+    }
+  else if (table->max_connections > 0
+           && entry->n_connections >= table->max_connections)
+    {
+      table->stats.n_refused_connections++;
+      ret = false;
+      goto out;
+    }
+  else if (entry->n_connections == 0)
+    {
+      vsx_list_remove (&entry->lru_link);
+    }
+
+  /* If the table is full of addresses with connections then the new
+   * one just isn’t tracked */
+  if (entry)
+    {
+      entry->n_connections++;
+      *tracked_out = true;
+    }
+
+ out:
+  pthread_mutex_unlock (&table->mutex);
+
+  return ret;
+}
+
+void
+vsx_address_table_remove_connection (VsxAddressTable *table,
+                                     const struct vsx_netaddress *address)
+{
+  uint64_t key;
+
+  if (!get_key (address, &key))
+    return;
+
+  pthread_mutex_lock (&table->mutex);
+
+  VsxAddressTableEntry *entry = lookup_entry (table, key);
+
+  /* Entries with connections are never reused */
+  assert (entry && entry->n_connections > 0);
+
+  if (--entry->n_connections == 0)
+    vsx_list_insert (&table->lru, &entry->lru_link);
+
+  pthread_mutex_unlock (&table->mutex);
+}
+
+bool
+vsx_address_table_add_messages (VsxAddressTable *table,
+                                const struct vsx_netaddress *address,
+                                int n_messages,
+                                int64_t now)
+{
+  if (table->message_interval == 0 || n_messages <= 0)
+    return true;
+
+  uint64_t key;
+
+  if (!get_key (address, &key))
+    return true;
+
+  bool ret = true;
+
+  pthread_mutex_lock (&table->mutex);
+
+  VsxAddressTableEntry *entry = lookup_entry (table, key);
+
+  if (entry)
+    {
+      int64_t rate_time = (MAX (entry->rate_time, now)
+                           + n_messages * table->message_interval);
+
+      /* Rejected messages don’t use up any of the rate, otherwise a
+       * flood would keep every connection from the address limited
+       * long after the flooding one has been dropped */
+      if (rate_time - now > VSX_ADDRESS_TABLE_BURST_TIME)
+        {
+          table->stats.n_rate_limited++;
+          ret = false;
+        }
+      else
+        {
+          entry->rate_time = rate_time;
+        }
+    }
+
+  pthread_mutex_unlock (&table->mutex);
+
+  return ret;
+}
+
+void
+vsx_address_table_get_stats (VsxAddressTable *table,
+                             VsxAddressTableStats *stats)
+{
+  pthread_mutex_lock (&table->mutex);
+  *stats = table->stats;
+  pthread_mutex_unlock (&table->mutex);
+}
+
+void
+vsx_address_table_free (VsxAddressTable *table)
+{
+  vsx_hash_table_destroy (&table->hash_table);
+  vsx_free (table->entries);
+  pthread_mutex_destroy (&table->mutex);
+  vsx_free (table);
+}
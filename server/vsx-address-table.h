@@ -0,0 +1,90 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_ADDRESS_TABLE_H
+#define VSX_ADDRESS_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vsx-netaddress.h"
+
+/* A fixed-size table of the usage of each remote address, shared by
+ * all of the threads. IPv4 addresses are tracked individually but
+ * IPv6 addresses are grouped by their /64 prefix because a single
+ * client usually has a whole /64 to pick addresses from. The table
+ * counts the open connections and limits the rate of messages from
+ * each address. Entries without any open connections only remember
+ * the message rate and they are reused in least-recently-used order
+ * when the table is full.
+ */
+
+typedef struct _VsxAddressTable VsxAddressTable;
+
+#define VSX_ADDRESS_TABLE_DEFAULT_SIZE 4096
+
+typedef struct
+{
+  /* Connections closed because their address already had too many */
+  uint64_t n_refused_connections;
+  /* Times that a connection was dropped for sending too many
+   * messages */
+  uint64_t n_rate_limited;
+  /* Entries that were reused for a different address */
+  uint64_t n_evicted;
+} VsxAddressTableStats;
+
+/* A limit of zero means no limit */
+VsxAddressTable *
+vsx_address_table_new (int size,
+                       int max_connections,
+                       int max_messages_per_second);
+
+/* Counts a new connection from the address and returns true, or
+ * returns false if the address already has too many. If the address
+ * isn’t an IP address or every entry has open connections then the
+ * connection is allowed without being counted. tracked_out is set to
+ * whether it was counted. */
+bool
+vsx_address_table_add_connection (VsxAddressTable *table,
+                                  const struct vsx_netaddress *address,
+                                  bool *tracked_out);
+
+/* This must only be called for connections that were counted */
+void
+vsx_address_table_remove_connection (VsxAddressTable *table,
+                                     const struct vsx_netaddress *address);
+
+/* Counts messages received from the address at the given monotonic
+ * time in microseconds. Returns false if the address has gone over
+ * its rate. Short bursts of up to a second’s worth of messages are
+ * allowed. */
+bool
+vsx_address_table_add_messages (VsxAddressTable *table,
+                                const struct vsx_netaddress *address,
+                                int n_messages,
+                                int64_t now);
+
+void
+vsx_address_table_get_stats (VsxAddressTable *table,
+                             VsxAddressTableStats *stats);
+
+void
+vsx_address_table_free (VsxAddressTable *table);
+
+#endif /* VSX_ADDRESS_TABLE_H */
@@ -0,0 +1,115 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vsx-admission.h"
+
+void
+vsx_admission_init (VsxAdmission *admission)
+{
+  vsx_admission_set_limits (admission,
+                            0, /* max_connections */
+                            0, /* max_people */
+                            0, /* max_conversations */
+                            VSX_ADMISSION_DEFAULT_SOFT_LIMIT);
+
+  atomic_init (&admission->n_connections, 0);
+  atomic_init (&admission->n_people, 0);
+  atomic_init (&admission->n_conversations, 0);
+  atomic_init (&admission->n_refused_connections, 0);
+  atomic_init (&admission->n_shed_players, 0);
+}
+
+void
+vsx_admission_set_limits (VsxAdmission *admission,
+                          int max_connections,
+                          int max_people,
+                          int max_conversations,
+                          int soft_limit)
+{
+  admission->max_connections = max_connections;
+  admission->max_people = max_people;
+  admission->max_conversations = max_conversations;
+  admission->soft_limit = soft_limit;
+}
+
+bool
+vsx_admission_add_connection (VsxAdmission *admission)
+{
+  int n_connections = atomic_fetch_add_explicit (&admission->n_connections,
+                                                 1,
+                                                 memory_order_relaxed);
+
+  if (admission->max_connections > 0
+      && n_connections >= admission->max_connections)
+    {
+      atomic_fetch_sub_explicit (&admission->n_connections,
+                                 1,
+                                 memory_order_relaxed);
+      atomic_fetch_add_explicit (&admission->n_refused_connections,
+                                 1,
+                                 memory_order_relaxed);
+      return false;
+    }
+
+  return true;
+}
+
+void
+vsx_admission_remove_connection (VsxAdmission *admission)
+{
+  atomic_fetch_sub_explicit (&admission->n_connections,
+                             1,
+                             memory_order_relaxed);
+}
+
+static bool
+is_above_soft_limit (const VsxAdmission *admission,
+                     const atomic_int *count,
+                     int max)
+{
+  if (max <= 0)
+    return false;
+
+  int64_t value = atomic_load_explicit (count, memory_order_relaxed);
+
+  return value * 100 >= (int64_t) max * admission->soft_limit;
+}
+
+bool
+vsx_admission_allow_new_player (VsxAdmission *admission)
+{
+  if (is_above_soft_limit (admission,
+                           &admission->n_connections,
+                           admission->max_connections)
+      || is_above_soft_limit (admission,
+                              &admission->n_people,
+                              admission->max_people)
+      || is_above_soft_limit (admission,
+                              &admission->n_conversations,
+                              admission->max_conversations))
+    {
+      atomic_fetch_add_explicit (&admission->n_shed_players,
+                                 1,
+                                 memory_order_relaxed);
+      return false;
+    }
+
+  return true;
+}
@@ -0,0 +1,97 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_ADMISSION_H
+#define VSX_ADMISSION_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Global limits on the resources used by the server, shared by all of
+ * the shards. The connections have a hard limit and any more are
+ * closed as soon as they are accepted. Once the usage of any of the
+ * resources goes above the soft limit, requests that would create a
+ * new player are turned away with a SERVER_BUSY message but existing
+ * players can still reconnect. That way the games that are already
+ * running stay responsive when the server is overloaded.
+ */
+
+typedef struct
+{
+  /* Zero means no limit */
+  int max_connections;
+  int max_people;
+  int max_conversations;
+  /* Percentage of the limits above which new players are refused */
+  int soft_limit;
+
+  atomic_int n_connections;
+  atomic_int n_people;
+  atomic_int n_conversations;
+
+  /* Connections closed because of max_connections */
+  atomic_uint_fast64_t n_refused_connections;
+  /* Requests for a new player that were turned away */
+  atomic_uint_fast64_t n_shed_players;
+} VsxAdmission;
+
+#define VSX_ADMISSION_DEFAULT_SOFT_LIMIT 90
+
+void
+vsx_admission_init (VsxAdmission *admission);
+
+void
+vsx_admission_set_limits (VsxAdmission *admission,
+                          int max_connections,
+                          int max_people,
+                          int max_conversations,
+                          int soft_limit);
+
+/* Counts a new connection and returns true, or returns false if the
+ * hard limit has been reached. */
+bool
+vsx_admission_add_connection (VsxAdmission *admission);
+
+void
+vsx_admission_remove_connection (VsxAdmission *admission);
+
+/* Returns false and counts the request as shed if any of the
+ * resources is above the soft limit. */
+bool
+vsx_admission_allow_new_player (VsxAdmission *admission);
+
+static inline void
+vsx_admission_add_people (VsxAdmission *admission,
+                          int n_people)
+{
+  atomic_fetch_add_explicit (&admission->n_people,
+                             n_people,
+                             memory_order_relaxed);
+}
+
+static inline void
+vsx_admission_add_conversations (VsxAdmission *admission,
+                                 int n_conversations)
+{
+  atomic_fetch_add_explicit (&admission->n_conversations,
+                             n_conversations,
+                             memory_order_relaxed);
+}
+
+#endif /* VSX_ADMISSION_H */
@@ -23,7 +23,10 @@
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <limits.h>
 
+#include "vsx-admission.h"
+#include "vsx-address-table.h"
 #include "vsx-key-value.h"
 #include "vsx-util.h"
 #include "vsx-buffer.h"
@@ -89,9 +92,15 @@ static const Option server_options[] = {
         }
   OPTION (address, STRING),
   OPTION (port, INT),
+  OPTION (backlog, INT),
   OPTION (certificate, STRING),
   OPTION (private_key, STRING),
   OPTION (private_key_password, STRING),
+  OPTION (ssl_session_cache_size, INT),
+  OPTION (ssl_session_timeout, INT),
+  OPTION (ssl_session_tickets, BOOL),
+  OPTION (ssl_ticket_key_lifetime, INT),
+  OPTION (ssl_ktls, BOOL),
 #undef OPTION
 };
 
@@ -103,8 +112,25 @@ static const Option general_options[] = {
                 OPTION_TYPE_ ## type,                   \
         }
   OPTION (log_file, STRING),
+  OPTION (journal_file, STRING),
+  OPTION (snapshot_file, STRING),
+  OPTION (snapshot_interval, INT),
   OPTION (user, STRING),
   OPTION (group, STRING),
+  OPTION (shards, INT),
+  OPTION (handshake_threads, INT),
+  OPTION (max_connections, INT),
+  OPTION (max_people, INT),
+  OPTION (max_conversations, INT),
+  OPTION (soft_limit, INT),
+  OPTION (max_connections_per_address, INT),
+  OPTION (max_messages_per_second, INT),
+  OPTION (address_table_size, INT),
+  OPTION (event_backend, STRING),
+  OPTION (metrics_address, STRING),
+  OPTION (metrics_port, INT),
+  OPTION (stall_threshold, INT),
+  OPTION (stall_report_interval, INT),
 #undef OPTION
 };
 
@@ -131,14 +157,18 @@ set_option (LoadConfigData *data,
       }
     case OPTION_TYPE_INT:
       {
-        int64_t *ptr = (int64_t *) ((uint8_t *) config_item + option->offset);
+        int *ptr = (int *) ((uint8_t *) config_item + option->offset);
         errno = 0;
         char *tail;
-        *ptr = strtoll (value, &tail, 10);
-        if (errno || *tail)
+        long long int_value = strtoll (value, &tail, 10);
+        if (errno || *tail || int_value < INT_MIN || int_value > INT_MAX)
           {
             load_config_error (data, "invalid value for %s", option->key);
           }
+        else
+          {
+            *ptr = int_value;
+          }
         break;
       }
     case OPTION_TYPE_BOOL:
@@ -200,6 +230,12 @@ load_config_func (VsxKeyValueEvent event,
         {
           data->server = vsx_calloc (sizeof *data->server);
           data->server->port = -1;
+          data->server->backlog = VSX_CONFIG_DEFAULT_BACKLOG;
+          data->server->ssl_session_cache_size =
+            VSX_CONFIG_DEFAULT_SSL_SESSION_CACHE_SIZE;
+          data->server->ssl_session_timeout =
+            VSX_CONFIG_DEFAULT_SSL_SESSION_TIMEOUT;
+          data->server->ssl_session_tickets = true;
           vsx_list_insert (data->config->servers.prev, &data->server->link);
         }
       else if (!strcmp (value, "general"))
@@ -268,6 +304,53 @@ validate_server (VsxConfigServer *server,
       return false;
     }
 
+  if (server->backlog <= 0)
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: backlog must be positive",
+                     filename);
+      return false;
+    }
+
+  if (server->ssl_session_cache_size < 0)
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: ssl_session_cache_size can’t be negative",
+                     filename);
+      return false;
+    }
+
+  if (server->ssl_session_timeout <= 0)
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: ssl_session_timeout must be positive",
+                     filename);
+      return false;
+    }
+
+  if (server->ssl_ticket_key_lifetime == 0)
+    {
+      server->ssl_ticket_key_lifetime = server->ssl_session_timeout;
+    }
+  else if (server->ssl_ticket_key_lifetime < server->ssl_session_timeout)
+    {
+      /* Otherwise the tickets would stop working before the sessions
+       * they hold expire */
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: ssl_ticket_key_lifetime can’t be less than "
+                     "ssl_session_timeout",
+                     filename);
+      return false;
+    }
+
   return true;
 }
 
@@ -287,6 +370,124 @@ validate_config (VsxConfig *config,
     found_something = true;
   }
 
+  if (config->shards < 0)
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: the number of shards can’t be negative",
+                     filename);
+      return false;
+    }
+
+  if (config->handshake_threads < 0)
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: the number of handshake threads can’t be "
+                     "negative",
+                     filename);
+      return false;
+    }
+
+  if (config->max_connections < 0
+      || config->max_people < 0
+      || config->max_conversations < 0
+      || config->max_connections_per_address < 0
+      || config->max_messages_per_second < 0)
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: the limits can’t be negative",
+                     filename);
+      return false;
+    }
+
+  if (config->soft_limit < 1 || config->soft_limit > 100)
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: soft_limit must be a percentage between 1 and 100",
+                     filename);
+      return false;
+    }
+
+  if (config->snapshot_interval <= 0)
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: snapshot_interval must be positive",
+                     filename);
+      return false;
+    }
+
+  if (config->address_table_size <= 0)
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: address_table_size must be positive",
+                     filename);
+      return false;
+    }
+
+  if (config->event_backend
+      && strcmp (config->event_backend, "epoll")
+      && strcmp (config->event_backend, "io_uring"))
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: event_backend must be either epoll or io_uring",
+                     filename);
+      return false;
+    }
+
+  if (config->metrics_port != -1
+      && (config->metrics_port <= 0 || config->metrics_port > 65535))
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: metrics_port must be between 1 and 65535",
+                     filename);
+      return false;
+    }
+
+  if (config->metrics_address && config->metrics_port == -1)
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: metrics_address specified without metrics_port",
+                     filename);
+      return false;
+    }
+
+  if (config->stall_threshold < -1)
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: stall_threshold can’t be negative",
+                     filename);
+      return false;
+    }
+
+  if (config->stall_report_interval <= 0)
+    {
+      vsx_set_error (error,
+                     &vsx_config_error,
+                     VSX_CONFIG_ERROR_IO,
+                     "%s: stall_report_interval must be positive",
+                     filename);
+      return false;
+    }
+
   if (!found_something)
     {
       vsx_set_error (error,
@@ -355,6 +556,15 @@ vsx_config_load (const char *filename, struct vsx_error **error)
 {
   VsxConfig *config = vsx_calloc (sizeof *config);
 
+  config->shards = 1;
+  config->handshake_threads = VSX_CONFIG_DEFAULT_HANDSHAKE_THREADS;
+  config->soft_limit = VSX_ADMISSION_DEFAULT_SOFT_LIMIT;
+  config->address_table_size = VSX_ADDRESS_TABLE_DEFAULT_SIZE;
+  config->snapshot_interval = VSX_CONFIG_DEFAULT_SNAPSHOT_INTERVAL;
+  config->metrics_port = -1;
+  config->stall_threshold = -1;
+  config->stall_report_interval = VSX_CONFIG_DEFAULT_STALL_REPORT_INTERVAL;
+
   vsx_list_init (&config->servers);
 
   if (!load_config (filename, config, error))
@@ -391,6 +601,10 @@ vsx_config_free (VsxConfig *config)
   vsx_free (config->user);
   vsx_free (config->group);
   vsx_free (config->log_file);
+  vsx_free (config->journal_file);
+  vsx_free (config->snapshot_file);
+  vsx_free (config->event_backend);
+  vsx_free (config->metrics_address);
 
   vsx_free (config);
 }
@@ -19,6 +19,8 @@
 #ifndef VSX_CONFIG_H
 #define VSX_CONFIG_H
 
+#include <stdbool.h>
+
 #include "vsx-list.h"
 #include "vsx-error.h"
 
@@ -27,21 +29,91 @@ typedef enum
   VSX_CONFIG_ERROR_IO
 } VsxConfigError;
 
+/* Defaults for the TLS session resumption options. If the ticket key
+ * lifetime isn’t configured then the keys are replaced as often as
+ * the sessions expire so that a ticket can always be used for at
+ * least as long as a cached session. */
+#define VSX_CONFIG_DEFAULT_SSL_SESSION_CACHE_SIZE (20 * 1024)
+#define VSX_CONFIG_DEFAULT_SSL_SESSION_TIMEOUT (60 * 60)
+
+#define VSX_CONFIG_DEFAULT_HANDSHAKE_THREADS 2
+
+/* Seconds between each snapshot of the games */
+#define VSX_CONFIG_DEFAULT_SNAPSHOT_INTERVAL 10
+
+/* Seconds between each summary of the slow callbacks */
+#define VSX_CONFIG_DEFAULT_STALL_REPORT_INTERVAL 60
+
+/* Length of the queue of connections waiting to be accepted. The
+ * kernel silently caps this to net.core.somaxconn. */
+#define VSX_CONFIG_DEFAULT_BACKLOG 1024
+
 typedef struct
 {
   struct vsx_list link;
   char *address;
   int port;
+  int backlog;
   char *certificate;
   char *private_key;
   char *private_key_password;
+  /* Maximum number of sessions in the server-side TLS session cache.
+   * Zero disables the cache. */
+  int ssl_session_cache_size;
+  /* Time in seconds that a session can be resumed for */
+  int ssl_session_timeout;
+  /* Whether to give out stateless session tickets */
+  bool ssl_session_tickets;
+  /* Time in seconds before the key used to encrypt the tickets is
+   * replaced. Defaults to the session timeout. */
+  int ssl_ticket_key_lifetime;
+  /* Whether to ask OpenSSL to move the record encryption into the
+   * kernel once the handshake is complete */
+  bool ssl_ktls;
 } VsxConfigServer;
 
 typedef struct
 {
   char *log_file;
+  /* File to record the commands from the clients to */
+  char *journal_file;
+  /* Prefix for the files to save the games to so that they survive
+   * a restart */
+  char *snapshot_file;
+  /* Time in seconds between each snapshot */
+  int snapshot_interval;
   char *user;
   char *group;
+  /* Number of threads to run the games on. Zero means one per CPU */
+  int shards;
+  /* Number of threads to run the SSL handshakes on. Zero means to do
+   * them on the shards. */
+  int handshake_threads;
+  /* Global limits on the server’s resources. Zero means no limit. */
+  int max_connections;
+  int max_people;
+  int max_conversations;
+  /* Percentage of the limits above which new players are turned
+   * away so that existing players can still reconnect */
+  int soft_limit;
+  /* Limits for each remote IP address, or IPv6 /64 prefix. Zero means
+   * no limit. */
+  int max_connections_per_address;
+  int max_messages_per_second;
+  /* Number of addresses to keep track of */
+  int address_table_size;
+  /* Either “epoll” or “io_uring”, or NULL for the default */
+  char *event_backend;
+  /* Address and port to serve the Prometheus metrics on. The port is
+   * -1 if the endpoint is disabled and a NULL address means the
+   * loopback interface. */
+  char *metrics_address;
+  int metrics_port;
+  /* Time in milliseconds above which a main loop callback is logged
+   * as slow, or -1 to not time the callbacks */
+  int stall_threshold;
+  /* Time in seconds between each summary of the slow callbacks */
+  int stall_report_interval;
   struct vsx_list servers;
 } VsxConfig;
 
@@ -27,9 +27,14 @@
 #include "vsx-ws-parser.h"
 #include "vsx-proto.h"
 #include "vsx-log.h"
+#include "vsx-journal.h"
+#include "vsx-metrics.h"
 #include "vsx-bitmask.h"
 #include "vsx-normalize-name.h"
 #include "vsx-base64.h"
+#include "vsx-shard.h"
+#include "vsx-shared-slice.h"
+#include "vsx-serial.h"
 #include "vsx-util.h"
 
 typedef enum
@@ -47,11 +52,42 @@ typedef enum
   VSX_CONNECTION_DIRTY_FLAG_CONVERSATION_ID = (1 << 3),
   VSX_CONNECTION_DIRTY_FLAG_N_TILES = (1 << 4),
   VSX_CONNECTION_DIRTY_FLAG_LANGUAGE = (1 << 5),
-  VSX_CONNECTION_DIRTY_FLAG_PENDING_SHOUT = (1 << 6),
-  VSX_CONNECTION_DIRTY_FLAG_SYNC = (1 << 7),
-  VSX_CONNECTION_DIRTY_FLAG_PENDING_ERROR = (1 << 8),
+  VSX_CONNECTION_DIRTY_FLAG_SYNC = (1 << 6),
+  VSX_CONNECTION_DIRTY_FLAG_PENDING_ERROR = (1 << 7),
 } VsxConnectionDirtyFlag;
 
+/* If a connection falls this many bytes behind the end of the
+ * conversation’s frame log then it stops reading the log and instead
+ * goes back to sending the whole state. That way a slow client can’t
+ * keep an unbounded amount of the log alive.
+ */
+#define VSX_CONNECTION_MAX_LOG_BACKLOG (64 * 1024)
+
+/* Size of the buffers used for read_buf and message_data. These are
+ * only allocated while the connection is part way through a frame or
+ * a message so that an idle connection doesn’t need them. They come
+ * from a pool that is shared between the shards because a connection
+ * can be handed over to another shard while it is holding them.
+ */
+#define VSX_CONNECTION_BUFFER_SIZE 1024
+
+_Static_assert (VSX_PROTO_MAX_PAYLOAD_SIZE <= VSX_CONNECTION_BUFFER_SIZE,
+                "The message data must fit in a connection buffer");
+
+/* Maximum amount of data that will be queued while the connection is
+ * moving to another shard. A handoff doesn’t take long so a client
+ * that sends more than this is misbehaving.
+ */
+#define VSX_CONNECTION_MAX_HANDOFF_DATA (16 * 1024)
+
+typedef struct
+{
+  uint8_t data[VSX_CONNECTION_BUFFER_SIZE];
+} VsxConnectionBuffer;
+
+VSX_SHARED_SLICE_ALLOCATOR (VsxConnectionBuffer, buffer_allocator);
+static __thread struct vsx_shared_slice_magazine buffer_magazine;
+
 struct _VsxConnection
 {
   VsxConnectionState state;
@@ -60,12 +96,42 @@ struct _VsxConnection
 
   int64_t last_message_time;
 
+  /* Time that the command which caused the oldest change that hasn’t
+   * been written yet was received, or zero if the change wasn’t
+   * caused by a command or metrics aren’t being recorded */
+  int64_t broadcast_time;
+
+  /* ID used to identify the connection in the journal and the last
+   * person that was recorded for it */
+  uint64_t journal_id;
+  VsxPersonId journal_person_id;
+
+  /* Number of complete frames received, including control frames.
+   * The server uses this to limit the message rate. */
+  uint32_t n_frames_received;
+
   struct vsx_netaddress socket_address;
   VsxConversationSet *conversation_set;
   VsxPersonSet *person_set;
 
-  /* This is freed and becomes NULL once the headers have all
-   * been parsed.
+  /* The shard that the connection is currently running on. The
+   * commands that pick a conversation use this to work out whether
+   * the connection needs to move to another shard first.
+   */
+  int shard_num;
+  int n_shards;
+
+  /* If this isn’t -1 then a command was received that needs to be
+   * processed on another shard. The message is left in message_data
+   * and nothing else will be processed until the connection is
+   * attached to the new shard. Any data that arrives in the meantime
+   * is queued in handoff_data.
+   */
+  int handoff_shard;
+  struct vsx_buffer handoff_data;
+
+  /* This is freed and becomes NULL once the WebSocket response has
+   * been written.
    */
   VsxWsParser *ws_parser;
 
@@ -75,12 +141,24 @@ struct _VsxConnection
 
   unsigned int message_num;
 
+  /* Messages before this number are written individually from the
+   * conversation’s message list. Anything after it comes from the
+   * frame log. */
+  unsigned int history_message_end;
+
+  /* Position in the conversation’s frame log. This is only valid
+   * when person is not NULL. */
+  VsxFrameLogCursor log_cursor;
+
   /* Number of players that we've sent a "player-name" event for */
   unsigned int named_players;
 
   VsxConnectionDirtyFlag dirty_flags;
 
-  /* Bit mask of players whose state needs updating */
+  /* Bit mask of players whose state needs updating. The bit masks
+   * are only used to send the full state when the connection starts
+   * following a person or needs to resync. Any changes after that
+   * come from the frame log. */
   vsx_bitmask_element_t dirty_players
   [VSX_BITMASK_N_ELEMENTS_FOR_SIZE (VSX_CONVERSATION_MAX_PLAYERS)];
 
@@ -88,14 +166,14 @@ struct _VsxConnection
   vsx_bitmask_element_t dirty_tiles
   [VSX_BITMASK_N_ELEMENTS_FOR_SIZE (VSX_TILE_DATA_N_TILES)];
 
-  int pending_shout;
-
   /* If DIRTY_FLAG_PENDING_ERROR is set, then a message with this
    * message number will be sent.
    */
   uint8_t pending_error;
 
-  uint8_t read_buf[1024];
+  /* NULL unless read_buf_pos is non-zero or we are in the middle of
+   * parsing it */
+  VsxConnectionBuffer *read_buf;
   size_t read_buf_pos;
 
   /* If VSX_CONNECTION_DIRTY_FLAG_PONG is set then we need to send a
@@ -108,12 +186,13 @@ struct _VsxConnection
 
   /* If message_data_length is non-zero then we are part way
    * through reading a message whose payload is stored in
-   * message_data.
+   * message_data. Otherwise message_data is NULL unless a message is
+   * being processed.
    */
   _Static_assert (VSX_PROTO_MAX_PAYLOAD_SIZE <= UINT16_MAX,
                   "The message size is too long for a uint16_t");
   uint16_t message_data_length;
-  uint8_t message_data[VSX_PROTO_MAX_PAYLOAD_SIZE];
+  uint8_t *message_data;
 };
 
 static const char
@@ -133,6 +212,34 @@ typedef int (* VsxConnectionWriteStateFunc) (VsxConnection *conn,
                                              uint8_t *buffer,
                                              size_t buffer_size);
 
+static void
+mark_full_state_dirty (VsxConnection *conn)
+{
+  VsxConversation *conversation = conn->person->conversation;
+
+  vsx_bitmask_set_range (conn->dirty_tiles, conversation->n_tiles_in_play);
+  vsx_bitmask_set_range (conn->dirty_players, conversation->n_players);
+
+  conn->history_message_end = vsx_conversation_get_n_messages (conversation);
+}
+
+static void
+check_log_backlog (VsxConnection *conn)
+{
+  VsxFrameLog *log = &conn->person->conversation->frame_log;
+
+  if (vsx_frame_log_get_end (log)
+      - vsx_frame_log_cursor_get_offset (&conn->log_cursor)
+      <= VSX_CONNECTION_MAX_LOG_BACKLOG)
+    return;
+
+  /* Skip to the end of the log and send the current state instead */
+  vsx_frame_log_cursor_destroy (&conn->log_cursor);
+  vsx_frame_log_cursor_init (&conn->log_cursor, log);
+
+  mark_full_state_dirty (conn);
+}
+
 static void
 conversation_changed_cb (struct vsx_listener *listener,
                          void *user_data)
@@ -152,23 +259,20 @@ conversation_changed_cb (struct vsx_listener *listener,
       break;
 
     case VSX_CONVERSATION_PLAYER_CHANGED:
-      vsx_bitmask_set (conn->dirty_players, data->num, true);
-      break;
-
     case VSX_CONVERSATION_TILE_CHANGED:
-      vsx_bitmask_set (conn->dirty_tiles, data->num, true);
-      break;
-
-    case VSX_CONVERSATION_STATE_CHANGED:
     case VSX_CONVERSATION_MESSAGE_ADDED:
+    case VSX_CONVERSATION_SHOUTED:
+      /* These are sent via the frame log */
+      check_log_backlog (conn);
       break;
 
-    case VSX_CONVERSATION_SHOUTED:
-      conn->pending_shout = data->num;
-      conn->dirty_flags |= VSX_CONNECTION_DIRTY_FLAG_PENDING_SHOUT;
+    case VSX_CONVERSATION_STATE_CHANGED:
       break;
     }
 
+  if (conn->broadcast_time == 0)
+    conn->broadcast_time = vsx_metrics_get_command_time ();
+
   vsx_signal_emit (&conn->changed_signal, NULL);
 }
 
@@ -181,17 +285,44 @@ start_following_person (VsxConnection *conn)
                         | VSX_CONNECTION_DIRTY_FLAG_LANGUAGE
                         | VSX_CONNECTION_DIRTY_FLAG_SYNC);
 
-  vsx_bitmask_set_range (conn->dirty_tiles,
-                         conn->person->conversation->n_tiles_in_play);
+  mark_full_state_dirty (conn);
 
-  vsx_bitmask_set_range (conn->dirty_players,
-                         conn->person->conversation->n_players);
+  vsx_frame_log_cursor_init (&conn->log_cursor,
+                             &conn->person->conversation->frame_log);
 
   conn->conversation_changed_listener.notify = conversation_changed_cb;
   vsx_signal_add (&conn->person->conversation->changed_signal,
                   &conn->conversation_changed_listener);
 }
 
+static bool
+needs_handoff (VsxConnection *conn,
+               int shard_num)
+{
+  if (shard_num == conn->shard_num)
+    return false;
+
+  conn->handoff_shard = shard_num;
+
+  return true;
+}
+
+/* Returns false and queues a SERVER_BUSY message if the server is too
+ * loaded to accept another player */
+static bool
+check_admission (VsxConnection *conn)
+{
+  VsxAdmission *admission = vsx_person_set_get_admission (conn->person_set);
+
+  if (admission == NULL || vsx_admission_allow_new_player (admission))
+    return true;
+
+  conn->pending_error = VSX_PROTO_SERVER_BUSY;
+  conn->dirty_flags |= VSX_CONNECTION_DIRTY_FLAG_PENDING_ERROR;
+
+  return false;
+}
+
 static bool
 handle_new_private_game (VsxConnection *conn,
                          struct vsx_error **error)
@@ -226,6 +357,9 @@ handle_new_private_game (VsxConnection *conn,
       return false;
     }
 
+  if (!check_admission (conn))
+    return true;
+
   bool ret = true;
   char *normalized_player_name = vsx_strdup (player_name);
 
@@ -296,6 +430,12 @@ handle_join_game (VsxConnection *conn,
       return false;
     }
 
+  if (!check_admission (conn))
+    return true;
+
+  if (needs_handoff (conn, vsx_shard_for_id (conversation_id, conn->n_shards)))
+    return true;
+
   VsxConversation *conversation =
     vsx_conversation_set_get_conversation (conn->conversation_set,
                                            conversation_id);
@@ -374,6 +514,12 @@ handle_new_player (VsxConnection *conn,
       return false;
     }
 
+  if (!check_admission (conn))
+    return true;
+
+  if (needs_handoff (conn, vsx_shard_for_room_name (room_name, conn->n_shards)))
+    return true;
+
   bool ret = true;
   char *normalized_room_name = vsx_strdup (room_name);
   char *normalized_player_name = vsx_strdup (player_name);
@@ -468,6 +614,9 @@ handle_reconnect (VsxConnection *conn,
       return false;
     }
 
+  if (needs_handoff (conn, vsx_shard_for_id (player_id, conn->n_shards)))
+    return true;
+
   VsxPerson *person = vsx_person_set_get_person (conn->person_set, player_id);
 
   if (person == NULL)
@@ -492,7 +641,7 @@ handle_reconnect (VsxConnection *conn,
       return false;
     }
 
-  vsx_person_make_noise (person);
+  vsx_person_set_make_noise (conn->person_set, person);
   conn->person = vsx_object_ref (person);
   conn->message_num = n_messages_received + person->message_offset;
 
@@ -514,7 +663,7 @@ activate_person (VsxConnection *conn,
       return false;
     }
 
-  vsx_person_make_noise (conn->person);
+  vsx_person_set_make_noise (conn->person_set, conn->person);
 
   return true;
 }
@@ -789,8 +938,8 @@ handle_set_language (VsxConnection *conn,
 }
 
 static bool
-process_message (VsxConnection *conn,
-                 struct vsx_error **error)
+handle_message (VsxConnection *conn,
+                struct vsx_error **error)
 {
   if (conn->message_data_length < 1)
     {
@@ -803,6 +952,8 @@ process_message (VsxConnection *conn,
 
   conn->last_message_time = vsx_main_context_get_monotonic_clock (NULL);
 
+  vsx_metrics_set_command_time (conn->last_message_time);
+
   switch (conn->message_data[0])
     {
     case VSX_PROTO_NEW_PRIVATE_GAME:
@@ -844,6 +995,58 @@ process_message (VsxConnection *conn,
   return false;
 }
 
+static uint64_t
+get_journal_conversation_id (VsxConnection *conn)
+{
+  return conn->person ? conn->person->conversation->hash_entry.id : 0;
+}
+
+static void
+add_message_to_journal (VsxConnection *conn)
+{
+  if (!vsx_journal_available ())
+    return;
+
+  vsx_journal_add (VSX_JOURNAL_RECORD_COMMAND,
+                   conn->journal_id,
+                   get_journal_conversation_id (conn),
+                   conn->message_data,
+                   conn->message_data_length);
+
+  if (conn->person && conn->person->hash_entry.id != conn->journal_person_id)
+    {
+      uint8_t payload[sizeof (uint64_t)];
+
+      conn->journal_person_id = conn->person->hash_entry.id;
+      vsx_proto_write_uint64_t (payload, conn->journal_person_id);
+
+      vsx_journal_add (VSX_JOURNAL_RECORD_PERSON,
+                       conn->journal_id,
+                       get_journal_conversation_id (conn),
+                       payload,
+                       sizeof payload);
+    }
+}
+
+static bool
+process_message (VsxConnection *conn,
+                 struct vsx_error **error)
+{
+  bool ret = handle_message (conn, error);
+
+  vsx_metrics_set_command_time (0);
+
+  /* If the message is being handed off then it will be counted and
+   * recorded once it is processed again on the other shard */
+  if (conn->handoff_shard == -1 && conn->message_data_length >= 1)
+    {
+      vsx_metrics_count_command (conn->message_data[0]);
+      add_message_to_journal (conn);
+    }
+
+  return ret;
+}
+
 VsxConnection *
 vsx_connection_new (const struct vsx_netaddress *socket_address,
                     VsxConversationSet *conversation_set,
@@ -855,12 +1058,24 @@ vsx_connection_new (const struct vsx_netaddress *socket_address,
   conn->conversation_set = vsx_object_ref (conversation_set);
   conn->person_set = vsx_object_ref (person_set);
 
+  conn->shard_num = 0;
+  conn->n_shards = 1;
+  conn->handoff_shard = -1;
+  vsx_buffer_init (&conn->handoff_data);
+
   conn->ws_parser = vsx_ws_parser_new ();
 
   conn->last_message_time = vsx_main_context_get_monotonic_clock (NULL);
 
   vsx_signal_init (&conn->changed_signal);
 
+  conn->journal_id = vsx_journal_generate_connection_id ();
+  vsx_journal_add (VSX_JOURNAL_RECORD_CONNECT,
+                   conn->journal_id,
+                   0, /* conversation_id */
+                   NULL, /* payload */
+                   0 /* payload_length */);
+
   return conn;
 }
 
@@ -886,10 +1101,15 @@ has_pending_data (VsxConnection *conn)
         return true;
     }
 
-  if (conn->person
-      && (conn->message_num
-          < vsx_conversation_get_n_messages (conn->person->conversation)))
-    return true;
+  if (conn->person)
+    {
+      if (conn->message_num < conn->history_message_end)
+        return true;
+
+      if (vsx_frame_log_cursor_get_offset (&conn->log_cursor)
+          < vsx_frame_log_get_end (&conn->person->conversation->frame_log))
+        return true;
+    }
 
   return false;
 }
@@ -1050,7 +1270,7 @@ write_tile (VsxConnection *conn,
 static int
 write_message (VsxConnection *conn,
                uint8_t *buffer,
-                   size_t buffer_size)
+               size_t buffer_size)
 {
   /* This returns -1 if there wasn’t enough space, 0 if there are no
    * messages to write or the size of the written data if one message
@@ -1064,8 +1284,7 @@ write_message (VsxConnection *conn,
 
   VsxConversation *conversation = conn->person->conversation;
 
-  if (conn->message_num
-      >= vsx_conversation_get_n_messages (conversation))
+  if (conn->message_num >= conn->history_message_end)
     return 0;
 
   const VsxConversationMessage *message =
@@ -1095,6 +1314,71 @@ write_message (VsxConnection *conn,
     }
 }
 
+static size_t
+get_frame_header_size (const uint8_t *frame)
+{
+  /* The server never masks its frames and never sends frames big
+   * enough to need the 64-bit length */
+  return frame[1] == 126 ? 4 : 2;
+}
+
+static size_t
+get_frame_payload_size (const uint8_t *frame)
+{
+  if (frame[1] == 126)
+    return (frame[2] << 8) | frame[3];
+  else
+    return frame[1];
+}
+
+static int
+write_log (VsxConnection *conn,
+           uint8_t *buffer,
+           size_t buffer_size)
+{
+  /* Copies as many whole frames from the frame log as will fit. This
+   * returns -1 if not even one frame fits, 0 if the log is empty or
+   * otherwise the number of bytes written.
+   */
+
+  if (conn->person == NULL)
+    return 0;
+
+  size_t length;
+  const uint8_t *data = vsx_frame_log_cursor_get_data (&conn->log_cursor,
+                                                       &length);
+
+  if (length == 0)
+    return 0;
+
+  size_t to_copy = 0;
+
+  while (to_copy < length)
+    {
+      const uint8_t *frame = data + to_copy;
+      size_t header_size = get_frame_header_size (frame);
+      size_t frame_size = header_size + get_frame_payload_size (frame);
+
+      if (to_copy + frame_size > buffer_size)
+        break;
+
+      /* Keep track of the number of messages sent so that the client
+       * can tell us when it reconnects */
+      if (frame[header_size] == VSX_PROTO_MESSAGE)
+        conn->message_num++;
+
+      to_copy += frame_size;
+    }
+
+  if (to_copy == 0)
+    return -1;
+
+  memcpy (buffer, data, to_copy);
+  vsx_frame_log_cursor_advance (&conn->log_cursor, to_copy);
+
+  return to_copy;
+}
+
 static int
 write_ws_response (VsxConnection *conn,
                    uint8_t *buffer,
@@ -1134,6 +1418,10 @@ write_ws_response (VsxConnection *conn,
   memcpy (p, ws_header_postfix, (sizeof ws_header_postfix) - 1);
   p += (sizeof ws_header_postfix) - 1;
 
+  /* The parser isn’t needed anymore */
+  vsx_ws_parser_free (conn->ws_parser);
+  conn->ws_parser = NULL;
+
   return p - buffer;
 }
 
@@ -1227,22 +1515,6 @@ write_language (VsxConnection *conn,
                                   VSX_PROTO_TYPE_NONE);
 }
 
-static int
-write_pending_shout (VsxConnection *conn,
-                     uint8_t *buffer,
-                     size_t buffer_size)
-{
-  return vsx_proto_write_command (buffer,
-                                  buffer_size,
-
-                                  VSX_PROTO_PLAYER_SHOUTED,
-
-                                  VSX_PROTO_TYPE_UINT8,
-                                  conn->pending_shout,
-
-                                  VSX_PROTO_TYPE_NONE);
-}
-
 static int
 write_end (VsxConnection *conn,
            uint8_t *buffer,
@@ -1315,9 +1587,9 @@ vsx_connection_fill_output_buffer (VsxConnection *conn,
       { VSX_CONNECTION_DIRTY_FLAG_LANGUAGE, write_language },
       { .func = write_player_name },
       { .func = write_player },
-      { VSX_CONNECTION_DIRTY_FLAG_PENDING_SHOUT, write_pending_shout },
       { .func = write_tile },
       { .func = write_message },
+      { .func = write_log },
       { .func = write_end },
       { VSX_CONNECTION_DIRTY_FLAG_SYNC, write_sync },
       { VSX_CONNECTION_DIRTY_FLAG_PENDING_ERROR, write_pending_error },
@@ -1371,6 +1643,15 @@ vsx_connection_fill_output_buffer (VsxConnection *conn,
                 }
             }
 
+          /* Everything that was pending has been written */
+          if (conn->broadcast_time)
+            {
+              vsx_metrics_record (VSX_METRICS_BROADCAST_LATENCY,
+                                  vsx_metrics_get_time ()
+                                  - conn->broadcast_time);
+              conn->broadcast_time = 0;
+            }
+
           return total_wrote;
 
         found:
@@ -1477,11 +1758,35 @@ unmask_data (uint32_t mask,
     buffer[i] ^= ((uint8_t *) &mask)[i % 4];
 }
 
+static void *
+alloc_buffer (void)
+{
+  return vsx_shared_slice_alloc (&buffer_allocator, &buffer_magazine);
+}
+
+static void
+free_buffer (void *buffer)
+{
+  vsx_shared_slice_free (&buffer_allocator, &buffer_magazine, buffer);
+}
+
+static void
+release_message_data (VsxConnection *conn)
+{
+  conn->message_data_length = 0;
+
+  if (conn->message_data)
+    {
+      free_buffer (conn->message_data);
+      conn->message_data = NULL;
+    }
+}
+
 static bool
 process_frames (VsxConnection *conn,
                 struct vsx_error **error)
 {
-  uint8_t *data = conn->read_buf;
+  uint8_t *data = conn->read_buf ? conn->read_buf->data : NULL;
   size_t length = conn->read_buf_pos;
   bool has_mask;
   bool is_fin;
@@ -1615,6 +1920,8 @@ process_frames (VsxConnection *conn,
           unmask_data (mask, data, payload_length);
         }
 
+      conn->n_frames_received++;
+
       if (opcode & 0x8)
         {
           if (!process_control_frame (conn,
@@ -1626,6 +1933,9 @@ process_frames (VsxConnection *conn,
         }
       else
         {
+          if (conn->message_data == NULL)
+            conn->message_data = alloc_buffer ();
+
           memcpy (conn->message_data + conn->message_data_length,
                   data,
                   payload_length);
@@ -1636,7 +1946,19 @@ process_frames (VsxConnection *conn,
               if (!process_message (conn, error))
                 return false;
 
-              conn->message_data_length = 0;
+              /* If the message needs to be processed on another
+               * shard then leave it in message_data and stop here so
+               * that the rest of the data can be processed after the
+               * handoff.
+               */
+              if (conn->handoff_shard != -1)
+                {
+                  data += payload_length;
+                  length -= payload_length;
+                  break;
+                }
+
+              release_message_data (conn);
             }
         }
 
@@ -1644,9 +1966,40 @@ process_frames (VsxConnection *conn,
       length -= payload_length;
     }
 
-  memmove (conn->read_buf, data, length);
   conn->read_buf_pos = length;
 
+  if (length > 0)
+    {
+      memmove (conn->read_buf->data, data, length);
+    }
+  else if (conn->read_buf)
+    {
+      free_buffer (conn->read_buf);
+      conn->read_buf = NULL;
+    }
+
+  return true;
+}
+
+static bool
+queue_handoff_data (VsxConnection *conn,
+                    const uint8_t *buffer,
+                    size_t buffer_length,
+                    struct vsx_error **error)
+{
+  if (conn->handoff_data.length + buffer_length
+      > VSX_CONNECTION_MAX_HANDOFF_DATA)
+    {
+      vsx_set_error (error,
+                     &vsx_connection_error,
+                     VSX_CONNECTION_ERROR_INVALID_PROTOCOL,
+                     "Client sent too much data while moving to another "
+                     "shard");
+      return false;
+    }
+
+  vsx_buffer_append (&conn->handoff_data, buffer, buffer_length);
+
   return true;
 }
 
@@ -1656,6 +2009,9 @@ vsx_connection_parse_data (VsxConnection *conn,
                            size_t buffer_length,
                            struct vsx_error **error)
 {
+  if (conn->handoff_shard != -1)
+    return queue_handoff_data (conn, buffer, buffer_length, error);
+
   if (conn->state == VSX_CONNECTION_STATE_READING_WS_HEADERS)
     {
       size_t consumed;
@@ -1681,20 +2037,94 @@ vsx_connection_parse_data (VsxConnection *conn,
 
   while (buffer_length > 0)
     {
+      if (conn->read_buf == NULL)
+        conn->read_buf = alloc_buffer ();
+
       size_t to_copy = MIN (buffer_length,
-                            (sizeof conn->read_buf) - conn->read_buf_pos);
-      memcpy (conn->read_buf + conn->read_buf_pos, buffer, to_copy);
+                            VSX_CONNECTION_BUFFER_SIZE - conn->read_buf_pos);
+      memcpy (conn->read_buf->data + conn->read_buf_pos, buffer, to_copy);
       conn->read_buf_pos += to_copy;
       buffer_length -= to_copy;
       buffer += to_copy;
 
       if (!process_frames (conn, error))
         return false;
+
+      if (conn->handoff_shard != -1)
+        return queue_handoff_data (conn, buffer, buffer_length, error);
     }
 
   return true;
 }
 
+void
+vsx_connection_set_shard (VsxConnection *conn,
+                          int shard_num,
+                          int n_shards)
+{
+  conn->shard_num = shard_num;
+  conn->n_shards = n_shards;
+}
+
+int
+vsx_connection_get_handoff_shard (VsxConnection *conn)
+{
+  return conn->handoff_shard;
+}
+
+void
+vsx_connection_detach (VsxConnection *conn)
+{
+  assert (conn->handoff_shard != -1);
+  assert (conn->person == NULL);
+
+  vsx_object_unref (conn->conversation_set);
+  conn->conversation_set = NULL;
+  vsx_object_unref (conn->person_set);
+  conn->person_set = NULL;
+}
+
+bool
+vsx_connection_attach (VsxConnection *conn,
+                       VsxConversationSet *conversation_set,
+                       VsxPersonSet *person_set,
+                       int shard_num,
+                       struct vsx_error **error)
+{
+  assert (conn->handoff_shard == shard_num);
+  assert (conn->conversation_set == NULL && conn->person_set == NULL);
+
+  conn->conversation_set = vsx_object_ref (conversation_set);
+  conn->person_set = vsx_object_ref (person_set);
+  conn->shard_num = shard_num;
+  conn->handoff_shard = -1;
+
+  /* Process the message that caused the handoff again now that we
+   * are on the right shard */
+  if (!process_message (conn, error))
+    return false;
+
+  assert (conn->handoff_shard == -1);
+
+  release_message_data (conn);
+
+  /* Then anything else that was left in the read buffer */
+  if (!process_frames (conn, error))
+    return false;
+
+  struct vsx_buffer handoff_data = conn->handoff_data;
+  vsx_buffer_init (&conn->handoff_data);
+
+  bool ret = vsx_connection_parse_data (conn,
+                                        handoff_data.data,
+                                        handoff_data.length,
+                                        error);
+
+  vsx_buffer_destroy (&handoff_data);
+
+  return ret;
+}
+
 bool
 vsx_connection_is_finished (VsxConnection *conn)
 {
@@ -1731,20 +2161,209 @@ vsx_connection_get_last_message_time (VsxConnection *conn)
   return conn->last_message_time;
 }
 
+uint32_t
+vsx_connection_get_n_frames_received (VsxConnection *conn)
+{
+  return conn->n_frames_received;
+}
+
+/* Dirty flags that aren’t recreated by start_following_person and so
+ * need to be saved with the state */
+#define VSX_CONNECTION_SAVED_DIRTY_FLAGS        \
+  (VSX_CONNECTION_DIRTY_FLAG_PONG               \
+   | VSX_CONNECTION_DIRTY_FLAG_PENDING_ERROR)
+
+bool
+vsx_connection_save_state (VsxConnection *conn,
+                           struct vsx_buffer *buffer)
+{
+  if (conn->state != VSX_CONNECTION_STATE_WRITING_DATA
+      || conn->ws_parser
+      || conn->handoff_shard != -1)
+    return false;
+
+  if (conn->person)
+    {
+      vsx_serial_write_u8 (buffer, 1);
+      vsx_serial_write_u64 (buffer, conn->person->hash_entry.id);
+    }
+  else
+    {
+      vsx_serial_write_u8 (buffer, 0);
+    }
+
+  vsx_serial_write_u32 (buffer, conn->message_num);
+  vsx_serial_write_u64 (buffer, conn->last_message_time);
+  vsx_serial_write_u32 (buffer, conn->n_frames_received);
+  vsx_serial_write_u8 (buffer,
+                       conn->dirty_flags & VSX_CONNECTION_SAVED_DIRTY_FLAGS);
+  vsx_serial_write_u8 (buffer, conn->pending_error);
+  vsx_serial_write_data (buffer, conn->pong_data, conn->pong_data_length);
+  vsx_serial_write_data (buffer,
+                         conn->message_data,
+                         conn->message_data_length);
+  vsx_serial_write_data (buffer,
+                         conn->read_buf ? conn->read_buf->data : NULL,
+                         conn->read_buf_pos);
+
+  return true;
+}
+
+static bool
+load_person (VsxConnection *conn,
+             VsxPersonId person_id,
+             unsigned int message_num,
+             struct vsx_error **error)
+{
+  VsxPerson *person = vsx_person_set_get_person (conn->person_set,
+                                                 person_id);
+
+  if (person == NULL)
+    {
+      vsx_set_error (error,
+                     &vsx_connection_error,
+                     VSX_CONNECTION_ERROR_INVALID_STATE,
+                     "Saved connection refers to a missing person");
+      return false;
+    }
+
+  if (message_num > vsx_conversation_get_n_messages (person->conversation))
+    {
+      vsx_set_error (error,
+                     &vsx_connection_error,
+                     VSX_CONNECTION_ERROR_INVALID_STATE,
+                     "Saved connection has an invalid message number");
+      return false;
+    }
+
+  conn->person = vsx_object_ref (person);
+  conn->message_num = message_num;
+
+  start_following_person (conn);
+
+  return true;
+}
+
+bool
+vsx_connection_load_state (VsxConnection *conn,
+                           const uint8_t *data,
+                           size_t length,
+                           struct vsx_error **error)
+{
+  assert (conn->state == VSX_CONNECTION_STATE_READING_WS_HEADERS);
+
+  VsxSerialReader reader;
+
+  vsx_serial_reader_init (&reader, data, length);
+
+  bool has_person = vsx_serial_read_u8 (&reader);
+  VsxPersonId person_id = has_person ? vsx_serial_read_u64 (&reader) : 0;
+  unsigned int message_num = vsx_serial_read_u32 (&reader);
+  int64_t last_message_time = vsx_serial_read_u64 (&reader);
+  uint32_t n_frames_received = vsx_serial_read_u32 (&reader);
+  uint8_t dirty_flags = vsx_serial_read_u8 (&reader);
+  uint8_t pending_error = vsx_serial_read_u8 (&reader);
+  size_t pong_data_length, message_data_length, read_buf_length;
+  const uint8_t *pong_data =
+    vsx_serial_read_data (&reader, &pong_data_length);
+  const uint8_t *message_data =
+    vsx_serial_read_data (&reader, &message_data_length);
+  const uint8_t *read_buf =
+    vsx_serial_read_data (&reader, &read_buf_length);
+
+  if (reader.error
+      || reader.p != reader.end
+      || (dirty_flags & ~VSX_CONNECTION_SAVED_DIRTY_FLAGS)
+      || pong_data_length > sizeof conn->pong_data
+      || message_data_length > VSX_PROTO_MAX_PAYLOAD_SIZE)
+    {
+      vsx_set_error (error,
+                     &vsx_connection_error,
+                     VSX_CONNECTION_ERROR_INVALID_STATE,
+                     "Invalid saved connection state");
+      return false;
+    }
+
+  /* The WebSocket handshake was already done by the old process */
+  vsx_ws_parser_free (conn->ws_parser);
+  conn->ws_parser = NULL;
+  conn->state = VSX_CONNECTION_STATE_WRITING_DATA;
+
+  if (has_person && !load_person (conn, person_id, message_num, error))
+    return false;
+
+  conn->last_message_time = last_message_time;
+  conn->n_frames_received = n_frames_received;
+  conn->dirty_flags |= dirty_flags;
+  conn->pending_error = pending_error;
+  memcpy (conn->pong_data, pong_data, pong_data_length);
+  conn->pong_data_length = pong_data_length;
+
+  if (message_data_length > 0)
+    {
+      conn->message_data = alloc_buffer ();
+      memcpy (conn->message_data, message_data, message_data_length);
+      conn->message_data_length = message_data_length;
+    }
+
+  /* The read buffer only ever contains an incomplete frame so feeding
+   * it through the parser again won’t process anything */
+  return vsx_connection_parse_data (conn, read_buf, read_buf_length, error);
+}
+
 void
 vsx_connection_free (VsxConnection *conn)
 {
+  vsx_journal_add (VSX_JOURNAL_RECORD_DISCONNECT,
+                   conn->journal_id,
+                   get_journal_conversation_id (conn),
+                   NULL, /* payload */
+                   0 /* payload_length */);
+
   if (conn->person)
     {
       vsx_list_remove (&conn->conversation_changed_listener.link);
+      vsx_frame_log_cursor_destroy (&conn->log_cursor);
       vsx_object_unref (conn->person);
     }
 
-  vsx_object_unref (conn->conversation_set);
-  vsx_object_unref (conn->person_set);
+  /* The sets will be NULL if the connection is freed in the middle of
+   * a handoff */
+  if (conn->conversation_set)
+    vsx_object_unref (conn->conversation_set);
+  if (conn->person_set)
+    vsx_object_unref (conn->person_set);
+
+  vsx_buffer_destroy (&conn->handoff_data);
 
   if (conn->ws_parser)
     vsx_ws_parser_free (conn->ws_parser);
 
+  if (conn->read_buf)
+    free_buffer (conn->read_buf);
+
+  release_message_data (conn);
+
   vsx_free (conn);
 }
+
+size_t
+vsx_connection_get_memory_usage (VsxConnection *conn)
+{
+  size_t total = sizeof *conn + conn->handoff_data.size;
+
+  if (conn->ws_parser)
+    total += vsx_ws_parser_get_size ();
+  if (conn->read_buf)
+    total += sizeof *conn->read_buf;
+  if (conn->message_data)
+    total += VSX_CONNECTION_BUFFER_SIZE;
+
+  return total;
+}
+
+void
+vsx_connection_flush_buffer_pool (void)
+{
+  vsx_shared_slice_flush (&buffer_allocator, &buffer_magazine);
+}
@@ -24,12 +24,23 @@
 #include "vsx-signal.h"
 #include "vsx-error.h"
 #include "vsx-netaddress.h"
+#include "vsx-buffer.h"
 
 typedef struct _VsxConnection VsxConnection;
 
+/* Maximum number of bytes that a connection should use once it has
+ * finished the WebSocket handshake and has nothing buffered in either
+ * direction, as reported by vsx_connection_get_memory_usage. This is
+ * checked by the unit tests. It doesn’t include the server’s
+ * per-socket state, which has its own budget in vsx-server.c, or the
+ * kernel’s socket buffers.
+ */
+#define VSX_CONNECTION_IDLE_MEMORY_BUDGET 512
+
 typedef enum
 {
   VSX_CONNECTION_ERROR_INVALID_PROTOCOL,
+  VSX_CONNECTION_ERROR_INVALID_STATE,
 } VsxConnectionError;
 
 extern struct vsx_error_domain
@@ -67,7 +78,80 @@ vsx_connection_get_changed_signal (VsxConnection *conn);
 int64_t
 vsx_connection_get_last_message_time (VsxConnection *conn);
 
+/* Returns the number of complete WebSocket frames that have been
+ * received so far. This wraps around after UINT32_MAX frames. */
+uint32_t
+vsx_connection_get_n_frames_received (VsxConnection *conn);
+
+/* Tells the connection which shard it is running on. By default a
+ * connection assumes there is only one shard and it will never need
+ * to be handed off.
+ */
+void
+vsx_connection_set_shard (VsxConnection *conn,
+                          int shard_num,
+                          int n_shards);
+
+/* Returns the shard that the connection needs to move to before it
+ * can process any more data, or -1 if it can stay where it is. Once
+ * this becomes set the connection won’t process any more data until
+ * it is detached and attached to the new shard.
+ */
+int
+vsx_connection_get_handoff_shard (VsxConnection *conn);
+
+/* Drops the references to the sets of the old shard. This must be
+ * called on the thread of the old shard.
+ */
+void
+vsx_connection_detach (VsxConnection *conn);
+
+/* Attaches the connection to the sets of its new shard and continues
+ * processing the data that was queued during the handoff. This must
+ * be called on the thread of the new shard.
+ */
+bool
+vsx_connection_attach (VsxConnection *conn,
+                       VsxConversationSet *conversation_set,
+                       VsxPersonSet *person_set,
+                       int shard_num,
+                       struct vsx_error **error);
+
+/* Appends enough state to the buffer for a connection in another
+ * process to carry on from where this one is. This is used to hand
+ * the connections over to a new binary. Returns false without
+ * writing anything if the connection can’t be saved because it is
+ * still in the WebSocket handshake or is moving to another shard.
+ */
+bool
+vsx_connection_save_state (VsxConnection *conn,
+                           struct vsx_buffer *buffer);
+
+/* Restores state written by vsx_connection_save_state onto a newly
+ * created connection. The person that the connection was following
+ * must already be in the person set. The connection will resend the
+ * full state of the conversation so that anything in the old
+ * process’s frame log doesn’t need to be saved.
+ */
+bool
+vsx_connection_load_state (VsxConnection *conn,
+                           const uint8_t *data,
+                           size_t length,
+                           struct vsx_error **error);
+
 void
 vsx_connection_free (VsxConnection *conn);
 
+/* Returns the number of bytes allocated for the connection, including
+ * any buffers that it is currently holding */
+size_t
+vsx_connection_get_memory_usage (VsxConnection *conn);
+
+/* The read buffers are taken from a pool with a cache per thread.
+ * This should be called before a thread that has been using
+ * connections exits so that the cached buffers go back to the
+ * pool. */
+void
+vsx_connection_flush_buffer_pool (void);
+
 #endif /* VSX_CONNECTION_H */
@@ -26,8 +26,9 @@
 #include "vsx-list.h"
 #include "vsx-hash-table.h"
 #include "vsx-generate-id.h"
+#include "vsx-shard.h"
 
-typedef struct
+typedef struct _VsxConversationSetListener
 {
   struct vsx_list link;
 
@@ -36,6 +37,13 @@ typedef struct
    * joining a game that has already started.
    */
   char *room_name;
+  /* While the room name is set, the listener is in the room name
+   * index keyed by a hash of the name. Only the first listener with a
+   * given hash is in the hash table and any others are chained from
+   * it.
+   */
+  struct vsx_hash_table_entry room_entry;
+  struct _VsxConversationSetListener *next_same_hash;
 
   VsxConversation *conversation;
   VsxConversationSet *set;
@@ -47,26 +55,120 @@ struct _VsxConversationSet
   VsxObject parent;
 
   struct vsx_hash_table hash_table;
+  /* Index of the pending conversations by room name */
+  struct vsx_hash_table room_names;
 
   /* List of conversations that have a room name and can still be
    * joined. Once the game starts or can no longer be joined the
-   * listener will move to the other list so this one can be quickly
-   * scanned for pending games.
+   * listener will move to the other list.
    */
   struct vsx_list pending_listeners;
   /* All the other conversations */
   struct vsx_list other_listeners;
+
+  int shard_num;
+  int n_shards;
+
+  /* Shared counters to keep track of the number of conversations.
+   * This can be NULL. */
+  VsxAdmission *admission;
 };
 
+static VsxConversationSetListener *
+get_room_name_head (VsxConversationSet *set,
+                    uint64_t hash)
+{
+  struct vsx_hash_table_entry *entry =
+    vsx_hash_table_get (&set->room_names, hash);
+
+  return (entry
+          ? vsx_container_of (entry, VsxConversationSetListener, room_entry)
+          : NULL);
+}
+
+static VsxConversationSetListener *
+find_pending_listener (VsxConversationSet *set,
+                       const char *room_name)
+{
+  VsxConversationSetListener *listener =
+    get_room_name_head (set, vsx_shard_hash_room_name (room_name));
+
+  for (; listener; listener = listener->next_same_hash)
+    {
+      if (!strcmp (listener->room_name, room_name))
+        return listener;
+    }
+
+  return NULL;
+}
+
+static void
+add_room_name (VsxConversationSetListener *listener,
+               const char *room_name)
+{
+  VsxConversationSet *set = listener->set;
+  uint64_t hash = vsx_shard_hash_room_name (room_name);
+  VsxConversationSetListener *head = get_room_name_head (set, hash);
+
+  listener->room_name = vsx_strdup (room_name);
+  listener->room_entry.id = hash;
+
+  if (head)
+    {
+      listener->next_same_hash = head->next_same_hash;
+      head->next_same_hash = listener;
+    }
+  else
+    {
+      listener->next_same_hash = NULL;
+      vsx_hash_table_add (&set->room_names, &listener->room_entry);
+    }
+}
+
+static void
+remove_room_name (VsxConversationSetListener *listener)
+{
+  VsxConversationSet *set = listener->set;
+  VsxConversationSetListener *head =
+    get_room_name_head (set, listener->room_entry.id);
+
+  if (head == listener)
+    {
+      vsx_hash_table_remove (&set->room_names, &listener->room_entry);
+
+      /* Let the next listener with the same hash take its place */
+      if (listener->next_same_hash)
+        vsx_hash_table_add (&set->room_names,
+                            &listener->next_same_hash->room_entry);
+    }
+  else
+    {
+      VsxConversationSetListener **prev = &head->next_same_hash;
+
+      while (*prev != listener)
+        prev = &(*prev)->next_same_hash;
+
+      *prev = listener->next_same_hash;
+    }
+
+  vsx_free (listener->room_name);
+  listener->room_name = NULL;
+}
+
 static void
 remove_listener (VsxConversationSetListener *listener)
 {
+  if (listener->room_name)
+    remove_room_name (listener);
+
   vsx_list_remove (&listener->link);
   vsx_list_remove (&listener->conversation_changed_listener.link);
   vsx_hash_table_remove (&listener->set->hash_table,
                          &listener->conversation->hash_entry);
+
+  if (listener->set->admission)
+    vsx_admission_add_conversations (listener->set->admission, -1);
   vsx_object_unref (listener->conversation);
-  vsx_free (listener->room_name);
   vsx_free (listener);
 }
 
@@ -102,8 +204,7 @@ conversation_changed_cb (struct vsx_listener *listener,
     {
       vsx_list_remove (&c_listener->link);
       vsx_list_insert (&c_listener->set->other_listeners, &c_listener->link);
-      vsx_free (c_listener->room_name);
-      c_listener->room_name = NULL;
+      remove_room_name (c_listener);
     }
 
   if (data->type == VSX_CONVERSATION_PLAYER_CHANGED &&
@@ -146,6 +247,7 @@ vsx_conversation_set_free (void *object)
   remove_listeners (&self->pending_listeners);
   remove_listeners (&self->other_listeners);
 
+  vsx_hash_table_destroy (&self->room_names);
   vsx_hash_table_destroy (&self->hash_table);
 
   vsx_free (self);
@@ -198,7 +300,8 @@ get_tile_data_for_language_code (const char *language_code)
 }
 
 VsxConversationSet *
-vsx_conversation_set_new (void)
+vsx_conversation_set_new_for_shard (int shard_num,
+                                    int n_shards)
 {
   VsxConversationSet *self = vsx_calloc (sizeof *self);
 
@@ -207,27 +310,36 @@ vsx_conversation_set_new (void)
   vsx_list_init (&self->pending_listeners);
   vsx_list_init (&self->other_listeners);
   vsx_hash_table_init (&self->hash_table);
+  vsx_hash_table_init (&self->room_names);
+
+  self->shard_num = shard_num;
+  self->n_shards = n_shards;
 
   return self;
 }
 
-static VsxConversationSetListener *
-generate_conversation (VsxConversationSet *set,
-                       const VsxTileData *tile_data,
-                       const struct vsx_netaddress *addr)
+VsxConversationSet *
+vsx_conversation_set_new (void)
 {
-  VsxConversationId id;
+  return vsx_conversation_set_new_for_shard (0, /* shard_num */
+                                             1 /* n_shards */);
+}
 
-  /* Keep generating ids until we find one that isn't used. It's
-   * hopefully pretty unlikely that it will generate a clash.
-   */
-  do
-    id = vsx_generate_id (addr);
-  while (vsx_hash_table_get (&set->hash_table, id));
+void
+vsx_conversation_set_set_admission (VsxConversationSet *set,
+                                    VsxAdmission *admission)
+{
+  set->admission = admission;
+}
 
+/* Takes ownership of the conversation */
+static VsxConversationSetListener *
+add_listener (VsxConversationSet *set,
+              VsxConversation *conversation)
+{
   VsxConversationSetListener *listener = vsx_alloc (sizeof *listener);
 
-  listener->conversation = vsx_conversation_new (id, tile_data);
+  listener->conversation = conversation;
 
   listener->room_name = NULL;
   listener->set = set;
@@ -241,9 +353,31 @@ generate_conversation (VsxConversationSet *set,
 
   vsx_hash_table_add (&set->hash_table, &listener->conversation->hash_entry);
 
+  if (set->admission)
+    vsx_admission_add_conversations (set->admission, 1);
+
   return listener;
 }
 
+static VsxConversationSetListener *
+generate_conversation (VsxConversationSet *set,
+                       const VsxTileData *tile_data,
+                       const struct vsx_netaddress *addr)
+{
+  VsxConversationId id;
+
+  /* Keep generating ids until we find one that isn't used. It's
+   * hopefully pretty unlikely that it will generate a clash.
+   */
+  do
+    id = vsx_shard_pin_id (vsx_generate_id (addr),
+                           set->shard_num,
+                           set->n_shards);
+  while (vsx_hash_table_get (&set->hash_table, id));
+
+  return add_listener (set, vsx_conversation_new (id, tile_data));
+}
+
 VsxConversation *
 vsx_conversation_set_generate_conversation (VsxConversationSet *set,
                                             const char *language_code,
@@ -274,13 +408,11 @@ vsx_conversation_set_get_pending_conversation (VsxConversationSet *set,
                                                const char *room_name,
                                                const struct vsx_netaddress *add)
 {
-  VsxConversationSetListener *listener;
+  VsxConversationSetListener *listener =
+    find_pending_listener (set, room_name);
 
-  vsx_list_for_each (listener, &set->pending_listeners, link)
-    {
-      if (!strcmp (listener->room_name, room_name))
-        return vsx_object_ref (listener->conversation);
-    }
+  if (listener)
+    return vsx_object_ref (listener->conversation);
 
   const VsxTileData *tile_data = get_tile_data_for_room_name (room_name);
 
@@ -289,7 +421,101 @@ vsx_conversation_set_get_pending_conversation (VsxConversationSet *set,
 
   vsx_list_insert (&set->pending_listeners, &listener->link);
 
-  listener->room_name = vsx_strdup (room_name);
+  add_room_name (listener, room_name);
 
   return vsx_object_ref (listener->conversation);
 }
+
+bool
+vsx_conversation_set_add_conversation (VsxConversationSet *set,
+                                       VsxConversation *conversation,
+                                       const char *room_name)
+{
+  VsxConversationId id = conversation->hash_entry.id;
+
+  if (vsx_shard_for_id (id, set->n_shards) != set->shard_num
+      || vsx_hash_table_get (&set->hash_table, id)
+      || (room_name && find_pending_listener (set, room_name)))
+    return false;
+
+  VsxConversationSetListener *listener =
+    add_listener (set, vsx_object_ref (conversation));
+
+  if (room_name && conversation->state == VSX_CONVERSATION_AWAITING_START)
+    {
+      vsx_list_insert (&set->pending_listeners, &listener->link);
+      add_room_name (listener, room_name);
+    }
+  else
+    {
+      vsx_list_insert (&set->other_listeners, &listener->link);
+    }
+
+  return true;
+}
+
+static void
+foreach_listener (struct vsx_list *list,
+                  VsxConversationSetForeachCb cb,
+                  void *user_data)
+{
+  VsxConversationSetListener *listener;
+
+  vsx_list_for_each (listener, list, link)
+    cb (listener->conversation, listener->room_name, user_data);
+}
+
+void
+vsx_conversation_set_foreach (VsxConversationSet *set,
+                              VsxConversationSetForeachCb cb,
+                              void *user_data)
+{
+  foreach_listener (&set->pending_listeners, cb, user_data);
+  foreach_listener (&set->other_listeners, cb, user_data);
+}
+
+void
+vsx_conversation_set_get_ids (VsxConversationSet *set,
+                              struct vsx_buffer *buffer)
+{
+  size_t start = buffer->length;
+
+  vsx_buffer_set_length (buffer,
+                         start
+                         + set->hash_table.n_entries
+                         * sizeof (VsxConversationId));
+
+  VsxConversationId *ids = (VsxConversationId *) (buffer->data + start);
+  struct vsx_hash_table_iter iter;
+
+  vsx_hash_table_iter_init (&iter, &set->hash_table);
+
+  while (vsx_hash_table_iter_next_id (&iter, ids))
+    ids++;
+}
+
+const char *
+vsx_conversation_set_get_room_name (VsxConversationSet *set,
+                                    VsxConversation *conversation)
+{
+  struct vsx_listener *listener;
+
+  /* The set’s listener is one of the few on the changed signal */
+  vsx_list_for_each (listener,
+                     &conversation->changed_signal.listener_list,
+                     link)
+    {
+      if (listener->notify != conversation_changed_cb)
+        continue;
+
+      VsxConversationSetListener *c_listener =
+        vsx_container_of (listener,
+                          VsxConversationSetListener,
+                          conversation_changed_listener);
+
+      if (c_listener->set == set)
+        return c_listener->room_name;
+    }
+
+  return NULL;
+}
@@ -21,6 +21,8 @@
 
 #include "vsx-conversation.h"
 #include "vsx-netaddress.h"
+#include "vsx-admission.h"
+#include "vsx-buffer.h"
 
 /* This class represents a list of pending conversations. It only
    contains conversations that can still be joined. As soon as the
@@ -32,6 +34,20 @@ typedef struct _VsxConversationSet VsxConversationSet;
 VsxConversationSet *
 vsx_conversation_set_new (void);
 
+/* Creates a set for one shard of a sharded server. All of the
+ * conversations that it generates will have IDs that map to the given
+ * shard.
+ */
+VsxConversationSet *
+vsx_conversation_set_new_for_shard (int shard_num,
+                                    int n_shards);
+
+/* Makes the set keep the shared count of conversations up to date.
+ * This must be called before any conversations are added. */
+void
+vsx_conversation_set_set_admission (VsxConversationSet *set,
+                                    VsxAdmission *admission);
+
 VsxConversation *
 vsx_conversation_set_get_conversation (VsxConversationSet *set,
                                        VsxConversationId id);
@@ -46,4 +62,41 @@ vsx_conversation_set_get_pending_conversation (VsxConversationSet *set,
                                                const char *room_name,
                                                const struct vsx_netaddress *a);
 
+/* Adds an existing conversation to the set, for example one that was
+ * restored from a snapshot. If the room name isn’t NULL and the game
+ * hasn’t started then other players can join it by the name. Returns
+ * false if the ID is already used or belongs to another shard. The
+ * set takes its own reference. */
+bool
+vsx_conversation_set_add_conversation (VsxConversationSet *set,
+                                       VsxConversation *conversation,
+                                       const char *room_name);
+
+typedef void
+(* VsxConversationSetForeachCb) (VsxConversation *conversation,
+                                 const char *room_name,
+                                 void *user_data);
+
+/* Calls the callback for every conversation in the set. The room name
+ * is NULL unless the conversation can still be joined by name. The
+ * callback must not modify the set. */
+void
+vsx_conversation_set_foreach (VsxConversationSet *set,
+                              VsxConversationSetForeachCb cb,
+                              void *user_data);
+
+/* Appends the ID of every conversation in the set to the buffer as an
+ * array of VsxConversationId. Only the set’s index is read, so this
+ * is quick even with lots of conversations. */
+void
+vsx_conversation_set_get_ids (VsxConversationSet *set,
+                              struct vsx_buffer *buffer);
+
+/* Returns the name that the conversation can be joined by or NULL if
+ * it can’t be joined by name anymore. The conversation must be in the
+ * set. */
+const char *
+vsx_conversation_set_get_room_name (VsxConversationSet *set,
+                                    VsxConversation *conversation);
+
 #endif /* VSX_CONVERSATION_SET_H */
@@ -21,10 +21,13 @@
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <stdarg.h>
 
 #include "vsx-conversation.h"
 #include "vsx-main-context.h"
 #include "vsx-log.h"
+#include "vsx-metrics.h"
 #include "vsx-proto.h"
 #include "vsx-utf8.h"
 #include "vsx-util.h"
@@ -39,7 +42,32 @@ _Static_assert(VSX_CONVERSATION_DEFAULT_N_TILES <=
                "The default number of tiles can’t exceed the amount in the "
                "tile data.");
 
-static uint16_t next_log_id = 0;
+/* This is atomic because conversations can be created from multiple
+ * shard threads at once */
+static atomic_uint next_log_id = 0;
+
+static VsxMetricsCounter
+get_state_counter (VsxConversation *conversation)
+{
+  switch (conversation->state)
+    {
+    case VSX_CONVERSATION_AWAITING_START:
+      break;
+    case VSX_CONVERSATION_IN_PROGRESS:
+      return VSX_METRICS_IN_PROGRESS_CONVERSATIONS;
+    }
+
+  return VSX_METRICS_AWAITING_START_CONVERSATIONS;
+}
+
+static void
+set_state (VsxConversation *conversation,
+           int state)
+{
+  vsx_metrics_add (get_state_counter (conversation), -1);
+  conversation->state = state;
+  vsx_metrics_add (get_state_counter (conversation), 1);
+}
 
 static void
 vsx_conversation_free (void *object)
@@ -49,6 +77,8 @@ vsx_conversation_free (void *object)
 
   vsx_log ("Game %i destroyed", self->log_id);
 
+  vsx_metrics_add (get_state_counter (self), -1);
+
   int n_messages = vsx_conversation_get_n_messages (self);
 
   for (i = 0; i < n_messages; i++)
@@ -63,6 +93,8 @@ vsx_conversation_free (void *object)
 
   vsx_buffer_destroy (&self->messages);
 
+  vsx_frame_log_destroy (&self->frame_log);
+
   vsx_free (self);
 }
 
@@ -72,12 +104,33 @@ vsx_conversation_class =
     .free = vsx_conversation_free,
   };
 
+static void
+log_command (VsxConversation *conversation,
+             int command,
+             ...)
+{
+  const size_t max_size = (VSX_PROTO_MAX_FRAME_HEADER_LENGTH
+                           + VSX_PROTO_MAX_PAYLOAD_SIZE);
+  uint8_t *buf = vsx_frame_log_begin (&conversation->frame_log, max_size);
+  va_list ap;
+
+  va_start (ap, command);
+  int wrote = vsx_proto_write_command_v (buf, max_size, command, ap);
+  va_end (ap);
+
+  assert (wrote > 0);
+
+  vsx_frame_log_commit (&conversation->frame_log, wrote);
+}
+
 static void
 vsx_conversation_changed (VsxConversation *conversation,
                           VsxConversationChangedType type)
 {
   VsxConversationChangedData data;
 
+  conversation->snapshot_generation = 0;
+
   data.conversation = conversation;
   data.type = type;
 
@@ -90,6 +143,14 @@ vsx_conversation_player_changed (VsxConversation *conversation,
 {
   VsxConversationChangedData data;
 
+  conversation->snapshot_generation = 0;
+
+  log_command (conversation,
+               VSX_PROTO_PLAYER,
+               VSX_PROTO_TYPE_UINT8, player->num,
+               VSX_PROTO_TYPE_UINT8, player->flags,
+               VSX_PROTO_TYPE_NONE);
+
   data.conversation = conversation;
   data.type = VSX_CONVERSATION_PLAYER_CHANGED;
   data.num = player->num;
@@ -103,6 +164,17 @@ vsx_conversation_tile_changed (VsxConversation *conversation,
 {
   VsxConversationChangedData data;
 
+  conversation->snapshot_generation = 0;
+
+  log_command (conversation,
+               VSX_PROTO_TILE,
+               VSX_PROTO_TYPE_UINT8, (int) (tile - conversation->tiles),
+               VSX_PROTO_TYPE_INT16, tile->x,
+               VSX_PROTO_TYPE_INT16, tile->y,
+               VSX_PROTO_TYPE_STRING, tile->letter,
+               VSX_PROTO_TYPE_UINT8, tile->last_player,
+               VSX_PROTO_TYPE_NONE);
+
   data.conversation = conversation;
   data.type = VSX_CONVERSATION_TILE_CHANGED;
   data.num = tile - conversation->tiles;
@@ -120,12 +192,18 @@ vsx_conversation_start (VsxConversation *conversation)
                "Game %i started with %i players",
                conversation->log_id,
                conversation->n_connected_players);
-      conversation->state = VSX_CONVERSATION_IN_PROGRESS;
+      set_state (conversation, VSX_CONVERSATION_IN_PROGRESS);
       vsx_conversation_changed (conversation,
                                 VSX_CONVERSATION_STATE_CHANGED);
     }
 }
 
+void
+vsx_conversation_restore_started (VsxConversation *conversation)
+{
+  set_state (conversation, VSX_CONVERSATION_IN_PROGRESS);
+}
+
 void
 vsx_conversation_add_message (VsxConversation *conversation,
                               unsigned int player_num,
@@ -158,6 +236,12 @@ vsx_conversation_add_message (VsxConversation *conversation,
 
   message->text = vsx_strndup (buffer, raw_length);
 
+  log_command (conversation,
+               VSX_PROTO_MESSAGE,
+               VSX_PROTO_TYPE_UINT8, player_num,
+               VSX_PROTO_TYPE_STRING, message->text,
+               VSX_PROTO_TYPE_NONE);
+
   vsx_conversation_changed (conversation,
                             VSX_CONVERSATION_MESSAGE_ADDED);
 }
@@ -353,7 +437,7 @@ vsx_conversation_new (VsxConversationId id,
 
   self->hash_entry.id = id;
 
-  self->log_id = next_log_id++;
+  self->log_id = (uint16_t) atomic_fetch_add (&next_log_id, 1);
   self->n_tiles_in_play = 0;
   self->total_n_tiles = VSX_CONVERSATION_DEFAULT_N_TILES;
   self->tile_data = tile_data;
@@ -362,7 +446,10 @@ vsx_conversation_new (VsxConversationId id,
 
   vsx_buffer_init (&self->messages);
 
+  vsx_frame_log_init (&self->frame_log);
+
   self->state = VSX_CONVERSATION_AWAITING_START;
+  vsx_metrics_add (VSX_METRICS_AWAITING_START_CONVERSATIONS, 1);
 
   return self;
 }
@@ -566,6 +653,11 @@ vsx_conversation_shout (VsxConversation *conversation,
 
   conversation->last_shout_time = vsx_main_context_get_monotonic_clock (NULL);
 
+  log_command (conversation,
+               VSX_PROTO_PLAYER_SHOUTED,
+               VSX_PROTO_TYPE_UINT8, player_num,
+               VSX_PROTO_TYPE_NONE);
+
   data.conversation = conversation;
   data.type = VSX_CONVERSATION_SHOUTED;
   data.num = player_num;
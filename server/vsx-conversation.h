@@ -28,6 +28,7 @@
 #include "vsx-tile-data.h"
 #include "vsx-buffer.h"
 #include "vsx-hash-table.h"
+#include "vsx-frame-log.h"
 
 #define VSX_CONVERSATION_MAX_PLAYERS 6
 
@@ -69,7 +70,20 @@ typedef struct
 
   int64_t last_shout_time;
 
+  /* Every change that is sent to all of the players is encoded once
+   * into this log and then the connections copy the frames out of
+   * it. */
+  VsxFrameLog frame_log;
+
   int log_id;
+
+  /* The generation of the last snapshot that the conversation was
+   * written to and where its record is in that snapshot. This is
+   * reset to zero whenever the conversation changes so that an
+   * unchanged record can be copied instead of encoded again. */
+  uint64_t snapshot_generation;
+  size_t snapshot_offset;
+  size_t snapshot_length;
 } VsxConversation;
 
 typedef struct
@@ -126,6 +140,11 @@ vsx_conversation_set_tile_data (VsxConversation *conversation,
 void
 vsx_conversation_start (VsxConversation *conversation);
 
+/* Marks a conversation that is being restored from a snapshot as
+ * started without logging it or notifying anyone */
+void
+vsx_conversation_restore_started (VsxConversation *conversation);
+
 void
 vsx_conversation_add_message (VsxConversation *conversation,
                               unsigned int player_num,
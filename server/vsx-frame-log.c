@@ -0,0 +1,144 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vsx-frame-log.h"
+
+#include <assert.h>
+
+#include "vsx-util.h"
+
+static VsxFrameLogChunk *
+chunk_new (uint64_t offset)
+{
+  VsxFrameLogChunk *chunk = vsx_alloc (sizeof *chunk);
+
+  chunk->ref_count = 1;
+  chunk->next = NULL;
+  chunk->offset = offset;
+  chunk->length = 0;
+
+  return chunk;
+}
+
+static VsxFrameLogChunk *
+chunk_ref (VsxFrameLogChunk *chunk)
+{
+  chunk->ref_count++;
+  return chunk;
+}
+
+static void
+chunk_unref (VsxFrameLogChunk *chunk)
+{
+  /* This is a loop instead of recursion so that a long chain of
+   * chunks can’t overflow the stack */
+  while (chunk && --chunk->ref_count <= 0)
+    {
+      VsxFrameLogChunk *next = chunk->next;
+      vsx_free (chunk);
+      chunk = next;
+    }
+}
+
+void
+vsx_frame_log_init (VsxFrameLog *log)
+{
+  log->tail = chunk_new (0);
+}
+
+uint8_t *
+vsx_frame_log_begin (VsxFrameLog *log,
+                     size_t max_size)
+{
+  assert (max_size <= VSX_FRAME_LOG_CHUNK_SIZE);
+
+  VsxFrameLogChunk *tail = log->tail;
+
+  if (tail->length + max_size > VSX_FRAME_LOG_CHUNK_SIZE)
+    {
+      /* The new chunk is referenced both by the link from the old
+       * tail and by the log. The log’s reference to the old tail is
+       * dropped so it will be freed once no cursors are using it. */
+      tail->next = chunk_new (tail->offset + tail->length);
+      log->tail = tail->next;
+      chunk_ref (log->tail);
+      chunk_unref (tail);
+      tail = log->tail;
+    }
+
+  return tail->data + tail->length;
+}
+
+void
+vsx_frame_log_commit (VsxFrameLog *log,
+                      size_t size)
+{
+  assert (log->tail->length + size <= VSX_FRAME_LOG_CHUNK_SIZE);
+
+  log->tail->length += size;
+}
+
+void
+vsx_frame_log_destroy (VsxFrameLog *log)
+{
+  chunk_unref (log->tail);
+}
+
+void
+vsx_frame_log_cursor_init (VsxFrameLogCursor *cursor,
+                           VsxFrameLog *log)
+{
+  cursor->chunk = chunk_ref (log->tail);
+  cursor->pos = log->tail->length;
+}
+
+const uint8_t *
+vsx_frame_log_cursor_get_data (VsxFrameLogCursor *cursor,
+                               size_t *length_out)
+{
+  /* Move on to the next chunk if we’ve finished this one */
+  if (cursor->pos >= cursor->chunk->length && cursor->chunk->next)
+    {
+      VsxFrameLogChunk *old = cursor->chunk;
+
+      cursor->chunk = chunk_ref (old->next);
+      cursor->pos = 0;
+      chunk_unref (old);
+    }
+
+  *length_out = cursor->chunk->length - cursor->pos;
+
+  return cursor->chunk->data + cursor->pos;
+}
+
+void
+vsx_frame_log_cursor_advance (VsxFrameLogCursor *cursor,
+                              size_t length)
+{
+  assert (cursor->pos + length <= cursor->chunk->length);
+
+  cursor->pos += length;
+}
+
+void
+vsx_frame_log_cursor_destroy (VsxFrameLogCursor *cursor)
+{
+  chunk_unref (cursor->chunk);
+}
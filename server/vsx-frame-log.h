@@ -0,0 +1,106 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_FRAME_LOG_H
+#define VSX_FRAME_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* A log of WebSocket frames that have already been encoded so that
+ * they can be copied directly to every connection that is reading
+ * it. The log is a singly-linked list of chunks. The log itself only
+ * keeps a reference to the last chunk and every chunk keeps a
+ * reference to the next one, so a chunk is freed as soon as all of
+ * the cursors have moved past it. A frame never spans two chunks.
+ */
+
+#define VSX_FRAME_LOG_CHUNK_SIZE 4096
+
+typedef struct _VsxFrameLogChunk VsxFrameLogChunk;
+
+struct _VsxFrameLogChunk
+{
+  int ref_count;
+  VsxFrameLogChunk *next;
+  /* Offset of the start of this chunk from the start of the log */
+  uint64_t offset;
+  size_t length;
+  uint8_t data[VSX_FRAME_LOG_CHUNK_SIZE];
+};
+
+typedef struct
+{
+  VsxFrameLogChunk *tail;
+} VsxFrameLog;
+
+typedef struct
+{
+  VsxFrameLogChunk *chunk;
+  size_t pos;
+} VsxFrameLogCursor;
+
+void
+vsx_frame_log_init (VsxFrameLog *log);
+
+/* Returns a pointer where up to max_size bytes can be written. The
+ * frame isn’t part of the log until vsx_frame_log_commit is called
+ * with the actual size. */
+uint8_t *
+vsx_frame_log_begin (VsxFrameLog *log,
+                     size_t max_size);
+
+void
+vsx_frame_log_commit (VsxFrameLog *log,
+                      size_t size);
+
+static inline uint64_t
+vsx_frame_log_get_end (const VsxFrameLog *log)
+{
+  return log->tail->offset + log->tail->length;
+}
+
+void
+vsx_frame_log_destroy (VsxFrameLog *log);
+
+/* Initialises the cursor to point to the end of the log so that it
+ * will only see frames that are added afterwards. */
+void
+vsx_frame_log_cursor_init (VsxFrameLogCursor *cursor,
+                           VsxFrameLog *log);
+
+static inline uint64_t
+vsx_frame_log_cursor_get_offset (const VsxFrameLogCursor *cursor)
+{
+  return cursor->chunk->offset + cursor->pos;
+}
+
+/* Returns the frames that are available in the current chunk. This
+ * always consists of whole frames. */
+const uint8_t *
+vsx_frame_log_cursor_get_data (VsxFrameLogCursor *cursor,
+                               size_t *length_out);
+
+void
+vsx_frame_log_cursor_advance (VsxFrameLogCursor *cursor,
+                              size_t length);
+
+void
+vsx_frame_log_cursor_destroy (VsxFrameLogCursor *cursor);
+
+#endif /* VSX_FRAME_LOG_H */
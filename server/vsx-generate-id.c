@@ -20,10 +20,7 @@
 
 #include "vsx-generate-id.h"
 
-#include <stdlib.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <string.h>
+#include "vsx-random.h"
 
 static void
 xor_bytes(uint64_t *id,
@@ -40,39 +37,10 @@ xor_bytes(uint64_t *id,
         }
 }
 
-static int
-fill_from_urandom(void *buf, size_t size)
-{
-        int fd = open("/dev/urandom", O_RDONLY);
-
-        if (fd == -1)
-                return 0;
-
-        int got = read(fd, buf, size);
-
-        close(fd);
-
-        return got == -1 ? 0 : got;
-}
-
 uint64_t
 vsx_generate_id(const struct vsx_netaddress *remote_address)
 {
-        uint16_t random_data;
-        uint64_t id = 0;
-        int i;
-
-        int got = fill_from_urandom(&id, sizeof id);
-
-        /* If it didn’t work, fill in the remaining data with rand() */
-        for (i = got / sizeof random_data;
-             i < sizeof id / sizeof random_data;
-             i++) {
-                random_data = rand();
-                memcpy((uint8_t *) &id + i * sizeof random_data,
-                       &random_data,
-                       sizeof random_data);
-        }
+        uint64_t id = vsx_random_uint64();
 
         /* XOR in the bytes of the client's address so that even if
          * the client can predict the random number sequence it'll
@@ -0,0 +1,342 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vsx-journal.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+
+#include "vsx-util.h"
+#include "vsx-proto.h"
+#include "vsx-ring-writer.h"
+#include "vsx-file-error.h"
+#include "vsx-main-context.h"
+
+/* Larger payloads are dropped. This is enough for any message that a
+ * connection will accept. */
+#define VSX_JOURNAL_MAX_PAYLOAD_SIZE 1024
+
+static VsxRingWriter *vsx_journal_writer = NULL;
+
+/* Monotonic time when the journal was started in microseconds */
+static int64_t vsx_journal_start_time;
+
+static uint64_t vsx_journal_n_dropped_closed = 0;
+
+static _Atomic uint64_t vsx_journal_next_connection_id = 1;
+
+bool
+vsx_journal_available (void)
+{
+  return vsx_journal_writer != NULL;
+}
+
+static size_t
+write_varint (uint8_t *buf,
+              uint64_t value)
+{
+  size_t length = 0;
+
+  while (value >= 0x80)
+    {
+      buf[length++] = (value & 0x7f) | 0x80;
+      value >>= 7;
+    }
+
+  buf[length++] = value;
+
+  return length;
+}
+
+static bool
+read_varint (const uint8_t **data,
+             const uint8_t *end,
+             uint64_t *value_out)
+{
+  uint64_t value = 0;
+
+  for (int shift = 0; shift < 64; shift += 7)
+    {
+      if (*data >= end)
+        return false;
+
+      uint8_t byte = *((*data)++);
+
+      value |= (uint64_t) (byte & 0x7f) << shift;
+
+      if ((byte & 0x80) == 0)
+        {
+          *value_out = value;
+          return true;
+        }
+    }
+
+  /* Too long */
+  return false;
+}
+
+static size_t
+write_header (uint8_t *buf,
+              const VsxJournalRecord *record)
+{
+  size_t length = 0;
+
+  buf[length++] = record->type;
+  length += write_varint (buf + length, record->timestamp);
+  length += write_varint (buf + length, record->connection_id);
+  vsx_proto_write_uint64_t (buf + length, record->conversation_id);
+  length += sizeof (uint64_t);
+  length += write_varint (buf + length, record->payload_length);
+
+  return length;
+}
+
+void
+vsx_journal_encode_record (struct vsx_buffer *buffer,
+                           const VsxJournalRecord *record)
+{
+  vsx_buffer_ensure_size (buffer,
+                          buffer->length
+                          + VSX_JOURNAL_MAX_HEADER_SIZE
+                          + record->payload_length);
+
+  buffer->length += write_header (buffer->data + buffer->length, record);
+
+  if (record->payload_length > 0)
+    vsx_buffer_append (buffer, record->payload, record->payload_length);
+}
+
+size_t
+vsx_journal_decode_record (const uint8_t *data,
+                           size_t length,
+                           VsxJournalRecord *record)
+{
+  const uint8_t *p = data, *end = data + length;
+  uint64_t payload_length;
+
+  if (p >= end)
+    return 0;
+
+  record->type = *(p++);
+
+  if (!read_varint (&p, end, &record->timestamp)
+      || !read_varint (&p, end, &record->connection_id)
+      || end - p < sizeof (uint64_t))
+    return 0;
+
+  record->conversation_id = vsx_proto_read_uint64_t (p);
+  p += sizeof (uint64_t);
+
+  if (!read_varint (&p, end, &payload_length)
+      || end - p < payload_length)
+    return 0;
+
+  record->payload = p;
+  record->payload_length = payload_length;
+
+  return p + payload_length - data;
+}
+
+static int64_t
+get_monotonic_time (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * INT64_C (1000000) + ts.tv_nsec / 1000;
+}
+
+static uint64_t
+get_timestamp (int64_t now)
+{
+  /* The main context’s cached clock can be slightly older than the
+   * start time */
+  return now > vsx_journal_start_time ? now - vsx_journal_start_time : 0;
+}
+
+uint64_t
+vsx_journal_generate_connection_id (void)
+{
+  return atomic_fetch_add_explicit (&vsx_journal_next_connection_id,
+                                    1,
+                                    memory_order_relaxed);
+}
+
+void
+vsx_journal_add (VsxJournalRecordType type,
+                 uint64_t connection_id,
+                 uint64_t conversation_id,
+                 const uint8_t *payload,
+                 size_t payload_length)
+{
+  if (!vsx_journal_available ())
+    return;
+
+  if (payload_length > VSX_JOURNAL_MAX_PAYLOAD_SIZE)
+    return;
+
+  uint8_t buf[VSX_JOURNAL_MAX_HEADER_SIZE + VSX_JOURNAL_MAX_PAYLOAD_SIZE];
+  int64_t now = vsx_main_context_get_monotonic_clock (NULL);
+  VsxJournalRecord record = {
+    .type = type,
+    .timestamp = get_timestamp (now),
+    .connection_id = connection_id,
+    .conversation_id = conversation_id,
+    .payload_length = payload_length,
+  };
+
+  size_t header_length = write_header (buf, &record);
+
+  if (payload_length > 0)
+    memcpy (buf + header_length, payload, payload_length);
+
+  vsx_ring_writer_add (vsx_journal_writer,
+                       buf,
+                       header_length + payload_length);
+}
+
+uint64_t
+vsx_journal_get_n_dropped (void)
+{
+  uint64_t n_dropped = vsx_journal_n_dropped_closed;
+
+  if (vsx_journal_writer)
+    n_dropped += vsx_ring_writer_get_n_dropped (vsx_journal_writer);
+
+  return n_dropped;
+}
+
+static void
+dropped_cb (struct vsx_buffer *buffer,
+            uint64_t n_dropped,
+            void *user_data)
+{
+  uint8_t payload[10];
+  VsxJournalRecord record = {
+    .type = VSX_JOURNAL_RECORD_DROPPED,
+    .timestamp = get_timestamp (get_monotonic_time ()),
+    .payload = payload,
+    .payload_length = write_varint (payload, n_dropped),
+  };
+
+  vsx_journal_encode_record (buffer, &record);
+}
+
+static bool
+write_start_record (FILE *file)
+{
+  uint8_t payload[VSX_JOURNAL_MAGIC_LENGTH + sizeof (uint64_t)];
+  struct timespec ts;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+
+  memcpy (payload, VSX_JOURNAL_MAGIC, VSX_JOURNAL_MAGIC_LENGTH);
+  vsx_proto_write_uint64_t (payload + VSX_JOURNAL_MAGIC_LENGTH,
+                            ts.tv_sec * UINT64_C (1000000)
+                            + ts.tv_nsec / 1000);
+
+  VsxJournalRecord record = {
+    .type = VSX_JOURNAL_RECORD_START,
+    .payload = payload,
+    .payload_length = sizeof payload,
+  };
+  struct vsx_buffer buffer = VSX_BUFFER_STATIC_INIT;
+
+  vsx_journal_encode_record (&buffer, &record);
+
+  bool ret = (fwrite (buffer.data, 1, buffer.length, file) == buffer.length
+              && fflush (file) == 0);
+
+  vsx_buffer_destroy (&buffer);
+
+  return ret;
+}
+
+bool
+vsx_journal_set_file (const char *filename,
+                      struct vsx_error **error)
+{
+  FILE *file;
+
+  /* The journal contains the player IDs that are needed to reconnect
+   * so only the owner should be able to read it */
+  int fd = open (filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+
+  if (fd == -1 || (file = fdopen (fd, "ab")) == NULL)
+    {
+      int errnum = errno;
+
+      if (fd != -1)
+        vsx_close (fd);
+
+      vsx_file_error_set (error,
+                          errnum,
+                          "%s: %s",
+                          filename,
+                          strerror (errnum));
+      return false;
+    }
+
+  vsx_journal_close ();
+
+  vsx_journal_start_time = get_monotonic_time ();
+
+  if (!write_start_record (file))
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "%s: %s",
+                          filename,
+                          strerror (errno));
+      fclose (file);
+      return false;
+    }
+
+  vsx_journal_writer = vsx_ring_writer_new (file, dropped_cb, NULL);
+
+  return true;
+}
+
+void
+vsx_journal_start (void)
+{
+  if (vsx_journal_writer)
+    vsx_ring_writer_start (vsx_journal_writer);
+}
+
+void
+vsx_journal_close (void)
+{
+  if (vsx_journal_writer == NULL)
+    return;
+
+  VsxRingWriter *writer = vsx_journal_writer;
+
+  vsx_journal_writer = NULL;
+
+  vsx_journal_n_dropped_closed += vsx_ring_writer_get_n_dropped (writer);
+
+  vsx_ring_writer_free (writer);
+}
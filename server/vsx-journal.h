@@ -0,0 +1,129 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_JOURNAL_H
+#define VSX_JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "vsx-error.h"
+#include "vsx-buffer.h"
+
+/* An optional append-only record of every command received from the
+ * clients so that a session can be played back later with
+ * vsx-replay. The records are added to per-thread rings and written
+ * to the file by a background thread in the same way as the log.
+ *
+ * Each record is encoded as:
+ *
+ *  u8      record type
+ *  varint  microseconds since the journal was started
+ *  varint  connection ID
+ *  u64     conversation ID (little-endian, zero if there isn’t one)
+ *  varint  payload length
+ *  bytes   payload
+ *
+ * where a varint is an unsigned LEB128 number. A file can contain
+ * several journals one after the other if the server was restarted.
+ * Each one begins with a START record and the timestamps after it are
+ * relative to that record. The records from each thread are written
+ * in order but the threads are interleaved in batches so a reader
+ * needs to sort them by the timestamp.
+ */
+
+typedef enum
+{
+  /* Payload is the magic string followed by the time the journal was
+   * started in microseconds since the epoch as a u64 */
+  VSX_JOURNAL_RECORD_START,
+  /* A new connection. There is no payload. */
+  VSX_JOURNAL_RECORD_CONNECT,
+  /* The connection was closed. There is no payload. */
+  VSX_JOURNAL_RECORD_DISCONNECT,
+  /* Payload is a message sent by the client, starting with the
+   * command byte */
+  VSX_JOURNAL_RECORD_COMMAND,
+  /* The connection now represents a different person. Payload is the
+   * person ID as a u64. */
+  VSX_JOURNAL_RECORD_PERSON,
+  /* Some records were thrown away because the writer thread couldn’t
+   * keep up. The payload is the number of records as a varint. */
+  VSX_JOURNAL_RECORD_DROPPED,
+} VsxJournalRecordType;
+
+#define VSX_JOURNAL_MAGIC "VSXJRNL1"
+#define VSX_JOURNAL_MAGIC_LENGTH (sizeof VSX_JOURNAL_MAGIC - 1)
+
+/* Largest size of the header of a record before the payload */
+#define VSX_JOURNAL_MAX_HEADER_SIZE (1 + 10 + 10 + 8 + 10)
+
+typedef struct
+{
+  VsxJournalRecordType type;
+  uint64_t timestamp;
+  uint64_t connection_id;
+  uint64_t conversation_id;
+  const uint8_t *payload;
+  size_t payload_length;
+} VsxJournalRecord;
+
+bool
+vsx_journal_available (void);
+
+bool
+vsx_journal_set_file (const char *filename,
+                      struct vsx_error **error);
+
+void
+vsx_journal_start (void);
+
+void
+vsx_journal_close (void);
+
+/* Returns a new ID to identify a connection in the journal */
+uint64_t
+vsx_journal_generate_connection_id (void);
+
+void
+vsx_journal_add (VsxJournalRecordType type,
+                 uint64_t connection_id,
+                 uint64_t conversation_id,
+                 const uint8_t *payload,
+                 size_t payload_length);
+
+/* Returns the number of records that were thrown away because the
+ * writer thread couldn’t keep up */
+uint64_t
+vsx_journal_get_n_dropped (void);
+
+/* Appends the encoding of a record to the buffer */
+void
+vsx_journal_encode_record (struct vsx_buffer *buffer,
+                           const VsxJournalRecord *record);
+
+/* Decodes one record from the data. Returns the number of bytes used
+ * or zero if the data doesn’t contain a complete record. The payload
+ * points into the data. */
+size_t
+vsx_journal_decode_record (const uint8_t *data,
+                           size_t length,
+                           VsxJournalRecord *record);
+
+#endif /* VSX_JOURNAL_H */
@@ -18,32 +18,72 @@
 
 #include "config.h"
 
-#include <unistd.h>
-#include <fcntl.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
-#include <pthread.h>
-#include <signal.h>
+#include <inttypes.h>
 
 #include "vsx-log.h"
 #include "vsx-util.h"
 #include "vsx-buffer.h"
+#include "vsx-ring-writer.h"
 #include "vsx-file-error.h"
+#include "vsx-main-context.h"
 
-static FILE *vsx_log_file = NULL;
-static struct vsx_buffer vsx_log_buffer = VSX_BUFFER_STATIC_INIT;
-static pthread_t vsx_log_thread;
-static bool vsx_log_has_thread = false;
-static pthread_mutex_t vsx_log_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t vsx_log_cond = PTHREAD_COND_INITIALIZER;
-static bool vsx_log_finished = false;
+/* Longer messages are truncated */
+#define VSX_LOG_MAX_LINE 1024
+
+static VsxRingWriter *vsx_log_writer = NULL;
+
+/* Messages dropped by writers that have already been closed */
+static uint64_t vsx_log_n_dropped_closed = 0;
+
+/* The formatted timestamp is reused for all messages logged by a
+ * thread within the same second */
+static __thread int64_t vsx_log_prefix_time = INT64_MIN;
+static __thread char vsx_log_prefix[32];
+static __thread int vsx_log_prefix_length;
 
 bool
 vsx_log_available (void)
 {
-  return vsx_log_file != NULL;
+  return vsx_log_writer != NULL;
+}
+
+static int
+format_prefix (char *buf,
+               size_t buf_size,
+               int64_t now)
+{
+  time_t t = now;
+  struct tm tm;
+
+  gmtime_r (&t, &tm);
+
+  return snprintf (buf,
+                   buf_size,
+                   "[%4d-%02d-%02dT%02d:%02d:%02dZ] ",
+                   tm.tm_year + 1900,
+                   tm.tm_mon + 1,
+                   tm.tm_mday,
+                   tm.tm_hour,
+                   tm.tm_min,
+                   tm.tm_sec);
+}
+
+static int64_t
+get_now (void)
+{
+  /* Use the time cached by the main context if this thread has one so
+   * that a burst of messages in one iteration only reads the clock
+   * once */
+  VsxMainContext *mc = vsx_main_context_get_existing_default ();
+
+  if (mc)
+    return vsx_main_context_get_wall_clock (mc);
+  else
+    return time (NULL);
 }
 
 void
@@ -55,104 +95,63 @@ vsx_log (const char *format,
   if (!vsx_log_available ())
     return;
 
-  pthread_mutex_lock (&vsx_log_mutex);
+  int64_t now = get_now ();
 
-  time_t now;
-  time (&now);
-  struct tm tm;
-  gmtime_r (&now, &tm);
+  if (now != vsx_log_prefix_time)
+    {
+      vsx_log_prefix_length = format_prefix (vsx_log_prefix,
+                                             sizeof vsx_log_prefix,
+                                             now);
+      vsx_log_prefix_time = now;
+    }
+
+  char line[VSX_LOG_MAX_LINE];
 
-  vsx_buffer_append_printf (&vsx_log_buffer,
-                            "[%4d-%02d-%02dT%02d:%02d:%02dZ] ",
-                            tm.tm_year + 1900,
-                            tm.tm_mon + 1,
-                            tm.tm_mday,
-                            tm.tm_hour,
-                            tm.tm_min,
-                            tm.tm_sec);
+  memcpy (line, vsx_log_prefix, vsx_log_prefix_length);
+
+  /* Leave space for the newline */
+  size_t space = sizeof line - vsx_log_prefix_length - 1;
 
   va_start (ap, format);
-  vsx_buffer_append_vprintf (&vsx_log_buffer, format, ap);
+  int length = vsnprintf (line + vsx_log_prefix_length, space, format, ap);
   va_end (ap);
 
-  vsx_buffer_append_c (&vsx_log_buffer, '\n');
+  if (length < 0)
+    return;
+
+  if (length >= space)
+    length = space - 1;
 
-  pthread_cond_signal (&vsx_log_cond);
+  length += vsx_log_prefix_length;
+  line[length++] = '\n';
 
-  pthread_mutex_unlock (&vsx_log_mutex);
+  vsx_ring_writer_add (vsx_log_writer, line, length);
 }
 
-static void
-block_sigint (void)
+uint64_t
+vsx_log_get_n_dropped (void)
 {
-  sigset_t sigset;
+  uint64_t n_dropped = vsx_log_n_dropped_closed;
 
-  sigemptyset (&sigset);
-  sigaddset (&sigset, SIGINT);
-  sigaddset (&sigset, SIGTERM);
+  if (vsx_log_writer)
+    n_dropped += vsx_ring_writer_get_n_dropped (vsx_log_writer);
 
-  if (pthread_sigmask (SIG_BLOCK, &sigset, NULL) == -1)
-    vsx_warning ("pthread_sigmask failed: %s", strerror (errno));
+  return n_dropped;
 }
 
-static void *
-vsx_log_thread_func (void *data)
+static void
+dropped_cb (struct vsx_buffer *buffer,
+            uint64_t n_dropped,
+            void *user_data)
 {
-  struct vsx_buffer alternate_buffer;
-  struct vsx_buffer tmp;
-  bool had_error = false;
+  char prefix[32];
 
-  block_sigint ();
+  format_prefix (prefix, sizeof prefix, time (NULL));
 
-  vsx_buffer_init (&alternate_buffer);
-
-  pthread_mutex_lock (&vsx_log_mutex);
-
-  while (!vsx_log_finished || vsx_log_buffer.length > 0)
-    {
-      size_t wrote;
-
-      /* Wait until there's something to do */
-      while (!vsx_log_finished && vsx_log_buffer.length == 0)
-        pthread_cond_wait (&vsx_log_cond, &vsx_log_mutex);
-
-      if (had_error)
-        /* Just ignore the data */
-        vsx_buffer_set_length (&vsx_log_buffer, 0);
-      else
-        {
-          /* Swap the log buffer for an empty alternate buffer so we can
-             write from the normal one */
-          tmp = vsx_log_buffer;
-          vsx_log_buffer = alternate_buffer;
-          alternate_buffer = tmp;
-
-          /* Release the mutex while we do a blocking write */
-          pthread_mutex_unlock (&vsx_log_mutex);
-
-          wrote = fwrite (alternate_buffer.data,
-                          1 /* size */,
-                          alternate_buffer.length,
-                          vsx_log_file);
-
-          /* If there was an error then we'll just start ignoring data
-             until we're told to quit */
-          if (wrote != alternate_buffer.length)
-            had_error = true;
-          else
-            fflush (vsx_log_file);
-
-          vsx_buffer_set_length (&alternate_buffer, 0);
-
-          pthread_mutex_lock (&vsx_log_mutex);
-        }
-    }
-
-  pthread_mutex_unlock (&vsx_log_mutex);
-
-  vsx_buffer_destroy (&alternate_buffer);
-
-  return NULL;
+  vsx_buffer_append_printf (buffer,
+                            "%sDropped %" PRIu64 " log messages\n",
+                            prefix,
+                            n_dropped);
 }
 
 bool
@@ -175,8 +174,7 @@ vsx_log_set_file (const char *filename,
 
   vsx_log_close ();
 
-  vsx_log_file = file;
-  vsx_log_finished = false;
+  vsx_log_writer = vsx_ring_writer_new (file, dropped_cb, NULL);
 
   return true;
 }
@@ -184,44 +182,21 @@ vsx_log_set_file (const char *filename,
 void
 vsx_log_start (void)
 {
-  if (!vsx_log_available ())
-    return;
-
-  if (vsx_log_has_thread)
-    return;
-
-  int res = pthread_create (&vsx_log_thread,
-                            NULL, /* attr */
-                            vsx_log_thread_func,
-                            NULL /* thread func arg */);
-
-  if (res)
-      vsx_fatal ("Error creating thread: %s", strerror (res));
-
-  vsx_log_has_thread = true;
+  if (vsx_log_writer)
+    vsx_ring_writer_start (vsx_log_writer);
 }
 
 void
 vsx_log_close (void)
 {
-  if (vsx_log_has_thread)
-    {
-      pthread_mutex_lock (&vsx_log_mutex);
-      vsx_log_finished = true;
-      pthread_cond_signal (&vsx_log_cond);
-      pthread_mutex_unlock (&vsx_log_mutex);
+  if (vsx_log_writer == NULL)
+    return;
 
-      pthread_join (vsx_log_thread, NULL);
+  VsxRingWriter *writer = vsx_log_writer;
 
-      vsx_log_has_thread = false;
-    }
+  vsx_log_writer = NULL;
 
-  vsx_buffer_destroy (&vsx_log_buffer);
-  vsx_buffer_init (&vsx_log_buffer);
+  vsx_log_n_dropped_closed += vsx_ring_writer_get_n_dropped (writer);
 
-  if (vsx_log_file)
-    {
-      fclose (vsx_log_file);
-      vsx_log_file = NULL;
-    }
+  vsx_ring_writer_free (writer);
 }
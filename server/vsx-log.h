@@ -20,6 +20,7 @@
 #define VSX_LOG_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "vsx-error.h"
 
@@ -30,6 +31,11 @@ void
 vsx_log (const char *format,
          ...) VSX_PRINTF_FORMAT (1, 2);
 
+/* Returns the number of messages that were thrown away because the
+ * log thread couldn’t keep up */
+uint64_t
+vsx_log_get_n_dropped (void);
+
 bool
 vsx_log_set_file (const char *filename,
                   struct vsx_error **error);
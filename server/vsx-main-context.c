@@ -34,19 +34,63 @@
 #include "vsx-list.h"
 #include "vsx-slice.h"
 #include "vsx-buffer.h"
+#include "vsx-log.h"
+#include "vsx-timer-wheel.h"
+#include "vsx-metrics.h"
+#include "vsx-stall-detector.h"
 #include "vsx-util.h"
 
+#ifdef HAVE_IO_URING
+#include "vsx-uring.h"
+#endif
+
 /* This is a simple replacement for the GMainLoop which uses
    epoll. The hope is that it will scale to more connections easily
    because it doesn't use poll which needs to upload the set of file
    descriptors every time it blocks and it doesn't have to walk the
-   list of file descriptors to find out which object it belongs to */
-
-typedef struct _VsxMainContextBucket VsxMainContextBucket;
+   list of file descriptors to find out which object it belongs to.
+
+   Alternatively it can use io_uring. In that case the poll sources
+   are one-shot POLL_ADD requests that get re-armed after each event.
+   All of the arming, modifying and removing is queued up and
+   submitted in the same system call that waits for the next events
+   so there are no equivalents of the epoll_ctl calls. */
+
+/* Number of submission queue entries for the io_uring backend. The
+ * queue is flushed early if it fills up so this doesn’t limit the
+ * number of sources. */
+#define VSX_MAIN_CONTEXT_URING_ENTRIES 1024
+
+/* Invokes a callback and times it if the main context has a stall
+ * detector. The callback might free the source so the function
+ * pointer to record needs to be copied out beforehand. */
+#define DISPATCH_CALLBACK(mc, stall_type, callback, invocation)         \
+  do                                                                    \
+    {                                                                   \
+      if ((mc)->stall_detector == NULL)                                 \
+        {                                                               \
+          invocation;                                                   \
+        }                                                               \
+      else                                                              \
+        {                                                               \
+          int64_t dispatch_start_time = vsx_metrics_get_time ();        \
+          invocation;                                                   \
+          record_callback_time ((mc),                                   \
+                                (stall_type),                           \
+                                (callback),                             \
+                                dispatch_start_time);                   \
+        }                                                               \
+    }                                                                   \
+  while (0)
 
 struct _VsxMainContext
 {
+  VsxMainContextBackend backend;
+
   int epoll_fd;
+#ifdef HAVE_IO_URING
+  VsxUring ring;
+#endif
   /* Number of sources that are currently attached. This is used so we
      can size the array passed to epoll_wait to ensure it's possible
      to process an event for every single source */
@@ -58,16 +102,45 @@ struct _VsxMainContext
      is received */
   struct vsx_list quit_sources;
 
+  /* List of upgrade sources. These are invoked when SIGUSR2 is
+     received */
+  struct vsx_list upgrade_sources;
+
+  /* List of flush sources. These are invoked at the end of every
+   * iteration before waiting for more events. */
+  struct vsx_list flush_sources;
+
   VsxMainContextSource *quit_pipe_source;
   int quit_pipe[2];
   void (* old_int_handler) (int);
   void (* old_term_handler) (int);
+  void (* old_usr2_handler) (int);
+  bool quit_handlers_installed;
+  bool upgrade_handler_installed;
 
   bool monotonic_time_valid;
   int64_t monotonic_time;
+  bool wall_time_valid;
+  int64_t wall_time;
+
+  /* Monotonic time when the current iteration woke up, or zero if
+   * neither the metrics nor the stall detector need it */
+  int64_t iteration_start_time;
+
+  /* NULL unless slow callbacks are being looked for. Checking this is
+   * the only cost of the timing when it is disabled. */
+  VsxStallDetector *stall_detector;
 
-  struct vsx_list buckets;
-  int64_t last_timer_time;
+  /* Timer sources, in milliseconds of the monotonic clock */
+  VsxTimerWheel timer_wheel;
+
+  /* Poll sources whose flags have been modified since the last time
+   * they were passed to the kernel. The changes are only applied
+   * right before waiting so that several modifications during one
+   * iteration only cost one system call or none if the flags end up
+   * back where they started. */
+  struct vsx_list dirty_poll_sources;
+  uint64_t n_poll_updates_avoided;
 
   struct vsx_slice_allocator source_allocator;
 };
@@ -78,7 +151,9 @@ struct _VsxMainContextSource
   {
     VSX_MAIN_CONTEXT_POLL_SOURCE,
     VSX_MAIN_CONTEXT_TIMER_SOURCE,
-    VSX_MAIN_CONTEXT_QUIT_SOURCE
+    VSX_MAIN_CONTEXT_QUIT_SOURCE,
+    VSX_MAIN_CONTEXT_UPGRADE_SOURCE,
+    VSX_MAIN_CONTEXT_FLUSH_SOURCE
   } type;
 
   union
@@ -87,7 +162,18 @@ struct _VsxMainContextSource
     struct
     {
       int fd;
+      /* The flags that the source last asked for */
       VsxMainContextPollFlags current_flags;
+      /* The flags that the kernel currently knows about */
+      VsxMainContextPollFlags applied_flags;
+      bool poll_dirty;
+      struct vsx_list dirty_link;
+      /* The following are only used by the io_uring backend. The
+       * source can’t be freed while the kernel still has a POLL_ADD
+       * request for it. */
+      bool poll_armed;
+      bool poll_dispatching;
+      bool poll_removed;
     };
 
     /* Quit sources */
@@ -96,13 +182,18 @@ struct _VsxMainContextSource
       struct vsx_list quit_link;
     };
 
+    /* Flush sources */
+    struct
+    {
+      struct vsx_list flush_link;
+    };
+
     /* Timer sources */
     struct
     {
-      VsxMainContextBucket *bucket;
-      struct vsx_list timer_link;
-      bool busy;
-      bool removed;
+      VsxTimerWheelEntry timer_entry;
+      /* Zero for one-shot timers */
+      int64_t timer_interval;
     };
   };
 
@@ -112,18 +203,30 @@ struct _VsxMainContextSource
   VsxMainContext *mc;
 };
 
-struct _VsxMainContextBucket
-{
-  struct vsx_list link;
-  struct vsx_list sources;
-  int minutes;
-  int minutes_passed;
-};
-
 struct vsx_error_domain
 vsx_main_context_error;
 
-static VsxMainContext *vsx_main_context_default = NULL;
+/* Each thread gets its own default main context so that the server
+ * shards can each run their own loop while the rest of the code keeps
+ * passing NULL to mean “the current loop”.
+ */
+static __thread VsxMainContext *vsx_main_context_default = NULL;
+
+/* Backend used by vsx_main_context_new. This is set once at startup
+ * before any threads are created.
+ */
+static VsxMainContextBackend vsx_main_context_default_backend =
+  VSX_MAIN_CONTEXT_BACKEND_EPOLL;
+
+/* In microseconds. The threshold is negative if stall detection is
+ * disabled. */
+static int64_t vsx_main_context_stall_threshold = -1;
+static int64_t vsx_main_context_stall_report_interval;
+
+/* The signal handlers can run on any thread so they need to know
+ * which context actually installed them.
+ */
+static VsxMainContext *vsx_main_context_quit_context = NULL;
 
 VsxMainContext *
 vsx_main_context_get_default (struct vsx_error **error)
@@ -134,6 +237,12 @@ vsx_main_context_get_default (struct vsx_error **error)
   return vsx_main_context_default;
 }
 
+VsxMainContext *
+vsx_main_context_get_existing_default (void)
+{
+  return vsx_main_context_default;
+}
+
 static VsxMainContext *
 vsx_main_context_get_default_or_abort (void)
 {
@@ -153,8 +262,47 @@ vsx_main_context_get_default_or_abort (void)
   return mc;
 }
 
-VsxMainContext *
-vsx_main_context_new (struct vsx_error **error)
+void
+vsx_main_context_set_default_backend (VsxMainContextBackend backend)
+{
+  vsx_main_context_default_backend = backend;
+}
+
+void
+vsx_main_context_set_stall_detection (int threshold_ms,
+                                      int report_interval)
+{
+  vsx_main_context_stall_threshold = threshold_ms * INT64_C (1000);
+  vsx_main_context_stall_report_interval = report_interval * INT64_C (1000000);
+}
+
+static void
+record_callback_time (VsxMainContext *mc,
+                      VsxStallDetectorType type,
+                      void *callback,
+                      int64_t start_time)
+{
+  int64_t duration = vsx_metrics_get_time () - start_time;
+
+  if (vsx_stall_detector_record_callback (mc->stall_detector,
+                                          type,
+                                          callback,
+                                          duration))
+    vsx_metrics_add (VSX_METRICS_SLOW_CALLBACKS, 1);
+}
+
+VsxMainContextBackend
+vsx_main_context_get_backend (VsxMainContext *mc)
+{
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
+
+  return mc->backend;
+}
+
+static bool
+init_epoll (VsxMainContext *mc,
+            struct vsx_error **error)
 {
   int fd;
 
@@ -174,27 +322,100 @@ vsx_main_context_new (struct vsx_error **error)
                        "failed to create an epoll descriptor: %s",
                        strerror (errno));
 
+      return false;
+    }
+
+  mc->backend = VSX_MAIN_CONTEXT_BACKEND_EPOLL;
+  mc->epoll_fd = fd;
+  vsx_buffer_init (&mc->events);
+
+  return true;
+}
+
+static int64_t
+get_monotonic_ms (VsxMainContext *mc)
+{
+  return vsx_main_context_get_monotonic_clock (mc) / 1000;
+}
+
+VsxMainContext *
+vsx_main_context_new_for_backend (VsxMainContextBackend backend,
+                                  struct vsx_error **error)
+{
+  VsxMainContext *mc = vsx_alloc (sizeof *mc);
+
+  mc->epoll_fd = -1;
+
+  if (backend == VSX_MAIN_CONTEXT_BACKEND_IO_URING)
+    {
+#ifdef HAVE_IO_URING
+      struct vsx_error *uring_error = NULL;
+
+      if (vsx_uring_init (&mc->ring,
+                          VSX_MAIN_CONTEXT_URING_ENTRIES,
+                          &uring_error))
+        {
+          mc->backend = VSX_MAIN_CONTEXT_BACKEND_IO_URING;
+          goto initialized;
+        }
+
+      vsx_warning ("%s, falling back to epoll", uring_error->message);
+      vsx_error_free (uring_error);
+#else
+      vsx_warning ("io_uring support was not compiled in, "
+                   "falling back to epoll");
+#endif
+    }
+
+  if (!init_epoll (mc, error))
+    {
+      vsx_free (mc);
       return NULL;
     }
+
+#ifdef HAVE_IO_URING
+ initialized:
+#endif
+  vsx_slice_allocator_init (&mc->source_allocator,
+                            sizeof (VsxMainContextSource),
+                            alignof (VsxMainContextSource));
+
+  mc->n_sources = 0;
+  mc->monotonic_time_valid = false;
+  mc->wall_time_valid = false;
+  mc->iteration_start_time = 0;
+
+  if (vsx_main_context_stall_threshold >= 0)
+    {
+      mc->stall_detector = vsx_alloc (sizeof *mc->stall_detector);
+      vsx_stall_detector_init (mc->stall_detector,
+                               vsx_main_context_stall_threshold,
+                               vsx_main_context_stall_report_interval,
+                               vsx_metrics_get_time ());
+    }
   else
     {
-      VsxMainContext *mc = vsx_alloc (sizeof *mc);
+      mc->stall_detector = NULL;
+    }
 
-      vsx_slice_allocator_init (&mc->source_allocator,
-                                sizeof (VsxMainContextSource),
-                                alignof (VsxMainContextSource));
+  vsx_list_init (&mc->quit_sources);
+  vsx_list_init (&mc->upgrade_sources);
+  vsx_list_init (&mc->flush_sources);
+  mc->quit_pipe_source = NULL;
+  mc->quit_handlers_installed = false;
+  mc->upgrade_handler_installed = false;
+  vsx_timer_wheel_init (&mc->timer_wheel, get_monotonic_ms (mc));
+  vsx_list_init (&mc->dirty_poll_sources);
+  mc->n_poll_updates_avoided = 0;
 
-      mc->epoll_fd = fd;
-      mc->n_sources = 0;
-      vsx_buffer_init (&mc->events);
-      mc->monotonic_time_valid = false;
-      vsx_list_init (&mc->quit_sources);
-      mc->quit_pipe_source = NULL;
-      vsx_list_init (&mc->buckets);
-      mc->last_timer_time = vsx_main_context_get_monotonic_clock (mc);
+  return mc;
+}
 
-      return mc;
-    }
+VsxMainContext *
+vsx_main_context_new (struct vsx_error **error)
+{
+  return vsx_main_context_new_for_backend (vsx_main_context_default_backend,
+                                           error);
 }
 
 static uint32_t
@@ -210,6 +431,154 @@ get_epoll_events (VsxMainContextPollFlags flags)
   return events;
 }
 
+#ifdef HAVE_IO_URING
+
+static uint32_t
+get_uring_poll_events (VsxMainContextPollFlags flags)
+{
+  /* The poll request takes the same bits as epoll */
+  uint32_t events = get_epoll_events (flags);
+
+#ifdef HAVE_BIG_ENDIAN
+  /* The kernel expects the two halves to be swapped */
+  events = (events << 16) | (events >> 16);
+#endif
+
+  return events;
+}
+
+static void
+arm_uring_poll (VsxMainContextSource *source)
+{
+  struct io_uring_sqe *sqe = vsx_uring_get_sqe (&source->mc->ring);
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = source->fd;
+  sqe->poll32_events = get_uring_poll_events (source->current_flags);
+  sqe->user_data = (uintptr_t) source;
+
+  source->applied_flags = source->current_flags;
+  source->poll_armed = true;
+}
+
+static void
+update_uring_poll (VsxMainContextSource *source,
+                   VsxMainContextPollFlags flags)
+{
+  struct io_uring_sqe *sqe = vsx_uring_get_sqe (&source->mc->ring);
+
+  /* If the poll has already fired but we haven’t seen the completion
+   * yet then this will fail with ENOENT. That doesn’t matter because
+   * the poll will be re-armed with the new flags after dispatching
+   * the completion. The completion of this request has no user data
+   * so it is ignored. */
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->addr = (uintptr_t) source;
+  sqe->len = IORING_POLL_UPDATE_EVENTS;
+  sqe->poll32_events = get_uring_poll_events (flags);
+}
+
+static void
+remove_uring_poll (VsxMainContextSource *source)
+{
+  VsxMainContext *mc = source->mc;
+
+  source->poll_removed = true;
+
+  if (source->poll_armed)
+    {
+      /* The source will be freed when the cancelled poll completes */
+      struct io_uring_sqe *sqe = vsx_uring_get_sqe (&mc->ring);
+
+      sqe->opcode = IORING_OP_POLL_REMOVE;
+      sqe->addr = (uintptr_t) source;
+    }
+  else if (!source->poll_dispatching)
+    {
+      vsx_slice_free (&mc->source_allocator, source);
+    }
+}
+
+static void
+handle_uring_completion (VsxMainContext *mc,
+                         const struct io_uring_cqe *cqe)
+{
+  /* Completions of update and remove requests don’t have any user
+   * data. */
+  if (cqe->user_data == 0)
+    return;
+
+  VsxMainContextSource *source = (VsxMainContextSource *) cqe->user_data;
+
+  source->poll_armed = false;
+
+  if (source->poll_removed)
+    {
+      vsx_slice_free (&mc->source_allocator, source);
+      return;
+    }
+
+  VsxMainContextPollFlags flags = 0;
+
+  if (cqe->res < 0)
+    {
+      if (cqe->res != -ECANCELED)
+        flags |= VSX_MAIN_CONTEXT_POLL_ERROR;
+    }
+  else
+    {
+      if (cqe->res & EPOLLOUT)
+        flags |= VSX_MAIN_CONTEXT_POLL_OUT;
+      if (cqe->res & (EPOLLIN | EPOLLRDHUP))
+        flags |= VSX_MAIN_CONTEXT_POLL_IN;
+      if (cqe->res & EPOLLHUP)
+        {
+          /* Same as for epoll below */
+          if (source->current_flags & VSX_MAIN_CONTEXT_POLL_IN)
+            flags |= VSX_MAIN_CONTEXT_POLL_IN;
+          else
+            flags |= VSX_MAIN_CONTEXT_POLL_ERROR;
+        }
+      if (cqe->res & EPOLLERR)
+        flags |= VSX_MAIN_CONTEXT_POLL_ERROR;
+
+      /* The flags might have been modified after the poll fired */
+      flags &= source->current_flags | VSX_MAIN_CONTEXT_POLL_ERROR;
+    }
+
+  if (flags)
+    {
+      VsxMainContextPollCallback callback = source->callback;
+
+      source->poll_dispatching = true;
+
+      /* The quit sources are timed separately */
+      if (source == mc->quit_pipe_source)
+        {
+          callback (source, source->fd, flags, source->user_data);
+        }
+      else
+        {
+          DISPATCH_CALLBACK (mc,
+                             VSX_STALL_DETECTOR_POLL,
+                             callback,
+                             callback (source,
+                                       source->fd,
+                                       flags,
+                                       source->user_data));
+        }
+
+      source->poll_dispatching = false;
+    }
+
+  if (source->poll_removed)
+    vsx_slice_free (&mc->source_allocator, source);
+  else
+    arm_uring_poll (source);
+}
+
+#endif /* HAVE_IO_URING */
+
 VsxMainContextSource *
 vsx_main_context_add_poll (VsxMainContext *mc,
                            int fd,
@@ -229,6 +598,22 @@ vsx_main_context_add_poll (VsxMainContext *mc,
   source->callback = callback;
   source->type = VSX_MAIN_CONTEXT_POLL_SOURCE;
   source->user_data = user_data;
+  source->current_flags = flags;
+  source->applied_flags = flags;
+  source->poll_dirty = false;
+  source->poll_armed = false;
+  source->poll_dispatching = false;
+  source->poll_removed = false;
+
+  mc->n_sources++;
+
+#ifdef HAVE_IO_URING
+  if (mc->backend == VSX_MAIN_CONTEXT_BACKEND_IO_URING)
+    {
+      arm_uring_poll (source);
+      return source;
+    }
+#endif
 
   event.events = get_epoll_events (flags);
   event.data.ptr = source;
@@ -236,10 +621,6 @@ vsx_main_context_add_poll (VsxMainContext *mc,
   if (epoll_ctl (mc->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
     vsx_warning ("EPOLL_CTL_ADD failed: %s", strerror (errno));
 
-  source->current_flags = flags;
-
-  mc->n_sources++;
-
   return source;
 }
 
@@ -247,20 +628,83 @@ void
 vsx_main_context_modify_poll (VsxMainContextSource *source,
                               VsxMainContextPollFlags flags)
 {
-  struct epoll_event event;
+  VsxMainContext *mc = source->mc;
 
   assert (source->type == VSX_MAIN_CONTEXT_POLL_SOURCE);
 
-  if (source->current_flags == flags)
-    return;
+  if (source->current_flags == flags || source->poll_dirty)
+    {
+      /* Either nothing changed or the source is already going to be
+       * updated before the next wait */
+      mc->n_poll_updates_avoided++;
+    }
+  else
+    {
+      source->poll_dirty = true;
+      vsx_list_insert (mc->dirty_poll_sources.prev, &source->dirty_link);
+    }
 
-  event.events = get_epoll_events (flags);
+  source->current_flags = flags;
+}
+
+static void
+apply_poll_flags (VsxMainContextSource *source)
+{
+  VsxMainContext *mc = source->mc;
+
+  if (source->current_flags == source->applied_flags)
+    {
+      mc->n_poll_updates_avoided++;
+      return;
+    }
+
+#ifdef HAVE_IO_URING
+  if (mc->backend == VSX_MAIN_CONTEXT_BACKEND_IO_URING)
+    {
+      /* If the poll isn’t armed then we are in the middle of
+       * dispatching it and it will be re-armed with the new flags
+       * afterwards. */
+      if (source->poll_armed)
+        {
+          update_uring_poll (source, source->current_flags);
+          source->applied_flags = source->current_flags;
+        }
+      return;
+    }
+#endif
+
+  struct epoll_event event;
+
+  event.events = get_epoll_events (source->current_flags);
   event.data.ptr = source;
 
-  if (epoll_ctl (source->mc->epoll_fd, EPOLL_CTL_MOD, source->fd, &event) == -1)
+  if (epoll_ctl (mc->epoll_fd, EPOLL_CTL_MOD, source->fd, &event) == -1)
     vsx_warning ("EPOLL_CTL_MOD failed: %s", strerror (errno));
 
-  source->current_flags = flags;
+  source->applied_flags = source->current_flags;
+}
+
+static void
+flush_dirty_poll_sources (VsxMainContext *mc)
+{
+  VsxMainContextSource *source, *tmp;
+
+  vsx_list_for_each_safe (source, tmp, &mc->dirty_poll_sources, dirty_link)
+    {
+      apply_poll_flags (source);
+      source->poll_dirty = false;
+    }
+
+  vsx_list_init (&mc->dirty_poll_sources);
+}
+
+uint64_t
+vsx_main_context_get_n_poll_updates_avoided (VsxMainContext *mc)
+{
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
+
+  return mc->n_poll_updates_avoided;
 }
 
 static void
@@ -279,13 +723,23 @@ vsx_main_context_quit_pipe_cb (VsxMainContextSource *source,
     }
   else
     {
-      VsxMainContextSource *quit_source;
-
-      vsx_list_for_each (quit_source, &mc->quit_sources, quit_link)
+      VsxMainContextSource *quit_source, *tmp;
+      bool upgrade = byte == SIGUSR2;
+      struct vsx_list *sources = (upgrade
+                                  ? &mc->upgrade_sources
+                                  : &mc->quit_sources);
+      VsxStallDetectorType stall_type = (upgrade
+                                         ? VSX_STALL_DETECTOR_UPGRADE
+                                         : VSX_STALL_DETECTOR_QUIT);
+
+      vsx_list_for_each_safe (quit_source, tmp, sources, quit_link)
         {
           VsxMainContextQuitCallback callback = quit_source->callback;
 
-          callback (quit_source, quit_source->user_data);
+          DISPATCH_CALLBACK (mc,
+                             stall_type,
+                             callback,
+                             callback (quit_source, quit_source->user_data));
         }
     }
 }
@@ -293,79 +747,117 @@ vsx_main_context_quit_pipe_cb (VsxMainContextSource *source,
 static void
 vsx_main_context_quit_signal_cb (int signum)
 {
-  VsxMainContext *mc = vsx_main_context_get_default_or_abort ();
-  uint8_t byte = 42;
+  VsxMainContext *mc = vsx_main_context_quit_context;
+  /* The signal number tells the pipe callback which sources to
+   * invoke */
+  uint8_t byte = signum;
+
+  if (mc == NULL)
+    return;
 
   while (write (mc->quit_pipe[1], &byte, 1) == -1
          && errno == EINTR);
 }
 
-VsxMainContextSource *
-vsx_main_context_add_quit (VsxMainContext *mc,
-                           VsxMainContextQuitCallback callback,
-                           void *user_data)
+static bool
+ensure_signal_pipe (VsxMainContext *mc)
 {
-  if (mc == NULL)
-    mc = vsx_main_context_get_default_or_abort ();
+  if (mc->quit_pipe_source)
+    return true;
+
+  if (pipe (mc->quit_pipe) == -1)
+    {
+      vsx_warning ("Failed to create quit pipe: %s", strerror (errno));
+      return false;
+    }
+
+  mc->quit_pipe_source
+    = vsx_main_context_add_poll (mc, mc->quit_pipe[0],
+                                 VSX_MAIN_CONTEXT_POLL_IN,
+                                 vsx_main_context_quit_pipe_cb,
+                                 mc);
 
+  vsx_main_context_quit_context = mc;
+
+  return true;
+}
+
+static VsxMainContextSource *
+add_signal_source (VsxMainContext *mc,
+                   int type,
+                   struct vsx_list *list,
+                   VsxMainContextQuitCallback callback,
+                   void *user_data)
+{
   VsxMainContextSource *source = vsx_slice_alloc (&mc->source_allocator);
 
   source->mc = mc;
   source->callback = callback;
-  source->type = VSX_MAIN_CONTEXT_QUIT_SOURCE;
+  source->type = type;
   source->user_data = user_data;
 
-  vsx_list_insert (&mc->quit_sources, &source->quit_link);
+  vsx_list_insert (list, &source->quit_link);
 
   mc->n_sources++;
 
-  if (mc->quit_pipe_source == NULL)
+  return source;
+}
+
+VsxMainContextSource *
+vsx_main_context_add_quit (VsxMainContext *mc,
+                           VsxMainContextQuitCallback callback,
+                           void *user_data)
+{
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
+
+  VsxMainContextSource *source =
+    add_signal_source (mc,
+                       VSX_MAIN_CONTEXT_QUIT_SOURCE,
+                       &mc->quit_sources,
+                       callback,
+                       user_data);
+
+  if (!mc->quit_handlers_installed && ensure_signal_pipe (mc))
     {
-      if (pipe (mc->quit_pipe) == -1)
-        vsx_warning ("Failed to create quit pipe: %s", strerror (errno));
-      else
-        {
-          mc->quit_pipe_source
-            = vsx_main_context_add_poll (mc, mc->quit_pipe[0],
-                                         VSX_MAIN_CONTEXT_POLL_IN,
-                                         vsx_main_context_quit_pipe_cb,
-                                         mc);
-
-          mc->old_int_handler =
-            signal (SIGINT, vsx_main_context_quit_signal_cb);
-          mc->old_term_handler =
-            signal (SIGTERM, vsx_main_context_quit_signal_cb);
-        }
+      mc->old_int_handler =
+        signal (SIGINT, vsx_main_context_quit_signal_cb);
+      mc->old_term_handler =
+        signal (SIGTERM, vsx_main_context_quit_signal_cb);
+      mc->quit_handlers_installed = true;
     }
 
   return source;
 }
 
-static VsxMainContextBucket *
-get_bucket (VsxMainContext *mc,
-            int minutes)
+VsxMainContextSource *
+vsx_main_context_add_upgrade (VsxMainContext *mc,
+                              VsxMainContextQuitCallback callback,
+                              void *user_data)
 {
-  VsxMainContextBucket *bucket;
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
 
-  vsx_list_for_each (bucket, &mc->buckets, link)
+  VsxMainContextSource *source =
+    add_signal_source (mc,
+                       VSX_MAIN_CONTEXT_UPGRADE_SOURCE,
+                       &mc->upgrade_sources,
+                       callback,
+                       user_data);
+
+  if (!mc->upgrade_handler_installed && ensure_signal_pipe (mc))
     {
-      if (bucket->minutes == minutes)
-        return bucket;
+      mc->old_usr2_handler =
+        signal (SIGUSR2, vsx_main_context_quit_signal_cb);
+      mc->upgrade_handler_installed = true;
     }
 
-  bucket = vsx_alloc (sizeof *bucket);
-  vsx_list_init (&bucket->sources);
-  bucket->minutes = minutes;
-  bucket->minutes_passed = 0;
-  vsx_list_insert (&mc->buckets, &bucket->link);
-
-  return bucket;
+  return source;
 }
 
 VsxMainContextSource *
-vsx_main_context_add_timer (VsxMainContext *mc,
-                            int minutes,
-                            VsxMainContextTimerCallback callback,
+vsx_main_context_add_flush (VsxMainContext *mc,
+                            VsxMainContextFlushCallback callback,
                             void *user_data)
 {
   if (mc == NULL)
@@ -374,20 +866,114 @@ vsx_main_context_add_timer (VsxMainContext *mc,
   VsxMainContextSource *source = vsx_slice_alloc (&mc->source_allocator);
 
   source->mc = mc;
-  source->bucket = get_bucket (mc, minutes);
+  source->callback = callback;
+  source->type = VSX_MAIN_CONTEXT_FLUSH_SOURCE;
+  source->user_data = user_data;
+
+  vsx_list_insert (mc->flush_sources.prev, &source->flush_link);
+
+  mc->n_sources++;
+
+  return source;
+}
+
+static void
+run_flush_sources (VsxMainContext *mc)
+{
+  VsxMainContextSource *source, *tmp;
+
+  vsx_list_for_each_safe (source, tmp, &mc->flush_sources, flush_link)
+    {
+      VsxMainContextFlushCallback callback = source->callback;
+
+      DISPATCH_CALLBACK (mc,
+                         VSX_STALL_DETECTOR_FLUSH,
+                         callback,
+                         callback (source, source->user_data));
+    }
+}
+
+static VsxMainContextSource *
+add_timer_source (VsxMainContext *mc,
+                  VsxMainContextTimerCallback callback,
+                  void *user_data)
+{
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
+
+  VsxMainContextSource *source = vsx_slice_alloc (&mc->source_allocator);
+
+  source->mc = mc;
   source->callback = callback;
   source->type = VSX_MAIN_CONTEXT_TIMER_SOURCE;
   source->user_data = user_data;
-  source->removed = false;
-  source->busy = false;
 
-  vsx_list_insert (&source->bucket->sources, &source->timer_link);
+  vsx_timer_wheel_entry_init (&source->timer_entry);
 
   mc->n_sources++;
 
   return source;
 }
 
+VsxMainContextSource *
+vsx_main_context_add_timer (VsxMainContext *mc,
+                            int minutes,
+                            VsxMainContextTimerCallback callback,
+                            void *user_data)
+{
+  return vsx_main_context_add_repeating_timer (mc,
+                                               minutes * 60 * 1000,
+                                               callback,
+                                               user_data);
+}
+
+VsxMainContextSource *
+vsx_main_context_add_repeating_timer (VsxMainContext *mc,
+                                      int64_t interval_ms,
+                                      VsxMainContextTimerCallback callback,
+                                      void *user_data)
+{
+  assert (interval_ms > 0);
+
+  VsxMainContextSource *source = add_timer_source (mc,
+                                                   callback,
+                                                   user_data);
+
+  source->timer_interval = interval_ms;
+  vsx_main_context_reset_timer (source, interval_ms);
+
+  return source;
+}
+
+VsxMainContextSource *
+vsx_main_context_add_timeout (VsxMainContext *mc,
+                              int64_t delay_ms,
+                              VsxMainContextTimerCallback callback,
+                              void *user_data)
+{
+  VsxMainContextSource *source = add_timer_source (mc,
+                                                   callback,
+                                                   user_data);
+
+  source->timer_interval = 0;
+  vsx_main_context_reset_timer (source, delay_ms);
+
+  return source;
+}
+
+void
+vsx_main_context_reset_timer (VsxMainContextSource *source,
+                              int64_t delay_ms)
+{
+  VsxMainContext *mc = source->mc;
+
+  assert (source->type == VSX_MAIN_CONTEXT_TIMER_SOURCE);
+
+  vsx_timer_wheel_add (&mc->timer_wheel,
+                       &source->timer_entry,
+                       get_monotonic_ms (mc) + MAX (delay_ms, 0));
+}
+
 void
 vsx_main_context_remove_source (VsxMainContextSource *source)
 {
@@ -397,33 +983,35 @@ vsx_main_context_remove_source (VsxMainContextSource *source)
   switch (source->type)
     {
     case VSX_MAIN_CONTEXT_POLL_SOURCE:
+      if (source->poll_dirty)
+        vsx_list_remove (&source->dirty_link);
+#ifdef HAVE_IO_URING
+      if (mc->backend == VSX_MAIN_CONTEXT_BACKEND_IO_URING)
+        {
+          remove_uring_poll (source);
+          break;
+        }
+#endif
       if (epoll_ctl (mc->epoll_fd, EPOLL_CTL_DEL, source->fd, &event) == -1)
         vsx_warning ("EPOLL_CTL_DEL failed: %s", strerror (errno));
       vsx_slice_free (&mc->source_allocator, source);
       break;
 
     case VSX_MAIN_CONTEXT_QUIT_SOURCE:
+    case VSX_MAIN_CONTEXT_UPGRADE_SOURCE:
       vsx_list_remove (&source->quit_link);
       vsx_slice_free (&mc->source_allocator, source);
       break;
 
-    case VSX_MAIN_CONTEXT_TIMER_SOURCE:
-      /* Timer sources need to be able to be removed while iterating
-       * the source list to emit, so we need to handle them specially
-       * during iteration. */
-
-      assert (!source->removed);
-
-      if (source->busy)
-        {
-          source->removed = true;
-        }
-      else
-        {
-          vsx_list_remove (&source->timer_link);
-          vsx_slice_free (&mc->source_allocator, source);
-        }
+    case VSX_MAIN_CONTEXT_FLUSH_SOURCE:
+      vsx_list_remove (&source->flush_link);
+      vsx_slice_free (&mc->source_allocator, source);
+      break;
 
+    case VSX_MAIN_CONTEXT_TIMER_SOURCE:
+      if (vsx_timer_wheel_entry_is_scheduled (&source->timer_entry))
+        vsx_timer_wheel_remove (&mc->timer_wheel, &source->timer_entry);
+      vsx_slice_free (&mc->source_allocator, source);
       break;
     }
 
@@ -433,114 +1021,172 @@ vsx_main_context_remove_source (VsxMainContextSource *source)
 static int
 get_timeout (VsxMainContext *mc)
 {
-  VsxMainContextBucket *bucket;
-  int min_minutes;
-  int64_t elapsed, elapsed_minutes;
-
-  min_minutes = INT_MAX;
+  int64_t next_time = vsx_timer_wheel_get_next_time (&mc->timer_wheel);
 
-  vsx_list_for_each (bucket, &mc->buckets, link)
+  if (mc->stall_detector)
     {
-      if (vsx_list_empty (&bucket->sources))
-        continue;
+      /* Wake up in time for the next report. This is rounded up so
+       * that the loop doesn’t wake up just before it is due. */
+      int64_t report_time = (mc->stall_detector->next_report_time + 999) / 1000;
 
-      int minutes_to_wait = bucket->minutes - bucket->minutes_passed;
-
-      if (minutes_to_wait < min_minutes)
-        min_minutes = minutes_to_wait;
+      if (report_time < next_time)
+        next_time = report_time;
     }
 
-  if (min_minutes == INT_MAX)
+  if (next_time == INT64_MAX)
     return -1;
 
-  elapsed = vsx_main_context_get_monotonic_clock (mc) - mc->last_timer_time;
-  elapsed_minutes = elapsed / 60000000;
+  int64_t now = get_monotonic_ms (mc);
 
-  /* If we've already waited enough time then don't wait any further time */
-  if (elapsed_minutes >= min_minutes)
+  if (next_time <= now)
     return 0;
 
-  /* Subtract the number of minutes we've already waited */
-  min_minutes -= (int) elapsed_minutes;
-
-  return (60000 - (elapsed / 1000 % 60000) + (min_minutes - 1) * 60000);
+  return MIN (next_time - now, INT_MAX);
 }
 
 static void
 check_timer_sources (VsxMainContext *mc)
 {
-  VsxMainContextBucket *bucket;
-  int64_t now;
-  int64_t elapsed_minutes;
+  int64_t now = get_monotonic_ms (mc);
+  VsxTimerWheelEntry *entry;
 
-  if (vsx_list_empty (&mc->buckets))
-    return;
+  /* The entry is taken out of the wheel before the callback is
+   * invoked so the callback is free to remove or reset any timer,
+   * including this one.
+   */
+  while ((entry = vsx_timer_wheel_pop_expired (&mc->timer_wheel, now)))
+    {
+      VsxMainContextSource *source =
+        vsx_container_of (entry, VsxMainContextSource, timer_entry);
 
-  now = vsx_main_context_get_monotonic_clock (mc);
-  elapsed_minutes = (now - mc->last_timer_time) / 60000000;
-  mc->last_timer_time += elapsed_minutes * 60000000;
+      if (source->timer_interval > 0)
+        {
+          /* Keep to the original schedule unless we’ve fallen more
+           * than a whole interval behind */
+          int64_t next_time = entry->expires + source->timer_interval;
 
-  if (elapsed_minutes < 1)
-    return;
+          if (next_time <= now)
+            next_time = now + source->timer_interval;
 
-  /* Collect all of the sources to emit into a list and mark them as
-   * busy. That way if they are removed they will just be marked as
-   * removed instead of actually modifying the bucket’s list. That way
-   * any timers can be removed as a result of invoking any callback.
-   */
-  struct vsx_list to_emit;
-  vsx_list_init (&to_emit);
+          vsx_timer_wheel_add (&mc->timer_wheel, entry, next_time);
+        }
+
+      VsxMainContextTimerCallback callback = source->callback;
+
+      DISPATCH_CALLBACK (mc,
+                         VSX_STALL_DETECTOR_TIMER,
+                         callback,
+                         callback (source, source->user_data));
+    }
+}
+
+static void
+start_iteration (VsxMainContext *mc)
+{
+  /* Once we've polled we can assume that some time has passed so our
+     cached values of the clocks are no longer valid */
+  mc->monotonic_time_valid = false;
+  mc->wall_time_valid = false;
 
-  vsx_list_for_each (bucket, &mc->buckets, link)
+  vsx_metrics_add (VSX_METRICS_WAKEUPS, 1);
+
+  if (vsx_metrics_enabled || mc->stall_detector)
     {
-      if (bucket->minutes_passed + elapsed_minutes >= bucket->minutes)
-        {
-          vsx_list_insert_list (&to_emit, &bucket->sources);
-          bucket->minutes_passed = 0;
-          vsx_list_init (&bucket->sources);
-        }
-      else
+      mc->iteration_start_time = vsx_main_context_get_monotonic_clock (mc);
+    }
+}
+
+static void
+log_stall_report (VsxMainContext *mc,
+                  int64_t now)
+{
+  struct vsx_buffer buffer = VSX_BUFFER_STATIC_INIT;
+
+  if (vsx_stall_detector_take_report (mc->stall_detector, now, &buffer))
+    {
+      /* Log each line separately so that they all get a prefix */
+      char *line = (char *) buffer.data;
+
+      while (true)
         {
-          bucket->minutes_passed += elapsed_minutes;
+          char *end = strchr (line, '\n');
+
+          if (end)
+            *end = '\0';
+
+          vsx_log ("%s", line);
+
+          if (end == NULL)
+            break;
+
+          line = end + 1;
         }
     }
 
-  VsxMainContextSource *source, *tmp_source;
+  vsx_buffer_destroy (&buffer);
+}
+
+/* This is called right before waiting so that the flush sources
+ * count as part of the iteration that triggered them */
+static void
+end_iteration (VsxMainContext *mc)
+{
+  if (mc->iteration_start_time == 0)
+    return;
 
-  vsx_list_for_each (source, &to_emit, timer_link)
+  int64_t now = vsx_metrics_get_time ();
+  int64_t duration = now - mc->iteration_start_time;
+
+  vsx_metrics_record (VSX_METRICS_LOOP_ITERATION, duration);
+
+  if (mc->stall_detector)
     {
-      source->busy = true;
+      vsx_stall_detector_record_iteration (mc->stall_detector, duration);
+
+      if (vsx_stall_detector_is_report_due (mc->stall_detector, now))
+        log_stall_report (mc, now);
     }
 
-  vsx_list_for_each (source, &to_emit, timer_link)
+  mc->iteration_start_time = 0;
+}
+
+#ifdef HAVE_IO_URING
+
+static void
+poll_uring (VsxMainContext *mc)
+{
+  run_flush_sources (mc);
+  flush_dirty_poll_sources (mc);
+  end_iteration (mc);
+
+  int ret = vsx_uring_submit_and_wait (&mc->ring, get_timeout (mc));
+
+  start_iteration (mc);
+
+  if (ret < 0 && ret != -EINTR && ret != -ETIME)
     {
-      if (source->removed)
-        continue;
-      VsxMainContextTimerCallback callback = source->callback;
-      callback (source, source->user_data);
+      vsx_warning ("io_uring_enter failed: %s", strerror (-ret));
+      return;
     }
 
-  vsx_list_for_each_safe (source, tmp_source, &to_emit, timer_link)
+  /* Only handle the completions that are already there. Re-arming a
+   * source that is still ready could otherwise keep adding more
+   * completions. */
+  unsigned n_completions = vsx_uring_cq_ready (&mc->ring);
+
+  for (unsigned i = 0; i < n_completions; i++)
     {
-      if (source->removed)
-        {
-          vsx_slice_free (&mc->source_allocator, source);
-        }
-      else
-        {
-          /* Remove from tmp_source before inserting into the bucket.
-           * Even though we are just going to discard the to_emit
-           * list, this is still important in order to have the
-           * correct links in the neighbouring nodes.
-           */
-          vsx_list_remove (&source->timer_link);
-          vsx_list_insert (&source->bucket->sources,
-                           &source->timer_link);
-          source->busy = false;
-        }
+      struct io_uring_cqe cqe;
+
+      vsx_uring_pop_cqe (&mc->ring, &cqe);
+      handle_uring_completion (mc, &cqe);
     }
+
+  check_timer_sources (mc);
 }
 
+#endif /* HAVE_IO_URING */
+
 void
 vsx_main_context_poll (VsxMainContext *mc)
 {
@@ -549,6 +1195,18 @@ vsx_main_context_poll (VsxMainContext *mc)
   if (mc == NULL)
     mc = vsx_main_context_get_default_or_abort ();
 
+#ifdef HAVE_IO_URING
+  if (mc->backend == VSX_MAIN_CONTEXT_BACKEND_IO_URING)
+    {
+      poll_uring (mc);
+      return;
+    }
+#endif
+
+  run_flush_sources (mc);
+  flush_dirty_poll_sources (mc);
+  end_iteration (mc);
+
   vsx_buffer_set_length (&mc->events,
                          mc->n_sources * sizeof (struct epoll_event));
 
@@ -557,9 +1215,7 @@ vsx_main_context_poll (VsxMainContext *mc)
                          mc->n_sources,
                          get_timeout (mc));
 
-  /* Once we've polled we can assume that some time has passed so our
-     cached value of the monotonic clock is no longer valid */
-  mc->monotonic_time_valid = false;
+  start_iteration (mc);
 
   if (n_events == -1)
     {
@@ -601,13 +1257,36 @@ vsx_main_context_poll (VsxMainContext *mc)
                 if (event->events & EPOLLERR)
                   flags |= VSX_MAIN_CONTEXT_POLL_ERROR;
 
-                callback (source, source->fd, flags, source->user_data);
+                /* The flags might have been modified since they were
+                 * last given to epoll */
+                flags &= source->current_flags | VSX_MAIN_CONTEXT_POLL_ERROR;
+
+                if (flags == 0)
+                  break;
+
+                /* The quit pipe only runs the quit sources, which are
+                 * timed separately */
+                if (source == mc->quit_pipe_source)
+                  {
+                    callback (source, source->fd, flags, source->user_data);
+                    break;
+                  }
+
+                DISPATCH_CALLBACK (mc,
+                                   VSX_STALL_DETECTOR_POLL,
+                                   callback,
+                                   callback (source,
+                                             source->fd,
+                                             flags,
+                                             source->user_data));
               }
               break;
 
             case VSX_MAIN_CONTEXT_QUIT_SOURCE:
+            case VSX_MAIN_CONTEXT_UPGRADE_SOURCE:
             case VSX_MAIN_CONTEXT_TIMER_SOURCE:
-              assert (!"Timer and quit sources shouldn’t be polled");
+            case VSX_MAIN_CONTEXT_FLUSH_SOURCE:
+              assert (!"Only poll sources should be polled");
               break;
             }
         }
@@ -641,16 +1320,24 @@ vsx_main_context_get_monotonic_clock (VsxMainContext *mc)
   return mc->monotonic_time;
 }
 
-static void
-free_buckets (VsxMainContext *mc)
+int64_t
+vsx_main_context_get_wall_clock (VsxMainContext *mc)
 {
-  VsxMainContextBucket *bucket, *tmp;
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
 
-  vsx_list_for_each_safe (bucket, tmp, &mc->buckets, link)
+  /* This is cached in the same way as the monotonic clock */
+  if (!mc->wall_time_valid)
     {
-      assert (vsx_list_empty (&bucket->sources));
-      vsx_free (bucket);
+      struct timespec ts;
+
+      clock_gettime (CLOCK_REALTIME, &ts);
+
+      mc->wall_time = ts.tv_sec;
+      mc->wall_time_valid = true;
     }
+
+  return mc->wall_time;
 }
 
 void
@@ -658,10 +1345,18 @@ vsx_main_context_free (VsxMainContext *mc)
 {
   assert (mc != NULL);
 
-  if (mc->quit_pipe_source)
+  if (mc->quit_handlers_installed)
     {
       signal (SIGINT, mc->old_int_handler);
       signal (SIGTERM, mc->old_term_handler);
+    }
+
+  if (mc->upgrade_handler_installed)
+    signal (SIGUSR2, mc->old_usr2_handler);
+
+  if (mc->quit_pipe_source)
+    {
+      vsx_main_context_quit_context = NULL;
       vsx_main_context_remove_source (mc->quit_pipe_source);
       close (mc->quit_pipe[0]);
       close (mc->quit_pipe[1]);
@@ -670,13 +1365,21 @@ vsx_main_context_free (VsxMainContext *mc)
   if (mc->n_sources > 0)
     vsx_warning ("Sources still remain on a main context that is being freed");
 
-  free_buckets (mc);
+#ifdef HAVE_IO_URING
+  if (mc->backend == VSX_MAIN_CONTEXT_BACKEND_IO_URING)
+    vsx_uring_destroy (&mc->ring);
+#endif
 
-  vsx_buffer_destroy (&mc->events);
-  close (mc->epoll_fd);
+  if (mc->backend == VSX_MAIN_CONTEXT_BACKEND_EPOLL)
+    {
+      vsx_buffer_destroy (&mc->events);
+      close (mc->epoll_fd);
+    }
 
   vsx_slice_allocator_destroy (&mc->source_allocator);
 
+  vsx_free (mc->stall_detector);
+
   vsx_free (mc);
 
   if (mc == vsx_main_context_default)
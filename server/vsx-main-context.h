@@ -19,6 +19,8 @@
 #ifndef VSX_MAIN_CONTEXT_H
 #define VSX_MAIN_CONTEXT_H
 
+#include <stdint.h>
+
 #include "vsx-error.h"
 
 typedef enum
@@ -34,6 +36,12 @@ typedef enum
   VSX_MAIN_CONTEXT_POLL_ERROR = 1 << 2,
 } VsxMainContextPollFlags;
 
+typedef enum
+{
+  VSX_MAIN_CONTEXT_BACKEND_EPOLL,
+  VSX_MAIN_CONTEXT_BACKEND_IO_URING,
+} VsxMainContextBackend;
+
 extern struct vsx_error_domain
 vsx_main_context_error;
 
@@ -53,12 +61,43 @@ typedef void (* VsxMainContextTimerCallback) (VsxMainContextSource *source,
 typedef void (* VsxMainContextQuitCallback) (VsxMainContextSource *source,
                                              void *user_data);
 
+typedef void (* VsxMainContextFlushCallback) (VsxMainContextSource *source,
+                                              void *user_data);
+
 VsxMainContext *
 vsx_main_context_new (struct vsx_error **error);
 
+/* If io_uring is requested but isn’t available then this will fall
+ * back to epoll. */
+VsxMainContext *
+vsx_main_context_new_for_backend (VsxMainContextBackend backend,
+                                  struct vsx_error **error);
+
+/* Sets the backend that vsx_main_context_new will use. This should be
+ * called before any threads are started. */
+void
+vsx_main_context_set_default_backend (VsxMainContextBackend backend);
+
+/* Makes every main context that is created afterwards time its
+ * callbacks. Any callback or iteration that takes longer than the
+ * threshold is recorded and a summary of the worst ones is logged
+ * every report_interval seconds. This should be called before any
+ * threads are started. */
+void
+vsx_main_context_set_stall_detection (int threshold_ms,
+                                      int report_interval);
+
+VsxMainContextBackend
+vsx_main_context_get_backend (VsxMainContext *mc);
+
 VsxMainContext *
 vsx_main_context_get_default (struct vsx_error **error);
 
+/* Returns the default main context for the calling thread without
+ * creating it, so this can be NULL */
+VsxMainContext *
+vsx_main_context_get_existing_default (void);
+
 VsxMainContextSource *
 vsx_main_context_add_poll (VsxMainContext *mc,
                            int fd,
@@ -66,21 +105,70 @@ vsx_main_context_add_poll (VsxMainContext *mc,
                            VsxMainContextPollCallback callback,
                            void *user_data);
 
+/* The change is only passed on to the kernel right before the next
+ * wait, so modifying a source several times during one iteration is
+ * cheap. */
 void
 vsx_main_context_modify_poll (VsxMainContextSource *source,
                               VsxMainContextPollFlags flags);
 
+/* Number of calls to vsx_main_context_modify_poll that didn’t need a
+ * system call because they were no-ops or were merged with another
+ * change */
+uint64_t
+vsx_main_context_get_n_poll_updates_avoided (VsxMainContext *mc);
+
 VsxMainContextSource *
 vsx_main_context_add_quit (VsxMainContext *mc,
                            VsxMainContextQuitCallback callback,
                            void *user_data);
 
+/* Adds a callback that is invoked when SIGUSR2 is received to ask
+ * the process to hand over to a new binary */
+VsxMainContextSource *
+vsx_main_context_add_upgrade (VsxMainContext *mc,
+                              VsxMainContextQuitCallback callback,
+                              void *user_data);
+
+/* Adds a callback that is invoked once per iteration of the loop
+ * after all of the events have been dispatched and right before it
+ * waits for more. This can be used to batch up work that was
+ * triggered by several events. The callback may remove its own
+ * source but not any other flush source. */
+VsxMainContextSource *
+vsx_main_context_add_flush (VsxMainContext *mc,
+                            VsxMainContextFlushCallback callback,
+                            void *user_data);
+
+/* Adds a timer that fires every given number of minutes */
 VsxMainContextSource *
 vsx_main_context_add_timer (VsxMainContext *mc,
                             int minutes,
                             VsxMainContextTimerCallback callback,
                             void *user_data);
 
+VsxMainContextSource *
+vsx_main_context_add_repeating_timer (VsxMainContext *mc,
+                                      int64_t interval_ms,
+                                      VsxMainContextTimerCallback callback,
+                                      void *user_data);
+
+/* Adds a timer that fires once after the delay. The source stays
+ * attached afterwards so it can be rearmed with
+ * vsx_main_context_reset_timer and it still needs to be removed. */
+VsxMainContextSource *
+vsx_main_context_add_timeout (VsxMainContext *mc,
+                              int64_t delay_ms,
+                              VsxMainContextTimerCallback callback,
+                              void *user_data);
+
+/* Reschedules a timer source to fire after the given delay from now.
+ * This works for both kinds of timer and is cheap enough to call
+ * every time a deadline is pushed back. */
+void
+vsx_main_context_reset_timer (VsxMainContextSource *source,
+                              int64_t delay_ms);
+
 void
 vsx_main_context_remove_source (VsxMainContextSource *source);
 
@@ -90,6 +178,11 @@ vsx_main_context_poll (VsxMainContext *mc);
 int64_t
 vsx_main_context_get_monotonic_clock (VsxMainContext *mc);
 
+/* Returns the time in seconds since the epoch. Like the monotonic
+ * clock, this is only read once per iteration of the main loop. */
+int64_t
+vsx_main_context_get_wall_clock (VsxMainContext *mc);
+
 void
 vsx_main_context_free (VsxMainContext *mc);
 
@@ -28,14 +28,17 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <assert.h>
+#include <limits.h>
 
 #ifdef USE_SYSTEMD
 #include <systemd/sd-daemon.h>
 #endif
 
 #include "vsx-server.h"
+#include "vsx-upgrade.h"
 #include "vsx-main-context.h"
 #include "vsx-log.h"
+#include "vsx-journal.h"
 #include "vsx-config.h"
 #include "vsx-buffer.h"
 #include "vsx-file-error.h"
@@ -177,13 +180,135 @@ load_config(struct vsx_error **error)
   return config;
 }
 
+static void
+add_upgrade_path (struct vsx_buffer *argv,
+                  const char *option,
+                  const char *path)
+{
+  /* The new process might not be started from the same directory */
+  char *full_path = realpath (path, NULL);
+
+  if (full_path == NULL)
+    full_path = vsx_strdup (path);
+
+  char *option_copy = vsx_strdup (option);
+
+  vsx_buffer_append (argv, &option_copy, sizeof option_copy);
+  vsx_buffer_append (argv, &full_path, sizeof full_path);
+}
+
+static void
+add_upgrade_arg (struct vsx_buffer *argv,
+                 const char *option,
+                 const char *value)
+{
+  char *option_copy = vsx_strdup (option);
+  char *value_copy = vsx_strdup (value);
+
+  vsx_buffer_append (argv, &option_copy, sizeof option_copy);
+  vsx_buffer_append (argv, &value_copy, sizeof value_copy);
+}
+
+static void
+set_upgrade_command (VsxServer *server)
+{
+  char exe[PATH_MAX];
+  ssize_t exe_length = readlink ("/proc/self/exe", exe, sizeof exe - 1);
+
+  if (exe_length == -1)
+    {
+      fprintf (stderr,
+               "Error getting the executable path, upgrades won’t be "
+               "possible: %s\n",
+               strerror (errno));
+      return;
+    }
+
+  exe[exe_length] = '\0';
+
+  /* The new process is started with the same options except that it
+   * doesn’t daemonize because it is already detached */
+  struct vsx_buffer argv = VSX_BUFFER_STATIC_INIT;
+  char *arg = vsx_strdup (exe);
+
+  vsx_buffer_append (&argv, &arg, sizeof arg);
+
+  if (option_config_file)
+    add_upgrade_path (&argv, "-c", option_config_file);
+  if (option_log_file)
+    add_upgrade_path (&argv, "-l", option_log_file);
+  if (option_user)
+    add_upgrade_arg (&argv, "-u", option_user);
+  if (option_group)
+    add_upgrade_arg (&argv, "-g", option_group);
+
+  arg = NULL;
+  vsx_buffer_append (&argv, &arg, sizeof arg);
+
+  char **args = (char **) argv.data;
+
+  vsx_server_set_upgrade_command (server, args);
+
+  for (char **p = args; *p; p++)
+    vsx_free (*p);
+
+  vsx_buffer_destroy (&argv);
+}
+
+static int
+get_n_shards (const VsxConfig *config)
+{
+  /* Zero means one shard per CPU */
+  if (config->shards == 0)
+    {
+      long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+      return n_cpus >= 1 ? n_cpus : 1;
+    }
+
+  return config->shards;
+}
+
+static bool
+receive_upgrade_sockets (int upgrade_fd,
+                         int n_sockets,
+                         VsxUpgradeState *state,
+                         struct vsx_error **error)
+{
+  if (!vsx_upgrade_receive_sockets (upgrade_fd, state, error))
+    return false;
+
+  int n_fds = vsx_upgrade_state_get_n_fds (state);
+
+  /* There can be an extra socket for the metrics endpoint */
+  if (n_fds != n_sockets && n_fds != n_sockets + 1)
+    {
+      vsx_set_error (error,
+                     &vsx_file_error,
+                     VSX_FILE_ERROR_BADF,
+                     "Wrong number of listening sockets received from the "
+                     "old process (expected: %i, got %i)",
+                     n_sockets,
+                     n_fds);
+      return false;
+    }
+
+  return true;
+}
+
+/* If upgrade_fd isn’t -1 then the listening sockets are received
+ * from the old process over it instead of from systemd */
 static VsxServer *
 create_server (VsxConfig *config,
+               int upgrade_fd,
                struct vsx_error **error)
 {
   assert (!vsx_list_empty (&config->servers));
 
   int override_fd = -1;
+  VsxUpgradeState upgrade_state;
+  int *upgrade_fds = NULL;
+
+  vsx_upgrade_state_init (&upgrade_state);
 
 #ifdef USE_SYSTEMD
   {
@@ -216,23 +341,131 @@ create_server (VsxConfig *config,
   }
 #endif /* USE_SYSTEMD */
 
-  VsxServer *server = vsx_server_new ();
+  if (upgrade_fd != -1)
+    {
+      if (!receive_upgrade_sockets (upgrade_fd,
+                                    vsx_list_length (&config->servers),
+                                    &upgrade_state,
+                                    error))
+        {
+          vsx_upgrade_state_destroy (&upgrade_state);
+          return NULL;
+        }
+
+      upgrade_fds = vsx_upgrade_state_get_fds (&upgrade_state);
+    }
+
+  VsxServer *server = vsx_server_new (get_n_shards (config));
+
+  vsx_server_set_n_handshake_threads (server, config->handshake_threads);
+
+  vsx_admission_set_limits (vsx_server_get_admission (server),
+                            config->max_connections,
+                            config->max_people,
+                            config->max_conversations,
+                            config->soft_limit);
+
+  vsx_server_set_address_limits (server,
+                                 config->address_table_size,
+                                 config->max_connections_per_address,
+                                 config->max_messages_per_second);
+
+  if (config->snapshot_file)
+    {
+      vsx_server_set_snapshot (server,
+                               config->snapshot_file,
+                               config->snapshot_interval);
+    }
 
   VsxConfigServer *server_config;
 
   vsx_list_for_each (server_config, &config->servers, link)
     {
-      if (!vsx_server_add_config (server, server_config, override_fd, error))
+      if (upgrade_fds)
         {
-          vsx_server_free (server);
-          return NULL;
+          override_fd = *upgrade_fds;
+          /* The server owns the socket now */
+          *(upgrade_fds++) = -1;
         }
 
+      if (!vsx_server_add_config (server, server_config, override_fd, error))
+        goto error;
+
       if (override_fd != -1)
         override_fd++;
     }
 
+  if (config->metrics_port != -1)
+    {
+      int metrics_fd = -1;
+
+      /* Take over the old process’s metrics socket if it had one.
+       * Otherwise it is left in the state to be closed. */
+      if (upgrade_fd != -1
+          && (vsx_upgrade_state_get_n_fds (&upgrade_state)
+              > vsx_list_length (&config->servers)))
+        {
+          metrics_fd = *upgrade_fds;
+          *upgrade_fds = -1;
+        }
+
+      if (!vsx_server_set_metrics_address (server,
+                                           config->metrics_address,
+                                           config->metrics_port,
+                                           metrics_fd,
+                                           error))
+        goto error;
+    }
+
+  /* Any listening sockets that weren’t used get closed here */
+  vsx_upgrade_state_destroy (&upgrade_state);
+
+  set_upgrade_command (server);
+
   return server;
+
+ error:
+  vsx_upgrade_state_destroy (&upgrade_state);
+
+  vsx_server_free (server);
+
+  return NULL;
+}
+
+/* Tells the old process that this one is ready and then takes over
+ * its state. This is done after everything else that can fail so that
+ * the old process can carry on if it doesn’t work. The socket is
+ * closed either way. */
+static bool
+take_over_upgrade (VsxServer *server,
+                   int upgrade_fd,
+                   int n_shards,
+                   struct vsx_error **error)
+{
+  VsxUpgradeState upgrade_state;
+  bool ret = false;
+
+  vsx_upgrade_state_init (&upgrade_state);
+
+  if (!vsx_upgrade_send_ready (upgrade_fd, n_shards, error)
+      || !vsx_upgrade_receive (upgrade_fd, &upgrade_state, error)
+      || !vsx_server_set_upgrade_state (server, &upgrade_state, error)
+      || !vsx_upgrade_send_ack (upgrade_fd, error))
+    goto out;
+
+#ifdef USE_SYSTEMD
+  /* Let systemd know that this process is taking over from the old
+   * one */
+  sd_notifyf (false, "MAINPID=%lu", (unsigned long) getpid ());
+#endif
+
+  ret = true;
+
+ out:
+  vsx_upgrade_state_destroy (&upgrade_state);
+  vsx_close (upgrade_fd);
+
+  return ret;
 }
 
 static void
@@ -328,6 +561,10 @@ main (int argc, char **argv)
   if (!process_arguments (argc, argv))
     return EXIT_FAILURE;
 
+  /* Set if this process was started by an old one that is
+   * upgrading */
+  int upgrade_fd = vsx_upgrade_get_fd ();
+
   struct vsx_error *error = NULL;
 
   config = load_config (&error);
@@ -339,6 +576,18 @@ main (int argc, char **argv)
       return EXIT_FAILURE;
     }
 
+  if (config->event_backend && !strcmp (config->event_backend, "io_uring"))
+    {
+      vsx_main_context_set_default_backend
+        (VSX_MAIN_CONTEXT_BACKEND_IO_URING);
+    }
+
+  if (config->stall_threshold != -1)
+    {
+      vsx_main_context_set_stall_detection (config->stall_threshold,
+                                            config->stall_report_interval);
+    }
+
   mc = vsx_main_context_get_default (&error);
 
   if (mc == NULL)
@@ -357,9 +606,18 @@ main (int argc, char **argv)
           fprintf (stderr, "Error setting log file: %s\n", error->message);
           vsx_error_free (error);
         }
+      else if (config->journal_file
+               && !vsx_journal_set_file (config->journal_file, &error))
+        {
+          fprintf (stderr,
+                   "Error setting journal file: %s\n",
+                   error->message);
+          vsx_error_free (error);
+          vsx_log_close ();
+        }
       else
         {
-          server = create_server (config, &error);
+          server = create_server (config, upgrade_fd, &error);
 
           if (server == NULL)
             {
@@ -378,22 +636,38 @@ main (int argc, char **argv)
               if (user)
                 set_user (user);
 
-              if (option_daemonize)
-                daemonize ();
-
-              vsx_log_start ();
-
-              if (!vsx_server_run (server, &error))
+              if (upgrade_fd != -1
+                  && !take_over_upgrade (server,
+                                         upgrade_fd,
+                                         get_n_shards (config),
+                                         &error))
                 {
-                  vsx_log ("%s", error->message);
+                  fprintf (stderr, "%s\n", error->message);
                   vsx_error_free (error);
                 }
+              else
+                {
+                  /* A process started for an upgrade is already
+                   * detached */
+                  if (option_daemonize && upgrade_fd == -1)
+                    daemonize ();
 
-              vsx_log ("Exiting...");
+                  vsx_log_start ();
+                  vsx_journal_start ();
+
+                  if (!vsx_server_run (server, &error))
+                    {
+                      vsx_log ("%s", error->message);
+                      vsx_error_free (error);
+                    }
+
+                  vsx_log ("Exiting...");
+                }
 
               vsx_server_free (server);
             }
 
+          vsx_journal_close ();
           vsx_log_close ();
         }
 
@@ -0,0 +1,327 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vsx-metrics.h"
+
+#include <pthread.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "vsx-util.h"
+
+bool
+vsx_metrics_enabled = false;
+
+__thread VsxMetricsThread *
+vsx_metrics_thread = NULL;
+
+static pthread_mutex_t
+threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct vsx_list
+threads = { &threads, &threads };
+
+/* Upper bounds of the histogram buckets in microseconds */
+static const int64_t
+bucket_bounds[VSX_METRICS_N_BUCKETS] = {
+  50, 100, 250, 500,
+  1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+  1000000,
+};
+
+static const char *const
+command_names[VSX_METRICS_N_COMMANDS] = {
+#define COMMAND(name) [VSX_PROTO_ ## name - VSX_METRICS_FIRST_COMMAND]
+  COMMAND (NEW_PLAYER) = "new_player",
+  COMMAND (RECONNECT) = "reconnect",
+  COMMAND (KEEP_ALIVE) = "keep_alive",
+  COMMAND (LEAVE) = "leave",
+  COMMAND (SEND_MESSAGE) = "send_message",
+  COMMAND (START_TYPING) = "start_typing",
+  COMMAND (STOP_TYPING) = "stop_typing",
+  COMMAND (MOVE_TILE) = "move_tile",
+  COMMAND (TURN) = "turn",
+  COMMAND (SHOUT) = "shout",
+  COMMAND (SET_N_TILES) = "set_n_tiles",
+  COMMAND (NEW_PRIVATE_GAME) = "new_private_game",
+  COMMAND (JOIN_GAME) = "join_game",
+  COMMAND (SET_LANGUAGE) = "set_language",
+#undef COMMAND
+};
+
+void
+vsx_metrics_enable (void)
+{
+  vsx_metrics_enabled = true;
+}
+
+VsxMetricsThread *
+vsx_metrics_create_thread (void)
+{
+  VsxMetricsThread *thread = vsx_calloc (sizeof *thread);
+
+  pthread_mutex_lock (&threads_mutex);
+  vsx_list_insert (threads.prev, &thread->link);
+  pthread_mutex_unlock (&threads_mutex);
+
+  return thread;
+}
+
+void
+vsx_metrics_record_histogram (VsxMetricsHistogram histogram,
+                              int64_t value)
+{
+  VsxMetricsHistogramData *data =
+    vsx_metrics_get_thread ()->histograms + histogram;
+  int bucket;
+
+  if (value < 0)
+    value = 0;
+
+  for (bucket = 0; bucket < VSX_METRICS_N_BUCKETS; bucket++)
+    {
+      if (value <= bucket_bounds[bucket])
+        break;
+    }
+
+  vsx_metrics_bump (data->buckets + bucket, 1);
+  vsx_metrics_bump (&data->sum, value);
+}
+
+int64_t
+vsx_metrics_get_time (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * INT64_C (1000000) + ts.tv_nsec / INT64_C (1000);
+}
+
+static void
+append_header (struct vsx_buffer *buffer,
+               const char *name,
+               const char *type,
+               const char *help)
+{
+  vsx_buffer_append_printf (buffer,
+                            "# HELP verda_sxtelo_%s %s\n"
+                            "# TYPE verda_sxtelo_%s %s\n",
+                            name, help,
+                            name, type);
+}
+
+void
+vsx_metrics_append_value (struct vsx_buffer *buffer,
+                          const char *name,
+                          const char *type,
+                          const char *help,
+                          int64_t value)
+{
+  append_header (buffer, name, type, help);
+  vsx_buffer_append_printf (buffer,
+                            "verda_sxtelo_%s %" PRIi64 "\n",
+                            name,
+                            value);
+}
+
+static void
+append_labelled_value (struct vsx_buffer *buffer,
+                       const char *name,
+                       const char *label,
+                       const char *label_value,
+                       int64_t value)
+{
+  vsx_buffer_append_printf (buffer,
+                            "verda_sxtelo_%s{%s=\"%s\"} %" PRIi64 "\n",
+                            name,
+                            label,
+                            label_value,
+                            value);
+}
+
+static void
+append_histogram (struct vsx_buffer *buffer,
+                  const char *name,
+                  const char *help,
+                  const uint64_t *buckets,
+                  uint64_t sum)
+{
+  append_header (buffer, name, "histogram", help);
+
+  uint64_t count = 0;
+
+  for (int i = 0; i < VSX_METRICS_N_BUCKETS; i++)
+    {
+      count += buckets[i];
+
+      vsx_buffer_append_printf (buffer,
+                                "verda_sxtelo_%s_bucket{le=\"%g\"} "
+                                "%" PRIu64 "\n",
+                                name,
+                                bucket_bounds[i] / 1e6,
+                                count);
+    }
+
+  count += buckets[VSX_METRICS_N_BUCKETS];
+
+  vsx_buffer_append_printf (buffer,
+                            "verda_sxtelo_%s_bucket{le=\"+Inf\"} "
+                            "%" PRIu64 "\n"
+                            "verda_sxtelo_%s_sum %.6f\n"
+                            "verda_sxtelo_%s_count %" PRIu64 "\n",
+                            name,
+                            count,
+                            name,
+                            sum / 1e6,
+                            name,
+                            count);
+}
+
+typedef struct
+{
+  uint64_t counters[VSX_METRICS_N_COUNTERS];
+  uint64_t commands[VSX_METRICS_N_COMMANDS];
+  struct
+  {
+    uint64_t buckets[VSX_METRICS_N_BUCKETS + 1];
+    uint64_t sum;
+  } histograms[VSX_METRICS_N_HISTOGRAMS];
+} Totals;
+
+static void
+add_thread_to_totals (Totals *totals,
+                      VsxMetricsThread *thread)
+{
+  for (int i = 0; i < VSX_METRICS_N_COUNTERS; i++)
+    {
+      totals->counters[i] += atomic_load_explicit (thread->counters + i,
+                                                   memory_order_relaxed);
+    }
+
+  for (int i = 0; i < VSX_METRICS_N_COMMANDS; i++)
+    {
+      totals->commands[i] += atomic_load_explicit (thread->commands + i,
+                                                   memory_order_relaxed);
+    }
+
+  for (int i = 0; i < VSX_METRICS_N_HISTOGRAMS; i++)
+    {
+      VsxMetricsHistogramData *data = thread->histograms + i;
+
+      for (int j = 0; j <= VSX_METRICS_N_BUCKETS; j++)
+        {
+          totals->histograms[i].buckets[j] +=
+            atomic_load_explicit (data->buckets + j, memory_order_relaxed);
+        }
+
+      totals->histograms[i].sum +=
+        atomic_load_explicit (&data->sum, memory_order_relaxed);
+    }
+}
+
+void
+vsx_metrics_append_all (struct vsx_buffer *buffer)
+{
+  Totals totals = { 0 };
+  VsxMetricsThread *thread;
+
+  pthread_mutex_lock (&threads_mutex);
+
+  vsx_list_for_each (thread, &threads, link)
+    add_thread_to_totals (&totals, thread);
+
+  pthread_mutex_unlock (&threads_mutex);
+
+  /* The gauges can be added and removed on different threads so
+   * they are only meaningful as a signed total */
+  const int64_t *gauges = (const int64_t *) totals.counters;
+
+  append_header (buffer,
+                 "connections",
+                 "gauge",
+                 "Open client connections");
+  append_labelled_value (buffer,
+                         "connections", "transport", "plain",
+                         gauges[VSX_METRICS_PLAIN_CONNECTIONS]);
+  append_labelled_value (buffer,
+                         "connections", "transport", "ssl",
+                         gauges[VSX_METRICS_SSL_CONNECTIONS]);
+
+  append_header (buffer,
+                 "conversations",
+                 "gauge",
+                 "Games in memory");
+  append_labelled_value (buffer,
+                         "conversations", "state", "awaiting_start",
+                         gauges[VSX_METRICS_AWAITING_START_CONVERSATIONS]);
+  append_labelled_value (buffer,
+                         "conversations", "state", "in_progress",
+                         gauges[VSX_METRICS_IN_PROGRESS_CONVERSATIONS]);
+
+  append_header (buffer,
+                 "commands_total",
+                 "counter",
+                 "Messages received from the clients");
+
+  for (int i = 0; i < VSX_METRICS_N_COMMANDS; i++)
+    {
+      if (command_names[i] == NULL)
+        continue;
+
+      append_labelled_value (buffer,
+                             "commands_total", "command", command_names[i],
+                             totals.commands[i]);
+    }
+
+  vsx_metrics_append_value (buffer,
+                            "received_bytes_total",
+                            "counter",
+                            "Bytes read from the clients after decryption",
+                            totals.counters[VSX_METRICS_BYTES_RECEIVED]);
+  vsx_metrics_append_value (buffer,
+                            "sent_bytes_total",
+                            "counter",
+                            "Bytes written to the clients before encryption",
+                            totals.counters[VSX_METRICS_BYTES_SENT]);
+  vsx_metrics_append_value (buffer,
+                            "wakeups_total",
+                            "counter",
+                            "Times that an event loop woke up",
+                            totals.counters[VSX_METRICS_WAKEUPS]);
+  vsx_metrics_append_value (buffer,
+                            "slow_callbacks_total",
+                            "counter",
+                            "Event loop callbacks that took longer than "
+                            "the stall threshold",
+                            totals.counters[VSX_METRICS_SLOW_CALLBACKS]);
+
+  append_histogram (buffer,
+                    "loop_iteration_seconds",
+                    "Time spent handling the events from each wakeup",
+                    totals.histograms[VSX_METRICS_LOOP_ITERATION].buckets,
+                    totals.histograms[VSX_METRICS_LOOP_ITERATION].sum);
+  append_histogram (buffer,
+                    "broadcast_latency_seconds",
+                    "Time from receiving a command to writing the "
+                    "change to each player",
+                    totals.histograms[VSX_METRICS_BROADCAST_LATENCY].buckets,
+                    totals.histograms[VSX_METRICS_BROADCAST_LATENCY].sum);
+}
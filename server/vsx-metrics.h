@@ -0,0 +1,208 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_METRICS_H
+#define VSX_METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "vsx-buffer.h"
+#include "vsx-list.h"
+#include "vsx-proto.h"
+
+/* Counters and histograms for the metrics endpoint. Each thread
+ * updates its own copy of the values so that recording something
+ * only needs a relaxed load and store and never has to share a cache
+ * line with another thread. The copies are added together when the
+ * metrics are read. A copy is kept after its thread exits so the
+ * totals never go backwards.
+ *
+ * Gauges are counted in the same way. A connection might be added on
+ * one thread and removed on another so only the total is meaningful.
+ *
+ * Nothing is recorded until vsx_metrics_enable is called so that the
+ * server doesn’t pay for it when the endpoint isn’t configured.
+ */
+
+typedef enum
+{
+  VSX_METRICS_PLAIN_CONNECTIONS,
+  VSX_METRICS_SSL_CONNECTIONS,
+  VSX_METRICS_AWAITING_START_CONVERSATIONS,
+  VSX_METRICS_IN_PROGRESS_CONVERSATIONS,
+  VSX_METRICS_BYTES_RECEIVED,
+  VSX_METRICS_BYTES_SENT,
+  /* Times that a main loop returned from waiting for events */
+  VSX_METRICS_WAKEUPS,
+  /* Callbacks that took longer than the stall detector’s threshold */
+  VSX_METRICS_SLOW_CALLBACKS,
+  VSX_METRICS_N_COUNTERS
+} VsxMetricsCounter;
+
+typedef enum
+{
+  /* Time that each iteration of a main loop spent dispatching events
+   * and flushing, not counting the time spent waiting */
+  VSX_METRICS_LOOP_ITERATION,
+  /* Time from when a command was received to when the change that
+   * it caused was written to the output of each connection that is
+   * following the conversation */
+  VSX_METRICS_BROADCAST_LATENCY,
+  VSX_METRICS_N_HISTOGRAMS
+} VsxMetricsHistogram;
+
+#define VSX_METRICS_FIRST_COMMAND VSX_PROTO_NEW_PLAYER
+#define VSX_METRICS_N_COMMANDS \
+  (VSX_PROTO_SET_LANGUAGE - VSX_METRICS_FIRST_COMMAND + 1)
+
+/* Number of buckets with an upper bound. There is an extra bucket
+ * for everything larger. */
+#define VSX_METRICS_N_BUCKETS 14
+
+typedef struct
+{
+  atomic_uint_fast64_t buckets[VSX_METRICS_N_BUCKETS + 1];
+  /* In microseconds */
+  atomic_uint_fast64_t sum;
+} VsxMetricsHistogramData;
+
+typedef struct
+{
+  struct vsx_list link;
+
+  atomic_uint_fast64_t counters[VSX_METRICS_N_COUNTERS];
+  atomic_uint_fast64_t commands[VSX_METRICS_N_COMMANDS];
+  VsxMetricsHistogramData histograms[VSX_METRICS_N_HISTOGRAMS];
+
+  /* Monotonic time of the command that is being processed by this
+   * thread, or zero if there isn’t one. Only the owning thread uses
+   * this. */
+  int64_t command_time;
+} VsxMetricsThread;
+
+extern bool
+vsx_metrics_enabled;
+
+extern __thread VsxMetricsThread *
+vsx_metrics_thread;
+
+/* Starts recording. This must be called before any other threads are
+ * started. */
+void
+vsx_metrics_enable (void);
+
+VsxMetricsThread *
+vsx_metrics_create_thread (void);
+
+static inline VsxMetricsThread *
+vsx_metrics_get_thread (void)
+{
+  if (vsx_metrics_thread == NULL)
+    vsx_metrics_thread = vsx_metrics_create_thread ();
+
+  return vsx_metrics_thread;
+}
+
+/* Only the owning thread modifies its values so this doesn’t need an
+ * atomic read-modify-write */
+static inline void
+vsx_metrics_bump (atomic_uint_fast64_t *value,
+                  uint64_t amount)
+{
+  atomic_store_explicit (value,
+                         atomic_load_explicit (value, memory_order_relaxed)
+                         + amount,
+                         memory_order_relaxed);
+}
+
+static inline void
+vsx_metrics_add (VsxMetricsCounter counter,
+                 int64_t amount)
+{
+  if (!vsx_metrics_enabled)
+    return;
+
+  vsx_metrics_bump (vsx_metrics_get_thread ()->counters + counter, amount);
+}
+
+static inline void
+vsx_metrics_count_command (int command)
+{
+  if (!vsx_metrics_enabled)
+    return;
+
+  unsigned index = command - VSX_METRICS_FIRST_COMMAND;
+
+  if (index < VSX_METRICS_N_COMMANDS)
+    vsx_metrics_bump (vsx_metrics_get_thread ()->commands + index, 1);
+}
+
+void
+vsx_metrics_record_histogram (VsxMetricsHistogram histogram,
+                              int64_t value);
+
+/* Adds a value in microseconds to a histogram */
+static inline void
+vsx_metrics_record (VsxMetricsHistogram histogram,
+                    int64_t value)
+{
+  if (vsx_metrics_enabled)
+    vsx_metrics_record_histogram (histogram, value);
+}
+
+/* Returns the monotonic clock in microseconds without the caching
+ * that the main context does */
+int64_t
+vsx_metrics_get_time (void);
+
+/* Sets the time that the command being processed on this thread was
+ * received so that anything it changes can be traced back to it. Zero
+ * means there is no command. */
+static inline void
+vsx_metrics_set_command_time (int64_t time)
+{
+  if (vsx_metrics_enabled)
+    vsx_metrics_get_thread ()->command_time = time;
+}
+
+static inline int64_t
+vsx_metrics_get_command_time (void)
+{
+  if (vsx_metrics_enabled)
+    return vsx_metrics_get_thread ()->command_time;
+  else
+    return 0;
+}
+
+/* Appends the Prometheus text for a single value along with its
+ * HELP and TYPE lines. The type should be “counter” or “gauge”. */
+void
+vsx_metrics_append_value (struct vsx_buffer *buffer,
+                          const char *name,
+                          const char *type,
+                          const char *help,
+                          int64_t value);
+
+/* Appends the Prometheus text for the values recorded by all of the
+ * threads */
+void
+vsx_metrics_append_all (struct vsx_buffer *buffer);
+
+#endif /* VSX_METRICS_H */
@@ -0,0 +1,208 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vsx-output-chain.h"
+
+#include <assert.h>
+
+#include "vsx-util.h"
+
+/* Maximum number of unused segments to keep per thread */
+#define VSX_OUTPUT_CHAIN_MAX_POOLED_SEGMENTS 64
+
+static __thread VsxOutputSegment *segment_pool = NULL;
+static __thread int n_pooled_segments = 0;
+
+static VsxOutputSegment *
+segment_new (void)
+{
+  VsxOutputSegment *segment;
+
+  if (segment_pool)
+    {
+      segment = segment_pool;
+      segment_pool = segment->next;
+      n_pooled_segments--;
+    }
+  else
+    {
+      segment = vsx_alloc (sizeof *segment);
+    }
+
+  segment->next = NULL;
+  segment->start = 0;
+  segment->end = 0;
+
+  return segment;
+}
+
+static void
+segment_free (VsxOutputSegment *segment)
+{
+  if (n_pooled_segments >= VSX_OUTPUT_CHAIN_MAX_POOLED_SEGMENTS)
+    {
+      vsx_free (segment);
+      return;
+    }
+
+  segment->next = segment_pool;
+  segment_pool = segment;
+  n_pooled_segments++;
+}
+
+void
+vsx_output_chain_init (VsxOutputChain *chain)
+{
+  chain->head = NULL;
+  chain->tail = NULL;
+  chain->length = 0;
+}
+
+uint8_t *
+vsx_output_chain_reserve (VsxOutputChain *chain,
+                          size_t min_space,
+                          size_t *space_out)
+{
+  assert (min_space <= VSX_OUTPUT_CHAIN_SEGMENT_SIZE);
+
+  VsxOutputSegment *tail = chain->tail;
+
+  if (tail == NULL)
+    {
+      tail = segment_new ();
+      chain->head = tail;
+      chain->tail = tail;
+    }
+  else if (VSX_OUTPUT_CHAIN_SEGMENT_SIZE - tail->end < min_space)
+    {
+      tail->next = segment_new ();
+      tail = tail->next;
+      chain->tail = tail;
+    }
+
+  *space_out = VSX_OUTPUT_CHAIN_SEGMENT_SIZE - tail->end;
+
+  return tail->data + tail->end;
+}
+
+void
+vsx_output_chain_commit (VsxOutputChain *chain,
+                         size_t length)
+{
+  assert (chain->tail);
+  assert (chain->tail->end + length <= VSX_OUTPUT_CHAIN_SEGMENT_SIZE);
+
+  chain->tail->end += length;
+  chain->length += length;
+}
+
+int
+vsx_output_chain_get_iovecs (const VsxOutputChain *chain,
+                             struct iovec *iovecs,
+                             int max_iovecs)
+{
+  int n_iovecs = 0;
+
+  for (const VsxOutputSegment *segment = chain->head;
+       segment && n_iovecs < max_iovecs;
+       segment = segment->next)
+    {
+      if (segment->end <= segment->start)
+        continue;
+
+      iovecs[n_iovecs].iov_base = (uint8_t *) segment->data + segment->start;
+      iovecs[n_iovecs].iov_len = segment->end - segment->start;
+      n_iovecs++;
+    }
+
+  return n_iovecs;
+}
+
+const uint8_t *
+vsx_output_chain_get_head (const VsxOutputChain *chain,
+                           size_t *length_out)
+{
+  if (chain->head == NULL)
+    {
+      *length_out = 0;
+      return NULL;
+    }
+
+  *length_out = chain->head->end - chain->head->start;
+
+  return chain->head->data + chain->head->start;
+}
+
+void
+vsx_output_chain_consume (VsxOutputChain *chain,
+                          size_t length)
+{
+  assert (length <= chain->length);
+
+  chain->length -= length;
+
+  while (chain->head)
+    {
+      VsxOutputSegment *head = chain->head;
+      size_t available = head->end - head->start;
+
+      if (length < available)
+        {
+          head->start += length;
+          break;
+        }
+
+      length -= available;
+
+      chain->head = head->next;
+
+      if (chain->head == NULL)
+        chain->tail = NULL;
+
+      segment_free (head);
+    }
+}
+
+void
+vsx_output_chain_destroy (VsxOutputChain *chain)
+{
+  VsxOutputSegment *segment, *next;
+
+  for (segment = chain->head; segment; segment = next)
+    {
+      next = segment->next;
+      segment_free (segment);
+    }
+
+  vsx_output_chain_init (chain);
+}
+
+void
+vsx_output_chain_clear_pool (void)
+{
+  while (segment_pool)
+    {
+      VsxOutputSegment *next = segment_pool->next;
+      vsx_free (segment_pool);
+      segment_pool = next;
+    }
+
+  n_pooled_segments = 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_OUTPUT_CHAIN_H
+#define VSX_OUTPUT_CHAIN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/* A queue of bytes waiting to be written to a socket. The data is
+ * stored in a singly-linked list of fixed-size segments so that it
+ * can grow without moving anything and it can be drained with a
+ * single writev. Segments that are no longer used are kept in a
+ * per-thread pool so that an idle connection doesn’t hold on to any
+ * memory for its output.
+ */
+
+/* Each segment can hold a whole TLS record */
+#define VSX_OUTPUT_CHAIN_SEGMENT_SIZE 16384
+
+typedef struct _VsxOutputSegment VsxOutputSegment;
+
+struct _VsxOutputSegment
+{
+  VsxOutputSegment *next;
+  /* Range of the data that hasn’t been consumed yet */
+  size_t start, end;
+  uint8_t data[VSX_OUTPUT_CHAIN_SEGMENT_SIZE];
+};
+
+typedef struct
+{
+  VsxOutputSegment *head, *tail;
+  size_t length;
+} VsxOutputChain;
+
+void
+vsx_output_chain_init (VsxOutputChain *chain);
+
+static inline size_t
+vsx_output_chain_get_length (const VsxOutputChain *chain)
+{
+  return chain->length;
+}
+
+/* Returns a pointer to the space at the end of the chain where data
+ * can be added. A new segment is added if the last one has less than
+ * min_space bytes available. The actual amount of space is returned
+ * in space_out. */
+uint8_t *
+vsx_output_chain_reserve (VsxOutputChain *chain,
+                          size_t min_space,
+                          size_t *space_out);
+
+/* Adds length bytes that were written to the space returned by
+ * vsx_output_chain_reserve */
+void
+vsx_output_chain_commit (VsxOutputChain *chain,
+                         size_t length);
+
+/* Fills in up to max_iovecs entries describing the start of the data
+ * and returns the number of entries used. */
+int
+vsx_output_chain_get_iovecs (const VsxOutputChain *chain,
+                             struct iovec *iovecs,
+                             int max_iovecs);
+
+/* Returns the data in the first segment */
+const uint8_t *
+vsx_output_chain_get_head (const VsxOutputChain *chain,
+                           size_t *length_out);
+
+/* Removes length bytes from the start of the chain. Segments that
+ * become empty are returned to the pool. */
+void
+vsx_output_chain_consume (VsxOutputChain *chain,
+                          size_t length);
+
+void
+vsx_output_chain_destroy (VsxOutputChain *chain);
+
+/* Frees the segments in the current thread’s pool. This should be
+ * called before a thread that used any chains exits. */
+void
+vsx_output_chain_clear_pool (void);
+
+#endif /* VSX_OUTPUT_CHAIN_H */
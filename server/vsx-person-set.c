@@ -25,18 +25,29 @@
 #include "vsx-list.h"
 #include "vsx-util.h"
 #include "vsx-hash-table.h"
-
-#define VSX_PERSON_SET_REMOVE_SILENT_PEOPLE_INTERVAL 5
+#include "vsx-shard.h"
 
 struct _VsxPersonSet
 {
   VsxObject parent;
 
+  /* All of the people use the same silence time so keeping this list
+   * in the order that they last made a noise also sorts it by the
+   * time they will become silent. */
   struct vsx_list people;
 
   struct vsx_hash_table hash_table;
 
+  /* One-shot timer for when the first person in the list will become
+   * silent. It only exists while the list isn’t empty. */
   VsxMainContextSource *people_timer_source;
+
+  int shard_num;
+  int n_shards;
+
+  /* Shared counters to keep track of the number of people. This can
+   * be NULL. */
+  VsxAdmission *admission;
 };
 
 static void
@@ -51,6 +62,9 @@ vsx_person_set_free (void *object)
   vsx_list_for_each_safe (person, tmp, &self->people, link)
     {
       vsx_object_unref (person);
+
+      if (self->admission)
+        vsx_admission_add_people (self->admission, -1);
     }
 
   if (self->people_timer_source)
@@ -73,39 +87,81 @@ remove_person (VsxPersonSet *set,
     vsx_person_leave_conversation (person);
 
   vsx_list_remove (&person->link);
+  /* Leave the link empty so that vsx_person_set_make_noise can tell
+   * that the person is no longer in the list */
+  vsx_list_init (&person->link);
 
   vsx_hash_table_remove (&set->hash_table, &person->hash_entry);
 
   vsx_object_unref (person);
+
+  if (set->admission)
+    vsx_admission_add_people (set->admission, -1);
 }
 
+static void
+schedule_people_timer (VsxPersonSet *set);
+
 static void
 remove_silent_people_timer_cb (VsxMainContextSource *source,
                                void *user_data)
 {
   VsxPersonSet *set = user_data;
 
-  /* This is probably relatively expensive because it has to iterate
-     the entire list of people, but it only happens infrequently so
-     hopefully it's not a problem */
+  /* Only the people at the start of the list can be silent */
+  while (!vsx_list_empty (&set->people))
+    {
+      VsxPerson *person =
+        vsx_container_of (set->people.next, VsxPerson, link);
 
-  VsxPerson *person, *tmp;
+      if (!vsx_person_is_silent (person))
+        break;
 
-  vsx_list_for_each_safe (person, tmp, &set->people, link)
-    {
-      if (vsx_person_is_silent (person))
-        remove_person (set, person);
+      remove_person (set, person);
     }
 
+  schedule_people_timer (set);
+}
+
+static void
+schedule_people_timer (VsxPersonSet *set)
+{
   if (vsx_list_empty (&set->people))
     {
-      vsx_main_context_remove_source (source);
-      set->people_timer_source = NULL;
+      if (set->people_timer_source)
+        {
+          vsx_main_context_remove_source (set->people_timer_source);
+          set->people_timer_source = NULL;
+        }
+
+      return;
+    }
+
+  VsxPerson *first = vsx_container_of (set->people.next, VsxPerson, link);
+  int64_t delay_us = (first->last_noise_time
+                      + VSX_PERSON_SILENCE_TIME
+                      - vsx_main_context_get_monotonic_clock (NULL));
+  /* Round up and add a millisecond because the person is only
+   * silent once the silence time has been exceeded */
+  int64_t delay_ms = MAX (delay_us, 0) / 1000 + 1;
+
+  if (set->people_timer_source)
+    {
+      vsx_main_context_reset_timer (set->people_timer_source, delay_ms);
+    }
+  else
+    {
+      set->people_timer_source =
+        vsx_main_context_add_timeout (NULL, /* default context */
+                                      delay_ms,
+                                      remove_silent_people_timer_cb,
+                                      set);
     }
 }
 
 VsxPersonSet *
-vsx_person_set_new (void)
+vsx_person_set_new_for_shard (int shard_num,
+                              int n_shards)
 {
   VsxPersonSet *self = vsx_calloc (sizeof *self);
 
@@ -115,9 +171,35 @@ vsx_person_set_new (void)
 
   vsx_hash_table_init (&self->hash_table);
 
+  self->shard_num = shard_num;
+  self->n_shards = n_shards;
+
   return self;
 }
 
+VsxPersonSet *
+vsx_person_set_new (void)
+{
+  return vsx_person_set_new_for_shard (0, /* shard_num */
+                                       1 /* n_shards */);
+}
+
+void
+vsx_person_set_set_admission (VsxPersonSet *set,
+                              VsxAdmission *admission)
+{
+  assert (set->admission == NULL);
+  assert (vsx_list_empty (&set->people));
+
+  set->admission = admission;
+}
+
+VsxAdmission *
+vsx_person_set_get_admission (VsxPersonSet *set)
+{
+  return set->admission;
+}
+
 VsxPerson *
 vsx_person_set_activate_person (VsxPersonSet *set,
                                 VsxPersonId id)
@@ -125,11 +207,29 @@ vsx_person_set_activate_person (VsxPersonSet *set,
   VsxPerson *person = vsx_person_set_get_person (set, id);
 
   if (person)
-    vsx_person_make_noise (person);
+    vsx_person_set_make_noise (set, person);
 
   return person;
 }
 
+void
+vsx_person_set_make_noise (VsxPersonSet *set,
+                           VsxPerson *person)
+{
+  vsx_person_make_noise (person);
+
+  /* A connection can still be holding a reference to a person that
+   * was already removed */
+  if (vsx_list_empty (&person->link))
+    return;
+
+  /* Move the person to the end of the list to keep it sorted. The
+   * timer doesn’t need to change because it only ever fires early
+   * when the first person moves and then it gets rescheduled. */
+  vsx_list_remove (&person->link);
+  vsx_list_insert (set->people.prev, &person->link);
+}
+
 VsxPerson *
 vsx_person_set_get_person (VsxPersonSet *set,
                            VsxPersonId id)
@@ -140,6 +240,24 @@ vsx_person_set_get_person (VsxPersonSet *set,
   return entry ? vsx_container_of (entry, VsxPerson, hash_entry) : NULL;
 }
 
+/* Takes ownership of the person */
+static void
+add_person (VsxPersonSet *set,
+            VsxPerson *person)
+{
+  /* The new person has made the most recent noise so they go at the
+   * end */
+  vsx_list_insert (set->people.prev, &person->link);
+
+  vsx_hash_table_add (&set->hash_table, &person->hash_entry);
+
+  if (set->admission)
+    vsx_admission_add_people (set->admission, 1);
+
+  if (set->people_timer_source == NULL)
+    schedule_people_timer (set);
+}
+
 VsxPerson *
 vsx_person_set_generate_person (VsxPersonSet *set,
                                 const char *player_name,
@@ -152,23 +270,61 @@ vsx_person_set_generate_person (VsxPersonSet *set,
   /* Keep generating ids until we find one that isn't used. It's
      hopefully pretty unlikely that it will generate a clash */
   do
-    id = vsx_generate_id (address);
+    id = vsx_shard_pin_id (vsx_generate_id (address),
+                           set->shard_num,
+                           set->n_shards);
   while (vsx_hash_table_get (&set->hash_table, id));
 
   person = vsx_person_new (id, player_name, conversation);
 
-  vsx_list_insert (&set->people, &person->link);
+  add_person (set, vsx_object_ref (person));
 
-  vsx_hash_table_add (&set->hash_table, &person->hash_entry);
+  return person;
+}
 
-  vsx_object_ref (person);
+bool
+vsx_person_set_add_person (VsxPersonSet *set,
+                           VsxPerson *person)
+{
+  VsxPersonId id = person->hash_entry.id;
 
-  if (set->people_timer_source == NULL)
-    set->people_timer_source =
-      vsx_main_context_add_timer (NULL, /* default context */
-                                  VSX_PERSON_SET_REMOVE_SILENT_PEOPLE_INTERVAL,
-                                  remove_silent_people_timer_cb,
-                                  set);
+  if (vsx_shard_for_id (id, set->n_shards) != set->shard_num
+      || vsx_hash_table_get (&set->hash_table, id))
+    return false;
 
-  return person;
+  vsx_person_make_noise (person);
+
+  add_person (set, vsx_object_ref (person));
+
+  return true;
+}
+
+void
+vsx_person_set_foreach (VsxPersonSet *set,
+                        VsxPersonSetForeachCb cb,
+                        void *user_data)
+{
+  VsxPerson *person;
+
+  vsx_list_for_each (person, &set->people, link)
+    cb (person, user_data);
+}
+
+void
+vsx_person_set_get_ids (VsxPersonSet *set,
+                        struct vsx_buffer *buffer)
+{
+  size_t start = buffer->length;
+
+  vsx_buffer_set_length (buffer,
+                         start
+                         + set->hash_table.n_entries * sizeof (VsxPersonId));
+
+  VsxPersonId *ids = (VsxPersonId *) (buffer->data + start);
+  struct vsx_hash_table_iter iter;
+
+  vsx_hash_table_iter_init (&iter, &set->hash_table);
+
+  while (vsx_hash_table_iter_next_id (&iter, ids))
+    ids++;
 }
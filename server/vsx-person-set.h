@@ -23,16 +23,42 @@
 #include "vsx-object.h"
 #include "vsx-main-context.h"
 #include "vsx-netaddress.h"
+#include "vsx-admission.h"
+#include "vsx-buffer.h"
 
 typedef struct _VsxPersonSet VsxPersonSet;
 
 VsxPersonSet *
 vsx_person_set_new (void);
 
+/* Creates a set for one shard of a sharded server. All of the people
+ * that it generates will have IDs that map to the given shard.
+ */
+VsxPersonSet *
+vsx_person_set_new_for_shard (int shard_num,
+                              int n_shards);
+
+/* Makes the set keep the shared count of people up to date. This
+ * must be called before any people are added. The connections also
+ * use it to find the limits. */
+void
+vsx_person_set_set_admission (VsxPersonSet *set,
+                              VsxAdmission *admission);
+
+VsxAdmission *
+vsx_person_set_get_admission (VsxPersonSet *set);
+
 VsxPerson *
 vsx_person_set_activate_person (VsxPersonSet *set,
                                 VsxPersonId id);
 
+/* Updates the last noise time of the person. This should be used
+ * instead of vsx_person_make_noise so that the set can keep track of
+ * when the person will become silent. */
+void
+vsx_person_set_make_noise (VsxPersonSet *set,
+                           VsxPerson *person);
+
 VsxPerson *
 vsx_person_set_get_person (VsxPersonSet *set,
                            VsxPersonId id);
@@ -43,4 +69,30 @@ vsx_person_set_generate_person (VsxPersonSet *set,
                                 const struct vsx_netaddress *address,
                                 VsxConversation *conversation);
 
+/* Adds an existing person to the set, for example one that was
+ * restored from a snapshot. The person is treated as if they had just
+ * made a noise. Returns false if the ID is already used or belongs to
+ * another shard. The set takes its own reference. */
+bool
+vsx_person_set_add_person (VsxPersonSet *set,
+                           VsxPerson *person);
+
+typedef void
+(* VsxPersonSetForeachCb) (VsxPerson *person,
+                           void *user_data);
+
+/* Calls the callback for every person in the set. The callback must
+ * not modify the set. */
+void
+vsx_person_set_foreach (VsxPersonSet *set,
+                        VsxPersonSetForeachCb cb,
+                        void *user_data);
+
+/* Appends the ID of every person in the set to the buffer as an
+ * array of VsxPersonId. Only the set’s index is read, so this is
+ * quick even with lots of people. */
+void
+vsx_person_set_get_ids (VsxPersonSet *set,
+                        struct vsx_buffer *buffer);
+
 #endif /* VSX_PERSON_SET_H */
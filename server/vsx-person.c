@@ -23,10 +23,6 @@
 #include "vsx-person.h"
 #include "vsx-main-context.h"
 
-/* Time in microseconds after the last request is sent on a person
-   before he/she is considered to be silent */
-#define VSX_PERSON_SILENCE_TIME (60 * 5 * (int64_t) 1000000)
-
 static void
 vsx_person_free (void *object)
 {
@@ -68,6 +64,26 @@ vsx_person_new (VsxPersonId id,
   return person;
 }
 
+VsxPerson *
+vsx_person_new_for_player (VsxPersonId id,
+                           VsxConversation *conversation,
+                           unsigned int player_num,
+                           unsigned int message_offset)
+{
+  VsxPerson *person = vsx_calloc (sizeof *person);
+
+  vsx_object_init (person, &vsx_person_class);
+
+  vsx_person_make_noise (person);
+
+  person->hash_entry.id = id;
+  person->conversation = vsx_object_ref (conversation);
+  person->message_offset = message_offset;
+  person->player = conversation->players[player_num];
+
+  return person;
+}
+
 void
 vsx_person_leave_conversation (VsxPerson *person)
 {
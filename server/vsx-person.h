@@ -28,6 +28,10 @@
 #include "vsx-list.h"
 #include "vsx-hash-table.h"
 
+/* Time in microseconds after the last request is sent on a person
+   before he/she is considered to be silent */
+#define VSX_PERSON_SILENCE_TIME (60 * 5 * (int64_t) 1000000)
+
 typedef uint64_t VsxPersonId;
 
 typedef struct _VsxPerson VsxPerson;
@@ -36,7 +40,8 @@ struct _VsxPerson
 {
   VsxObject parent;
 
-  /* Position in the global list of people */
+  /* Position in the set’s list of people. The list is kept in the
+   * order of last_noise_time. */
   struct vsx_list link;
 
   /* Used to implement the hash table */
@@ -60,6 +65,14 @@ vsx_person_new (VsxPersonId id,
                 const char *player_name,
                 VsxConversation *conversation);
 
+/* Creates a person for a player that is already in the conversation,
+ * for example when restoring a snapshot */
+VsxPerson *
+vsx_person_new_for_player (VsxPersonId id,
+                           VsxConversation *conversation,
+                           unsigned int player_num,
+                           unsigned int message_offset);
+
 void
 vsx_person_make_noise (VsxPerson *person);
 
@@ -0,0 +1,276 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vsx-random.h"
+
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef HAVE_GETRANDOM
+#include <sys/random.h>
+#endif
+
+#include "vsx-util.h"
+
+/* Number of ChaCha20 blocks to generate at a time */
+#define VSX_RANDOM_N_BLOCKS 8
+#define VSX_RANDOM_BUFFER_SIZE (VSX_RANDOM_N_BLOCKS * VSX_CHACHA20_BLOCK_SIZE)
+
+/* Number of times the buffer is refilled before the key is mixed with
+ * fresh data from the kernel */
+#define VSX_RANDOM_RESEED_INTERVAL 1024
+
+typedef struct
+{
+  bool seeded;
+  int refills_until_reseed;
+  uint8_t key[VSX_CHACHA20_KEY_SIZE];
+  /* The output that hasn’t been used yet is at the end of the buffer */
+  size_t buffer_pos;
+  uint8_t buffer[VSX_RANDOM_BUFFER_SIZE];
+} VsxRandomState;
+
+static __thread VsxRandomState random_state = {
+  .buffer_pos = VSX_RANDOM_BUFFER_SIZE,
+};
+
+static uint32_t
+rotate_left (uint32_t x,
+             int n)
+{
+  return (x << n) | (x >> (32 - n));
+}
+
+static void
+quarter_round (uint32_t *s,
+               int a,
+               int b,
+               int c,
+               int d)
+{
+  s[a] += s[b];
+  s[d] = rotate_left (s[d] ^ s[a], 16);
+  s[c] += s[d];
+  s[b] = rotate_left (s[b] ^ s[c], 12);
+  s[a] += s[b];
+  s[d] = rotate_left (s[d] ^ s[a], 8);
+  s[c] += s[d];
+  s[b] = rotate_left (s[b] ^ s[c], 7);
+}
+
+static uint32_t
+load_le32 (const uint8_t *p)
+{
+  return (p[0]
+          | ((uint32_t) p[1] << 8)
+          | ((uint32_t) p[2] << 16)
+          | ((uint32_t) p[3] << 24));
+}
+
+static void
+store_le32 (uint8_t *p,
+            uint32_t x)
+{
+  p[0] = x;
+  p[1] = x >> 8;
+  p[2] = x >> 16;
+  p[3] = x >> 24;
+}
+
+void
+vsx_chacha20_block (const uint8_t key[VSX_CHACHA20_KEY_SIZE],
+                    uint32_t counter,
+                    const uint8_t nonce[VSX_CHACHA20_NONCE_SIZE],
+                    uint8_t out[VSX_CHACHA20_BLOCK_SIZE])
+{
+  uint32_t input[16] = {
+    /* “expand 32-byte k” */
+    0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+  };
+
+  for (int i = 0; i < 8; i++)
+    input[4 + i] = load_le32 (key + i * 4);
+
+  input[12] = counter;
+
+  for (int i = 0; i < 3; i++)
+    input[13 + i] = load_le32 (nonce + i * 4);
+
+  uint32_t s[16];
+
+  memcpy (s, input, sizeof s);
+
+  for (int i = 0; i < 10; i++)
+    {
+      quarter_round (s, 0, 4, 8, 12);
+      quarter_round (s, 1, 5, 9, 13);
+      quarter_round (s, 2, 6, 10, 14);
+      quarter_round (s, 3, 7, 11, 15);
+      quarter_round (s, 0, 5, 10, 15);
+      quarter_round (s, 1, 6, 11, 12);
+      quarter_round (s, 2, 7, 8, 13);
+      quarter_round (s, 3, 4, 9, 14);
+    }
+
+  for (int i = 0; i < 16; i++)
+    store_le32 (out + i * 4, s[i] + input[i]);
+}
+
+static size_t
+get_kernel_random (void *buf,
+                   size_t size)
+{
+  size_t got = 0;
+
+#ifdef HAVE_GETRANDOM
+  while (got < size)
+    {
+      ssize_t r = getrandom ((uint8_t *) buf + got, size - got, 0);
+
+      if (r == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+
+      got += r;
+    }
+#endif
+
+  /* Fall back to the device if getrandom isn’t available */
+  if (got < size)
+    {
+      int fd = open ("/dev/urandom", O_RDONLY | O_CLOEXEC);
+
+      if (fd != -1)
+        {
+          ssize_t r = read (fd, (uint8_t *) buf + got, size - got);
+
+          if (r > 0)
+            got += r;
+
+          vsx_close (fd);
+        }
+    }
+
+  return got;
+}
+
+static void
+reseed (VsxRandomState *state)
+{
+  uint8_t seed[VSX_CHACHA20_KEY_SIZE];
+  size_t got = get_kernel_random (seed, sizeof seed);
+
+  /* Mix the new data into the existing key so that a failure can’t
+   * make it any weaker than it already was */
+  for (size_t i = 0; i < got; i++)
+    state->key[i] ^= seed[i];
+
+  if (got >= sizeof seed)
+    {
+      state->seeded = true;
+      state->refills_until_reseed = VSX_RANDOM_RESEED_INTERVAL;
+    }
+  else
+    {
+      /* This is probably because there are no file descriptors left.
+       * Use rand() for now like the ID generator used to and try
+       * again on the next refill.
+       */
+      for (size_t i = got; i < sizeof seed; i++)
+        state->key[i] ^= rand ();
+
+      state->refills_until_reseed = 1;
+    }
+
+  memset (seed, 0, sizeof seed);
+}
+
+static void
+refill (VsxRandomState *state)
+{
+  if (!state->seeded || --state->refills_until_reseed <= 0)
+    reseed (state);
+
+  static const uint8_t nonce[VSX_CHACHA20_NONCE_SIZE] = { 0 };
+
+  for (int i = 0; i < VSX_RANDOM_N_BLOCKS; i++)
+    {
+      vsx_chacha20_block (state->key,
+                          i,
+                          nonce,
+                          state->buffer + i * VSX_CHACHA20_BLOCK_SIZE);
+    }
+
+  /* Use the start of the output as the next key and throw it away */
+  memcpy (state->key, state->buffer, sizeof state->key);
+  memset (state->buffer, 0, sizeof state->key);
+  state->buffer_pos = sizeof state->key;
+}
+
+void
+vsx_random_fill (void *buf,
+                 size_t size)
+{
+  VsxRandomState *state = &random_state;
+  uint8_t *p = buf;
+
+  while (size > 0)
+    {
+      if (state->buffer_pos >= VSX_RANDOM_BUFFER_SIZE)
+        refill (state);
+
+      size_t to_copy = MIN (size, VSX_RANDOM_BUFFER_SIZE - state->buffer_pos);
+
+      memcpy (p, state->buffer + state->buffer_pos, to_copy);
+      /* Don’t leave output that has been used in memory */
+      memset (state->buffer + state->buffer_pos, 0, to_copy);
+
+      state->buffer_pos += to_copy;
+      p += to_copy;
+      size -= to_copy;
+    }
+}
+
+uint64_t
+vsx_random_uint64 (void)
+{
+  VsxRandomState *state = &random_state;
+  uint64_t value;
+
+  /* Fast path with a fixed size so that the copies get inlined */
+  if (state->buffer_pos + sizeof value <= VSX_RANDOM_BUFFER_SIZE)
+    {
+      memcpy (&value, state->buffer + state->buffer_pos, sizeof value);
+      memset (state->buffer + state->buffer_pos, 0, sizeof value);
+      state->buffer_pos += sizeof value;
+    }
+  else
+    {
+      vsx_random_fill (&value, sizeof value);
+    }
+
+  return value;
+}
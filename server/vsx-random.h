@@ -0,0 +1,51 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_RANDOM_H
+#define VSX_RANDOM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* A cryptographically secure random number generator for each thread.
+ * It is ChaCha20 with a key from getrandom. The output is generated
+ * several blocks at a time and the first part of each batch replaces
+ * the key so that the earlier output can’t be recovered from the
+ * state. The key is also refreshed from the kernel every so often.
+ */
+
+#define VSX_CHACHA20_KEY_SIZE 32
+#define VSX_CHACHA20_NONCE_SIZE 12
+#define VSX_CHACHA20_BLOCK_SIZE 64
+
+/* Generates one block of the ChaCha20 stream as described in RFC
+ * 8439 */
+void
+vsx_chacha20_block (const uint8_t key[VSX_CHACHA20_KEY_SIZE],
+                    uint32_t counter,
+                    const uint8_t nonce[VSX_CHACHA20_NONCE_SIZE],
+                    uint8_t out[VSX_CHACHA20_BLOCK_SIZE]);
+
+void
+vsx_random_fill (void *buf,
+                 size_t size);
+
+uint64_t
+vsx_random_uint64 (void);
+
+#endif /* VSX_RANDOM_H */
@@ -0,0 +1,1028 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Plays back a journal recorded by the server with the journal_file
+ * option. The commands are fed to connections in an in-process
+ * server with a single shard, either with the same timing as they
+ * were recorded or as fast as possible. The player and conversation
+ * IDs that the server generates will be different from the recorded
+ * ones so the tool keeps track of the IDs that each connection
+ * receives and rewrites the commands that refer to them.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "vsx-journal.h"
+#include "vsx-connection.h"
+#include "vsx-main-context.h"
+#include "vsx-hash-table.h"
+#include "vsx-proto.h"
+#include "vsx-buffer.h"
+#include "vsx-list.h"
+#include "vsx-util.h"
+
+typedef struct
+{
+  struct vsx_hash_table_entry hash_entry;
+  uint64_t new_id;
+} IdMapping;
+
+typedef struct _Replay Replay;
+
+typedef struct
+{
+  /* The ID is the connection ID from the journal */
+  struct vsx_hash_table_entry hash_entry;
+
+  Replay *replay;
+
+  VsxConnection *conn;
+  struct vsx_listener changed_listener;
+
+  /* Link in the list of connections that have output waiting */
+  struct vsx_list dirty_link;
+  bool dirty;
+
+  /* Data received from the connection that hasn’t been parsed yet */
+  struct vsx_buffer output;
+  bool negotiated;
+
+  /* The last IDs sent to the connection */
+  uint64_t person_id;
+  uint64_t conversation_id;
+
+  /* The connection was closed because of an error */
+  bool failed;
+} ReplayConnection;
+
+struct _Replay
+{
+  VsxMainContext *mc;
+  VsxConversationSet *conversation_set;
+  VsxPersonSet *person_set;
+  struct vsx_netaddress socket_address;
+
+  struct vsx_hash_table connections;
+  struct vsx_list dirty_connections;
+
+  /* Maps from the recorded IDs to the ones in this server */
+  struct vsx_hash_table person_ids;
+  struct vsx_hash_table conversation_ids;
+
+  /* Timing for replaying in real time */
+  VsxMainContextSource *timer;
+  bool timer_fired;
+  int64_t start_time;
+  /* Added to the timestamps to account for the previous journals in
+   * the same file */
+  uint64_t journal_offset;
+  uint64_t last_timestamp;
+
+  /* Time taken to process each command in nanoseconds */
+  struct vsx_buffer latencies;
+
+  uint64_t n_records;
+  uint64_t n_dropped;
+  uint64_t n_errors;
+  uint64_t n_bad_ids;
+  uint64_t n_frames_received;
+  uint64_t n_bytes_received;
+};
+
+static char
+ws_request[] =
+  "GET / HTTP/1.1\r\n"
+  "Sec-WebSocket-Key: potato\r\n"
+  "\r\n";
+
+static const char options[] = "-hm";
+
+static bool option_max_speed = false;
+static const char *option_journal = NULL;
+
+static void
+usage (void)
+{
+  printf ("vsx-replay - Plays back a journal recorded by verda-sxtelo\n"
+          "usage: vsx-replay [options]... <journal>\n"
+          " -h                   Show this help message\n"
+          " -m                   Replay at maximum speed instead of\n"
+          "                      with the recorded timing. The\n"
+          "                      server’s clock doesn’t advance in\n"
+          "                      this mode.\n");
+}
+
+static bool
+process_arguments (int argc, char **argv)
+{
+  int opt;
+
+  opterr = false;
+
+  while ((opt = getopt (argc, argv, options)) != -1)
+    {
+      switch (opt)
+        {
+        case ':':
+        case '?':
+          fprintf (stderr,
+                   "invalid option '%c'\n",
+                   optopt);
+          return false;
+
+        case '\1':
+          if (option_journal)
+            {
+              fprintf (stderr,
+                       "unexpected argument \"%s\"\n",
+                       optarg);
+              return false;
+            }
+          option_journal = optarg;
+          break;
+
+        case 'h':
+          usage ();
+          return false;
+
+        case 'm':
+          option_max_speed = true;
+          break;
+        }
+    }
+
+  if (option_journal == NULL)
+    {
+      usage ();
+      return false;
+    }
+
+  return true;
+}
+
+static int64_t
+get_time_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * INT64_C (1000000000) + ts.tv_nsec;
+}
+
+static bool
+load_journal (const char *filename,
+              struct vsx_buffer *buffer)
+{
+  FILE *file = fopen (filename, "rb");
+
+  if (file == NULL)
+    {
+      fprintf (stderr, "%s: %s\n", filename, strerror (errno));
+      return false;
+    }
+
+  while (true)
+    {
+      vsx_buffer_ensure_size (buffer, buffer->length + 65536);
+
+      size_t got = fread (buffer->data + buffer->length,
+                          1,
+                          buffer->size - buffer->length,
+                          file);
+
+      if (got == 0)
+        break;
+
+      buffer->length += got;
+    }
+
+  bool ret = !ferror (file);
+
+  if (!ret)
+    fprintf (stderr, "%s: %s\n", filename, strerror (errno));
+
+  fclose (file);
+
+  return ret;
+}
+
+static uint64_t
+map_id (struct vsx_hash_table *table,
+        uint64_t id)
+{
+  struct vsx_hash_table_entry *entry = vsx_hash_table_get (table, id);
+
+  if (entry == NULL)
+    return id;
+
+  IdMapping *mapping = vsx_container_of (entry, IdMapping, hash_entry);
+
+  return mapping->new_id;
+}
+
+static void
+set_mapping (struct vsx_hash_table *table,
+             uint64_t old_id,
+             uint64_t new_id)
+{
+  struct vsx_hash_table_entry *entry = vsx_hash_table_get (table, old_id);
+  IdMapping *mapping;
+
+  if (entry)
+    {
+      mapping = vsx_container_of (entry, IdMapping, hash_entry);
+    }
+  else
+    {
+      mapping = vsx_alloc (sizeof *mapping);
+      mapping->hash_entry.id = old_id;
+      vsx_hash_table_add (table, &mapping->hash_entry);
+    }
+
+  mapping->new_id = new_id;
+}
+
+static void
+free_mappings (struct vsx_hash_table *table)
+{
+  struct vsx_hash_table_iter iter;
+  struct vsx_hash_table_entry *entry;
+
+  vsx_hash_table_iter_init (&iter, table);
+
+  while ((entry = vsx_hash_table_iter_next (&iter)))
+    vsx_free (vsx_container_of (entry, IdMapping, hash_entry));
+
+  vsx_hash_table_destroy (table);
+}
+
+static void
+changed_cb (struct vsx_listener *listener,
+            void *data)
+{
+  ReplayConnection *rc =
+    vsx_container_of (listener, ReplayConnection, changed_listener);
+  Replay *replay = rc->replay;
+
+  if (rc->dirty)
+    return;
+
+  rc->dirty = true;
+  vsx_list_insert (replay->dirty_connections.prev, &rc->dirty_link);
+}
+
+static void
+handle_server_message (Replay *replay,
+                       ReplayConnection *rc,
+                       const uint8_t *payload,
+                       size_t length)
+{
+  if (length < 1)
+    return;
+
+  /* These would mean that an ID wasn’t rewritten properly or that
+   * the server behaved differently from when it was recorded */
+  if (payload[0] == VSX_PROTO_BAD_PLAYER_ID
+      || payload[0] == VSX_PROTO_BAD_CONVERSATION_ID)
+    {
+      replay->n_bad_ids++;
+      return;
+    }
+
+  if (length < 1 + sizeof (uint64_t))
+    return;
+
+  switch (payload[0])
+    {
+    case VSX_PROTO_PLAYER_ID:
+      rc->person_id = vsx_proto_read_uint64_t (payload + 1);
+      break;
+    case VSX_PROTO_CONVERSATION_ID:
+      rc->conversation_id = vsx_proto_read_uint64_t (payload + 1);
+      break;
+    }
+}
+
+static void
+parse_output (Replay *replay,
+              ReplayConnection *rc)
+{
+  uint8_t *p = rc->output.data;
+  uint8_t *end = p + rc->output.length;
+
+  if (!rc->negotiated)
+    {
+      /* Skip the HTTP response */
+      while (true)
+        {
+          if (end - p < 4)
+            return;
+
+          if (!memcmp (p, "\r\n\r\n", 4))
+            break;
+
+          p++;
+        }
+
+      p += 4;
+      rc->negotiated = true;
+    }
+
+  while (end - p >= 2)
+    {
+      uint64_t payload_length = p[1] & 0x7f;
+      size_t header_length = 2;
+
+      if (payload_length == 126)
+        {
+          if (end - p < 4)
+            break;
+          payload_length = (p[2] << 8) | p[3];
+          header_length = 4;
+        }
+      else if (payload_length == 127)
+        {
+          if (end - p < 10)
+            break;
+          payload_length = 0;
+          for (int i = 0; i < 8; i++)
+            payload_length = (payload_length << 8) | p[2 + i];
+          header_length = 10;
+        }
+
+      if (end - p - header_length < payload_length)
+        break;
+
+      /* Only look at binary frames */
+      if ((p[0] & 0x0f) == 0x2)
+        {
+          handle_server_message (replay,
+                                 rc,
+                                 p + header_length,
+                                 payload_length);
+        }
+
+      replay->n_frames_received++;
+      p += header_length + payload_length;
+    }
+
+  size_t remaining = end - p;
+
+  memmove (rc->output.data, p, remaining);
+  vsx_buffer_set_length (&rc->output, remaining);
+}
+
+static void
+read_output (Replay *replay,
+             ReplayConnection *rc)
+{
+  while (true)
+    {
+      vsx_buffer_ensure_size (&rc->output, rc->output.length + 4096);
+
+      size_t got =
+        vsx_connection_fill_output_buffer (rc->conn,
+                                           rc->output.data
+                                           + rc->output.length,
+                                           rc->output.size
+                                           - rc->output.length);
+
+      if (got == 0)
+        break;
+
+      rc->output.length += got;
+      replay->n_bytes_received += got;
+    }
+
+  parse_output (replay, rc);
+}
+
+static void
+flush_dirty_connections (Replay *replay)
+{
+  while (!vsx_list_empty (&replay->dirty_connections))
+    {
+      ReplayConnection *rc =
+        vsx_container_of (replay->dirty_connections.next,
+                          ReplayConnection,
+                          dirty_link);
+
+      vsx_list_remove (&rc->dirty_link);
+      rc->dirty = false;
+
+      read_output (replay, rc);
+    }
+}
+
+static void
+report_error (Replay *replay,
+              ReplayConnection *rc,
+              struct vsx_error *error)
+{
+  fprintf (stderr,
+           "Connection %" PRIu64 ": %s\n",
+           rc->hash_entry.id,
+           error->message);
+  vsx_error_free (error);
+
+  rc->failed = true;
+  replay->n_errors++;
+}
+
+static void
+free_connection (Replay *replay,
+                 ReplayConnection *rc)
+{
+  vsx_hash_table_remove (&replay->connections, &rc->hash_entry);
+
+  if (rc->dirty)
+    vsx_list_remove (&rc->dirty_link);
+
+  vsx_list_remove (&rc->changed_listener.link);
+  vsx_connection_free (rc->conn);
+  vsx_buffer_destroy (&rc->output);
+
+  vsx_free (rc);
+}
+
+static ReplayConnection *
+get_connection (Replay *replay,
+                uint64_t id)
+{
+  struct vsx_hash_table_entry *entry =
+    vsx_hash_table_get (&replay->connections, id);
+
+  if (entry == NULL)
+    return NULL;
+
+  return vsx_container_of (entry, ReplayConnection, hash_entry);
+}
+
+static void
+handle_connect (Replay *replay,
+                const VsxJournalRecord *record)
+{
+  ReplayConnection *rc = get_connection (replay, record->connection_id);
+
+  /* A journal appended after a restart will reuse the IDs */
+  if (rc)
+    free_connection (replay, rc);
+
+  rc = vsx_calloc (sizeof *rc);
+
+  rc->replay = replay;
+  rc->hash_entry.id = record->connection_id;
+  vsx_hash_table_add (&replay->connections, &rc->hash_entry);
+
+  vsx_buffer_init (&rc->output);
+
+  rc->conn = vsx_connection_new (&replay->socket_address,
+                                 replay->conversation_set,
+                                 replay->person_set);
+
+  rc->changed_listener.notify = changed_cb;
+  vsx_signal_add (vsx_connection_get_changed_signal (rc->conn),
+                  &rc->changed_listener);
+
+  struct vsx_error *error = NULL;
+
+  if (!vsx_connection_parse_data (rc->conn,
+                                  (const uint8_t *) ws_request,
+                                  (sizeof ws_request) - 1,
+                                  &error))
+    report_error (replay, rc, error);
+
+  read_output (replay, rc);
+}
+
+static void
+handle_command (Replay *replay,
+                const VsxJournalRecord *record)
+{
+  ReplayConnection *rc = get_connection (replay, record->connection_id);
+
+  /* The connection might be missing if the CONNECT record was
+   * dropped */
+  if (rc == NULL || rc->failed || record->payload_length < 1)
+    return;
+
+  uint8_t frame[4 + VSX_PROTO_MAX_PAYLOAD_SIZE];
+  size_t payload_length = record->payload_length;
+  size_t header_length;
+
+  if (payload_length > VSX_PROTO_MAX_PAYLOAD_SIZE)
+    return;
+
+  frame[0] = 0x82;
+
+  if (payload_length < 126)
+    {
+      frame[1] = payload_length;
+      header_length = 2;
+    }
+  else
+    {
+      frame[1] = 126;
+      frame[2] = payload_length >> 8;
+      frame[3] = payload_length;
+      header_length = 4;
+    }
+
+  uint8_t *payload = frame + header_length;
+
+  memcpy (payload, record->payload, payload_length);
+
+  /* Rewrite the IDs that the server will have generated differently */
+  if (payload_length >= 1 + sizeof (uint64_t))
+    {
+      switch (payload[0])
+        {
+        case VSX_PROTO_RECONNECT:
+          vsx_proto_write_uint64_t (payload + 1,
+                                    map_id (&replay->person_ids,
+                                            vsx_proto_read_uint64_t
+                                            (payload + 1)));
+          break;
+        case VSX_PROTO_JOIN_GAME:
+          vsx_proto_write_uint64_t (payload + 1,
+                                    map_id (&replay->conversation_ids,
+                                            vsx_proto_read_uint64_t
+                                            (payload + 1)));
+          break;
+        }
+    }
+
+  struct vsx_error *error = NULL;
+  int64_t start = get_time_ns ();
+
+  if (!vsx_connection_parse_data (rc->conn,
+                                  frame,
+                                  header_length + payload_length,
+                                  &error))
+    report_error (replay, rc, error);
+
+  read_output (replay, rc);
+  flush_dirty_connections (replay);
+
+  int64_t latency = get_time_ns () - start;
+
+  vsx_buffer_append (&replay->latencies, &latency, sizeof latency);
+
+  if (record->conversation_id && rc->conversation_id)
+    {
+      set_mapping (&replay->conversation_ids,
+                   record->conversation_id,
+                   rc->conversation_id);
+    }
+}
+
+static void
+handle_person (Replay *replay,
+               const VsxJournalRecord *record)
+{
+  ReplayConnection *rc = get_connection (replay, record->connection_id);
+
+  if (rc == NULL
+      || rc->person_id == 0
+      || record->payload_length != sizeof (uint64_t))
+    return;
+
+  set_mapping (&replay->person_ids,
+               vsx_proto_read_uint64_t (record->payload),
+               rc->person_id);
+}
+
+static void
+handle_disconnect (Replay *replay,
+                   const VsxJournalRecord *record)
+{
+  ReplayConnection *rc = get_connection (replay, record->connection_id);
+
+  if (rc)
+    free_connection (replay, rc);
+
+  flush_dirty_connections (replay);
+}
+
+static void
+handle_dropped (Replay *replay,
+                const VsxJournalRecord *record)
+{
+  uint64_t n_dropped = 0;
+
+  for (size_t i = 0; i < record->payload_length && i < 10; i++)
+    {
+      n_dropped |= (uint64_t) (record->payload[i] & 0x7f) << (i * 7);
+
+      if ((record->payload[i] & 0x80) == 0)
+        break;
+    }
+
+  replay->n_dropped += n_dropped;
+}
+
+static void
+timer_cb (VsxMainContextSource *source,
+          void *user_data)
+{
+  Replay *replay = user_data;
+
+  replay->timer_fired = true;
+}
+
+static void
+wait_for_record (Replay *replay,
+                 uint64_t timestamp)
+{
+  int64_t target = replay->start_time + replay->journal_offset + timestamp;
+
+  while (true)
+    {
+      int64_t delay_us = (target
+                          - vsx_main_context_get_monotonic_clock
+                          (replay->mc));
+
+      if (delay_us <= 0)
+        break;
+
+      /* Run the main context in the meantime so that the server’s
+       * timers still fire */
+      replay->timer_fired = false;
+      vsx_main_context_reset_timer (replay->timer,
+                                    (delay_us + 999) / 1000);
+
+      while (!replay->timer_fired)
+        vsx_main_context_poll (replay->mc);
+    }
+}
+
+static void
+handle_record (Replay *replay,
+               const VsxJournalRecord *record)
+{
+  replay->n_records++;
+
+  if (record->type == VSX_JOURNAL_RECORD_START)
+    {
+      /* Carry on from the end of the previous journal */
+      replay->journal_offset += replay->last_timestamp;
+      replay->last_timestamp = 0;
+      return;
+    }
+
+  /* The dropped records are written by the writer thread so they
+   * can be out of order */
+  if (record->type != VSX_JOURNAL_RECORD_DROPPED)
+    {
+      if (record->timestamp > replay->last_timestamp)
+        replay->last_timestamp = record->timestamp;
+
+      if (!option_max_speed)
+        wait_for_record (replay, record->timestamp);
+    }
+
+  switch (record->type)
+    {
+    case VSX_JOURNAL_RECORD_START:
+      break;
+    case VSX_JOURNAL_RECORD_CONNECT:
+      handle_connect (replay, record);
+      break;
+    case VSX_JOURNAL_RECORD_DISCONNECT:
+      handle_disconnect (replay, record);
+      break;
+    case VSX_JOURNAL_RECORD_COMMAND:
+      handle_command (replay, record);
+      break;
+    case VSX_JOURNAL_RECORD_PERSON:
+      handle_person (replay, record);
+      break;
+    case VSX_JOURNAL_RECORD_DROPPED:
+      handle_dropped (replay, record);
+      break;
+    }
+}
+
+typedef struct
+{
+  VsxJournalRecord record;
+  /* Number of START records before this one */
+  unsigned int journal_num;
+  /* Position in the file */
+  size_t index;
+} SortedRecord;
+
+static int
+get_type_order (VsxJournalRecordType type)
+{
+  switch (type)
+    {
+    case VSX_JOURNAL_RECORD_START:
+      return 0;
+    case VSX_JOURNAL_RECORD_CONNECT:
+      return 1;
+    case VSX_JOURNAL_RECORD_DISCONNECT:
+      return 3;
+    default:
+      return 2;
+    }
+}
+
+static int
+compare_record (const void *a,
+                const void *b)
+{
+  const SortedRecord *ra = a;
+  const SortedRecord *rb = b;
+
+  if (ra->journal_num != rb->journal_num)
+    return ra->journal_num < rb->journal_num ? -1 : 1;
+
+  if (ra->record.timestamp != rb->record.timestamp)
+    return ra->record.timestamp < rb->record.timestamp ? -1 : 1;
+
+  /* Records from different threads with the same time might be in
+   * the wrong order so make sure a connection is created before it
+   * is used */
+  int type_a = get_type_order (ra->record.type);
+  int type_b = get_type_order (rb->record.type);
+
+  if (type_a != type_b)
+    return type_a - type_b;
+
+  return ra->index < rb->index ? -1 : ra->index > rb->index ? 1 : 0;
+}
+
+/* Each thread has its own ring in the writer so the records from
+ * different shards aren’t necessarily in the order that they
+ * happened. A connection can even be created on one shard and send
+ * its first command on another. This sorts them by the timestamp
+ * instead. The records from one thread are already in order so the
+ * original order is kept when the times are the same. */
+static SortedRecord *
+sort_records (const uint8_t *data,
+              size_t length,
+              size_t *n_records_out,
+              size_t *length_used_out)
+{
+  struct vsx_buffer buffer = VSX_BUFFER_STATIC_INIT;
+  const uint8_t *p = data, *end = data + length;
+  SortedRecord sorted = { .journal_num = 0 };
+  size_t record_length;
+
+  while ((record_length = vsx_journal_decode_record (p,
+                                                     end - p,
+                                                     &sorted.record)))
+    {
+      if (sorted.record.type == VSX_JOURNAL_RECORD_START && sorted.index > 0)
+        sorted.journal_num++;
+
+      vsx_buffer_append (&buffer, &sorted, sizeof sorted);
+
+      sorted.index++;
+      p += record_length;
+    }
+
+  qsort (buffer.data, sorted.index, sizeof sorted, compare_record);
+
+  *n_records_out = sorted.index;
+  *length_used_out = p - data;
+
+  return (SortedRecord *) buffer.data;
+}
+
+static int
+compare_latency (const void *a,
+                 const void *b)
+{
+  int64_t la = *(const int64_t *) a;
+  int64_t lb = *(const int64_t *) b;
+
+  return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+static void
+print_report (Replay *replay,
+              int64_t elapsed_ns)
+{
+  int64_t *latencies = (int64_t *) replay->latencies.data;
+  size_t n_commands = replay->latencies.length / sizeof *latencies;
+
+  printf ("records:          %" PRIu64 "\n"
+          "commands:         %zu\n"
+          "errors:           %" PRIu64 "\n"
+          "bad ID replies:   %" PRIu64 "\n"
+          "dropped records:  %" PRIu64 "\n"
+          "frames received:  %" PRIu64 "\n"
+          "bytes received:   %" PRIu64 "\n"
+          "elapsed:          %.3f s\n",
+          replay->n_records,
+          n_commands,
+          replay->n_errors,
+          replay->n_bad_ids,
+          replay->n_dropped,
+          replay->n_frames_received,
+          replay->n_bytes_received,
+          elapsed_ns / 1e9);
+
+  if (n_commands == 0)
+    return;
+
+  qsort (latencies, n_commands, sizeof *latencies, compare_latency);
+
+  int64_t total = 0;
+
+  for (size_t i = 0; i < n_commands; i++)
+    total += latencies[i];
+
+  printf ("commands/s:       %.0f (%.0f while processing)\n"
+          "latency p50:      %.2f µs\n"
+          "latency p99:      %.2f µs\n"
+          "latency max:      %.2f µs\n",
+          n_commands / (elapsed_ns / 1e9),
+          n_commands / (total / 1e9),
+          latencies[n_commands / 2] / 1e3,
+          latencies[n_commands * 99 / 100] / 1e3,
+          latencies[n_commands - 1] / 1e3);
+}
+
+static bool
+run_replay (Replay *replay,
+            const struct vsx_buffer *journal)
+{
+  const uint8_t *p = journal->data;
+  const uint8_t *end = p + journal->length;
+  VsxJournalRecord record;
+  size_t record_length;
+
+  /* The file should start with a START record */
+  record_length = vsx_journal_decode_record (p, end - p, &record);
+
+  if (record_length == 0
+      || record.type != VSX_JOURNAL_RECORD_START
+      || record.payload_length < VSX_JOURNAL_MAGIC_LENGTH
+      || memcmp (record.payload,
+                 VSX_JOURNAL_MAGIC,
+                 VSX_JOURNAL_MAGIC_LENGTH))
+    {
+      fprintf (stderr, "%s: not a journal file\n", option_journal);
+      return false;
+    }
+
+  size_t n_records, length_used;
+  SortedRecord *records = sort_records (journal->data,
+                                        journal->length,
+                                        &n_records,
+                                        &length_used);
+
+  if (length_used < journal->length)
+    {
+      fprintf (stderr,
+               "%s: ignoring %zu bytes of truncated data at the end\n",
+               option_journal,
+               journal->length - length_used);
+    }
+
+  replay->start_time = vsx_main_context_get_monotonic_clock (replay->mc);
+
+  int64_t start = get_time_ns ();
+
+  for (size_t i = 0; i < n_records; i++)
+    handle_record (replay, &records[i].record);
+
+  int64_t elapsed = get_time_ns () - start;
+
+  vsx_free (records);
+
+  print_report (replay, elapsed);
+
+  return true;
+}
+
+static void
+destroy_replay (Replay *replay)
+{
+  struct vsx_hash_table_iter iter;
+  struct vsx_hash_table_entry *entry;
+  struct vsx_list connections;
+
+  /* Free the remaining connections outside of the iteration because
+   * freeing one removes it from the table */
+  vsx_list_init (&connections);
+
+  vsx_hash_table_iter_init (&iter, &replay->connections);
+
+  while ((entry = vsx_hash_table_iter_next (&iter)))
+    {
+      ReplayConnection *rc =
+        vsx_container_of (entry, ReplayConnection, hash_entry);
+
+      if (rc->dirty)
+        vsx_list_remove (&rc->dirty_link);
+
+      vsx_list_insert (connections.prev, &rc->dirty_link);
+    }
+
+  ReplayConnection *rc, *tmp;
+
+  vsx_list_for_each_safe (rc, tmp, &connections, dirty_link)
+    {
+      rc->dirty = false;
+      free_connection (replay, rc);
+    }
+
+  vsx_hash_table_destroy (&replay->connections);
+
+  free_mappings (&replay->person_ids);
+  free_mappings (&replay->conversation_ids);
+
+  vsx_buffer_destroy (&replay->latencies);
+
+  vsx_main_context_remove_source (replay->timer);
+
+  vsx_object_unref (replay->conversation_set);
+  vsx_object_unref (replay->person_set);
+}
+
+int
+main (int argc, char **argv)
+{
+  if (!process_arguments (argc, argv))
+    return EXIT_FAILURE;
+
+  struct vsx_buffer journal = VSX_BUFFER_STATIC_INIT;
+
+  if (!load_journal (option_journal, &journal))
+    {
+      vsx_buffer_destroy (&journal);
+      return EXIT_FAILURE;
+    }
+
+  struct vsx_error *error = NULL;
+  VsxMainContext *mc = vsx_main_context_get_default (&error);
+
+  if (mc == NULL)
+    {
+      fprintf (stderr, "%s\n", error->message);
+      vsx_error_free (error);
+      vsx_buffer_destroy (&journal);
+      return EXIT_FAILURE;
+    }
+
+  Replay replay = {
+    .mc = mc,
+    .latencies = VSX_BUFFER_STATIC_INIT,
+  };
+
+  vsx_netaddress_from_string (&replay.socket_address, "127.0.0.1", 5344);
+
+  replay.conversation_set = vsx_conversation_set_new ();
+  replay.person_set = vsx_person_set_new ();
+
+  vsx_hash_table_init (&replay.connections);
+  vsx_hash_table_init (&replay.person_ids);
+  vsx_hash_table_init (&replay.conversation_ids);
+  vsx_list_init (&replay.dirty_connections);
+
+  /* This is rescheduled whenever it is used */
+  replay.timer = vsx_main_context_add_timeout (mc,
+                                               24 * 60 * 60 * 1000,
+                                               timer_cb,
+                                               &replay);
+
+  bool ret = run_replay (&replay, &journal);
+
+  destroy_replay (&replay);
+
+  vsx_main_context_free (mc);
+
+  vsx_connection_flush_buffer_pool ();
+
+  vsx_buffer_destroy (&journal);
+
+  return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
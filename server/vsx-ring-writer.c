@@ -0,0 +1,430 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vsx-ring-writer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "vsx-util.h"
+#include "vsx-list.h"
+
+/* Size of the ring for each thread. Must be a power of two. */
+#define VSX_RING_WRITER_RING_SIZE (256 * 1024)
+
+#define VSX_RING_WRITER_BATCH_INTERVAL_MS 10
+
+typedef struct
+{
+  struct vsx_list link;
+
+  /* Total number of bytes added. Only changed by the thread that owns
+   * the ring. */
+  atomic_size_t head;
+  /* Total number of bytes read. Only changed by the writer thread. */
+  atomic_size_t tail;
+
+  /* Set when the thread that owns the ring exits so that the writer
+   * thread can free it once it is empty */
+  atomic_bool orphaned;
+
+  _Atomic uint64_t n_dropped;
+  /* Only used by the writer thread */
+  uint64_t n_dropped_reported;
+
+  uint8_t buffer[VSX_RING_WRITER_RING_SIZE];
+} VsxRingWriterRing;
+
+struct _VsxRingWriter
+{
+  FILE *file;
+  bool had_error;
+
+  VsxRingWriterDroppedCb dropped_cb;
+  void *user_data;
+
+  pthread_t thread;
+  bool has_thread;
+
+  /* Protects the list of rings and the condition */
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool finished;
+  struct vsx_list rings;
+
+  /* Set by the writer thread when it is about to wait for a record
+   * so that the producers know they need to wake it up */
+  atomic_bool consumer_waiting;
+
+  _Atomic uint64_t n_dropped;
+
+  /* Each thread’s ring */
+  pthread_key_t ring_key;
+
+  /* Only used by the writer thread */
+  struct vsx_buffer buffer;
+};
+
+static void
+ring_destructor (void *data)
+{
+  VsxRingWriterRing *ring = data;
+
+  atomic_store_explicit (&ring->orphaned, true, memory_order_release);
+}
+
+VsxRingWriter *
+vsx_ring_writer_new (FILE *file,
+                     VsxRingWriterDroppedCb dropped_cb,
+                     void *user_data)
+{
+  VsxRingWriter *writer = vsx_calloc (sizeof *writer);
+
+  writer->file = file;
+  writer->dropped_cb = dropped_cb;
+  writer->user_data = user_data;
+
+  pthread_mutex_init (&writer->mutex, NULL);
+  pthread_cond_init (&writer->cond, NULL);
+  vsx_list_init (&writer->rings);
+  atomic_init (&writer->consumer_waiting, false);
+  atomic_init (&writer->n_dropped, 0);
+  vsx_buffer_init (&writer->buffer);
+
+  int res = pthread_key_create (&writer->ring_key, ring_destructor);
+
+  if (res)
+    vsx_fatal ("Error creating thread key: %s", strerror (res));
+
+  return writer;
+}
+
+static VsxRingWriterRing *
+get_thread_ring (VsxRingWriter *writer)
+{
+  VsxRingWriterRing *ring = pthread_getspecific (writer->ring_key);
+
+  if (ring)
+    return ring;
+
+  ring = vsx_calloc (sizeof *ring);
+
+  pthread_mutex_lock (&writer->mutex);
+  vsx_list_insert (writer->rings.prev, &ring->link);
+  pthread_mutex_unlock (&writer->mutex);
+
+  pthread_setspecific (writer->ring_key, ring);
+
+  return ring;
+}
+
+static void
+wake_consumer (VsxRingWriter *writer)
+{
+  pthread_mutex_lock (&writer->mutex);
+  atomic_store (&writer->consumer_waiting, false);
+  pthread_cond_signal (&writer->cond);
+  pthread_mutex_unlock (&writer->mutex);
+}
+
+void
+vsx_ring_writer_add (VsxRingWriter *writer,
+                     const void *data,
+                     size_t length)
+{
+  VsxRingWriterRing *ring = get_thread_ring (writer);
+  size_t head = atomic_load_explicit (&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit (&ring->tail, memory_order_acquire);
+
+  if (VSX_RING_WRITER_RING_SIZE - (head - tail) < length)
+    {
+      atomic_fetch_add_explicit (&ring->n_dropped, 1, memory_order_relaxed);
+      atomic_fetch_add_explicit (&writer->n_dropped,
+                                 1,
+                                 memory_order_relaxed);
+      return;
+    }
+
+  size_t pos = head & (VSX_RING_WRITER_RING_SIZE - 1);
+  size_t first_part = MIN (length, VSX_RING_WRITER_RING_SIZE - pos);
+
+  memcpy (ring->buffer + pos, data, first_part);
+  memcpy (ring->buffer, (const uint8_t *) data + first_part,
+          length - first_part);
+
+  /* This needs to be ordered before checking whether the consumer is
+   * waiting, which it sets before checking the rings */
+  atomic_store (&ring->head, head + length);
+
+  if (atomic_load (&writer->consumer_waiting))
+    wake_consumer (writer);
+}
+
+uint64_t
+vsx_ring_writer_get_n_dropped (VsxRingWriter *writer)
+{
+  return atomic_load_explicit (&writer->n_dropped, memory_order_relaxed);
+}
+
+static void
+report_dropped (VsxRingWriter *writer,
+                VsxRingWriterRing *ring)
+{
+  uint64_t n_dropped = atomic_load_explicit (&ring->n_dropped,
+                                             memory_order_relaxed);
+
+  if (n_dropped == ring->n_dropped_reported)
+    return;
+
+  if (writer->dropped_cb)
+    {
+      writer->dropped_cb (&writer->buffer,
+                          n_dropped - ring->n_dropped_reported,
+                          writer->user_data);
+    }
+
+  ring->n_dropped_reported = n_dropped;
+}
+
+/* Moves everything in the rings to the buffer. Must be called with
+ * the mutex locked. */
+static void
+drain_rings (VsxRingWriter *writer)
+{
+  VsxRingWriterRing *ring, *tmp;
+
+  vsx_list_for_each_safe (ring, tmp, &writer->rings, link)
+    {
+      /* Check this before the head so that nothing can be added
+       * after we decide to free it */
+      bool orphaned = atomic_load_explicit (&ring->orphaned,
+                                            memory_order_acquire);
+      size_t head = atomic_load_explicit (&ring->head, memory_order_acquire);
+      size_t tail = atomic_load_explicit (&ring->tail, memory_order_relaxed);
+      size_t length = head - tail;
+
+      report_dropped (writer, ring);
+
+      if (length > 0)
+        {
+          size_t pos = tail & (VSX_RING_WRITER_RING_SIZE - 1);
+          size_t first_part = MIN (length, VSX_RING_WRITER_RING_SIZE - pos);
+
+          vsx_buffer_append (&writer->buffer, ring->buffer + pos, first_part);
+          vsx_buffer_append (&writer->buffer,
+                             ring->buffer,
+                             length - first_part);
+
+          atomic_store_explicit (&ring->tail, head, memory_order_release);
+        }
+
+      if (orphaned)
+        {
+          vsx_list_remove (&ring->link);
+          vsx_free (ring);
+        }
+    }
+}
+
+static bool
+rings_are_empty (VsxRingWriter *writer)
+{
+  VsxRingWriterRing *ring;
+
+  vsx_list_for_each (ring, &writer->rings, link)
+    {
+      if (atomic_load (&ring->head)
+          != atomic_load_explicit (&ring->tail, memory_order_relaxed))
+        return false;
+    }
+
+  return true;
+}
+
+static void
+write_buffer (VsxRingWriter *writer)
+{
+  if (!writer->had_error && writer->buffer.length > 0)
+    {
+      size_t wrote = fwrite (writer->buffer.data,
+                             1 /* size */,
+                             writer->buffer.length,
+                             writer->file);
+
+      /* If there was an error then we'll just start ignoring data
+         until we're told to quit */
+      if (wrote != writer->buffer.length)
+        writer->had_error = true;
+      else
+        fflush (writer->file);
+    }
+
+  vsx_buffer_set_length (&writer->buffer, 0);
+}
+
+static void
+block_sigint (void)
+{
+  sigset_t sigset;
+
+  sigemptyset (&sigset);
+  sigaddset (&sigset, SIGINT);
+  sigaddset (&sigset, SIGTERM);
+
+  if (pthread_sigmask (SIG_BLOCK, &sigset, NULL) == -1)
+    vsx_warning ("pthread_sigmask failed: %s", strerror (errno));
+}
+
+static void
+wait_for_batch_interval (VsxRingWriter *writer)
+{
+  struct timespec deadline;
+
+  clock_gettime (CLOCK_REALTIME, &deadline);
+
+  deadline.tv_nsec += VSX_RING_WRITER_BATCH_INTERVAL_MS * 1000000L;
+
+  if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+
+  /* Only vsx_ring_writer_free signals the condition while the
+   * consumer isn’t marked as waiting */
+  while (!writer->finished)
+    {
+      if (pthread_cond_timedwait (&writer->cond,
+                                  &writer->mutex,
+                                  &deadline) == ETIMEDOUT)
+        break;
+    }
+}
+
+static void *
+writer_thread_func (void *data)
+{
+  VsxRingWriter *writer = data;
+
+  block_sigint ();
+
+  pthread_mutex_lock (&writer->mutex);
+
+  while (true)
+    {
+      drain_rings (writer);
+
+      if (writer->buffer.length > 0)
+        {
+          /* Release the mutex while we do a blocking write */
+          pthread_mutex_unlock (&writer->mutex);
+          write_buffer (writer);
+          pthread_mutex_lock (&writer->mutex);
+
+          wait_for_batch_interval (writer);
+
+          continue;
+        }
+
+      if (writer->finished)
+        break;
+
+      atomic_store (&writer->consumer_waiting, true);
+
+      /* Check again after setting the flag in case a record was added
+       * before the producer could see it */
+      if (!rings_are_empty (writer))
+        {
+          atomic_store (&writer->consumer_waiting, false);
+          continue;
+        }
+
+      while (atomic_load (&writer->consumer_waiting) && !writer->finished)
+        pthread_cond_wait (&writer->cond, &writer->mutex);
+
+      atomic_store (&writer->consumer_waiting, false);
+    }
+
+  pthread_mutex_unlock (&writer->mutex);
+
+  return NULL;
+}
+
+void
+vsx_ring_writer_start (VsxRingWriter *writer)
+{
+  if (writer->has_thread)
+    return;
+
+  int res = pthread_create (&writer->thread,
+                            NULL, /* attr */
+                            writer_thread_func,
+                            writer);
+
+  if (res)
+    vsx_fatal ("Error creating thread: %s", strerror (res));
+
+  writer->has_thread = true;
+}
+
+void
+vsx_ring_writer_free (VsxRingWriter *writer)
+{
+  if (writer->has_thread)
+    {
+      pthread_mutex_lock (&writer->mutex);
+      writer->finished = true;
+      pthread_cond_signal (&writer->cond);
+      pthread_mutex_unlock (&writer->mutex);
+
+      pthread_join (writer->thread, NULL);
+    }
+  else
+    {
+      /* Write anything that was added before the thread started */
+      pthread_mutex_lock (&writer->mutex);
+      drain_rings (writer);
+      pthread_mutex_unlock (&writer->mutex);
+      write_buffer (writer);
+    }
+
+  /* The threads that still own rings won’t run their destructors
+   * once the key is deleted */
+  pthread_setspecific (writer->ring_key, NULL);
+  pthread_key_delete (writer->ring_key);
+
+  VsxRingWriterRing *ring, *tmp;
+
+  vsx_list_for_each_safe (ring, tmp, &writer->rings, link)
+    vsx_free (ring);
+
+  fclose (writer->file);
+
+  vsx_buffer_destroy (&writer->buffer);
+  pthread_cond_destroy (&writer->cond);
+  pthread_mutex_destroy (&writer->mutex);
+
+  vsx_free (writer);
+}
@@ -0,0 +1,74 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_RING_WRITER_H
+#define VSX_RING_WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "vsx-buffer.h"
+
+/* Writes records to a file from a background thread. Each thread
+ * that writes gets its own ring buffer that only it adds to and only
+ * the writer thread reads from, so adding a record doesn’t need any
+ * locks. If a ring is full then the record is dropped and counted
+ * instead of making the thread wait. Once the writer thread has
+ * written something it waits a short while before writing again so
+ * that busy periods get written in batches.
+ */
+
+typedef struct _VsxRingWriter VsxRingWriter;
+
+/* Called on the writer thread so that a note can be added to the
+ * output when some records from a thread had to be dropped */
+typedef void
+(* VsxRingWriterDroppedCb) (struct vsx_buffer *buffer,
+                            uint64_t n_dropped,
+                            void *user_data);
+
+/* Takes ownership of the file */
+VsxRingWriter *
+vsx_ring_writer_new (FILE *file,
+                     VsxRingWriterDroppedCb dropped_cb,
+                     void *user_data);
+
+/* Starts the writer thread. Anything added before this is kept in
+ * the rings until then. */
+void
+vsx_ring_writer_start (VsxRingWriter *writer);
+
+/* Adds a record to the calling thread’s ring. The record is always
+ * written in one piece. */
+void
+vsx_ring_writer_add (VsxRingWriter *writer,
+                     const void *data,
+                     size_t length);
+
+/* Returns the number of records that were thrown away because the
+ * writer thread couldn’t keep up */
+uint64_t
+vsx_ring_writer_get_n_dropped (VsxRingWriter *writer);
+
+/* Writes everything that is left, stops the thread and closes the
+ * file. No other thread can add records after this is called. */
+void
+vsx_ring_writer_free (VsxRingWriter *writer);
+
+#endif /* VSX_RING_WRITER_H */
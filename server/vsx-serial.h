@@ -0,0 +1,216 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_SERIAL_H
+#define VSX_SERIAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "vsx-buffer.h"
+#include "vsx-proto.h"
+#include "vsx-util.h"
+
+/* Helpers to write little-endian values to a buffer and read them
+ * back. These are used for the snapshot files and for the state that
+ * is passed to a new process during an upgrade. The reader doesn’t
+ * report an error until the end. Instead it sets the error flag and
+ * returns zeros for anything read after running out of data.
+ */
+
+typedef struct
+{
+  const uint8_t *p, *end;
+  bool error;
+} VsxSerialReader;
+
+static inline void
+vsx_serial_reader_init (VsxSerialReader *reader,
+                        const uint8_t *data,
+                        size_t length)
+{
+  reader->p = data;
+  reader->end = data + length;
+  reader->error = false;
+}
+
+static inline void
+vsx_serial_write_u8 (struct vsx_buffer *buf,
+                     uint8_t value)
+{
+  vsx_buffer_append_c (buf, value);
+}
+
+static inline void
+vsx_serial_write_u16 (struct vsx_buffer *buf,
+                      uint16_t value)
+{
+  vsx_buffer_ensure_size (buf, buf->length + sizeof value);
+  vsx_proto_write_uint16_t (buf->data + buf->length, value);
+  buf->length += sizeof value;
+}
+
+static inline void
+vsx_serial_write_u32 (struct vsx_buffer *buf,
+                      uint32_t value)
+{
+  vsx_buffer_ensure_size (buf, buf->length + sizeof value);
+  vsx_proto_write_uint32_t (buf->data + buf->length, value);
+  buf->length += sizeof value;
+}
+
+static inline void
+vsx_serial_write_u64 (struct vsx_buffer *buf,
+                      uint64_t value)
+{
+  vsx_buffer_ensure_size (buf, buf->length + sizeof value);
+  vsx_proto_write_uint64_t (buf->data + buf->length, value);
+  buf->length += sizeof value;
+}
+
+static inline void
+vsx_serial_write_string (struct vsx_buffer *buf,
+                         const char *str)
+{
+  vsx_buffer_append (buf, str, strlen (str) + 1);
+}
+
+/* Writes a 32-bit length followed by the data */
+static inline void
+vsx_serial_write_data (struct vsx_buffer *buf,
+                       const void *data,
+                       size_t length)
+{
+  vsx_serial_write_u32 (buf, length);
+
+  if (length > 0)
+    vsx_buffer_append (buf, data, length);
+}
+
+static inline bool
+vsx_serial_check_space (VsxSerialReader *reader,
+                        size_t length)
+{
+  if (reader->error || (size_t) (reader->end - reader->p) < length)
+    {
+      reader->error = true;
+      return false;
+    }
+
+  return true;
+}
+
+static inline uint8_t
+vsx_serial_read_u8 (VsxSerialReader *reader)
+{
+  if (!vsx_serial_check_space (reader, sizeof (uint8_t)))
+    return 0;
+
+  return *(reader->p++);
+}
+
+static inline uint16_t
+vsx_serial_read_u16 (VsxSerialReader *reader)
+{
+  if (!vsx_serial_check_space (reader, sizeof (uint16_t)))
+    return 0;
+
+  uint16_t value = vsx_proto_read_uint16_t (reader->p);
+
+  reader->p += sizeof value;
+
+  return value;
+}
+
+static inline uint32_t
+vsx_serial_read_u32 (VsxSerialReader *reader)
+{
+  if (!vsx_serial_check_space (reader, sizeof (uint32_t)))
+    return 0;
+
+  uint32_t value = vsx_proto_read_uint32_t (reader->p);
+
+  reader->p += sizeof value;
+
+  return value;
+}
+
+static inline uint64_t
+vsx_serial_read_u64 (VsxSerialReader *reader)
+{
+  if (!vsx_serial_check_space (reader, sizeof (uint64_t)))
+    return 0;
+
+  uint64_t value = vsx_proto_read_uint64_t (reader->p);
+
+  reader->p += sizeof value;
+
+  return value;
+}
+
+/* Returns a pointer to a string in the data. The string must be
+ * terminated within max_length bytes. */
+static inline const char *
+vsx_serial_read_string (VsxSerialReader *reader,
+                        size_t max_length)
+{
+  if (reader->error)
+    return "";
+
+  const uint8_t *nul = memchr (reader->p,
+                               '\0',
+                               MIN ((size_t) (reader->end - reader->p),
+                                    max_length + 1));
+
+  if (nul == NULL)
+    {
+      reader->error = true;
+      return "";
+    }
+
+  const char *str = (const char *) reader->p;
+
+  reader->p = nul + 1;
+
+  return str;
+}
+
+/* Reads data written with vsx_serial_write_data and returns a
+ * pointer to it within the reader’s data */
+static inline const uint8_t *
+vsx_serial_read_data (VsxSerialReader *reader,
+                      size_t *length_out)
+{
+  size_t length = vsx_serial_read_u32 (reader);
+
+  if (!vsx_serial_check_space (reader, length))
+    {
+      *length_out = 0;
+      return NULL;
+    }
+
+  const uint8_t *data = reader->p;
+
+  reader->p += length;
+  *length_out = length;
+
+  return data;
+}
+
+#endif /* VSX_SERIAL_H */
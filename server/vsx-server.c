@@ -16,14 +16,26 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/* Needed for accept4 */
+#define _GNU_SOURCE
+
 #include "config.h"
 
 #include <string.h>
+#include <inttypes.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <openssl/ssl.h>
 #include <unistd.h>
 #include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 
 #include "vsx-server.h"
 #include "vsx-main-context.h"
@@ -31,7 +43,12 @@
 #include "vsx-connection.h"
 #include "vsx-conversation.h"
 #include "vsx-conversation-set.h"
+#include "vsx-snapshot.h"
+#include "vsx-upgrade.h"
+#include "vsx-serial.h"
 #include "vsx-log.h"
+#include "vsx-journal.h"
+#include "vsx-metrics.h"
 #include "vsx-ssl-error.h"
 #include "vsx-proto.h"
 #include "vsx-util.h"
@@ -39,10 +56,107 @@
 #include "vsx-file-error.h"
 #include "vsx-netaddress.h"
 #include "vsx-socket.h"
+#include "vsx-output-chain.h"
+#include "vsx-ticket-keys.h"
 
 #define DEFAULT_PORT 5144
 #define DEFAULT_SSL_PORT (DEFAULT_PORT + 1)
 
+/* The games are split into shards. Each shard has its own set of
+ * conversations, people and connections, and if there is more than
+ * one then each shard runs its own main loop on a separate thread.
+ * The main thread only accepts new connections and passes them on.
+ */
+typedef struct
+{
+  VsxServer *server;
+
+  int num;
+
+  /* List of open connections sorted by their deadline */
+  struct vsx_list connections;
+
+  VsxConversationSet *pending_conversations;
+
+  VsxPersonSet *person_set;
+
+  /* Saves the sets periodically if a snapshot file was configured.
+   * These are created on the shard’s own thread. */
+  VsxSnapshot *snapshot;
+  VsxMainContextSource *snapshot_source;
+  /* Runs the next step of a snapshot that is being saved */
+  VsxMainContextSource *snapshot_step_source;
+
+  /* State passed between the processes during an upgrade. The old
+   * process fills it in on the shard’s thread as it quits and the
+   * new process restores it when the shard starts. The connections
+   * in the data are in the same order as their file descriptors.
+   */
+  bool has_upgrade_state;
+  struct vsx_buffer upgrade_data;
+  struct vsx_buffer upgrade_fds;
+
+  /* One-shot timer for the deadline of the first connection. This
+   * only exists while there are connections. */
+  VsxMainContextSource *expiry_source;
+
+  /* Connections that have something to write. Instead of writing as
+   * soon as a connection has data, everything that is generated
+   * while handling the events of one iteration is gathered and each
+   * connection is written once at the end. The flush source has the
+   * same lifetime as the expiry source. */
+  struct vsx_list flush_connections;
+  VsxMainContextSource *flush_source;
+
+  /* If the server only has one shard then it runs directly on the
+   * main thread and none of the following are used.
+   */
+  bool has_thread;
+  pthread_t thread;
+
+  /* Connections that other threads have handed over to this shard.
+   * The shard picks them up when inbox_fd becomes readable.
+   */
+  pthread_mutex_t inbox_mutex;
+  struct vsx_list inbox;
+  int inbox_fd;
+  VsxMainContextSource *inbox_source;
+
+  /* Set by the main thread to make the shard’s thread return */
+  atomic_bool quit;
+} VsxServerShard;
+
+/* New SSL connections are first sent to one of these threads which
+ * runs the handshake before handing the connection over to its
+ * shard. That way the expensive key exchange doesn’t hold up the
+ * games running on the shards.
+ */
+typedef struct
+{
+  VsxServer *server;
+
+  int num;
+
+  pthread_t thread;
+  bool has_thread;
+
+  /* Connections that are in the middle of the handshake, sorted by
+   * their deadline */
+  struct vsx_list connections;
+
+  /* One-shot timer for the deadline of the first connection. This
+   * only exists while there are connections. */
+  VsxMainContextSource *expiry_source;
+
+  /* New connections from the main thread, the same as for a shard */
+  pthread_mutex_t inbox_mutex;
+  struct vsx_list inbox;
+  int inbox_fd;
+  VsxMainContextSource *inbox_source;
+
+  atomic_bool quit;
+} VsxServerHandshakeWorker;
+
 struct _VsxServer
 {
   /* List of VsxServerSockets */
@@ -52,31 +166,121 @@ struct _VsxServer
      error */
   struct vsx_error *fatal_error;
 
-  /* List of open connections */
-  struct vsx_list connections;
-
-  VsxConversationSet *pending_conversations;
+  int n_shards;
+  VsxServerShard *shards;
+
+  /* Shard that will receive the next accepted connection */
+  int next_shard;
+
+  /* Number of completed SSL handshakes that had to do the full key
+   * exchange and ones that resumed a previous session. These are
+   * updated from every shard. */
+  atomic_uint_fast64_t n_full_ssl_handshakes;
+  atomic_uint_fast64_t n_resumed_ssl_handshakes;
+  /* Handshakes after which the kernel took over sending */
+  atomic_uint_fast64_t n_ktls_ssl_handshakes;
+
+  /* Threads to run the SSL handshakes on. If there are none then the
+   * handshake is done on the shard as part of the first read. */
+  int n_handshake_workers;
+  VsxServerHandshakeWorker *handshake_workers;
+  int next_handshake_worker;
+
+  /* Handshakes that completed on a worker and the total time in
+   * microseconds from accepting the connection until the handshake
+   * finished, including the time spent waiting for the worker */
+  atomic_uint_fast64_t n_offloaded_ssl_handshakes;
+  atomic_uint_fast64_t offloaded_ssl_handshake_time;
+  /* Connections that have been sent to a worker and haven’t finished
+   * their handshake yet */
+  atomic_int ssl_handshake_queue_depth;
+
+  /* When the shards have their own threads, the main thread can’t
+   * tell when a connection is closed. If we run out of file
+   * descriptors then this timer is used instead to start listening
+   * again.
+   */
+  VsxMainContextSource *relisten_source;
+
+  /* A file descriptor that is kept open only so that it can be closed
+   * to make room to accept and close a connection when we run out.
+   * This is -1 if it couldn’t be reopened. */
+  int reserve_fd;
+
+  /* Only used on the main thread */
+  VsxServerAcceptStats accept_stats;
+
+  VsxAdmission admission;
+
+  /* Limits for each remote address, or NULL if there aren’t any */
+  VsxAddressTable *address_table;
+
+  /* Prefix of the snapshot files or NULL if snapshots are disabled */
+  char *snapshot_file;
+  int snapshot_interval;
+
+  /* NULL-terminated arguments to start the new binary when SIGUSR2
+   * is received, or NULL if upgrades aren’t possible */
+  char **upgrade_command;
+  /* Socket to the new process while it is starting, otherwise -1 */
+  int upgrade_sock;
+  pid_t upgrade_pid;
+  VsxMainContextSource *upgrade_sock_source;
+  VsxMainContextSource *upgrade_timeout_source;
+  /* Set once the new process is ready to take over. This makes
+   * vsx_server_run return and the shards save their state as they
+   * quit. */
+  bool upgrade_ready;
+
+  /* Listening socket for the metrics endpoint or -1 if it isn’t
+   * enabled. This and the clients are only used on the main
+   * thread. */
+  int metrics_sock;
+  VsxMainContextSource *metrics_source;
+  /* List of VsxServerMetricsClients */
+  struct vsx_list metrics_clients;
+  int n_metrics_clients;
+};
 
-  VsxPersonSet *person_set;
+/* Space needed to add the largest payload plus the corresponding
+ * frame header to the output */
+#define VSX_SERVER_MAX_FRAME_SIZE (1 + 1 + 2 + VSX_PROTO_MAX_PAYLOAD_SIZE)
 
-  VsxMainContextSource *gc_source;
-};
+/* Maximum amount of data to stage in a connection’s output before
+ * trying to write it */
+#define VSX_SERVER_MAX_STAGED_OUTPUT (4 * VSX_OUTPUT_CHAIN_SEGMENT_SIZE)
 
-/* Make sure the output buffer is large enough to contain the largest
- * payload plus the corresponding frame header.
- */
-#define VSX_SERVER_OUTPUT_BUFFER_SIZE (1 + 1 + 2 + VSX_PROTO_MAX_PAYLOAD_SIZE)
+/* Maximum number of segments to pass to a single sendmsg. This is
+ * enough to write everything that can be staged at once. */
+#define VSX_SERVER_MAX_IOVECS 8
 
 typedef struct
 {
-  VsxServer *server;
+  VsxServerShard *shard;
 
   int client_socket;
   VsxMainContextSource *source;
 
+  /* This is only used to create the VsxConnection once the
+   * connection reaches its shard */
+  struct vsx_netaddress remote_address;
+
   /* List node within the list of connections */
   struct vsx_list link;
 
+  /* Time when the connection will be considered dead if nothing else
+   * is received, and the last message time that it was based on */
+  int64_t deadline;
+  int64_t last_message_time;
+
+  /* Whether the connection was counted in the address table and
+   * needs to be removed from it when it closes */
+  bool address_tracked;
+
+  /* Number of frames received by the VsxConnection that have been
+   * counted towards the message rate of its address */
+  uint32_t n_frames_counted;
+
   VsxConnection *ws_connection;
   struct vsx_listener ws_connection_listener;
 
@@ -96,9 +300,27 @@ typedef struct
   VsxMainContextPollFlags ssl_read_block;
   /* Same for an SSL_write */
   VsxMainContextPollFlags ssl_write_block;
-
-  unsigned int output_length;
-  uint8_t output_buffer[VSX_SERVER_OUTPUT_BUFFER_SIZE];
+  /* Becomes true once the SSL handshake has been counted */
+  bool ssl_handshake_finished;
+  /* Becomes true if the kernel took over encrypting the records
+   * after the handshake. The output can then be written to the
+   * socket directly instead of going through SSL_write. */
+  bool ktls_send;
+  /* Monotonic time when the connection was accepted. This is only
+   * used to measure how long the handshake took. */
+  int64_t accept_time;
+
+  /* This becomes true when the socket didn’t accept everything that
+   * we tried to write. The connection then waits for the socket to
+   * become writable instead of writing at the end of the
+   * iteration. */
+  bool write_blocked;
+
+  /* Link in the shard’s list of connections to flush */
+  bool flush_queued;
+  struct vsx_list flush_link;
+
+  VsxOutputChain output;
 
   /* IP address of the connection. This is only filled in if logging
      is enabled */
@@ -107,6 +329,19 @@ typedef struct
   SSL *ssl;
 } VsxServerConnection;
 
+/* The memory needed for an idle WebSocket that isn’t using SSL is
+ * this struct, the VsxConnection (see
+ * VSX_CONNECTION_IDLE_MEMORY_BUDGET) and a poll source in the main
+ * context. None of the read or write buffers are kept while the
+ * connection has nothing buffered. This budget is here to catch
+ * anything that adds inline buffers back to the struct.
+ */
+#define VSX_SERVER_CONNECTION_IDLE_MEMORY_BUDGET 256
+
+_Static_assert (sizeof (VsxServerConnection)
+                <= VSX_SERVER_CONNECTION_IDLE_MEMORY_BUDGET,
+                "VsxServerConnection is bigger than its memory budget");
+
 typedef struct
 {
   struct vsx_list link;
@@ -114,11 +349,31 @@ typedef struct
   int sock;
   VsxServer *server;
   SSL_CTX *ssl_ctx;
+  VsxTicketKeys *ticket_keys;
 } VsxServerSocket;
 
-/* Interval time in minutes to run the dead person garbage
-   collector */
-#define VSX_SERVER_GC_TIMEOUT 5
+/* A connection to the metrics endpoint. It reads one HTTP request,
+ * writes the response and closes. */
+typedef struct
+{
+  struct vsx_list link;
+  VsxServer *server;
+  int sock;
+  VsxMainContextSource *source;
+  VsxMainContextSource *timeout_source;
+  struct vsx_buffer request;
+  /* Empty until the whole request has been read */
+  struct vsx_buffer response;
+  size_t response_pos;
+} VsxServerMetricsClient;
+
+/* Time in milliseconds that a metrics client has to send its request
+ * and read the response */
+#define VSX_SERVER_METRICS_TIMEOUT (10 * 1000)
+#define VSX_SERVER_MAX_METRICS_REQUEST 4096
+/* Any more connections to the metrics endpoint are closed straight
+ * away */
+#define VSX_SERVER_MAX_METRICS_CLIENTS 8
 
 /* Time in microseconds after which a connection with no responses
  * will be considered dead. This is necessary to avoid keeping around
@@ -127,12 +382,37 @@ typedef struct
  * resources. */
 #define VSX_SERVER_NO_RESPONSE_TIMEOUT (5 * 60 * (int64_t) 1000000)
 
+/* Time in milliseconds that the new process has to load its config
+ * and report that it is ready during an upgrade */
+#define VSX_SERVER_UPGRADE_TIMEOUT (30 * 1000)
+
+/* Time in microseconds that a connection can take to complete the
+ * SSL handshake on a handshake worker before it is dropped */
+#define VSX_SERVER_HANDSHAKE_TIMEOUT (30 * (int64_t) 1000000)
+
+/* Maximum number of connections to accept from a listening socket
+ * for each time it becomes readable */
+#define VSX_SERVER_MAX_ACCEPTS_PER_EVENT 64
+
+/* Time in microseconds that a shard spends on each step of saving a
+ * snapshot, and the time in milliseconds that it waits in between
+ * steps to let the main loop handle the connections */
+#define VSX_SERVER_SNAPSHOT_STEP_TIME 2000
+#define VSX_SERVER_SNAPSHOT_STEP_DELAY 1
+
+/* Set on a handshake worker’s thread to the worker that it is
+ * running. Connections are never adopted directly by a shard from
+ * one of these threads. */
+static __thread VsxServerHandshakeWorker *current_handshake_worker;
+
 static void
 update_poll (VsxServerConnection *connection);
 
 static void
-vsx_server_remove_connection (VsxServer *server,
-                              VsxServerConnection *connection);
+vsx_server_remove_connection (VsxServerConnection *connection);
+
+static void
+handle_read (VsxServerConnection *connection);
 
 struct vsx_error_domain
 vsx_server_error;
@@ -164,69 +444,250 @@ set_bad_input_with_error (VsxServerConnection *connection,
   set_bad_input (connection);
 }
 
+/* Counts any new frames towards the message rate of the address and
+ * returns false if it has gone over */
+static bool
+check_message_rate (VsxServerConnection *connection)
+{
+  VsxAddressTable *address_table = connection->shard->server->address_table;
+
+  if (address_table == NULL)
+    return true;
+
+  uint32_t n_frames =
+    vsx_connection_get_n_frames_received (connection->ws_connection);
+  uint32_t n_new_frames = n_frames - connection->n_frames_counted;
+
+  if (n_new_frames == 0)
+    return true;
+
+  connection->n_frames_counted = n_frames;
+
+  return vsx_address_table_add_messages (address_table,
+                                         &connection->remote_address,
+                                         n_new_frames,
+                                         vsx_main_context_get_monotonic_clock
+                                         (NULL));
+}
+
+static void
+schedule_expiry (VsxServerShard *shard,
+                 int64_t now)
+{
+  VsxServerConnection *first =
+    vsx_container_of (shard->connections.next, VsxServerConnection, link);
+  /* Round up to the next millisecond */
+  int64_t delay_ms = (MAX (first->deadline - now, 0) + 999) / 1000;
+
+  vsx_main_context_reset_timer (shard->expiry_source, delay_ms);
+}
+
 static void
-check_dead_connection (VsxServerConnection *connection)
+set_deadline (VsxServerConnection *connection,
+              int64_t deadline)
 {
-  if (vsx_main_context_get_monotonic_clock (NULL)
-      - vsx_connection_get_last_message_time (connection->ws_connection)
-      >= VSX_SERVER_NO_RESPONSE_TIMEOUT)
+  VsxServerShard *shard = connection->shard;
+  int64_t old_deadline = connection->deadline;
+
+  connection->deadline = deadline;
+
+  /* Every connection uses the same timeout so the new deadline is
+   * nearly always the latest one and the connection goes at the end
+   * of the list. Connections that come from another shard or from an
+   * upgrade keep the time of their last message though, so the
+   * position is found by walking back from the end. */
+  vsx_list_remove (&connection->link);
+
+  struct vsx_list *prev;
+
+  for (prev = shard->connections.prev;
+       prev != &shard->connections;
+       prev = prev->prev)
     {
-      /* If we've already had bad input then we'll just remove the
-       * connection. This will happen if the client doesn't close its
-       * end of the connection after we finish sending the bad input
-       * message */
-      if (connection->had_bad_input)
-        vsx_server_remove_connection (connection->server, connection);
-      else
+      VsxServerConnection *other =
+        vsx_container_of (prev, VsxServerConnection, link);
+
+      if (other->deadline <= deadline)
+        break;
+    }
+
+  vsx_list_insert (prev, &connection->link);
+
+  /* If the first deadline gets later then the timer will fire early
+   * and reschedule itself, but it needs to be moved if it gets
+   * earlier */
+  if (prev == &shard->connections
+      && deadline < old_deadline
+      && shard->expiry_source)
+    schedule_expiry (shard, vsx_main_context_get_monotonic_clock (NULL));
+}
+
+static void
+update_deadline (VsxServerConnection *connection)
+{
+  int64_t last_message_time =
+    vsx_connection_get_last_message_time (connection->ws_connection);
+
+  if (last_message_time == connection->last_message_time)
+    return;
+
+  connection->last_message_time = last_message_time;
+  set_deadline (connection,
+                last_message_time + VSX_SERVER_NO_RESPONSE_TIMEOUT);
+}
+
+static void
+expire_connection (VsxServerConnection *connection,
+                   int64_t now)
+{
+  /* If we've already had bad input then we'll just remove the
+   * connection. This will happen if the client doesn't close its
+   * end of the connection after we finish sending the bad input
+   * message */
+  if (connection->had_bad_input)
+    {
+      vsx_server_remove_connection (connection);
+    }
+  else
+    {
+      set_bad_input (connection);
+      /* Give the client another timeout to close the connection */
+      set_deadline (connection, now + VSX_SERVER_NO_RESPONSE_TIMEOUT);
+      update_poll (connection);
+    }
+}
+
+static void
+vsx_server_expiry_cb (VsxMainContextSource *source,
+                      void *user_data)
+{
+  VsxServerShard *shard = user_data;
+  int64_t now = vsx_main_context_get_monotonic_clock (NULL);
+
+  /* Only the connections at the start of the list can have expired.
+   * Removing the last connection also removes this timer. */
+  while (shard->expiry_source)
+    {
+      VsxServerConnection *first =
+        vsx_container_of (shard->connections.next, VsxServerConnection, link);
+
+      if (first->deadline > now)
         {
-          set_bad_input (connection);
-          update_poll (connection);
+          schedule_expiry (shard, now);
+          break;
         }
+
+      expire_connection (first, now);
     }
 }
 
 static void
-vsx_server_gc_cb (VsxMainContextSource *source,
-                  void *user_data)
+open_reserve_fd (VsxServer *server)
+{
+  if (server->reserve_fd == -1)
+    server->reserve_fd = open ("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+static void
+relisten (VsxServer *server)
+{
+  VsxServerSocket *ssocket;
+
+  open_reserve_fd (server);
+
+  vsx_list_for_each (ssocket, &server->sockets, link)
+    {
+      vsx_main_context_modify_poll (ssocket->source, VSX_MAIN_CONTEXT_POLL_IN);
+    }
+}
+
+static void
+relisten_cb (VsxMainContextSource *source,
+             void *user_data)
 {
   VsxServer *server = user_data;
-  VsxServerConnection *connection, *tmp;
 
-  vsx_list_for_each_safe (connection, tmp, &server->connections, link)
-    check_dead_connection (connection);
+  relisten (server);
+
+  vsx_main_context_remove_source (source);
+  server->relisten_source = NULL;
 }
 
 static void
-vsx_server_remove_connection (VsxServer *server,
-                              VsxServerConnection *connection)
+free_connection (VsxServerConnection *connection)
 {
+  vsx_metrics_add (connection->ssl
+                   ? VSX_METRICS_SSL_CONNECTIONS
+                   : VSX_METRICS_PLAIN_CONNECTIONS,
+                   -1);
+
   if (connection->ssl)
     SSL_free(connection->ssl);
 
-  vsx_main_context_remove_source (connection->source);
-  vsx_close (connection->client_socket);
-  vsx_list_remove (&connection->link);
+  /* The socket will be -1 if it was handed over to a new process */
+  if (connection->client_socket != -1)
+    vsx_close (connection->client_socket);
   vsx_free (connection->peer_address_string);
 
-  vsx_connection_free (connection->ws_connection);
+  vsx_output_chain_destroy (&connection->output);
 
-  vsx_free (connection);
+  if (connection->ws_connection)
+    vsx_connection_free (connection->ws_connection);
+
+  VsxServer *server = connection->shard->server;
 
-  if (vsx_list_empty (&server->connections))
+  vsx_admission_remove_connection (&server->admission);
+
+  if (connection->address_tracked)
     {
-      vsx_main_context_remove_source (server->gc_source);
-      server->gc_source = NULL;
+      vsx_address_table_remove_connection (server->address_table,
+                                           &connection->remote_address);
     }
 
-  /* Reset the poll on the server sockets in case we previously
-     stopped listening because we ran out of file descriptors. This
-     will do nothing if we were already listening */
-  VsxServerSocket *ssocket;
+  vsx_free (connection);
+}
 
-  vsx_list_for_each (ssocket, &server->sockets, link)
+/* Removes the connection from the main loop and the shard without
+ * freeing it */
+static void
+detach_connection (VsxServerConnection *connection)
+{
+  VsxServerShard *shard = connection->shard;
+
+  vsx_main_context_remove_source (connection->source);
+  connection->source = NULL;
+  vsx_list_remove (&connection->link);
+
+  if (connection->flush_queued)
     {
-      vsx_main_context_modify_poll (ssocket->source, VSX_MAIN_CONTEXT_POLL_IN);
+      vsx_list_remove (&connection->flush_link);
+      connection->flush_queued = false;
     }
+
+  if (vsx_list_empty (&shard->connections))
+    {
+      vsx_main_context_remove_source (shard->expiry_source);
+      shard->expiry_source = NULL;
+      vsx_main_context_remove_source (shard->flush_source);
+      shard->flush_source = NULL;
+    }
+}
+
+static void
+vsx_server_remove_connection (VsxServerConnection *connection)
+{
+  VsxServerShard *shard = connection->shard;
+
+  detach_connection (connection);
+  free_connection (connection);
+
+  /* Reset the poll on the server sockets in case we previously
+     stopped listening because we ran out of file descriptors. This
+     will do nothing if we were already listening. The sockets are
+     only on our main context if the shard isn’t running its own
+     thread. */
+  if (!shard->has_thread)
+    relisten (shard->server);
 }
 
 static void
@@ -236,6 +697,9 @@ vsx_server_remove_socket (VsxServer *server,
   if (ssocket->ssl_ctx)
     SSL_CTX_free (ssocket->ssl_ctx);
 
+  if (ssocket->ticket_keys)
+    vsx_ticket_keys_free (ssocket->ticket_keys);
+
   if (ssocket->source)
     vsx_main_context_remove_source (ssocket->source);
 
@@ -266,7 +730,7 @@ is_would_block_error (int err)
 static bool
 should_shutdown (VsxServerConnection *connection)
 {
-  if (connection->output_length > 0)
+  if (vsx_output_chain_get_length (&connection->output) > 0)
     return false;
 
   if (connection->had_bad_input)
@@ -283,6 +747,18 @@ should_shutdown (VsxServerConnection *connection)
           && vsx_connection_is_finished (connection->ws_connection));
 }
 
+static void
+queue_flush (VsxServerConnection *connection)
+{
+  if (connection->flush_queued)
+    return;
+
+  VsxServerShard *shard = connection->shard;
+
+  vsx_list_insert (shard->flush_connections.prev, &connection->flush_link);
+  connection->flush_queued = true;
+}
+
 static void
 update_poll (VsxServerConnection *connection)
 {
@@ -316,7 +792,7 @@ update_poll (VsxServerConnection *connection)
                   break;
                 default:
                   log_ssl_error (connection);
-                  vsx_server_remove_connection (connection->server, connection);
+                  vsx_server_remove_connection (connection);
                   return;
                 }
             }
@@ -328,7 +804,7 @@ update_poll (VsxServerConnection *connection)
               vsx_log ("shutdown socket failed for %s: %s",
                        connection->peer_address_string,
                        strerror (errno));
-              vsx_server_remove_connection (connection->server, connection);
+              vsx_server_remove_connection (connection);
               return;
             }
 
@@ -339,25 +815,68 @@ update_poll (VsxServerConnection *connection)
   if (!connection->write_finished)
     {
       if (connection->ssl_write_block)
-        flags |= connection->ssl_write_block;
-      else if (connection->output_length > 0)
-        flags |= VSX_MAIN_CONTEXT_POLL_OUT;
-      else if (vsx_connection_has_data (connection->ws_connection))
-        flags |= VSX_MAIN_CONTEXT_POLL_OUT;
+        {
+          flags |= connection->ssl_write_block;
+        }
+      else if (vsx_output_chain_get_length (&connection->output) > 0
+               || vsx_connection_has_data (connection->ws_connection))
+        {
+          if (connection->write_blocked)
+            flags |= VSX_MAIN_CONTEXT_POLL_OUT;
+          else
+            queue_flush (connection);
+        }
     }
 
   /* If both ends of the connection are closed then we can abandon
      this connectin */
   if (connection->read_finished && connection->write_finished)
-    vsx_server_remove_connection (connection->server, connection);
+    vsx_server_remove_connection (connection);
   else
     vsx_main_context_modify_poll (connection->source,
                                   flags);
 }
 
 static void
-handle_read (VsxServer *server,
-             VsxServerConnection *connection)
+check_ssl_handshake (VsxServerConnection *connection)
+{
+  if (connection->ssl_handshake_finished
+      || !SSL_is_init_finished (connection->ssl))
+    return;
+
+  connection->ssl_handshake_finished = true;
+
+  VsxServer *server = connection->shard->server;
+  bool resumed = SSL_session_reused (connection->ssl);
+
+  if (resumed)
+    atomic_fetch_add (&server->n_resumed_ssl_handshakes, 1);
+  else
+    atomic_fetch_add (&server->n_full_ssl_handshakes, 1);
+
+  /* OpenSSL only enables kTLS if it was requested on the context and
+   * both the kernel and the negotiated cipher support it. Otherwise
+   * everything keeps going through SSL_write. */
+#if defined (BIO_get_ktls_send) && !defined (OPENSSL_NO_KTLS)
+  connection->ktls_send = BIO_get_ktls_send (SSL_get_wbio (connection->ssl));
+#else
+  connection->ktls_send = false;
+#endif
+
+  if (connection->ktls_send)
+    atomic_fetch_add (&server->n_ktls_ssl_handshakes, 1);
+
+  vsx_log ("SSL handshake for %s %s%s",
+           connection->peer_address_string,
+           resumed ? "resumed a session" : "was a full handshake",
+           connection->ktls_send ? " using kTLS" : "");
+}
+
+static void
+hand_off_connection (VsxServerConnection *connection);
+
+static void
+handle_read (VsxServerConnection *connection)
 {
   if (connection->read_finished)
     {
@@ -377,6 +896,8 @@ handle_read (VsxServer *server,
 
       got = SSL_read (connection->ssl, buf, sizeof (buf));
 
+      check_ssl_handshake (connection);
+
       if (got <= 0)
         {
           switch (SSL_get_error (connection->ssl, got))
@@ -394,7 +915,7 @@ handle_read (VsxServer *server,
               return;
             default:
               log_ssl_error (connection);
-              vsx_server_remove_connection (connection->server, connection);
+              vsx_server_remove_connection (connection);
               return;
             }
         }
@@ -411,7 +932,7 @@ handle_read (VsxServer *server,
               vsx_log ("Error reading from socket for %s: %s",
                        connection->peer_address_string,
                        strerror (errno));
-              vsx_server_remove_connection (server, connection);
+              vsx_server_remove_connection (connection);
             }
 
           return;
@@ -439,6 +960,8 @@ handle_read (VsxServer *server,
     {
       struct vsx_error *ws_error = NULL;
 
+      vsx_metrics_add (VSX_METRICS_BYTES_RECEIVED, got);
+
       if (!connection->had_bad_input
           && !vsx_connection_parse_data (connection->ws_connection,
                                          (uint8_t *) buf,
@@ -448,34 +971,57 @@ handle_read (VsxServer *server,
           set_bad_input_with_error (connection, ws_error);
           vsx_error_free (ws_error);
         }
+      else if (!check_message_rate (connection))
+        {
+          vsx_log ("For %s: Client is sending too many messages",
+                   connection->peer_address_string);
+          set_bad_input (connection);
+        }
+      else if (vsx_connection_get_handoff_shard (connection->ws_connection)
+               != -1)
+        {
+          /* The connection wants to join a game on another shard */
+          hand_off_connection (connection);
+          return;
+        }
 
+      update_deadline (connection);
       update_poll (connection);
     }
 }
 
 static void
-fill_output_buffer (VsxServerConnection *connection)
+fill_output (VsxServerConnection *connection)
 {
-  size_t added =
-    vsx_connection_fill_output_buffer (connection->ws_connection,
-                                       connection->output_buffer
-                                       + connection->output_length,
-                                       VSX_SERVER_OUTPUT_BUFFER_SIZE
-                                       - connection->output_length);
-
-  connection->output_length += added;
+  while (vsx_output_chain_get_length (&connection->output)
+         < VSX_SERVER_MAX_STAGED_OUTPUT)
+    {
+      size_t space;
+      uint8_t *buffer = vsx_output_chain_reserve (&connection->output,
+                                                  VSX_SERVER_MAX_FRAME_SIZE,
+                                                  &space);
+      size_t added =
+        vsx_connection_fill_output_buffer (connection->ws_connection,
+                                           buffer,
+                                           space);
+
+      if (added == 0)
+        break;
+
+      vsx_output_chain_commit (&connection->output, added);
+    }
 }
 
 static void
-handle_write (VsxServer *server,
-              VsxServerConnection *connection)
+handle_write (VsxServerConnection *connection)
 {
   ssize_t wrote;
+  size_t to_write;
 
   if (connection->ssl_write_block == 0)
-    fill_output_buffer (connection);
+    fill_output (connection);
 
-  if (connection->output_length == 0)
+  if (vsx_output_chain_get_length (&connection->output) == 0)
     {
       /* This might happen if the SSL_Shutdown command triggered a
        * poll for output */
@@ -483,14 +1029,22 @@ handle_write (VsxServer *server,
       return;
     }
 
-
-  if (connection->ssl)
+  /* With kTLS the socket can be written to directly, unless OpenSSL
+   * is in the middle of a write that it has to retry */
+  if (connection->ssl
+      && (!connection->ktls_send || connection->ssl_write_block))
     {
       connection->ssl_write_block = 0;
 
-      wrote = SSL_write (connection->ssl,
-                         connection->output_buffer,
-                         connection->output_length);
+      /* Each segment is written as one TLS record. The head of the
+       * chain isn’t modified while a write is blocked so it will be
+       * retried with the same arguments. */
+      const uint8_t *data = vsx_output_chain_get_head (&connection->output,
+                                                       &to_write);
+
+      wrote = SSL_write (connection->ssl, data, to_write);
+
+      check_ssl_handshake (connection);
 
       if (wrote <= 0)
         {
@@ -506,36 +1060,64 @@ handle_write (VsxServer *server,
               return;
             default:
               log_ssl_error (connection);
-              vsx_server_remove_connection (connection->server, connection);
+              vsx_server_remove_connection (connection);
               return;
             }
         }
     }
   else
     {
-      wrote = write (connection->client_socket,
-                     (const char *) connection->output_buffer,
-                     connection->output_length);
+      struct iovec iovecs[VSX_SERVER_MAX_IOVECS];
+      int n_iovecs = vsx_output_chain_get_iovecs (&connection->output,
+                                                  iovecs,
+                                                  VSX_N_ELEMENTS (iovecs));
+
+      to_write = 0;
+
+      for (int i = 0; i < n_iovecs; i++)
+        to_write += iovecs[i].iov_len;
+
+      /* If there is more data than we can write in one go then we
+       * are going to write again straight away so there’s no point
+       * in sending a partial packet */
+      int send_flags = 0;
+
+      if (to_write < vsx_output_chain_get_length (&connection->output)
+          || vsx_connection_has_data (connection->ws_connection))
+        send_flags |= MSG_MORE;
+
+      struct msghdr msg = {
+        .msg_iov = iovecs,
+        .msg_iovlen = n_iovecs,
+      };
+
+      wrote = sendmsg (connection->client_socket, &msg, send_flags);
 
       if (wrote == -1)
         {
-          if (!is_would_block_error (errno) && errno != EINTR)
+          if (is_would_block_error (errno))
+            {
+              connection->write_blocked = true;
+              update_poll (connection);
+            }
+          else if (errno != EINTR)
             {
               vsx_log ("Error writing to socket for %s: %s",
                        connection->peer_address_string,
                        strerror (errno));
-              vsx_server_remove_connection (server, connection);
+              vsx_server_remove_connection (connection);
             }
 
           return;
         }
     }
 
-  /* Move any remaining data in the output buffer to the front */
-  memmove (connection->output_buffer,
-           connection->output_buffer + wrote,
-           connection->output_length - wrote);
-  connection->output_length -= wrote;
+  if ((size_t) wrote < to_write)
+    connection->write_blocked = true;
+
+  vsx_metrics_add (VSX_METRICS_BYTES_SENT, wrote);
+
+  vsx_output_chain_consume (&connection->output, wrote);
 
   update_poll (connection);
 }
@@ -547,7 +1129,6 @@ vsx_server_connection_poll_cb (VsxMainContextSource *source,
                                void *user_data)
 {
   VsxServerConnection *connection = user_data;
-  VsxServer *server = connection->server;
 
   if (flags & VSX_MAIN_CONTEXT_POLL_ERROR)
     {
@@ -568,27 +1149,28 @@ vsx_server_connection_poll_cb (VsxMainContextSource *source,
                  connection->peer_address_string,
                  strerror (value));
 
-      vsx_server_remove_connection (server, connection);
+      vsx_server_remove_connection (connection);
     }
   else if (connection->ssl_read_block
            && ((flags & connection->ssl_read_block)
                == connection->ssl_read_block))
     {
-      handle_read (server, connection);
+      handle_read (connection);
     }
   else if (connection->ssl_write_block
            && ((flags & connection->ssl_write_block)
                == connection->ssl_write_block))
     {
-      handle_write (server, connection);
+      handle_write (connection);
     }
   else if (flags & VSX_MAIN_CONTEXT_POLL_IN)
     {
-      handle_read (server, connection);
+      handle_read (connection);
     }
   else if (flags & VSX_MAIN_CONTEXT_POLL_OUT)
     {
-      handle_write (server, connection);
+      connection->write_blocked = false;
+      handle_write (connection);
     }
 }
 
@@ -602,6 +1184,9 @@ init_connection_ssl (VsxServerConnection *connection,
   if (connection->ssl == NULL)
     goto error;
 
+  vsx_metrics_add (VSX_METRICS_PLAIN_CONNECTIONS, -1);
+  vsx_metrics_add (VSX_METRICS_SSL_CONNECTIONS, 1);
+
   SSL_set_accept_state (connection->ssl);
 
   if (!SSL_set_fd (connection->ssl, connection->client_socket))
@@ -615,474 +1200,2768 @@ init_connection_ssl (VsxServerConnection *connection,
 }
 
 static void
-vsx_server_pending_connection_cb (VsxMainContextSource *source,
-                                  int fd,
-                                  VsxMainContextPollFlags flags,
-                                  void *user_data)
+vsx_server_flush_cb (VsxMainContextSource *source,
+                     void *user_data)
 {
-  VsxServerSocket *ssocket = user_data;
-  VsxServer *server = ssocket->server;
-
-  struct vsx_netaddress_native native_address =
-    {
-      .length = offsetof (struct vsx_netaddress_native, length)
-    };
+  VsxServerShard *shard = user_data;
 
-  int client_socket = accept (ssocket->sock,
-                              &native_address.sockaddr,
-                              &native_address.length);
-
-  if (client_socket == -1)
+  /* Writing a connection can queue it again if it had more data
+   * than fits in the output buffer, so keep going until everything
+   * has been written or the sockets are full */
+  while (!vsx_list_empty (&shard->flush_connections))
     {
-      /* Ignore WOULD_BLOCK and EINTR errors */
-      if (is_would_block_error (errno) || errno == EINTR)
-        return;
-
-      if (errno == EMFILE)
-        {
-          vsx_log ("Too many open files to accept connection");
-
-          /* Stop listening for new connections until someone disconnects */
-          vsx_main_context_modify_poll (source, 0);
-          return;
-        }
+      VsxServerConnection *connection =
+        vsx_container_of (shard->flush_connections.next,
+                          VsxServerConnection,
+                          flush_link);
 
-      /* This will cause vsx_server_run to return */
-      vsx_file_error_set (&server->fatal_error,
-                          errno,
-                          "Error accepting connection: %s",
-                          strerror (errno));
+      vsx_list_remove (&connection->flush_link);
+      connection->flush_queued = false;
 
-      return;
+      handle_write (connection);
     }
+}
 
-  struct vsx_error *error = NULL;
+static void
+ensure_shard_sources (VsxServerShard *shard)
+{
+  if (shard->expiry_source)
+    return;
 
-  if (!vsx_socket_set_nonblock (client_socket, &error))
-    {
-      vsx_log ("While accepting connection: %s", error->message);
-      vsx_error_free (error);
-      return;
-    }
+  shard->flush_source =
+    vsx_main_context_add_flush (NULL, /* default context */
+                                vsx_server_flush_cb,
+                                shard);
 
-  VsxServerConnection *connection = vsx_alloc (sizeof *connection);
+  shard->expiry_source =
+    vsx_main_context_add_timeout (NULL, /* default context */
+                                  0, /* delay_ms */
+                                  vsx_server_expiry_cb,
+                                  shard);
 
-  connection->server = server;
-  connection->client_socket = client_socket;
+  schedule_expiry (shard, vsx_main_context_get_monotonic_clock (NULL));
+}
+
+/* Called on the shard’s own thread to take ownership of a connection
+ * that was either freshly accepted or handed over from another
+ * shard. */
+static void
+adopt_connection (VsxServerShard *shard,
+                  VsxServerConnection *connection)
+{
+  connection->shard = shard;
   connection->source =
     vsx_main_context_add_poll (NULL /* default context */,
-                               client_socket,
+                               connection->client_socket,
                                VSX_MAIN_CONTEXT_POLL_IN,
                                vsx_server_connection_poll_cb,
                                connection);
-  vsx_list_insert (&server->connections, &connection->link);
 
-  struct vsx_netaddress remote_address;
-  vsx_netaddress_from_native (&remote_address, &native_address);
+  /* The real deadline is set below once the VsxConnection exists */
+  connection->last_message_time = INT64_MIN;
+  connection->deadline = (vsx_main_context_get_monotonic_clock (NULL)
+                          + VSX_SERVER_NO_RESPONSE_TIMEOUT);
+  vsx_list_insert (shard->connections.prev, &connection->link);
 
-  connection->ws_connection =
-    vsx_connection_new (&remote_address,
-                        server->pending_conversations,
-                        server->person_set);
+  ensure_shard_sources (shard);
 
-  struct vsx_signal *changed_signal =
-    vsx_connection_get_changed_signal (connection->ws_connection);
-  connection->ws_connection_listener.notify =
-    ws_connection_changed_cb;
-  vsx_signal_add (changed_signal,
-                  &connection->ws_connection_listener);
+  if (connection->ws_connection == NULL)
+    {
+      connection->ws_connection =
+        vsx_connection_new (&connection->remote_address,
+                            shard->pending_conversations,
+                            shard->person_set);
+
+      vsx_connection_set_shard (connection->ws_connection,
+                                shard->num,
+                                shard->server->n_shards);
+
+      struct vsx_signal *changed_signal =
+        vsx_connection_get_changed_signal (connection->ws_connection);
+      connection->ws_connection_listener.notify =
+        ws_connection_changed_cb;
+      vsx_signal_add (changed_signal,
+                      &connection->ws_connection_listener);
+    }
+  else
+    {
+      struct vsx_error *error = NULL;
 
-  connection->had_bad_input = false;
+      if (!vsx_connection_attach (connection->ws_connection,
+                                  shard->pending_conversations,
+                                  shard->person_set,
+                                  shard->num,
+                                  &error))
+        {
+          set_bad_input_with_error (connection, error);
+          vsx_error_free (error);
+        }
+      else if (vsx_connection_get_handoff_shard (connection->ws_connection)
+               != -1)
+        {
+          /* The queued data wants to move the connection again */
+          hand_off_connection (connection);
+          return;
+        }
+    }
+
+  update_deadline (connection);
+
+  /* OpenSSL may have already read data on the previous shard or on
+   * the handshake worker */
+  if (connection->ssl
+      && !connection->had_bad_input
+      && SSL_has_pending (connection->ssl))
+    handle_read (connection);
+  else
+    update_poll (connection);
+}
+
+static void
+wake_inbox (int inbox_fd)
+{
+  uint64_t one = 1;
+
+  while (write (inbox_fd, &one, sizeof one) == -1
+         && errno == EINTR);
+}
+
+static void
+send_connection_to_shard (VsxServerShard *shard,
+                          VsxServerConnection *connection)
+{
+  if (!shard->has_thread && current_handshake_worker == NULL)
+    {
+      adopt_connection (shard, connection);
+      return;
+    }
+
+  pthread_mutex_lock (&shard->inbox_mutex);
+  vsx_list_insert (shard->inbox.prev, &connection->link);
+  pthread_mutex_unlock (&shard->inbox_mutex);
+
+  wake_inbox (shard->inbox_fd);
+}
+
+static void
+hand_off_connection (VsxServerConnection *connection)
+{
+  VsxServerShard *shard = connection->shard;
+  int shard_num =
+    vsx_connection_get_handoff_shard (connection->ws_connection);
+
+  detach_connection (connection);
+  vsx_connection_detach (connection->ws_connection);
+
+  send_connection_to_shard (shard->server->shards + shard_num, connection);
+}
+
+static void
+shard_inbox_cb (VsxMainContextSource *source,
+                int fd,
+                VsxMainContextPollFlags flags,
+                void *user_data)
+{
+  VsxServerShard *shard = user_data;
+  uint64_t value;
+
+  if (read (fd, &value, sizeof value) == -1)
+    return;
+
+  struct vsx_list connections;
+
+  vsx_list_init (&connections);
+
+  pthread_mutex_lock (&shard->inbox_mutex);
+  vsx_list_insert_list (&connections, &shard->inbox);
+  vsx_list_init (&shard->inbox);
+  pthread_mutex_unlock (&shard->inbox_mutex);
+
+  VsxServerConnection *connection, *tmp;
+
+  vsx_list_for_each_safe (connection, tmp, &connections, link)
+    {
+      vsx_list_remove (&connection->link);
+      adopt_connection (shard, connection);
+    }
+}
+
+static void
+detach_handshake_connection (VsxServerHandshakeWorker *worker,
+                             VsxServerConnection *connection)
+{
+  vsx_main_context_remove_source (connection->source);
+  connection->source = NULL;
+  vsx_list_remove (&connection->link);
+
+  if (vsx_list_empty (&worker->connections))
+    {
+      vsx_main_context_remove_source (worker->expiry_source);
+      worker->expiry_source = NULL;
+    }
+
+  atomic_fetch_sub (&worker->server->ssl_handshake_queue_depth, 1);
+}
+
+static void
+finish_handshake (VsxServerHandshakeWorker *worker,
+                  VsxServerConnection *connection)
+{
+  VsxServer *server = worker->server;
+  int64_t now = vsx_main_context_get_monotonic_clock (NULL);
+
+  detach_handshake_connection (worker, connection);
+
+  atomic_fetch_add (&server->n_offloaded_ssl_handshakes, 1);
+  atomic_fetch_add (&server->offloaded_ssl_handshake_time,
+                    now - connection->accept_time);
+
+  check_ssl_handshake (connection);
+
+  send_connection_to_shard (connection->shard, connection);
+}
+
+static void
+continue_handshake (VsxServerHandshakeWorker *worker,
+                    VsxServerConnection *connection)
+{
+  int ret = SSL_do_handshake (connection->ssl);
+
+  if (ret == 1)
+    {
+      finish_handshake (worker, connection);
+      return;
+    }
+
+  switch (SSL_get_error (connection->ssl, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+      vsx_main_context_modify_poll (connection->source,
+                                    VSX_MAIN_CONTEXT_POLL_IN);
+      break;
+    case SSL_ERROR_WANT_WRITE:
+      vsx_main_context_modify_poll (connection->source,
+                                    VSX_MAIN_CONTEXT_POLL_OUT);
+      break;
+    default:
+      log_ssl_error (connection);
+      detach_handshake_connection (worker, connection);
+      free_connection (connection);
+      break;
+    }
+}
+
+static void
+handshake_poll_cb (VsxMainContextSource *source,
+                   int fd,
+                   VsxMainContextPollFlags flags,
+                   void *user_data)
+{
+  VsxServerConnection *connection = user_data;
+
+  continue_handshake (current_handshake_worker, connection);
+}
+
+static void
+schedule_handshake_expiry (VsxServerHandshakeWorker *worker,
+                           int64_t now)
+{
+  VsxServerConnection *first =
+    vsx_container_of (worker->connections.next, VsxServerConnection, link);
+  /* Round up to the next millisecond */
+  int64_t delay_ms = (MAX (first->deadline - now, 0) + 999) / 1000;
+
+  vsx_main_context_reset_timer (worker->expiry_source, delay_ms);
+}
+
+static void
+handshake_expiry_cb (VsxMainContextSource *source,
+                     void *user_data)
+{
+  VsxServerHandshakeWorker *worker = user_data;
+  int64_t now = vsx_main_context_get_monotonic_clock (NULL);
+
+  /* Removing the last connection also removes this timer */
+  while (worker->expiry_source)
+    {
+      VsxServerConnection *first =
+        vsx_container_of (worker->connections.next,
+                          VsxServerConnection,
+                          link);
+
+      if (first->deadline > now)
+        {
+          schedule_handshake_expiry (worker, now);
+          break;
+        }
+
+      vsx_log ("SSL handshake for %s timed out",
+               first->peer_address_string);
+
+      detach_handshake_connection (worker, first);
+      free_connection (first);
+    }
+}
+
+static void
+adopt_handshake_connection (VsxServerHandshakeWorker *worker,
+                            VsxServerConnection *connection)
+{
+  connection->source =
+    vsx_main_context_add_poll (NULL /* default context */,
+                               connection->client_socket,
+                               VSX_MAIN_CONTEXT_POLL_IN,
+                               handshake_poll_cb,
+                               connection);
+
+  /* Every connection has the same timeout and they arrive in order
+   * so adding to the end keeps the list sorted */
+  connection->deadline = (connection->accept_time
+                          + VSX_SERVER_HANDSHAKE_TIMEOUT);
+  vsx_list_insert (worker->connections.prev, &connection->link);
+
+  if (worker->expiry_source == NULL)
+    {
+      worker->expiry_source =
+        vsx_main_context_add_timeout (NULL, /* default context */
+                                      0, /* delay_ms */
+                                      handshake_expiry_cb,
+                                      worker);
+      schedule_handshake_expiry (worker,
+                                 vsx_main_context_get_monotonic_clock (NULL));
+    }
+
+  /* The client has probably already sent its hello so try to make
+   * some progress straight away */
+  continue_handshake (worker, connection);
+}
+
+static void
+handshake_inbox_cb (VsxMainContextSource *source,
+                    int fd,
+                    VsxMainContextPollFlags flags,
+                    void *user_data)
+{
+  VsxServerHandshakeWorker *worker = user_data;
+  uint64_t value;
+
+  if (read (fd, &value, sizeof value) == -1)
+    return;
+
+  struct vsx_list connections;
+
+  vsx_list_init (&connections);
+
+  pthread_mutex_lock (&worker->inbox_mutex);
+  vsx_list_insert_list (&connections, &worker->inbox);
+  vsx_list_init (&worker->inbox);
+  pthread_mutex_unlock (&worker->inbox_mutex);
+
+  VsxServerConnection *connection, *tmp;
+
+  vsx_list_for_each_safe (connection, tmp, &connections, link)
+    {
+      vsx_list_remove (&connection->link);
+      adopt_handshake_connection (worker, connection);
+    }
+}
+
+static void
+send_connection_to_handshake_worker (VsxServer *server,
+                                     VsxServerConnection *connection)
+{
+  VsxServerHandshakeWorker *worker =
+    server->handshake_workers + server->next_handshake_worker;
+
+  server->next_handshake_worker =
+    (server->next_handshake_worker + 1) % server->n_handshake_workers;
+
+  atomic_fetch_add (&server->ssl_handshake_queue_depth, 1);
+
+  pthread_mutex_lock (&worker->inbox_mutex);
+  vsx_list_insert (worker->inbox.prev, &connection->link);
+  pthread_mutex_unlock (&worker->inbox_mutex);
+
+  wake_inbox (worker->inbox_fd);
+}
+
+static void
+stop_listening (VsxServer *server,
+                VsxServerSocket *ssocket)
+{
+  vsx_log ("Too many open files to accept connection");
+
+  server->accept_stats.n_paused++;
+
+  /* Stop listening for new connections until someone disconnects */
+  vsx_main_context_modify_poll (ssocket->source, 0);
+
+  /* Connections that are freed on another thread can’t reset the
+   * poll so a timer is needed to make sure we start listening again.
+   * That happens when the other shards or the handshake workers are
+   * holding the file descriptors. */
+  if ((server->n_shards > 1 || server->handshake_workers)
+      && server->relisten_source == NULL)
+    {
+      server->relisten_source =
+        vsx_main_context_add_timer (NULL, /* default context */
+                                    1, /* minutes */
+                                    relisten_cb,
+                                    server);
+    }
+}
+
+/* Called when there are no file descriptors left to accept a
+ * connection. If we have the reserved file descriptor then it is
+ * closed to make room to accept the connection and close it straight
+ * away. This takes the connection out of the kernel’s queue instead
+ * of leaving the client waiting until it gives up. Otherwise the
+ * server stops listening. Returns false if there are no more
+ * connections to accept for now. */
+static bool
+reject_connection (VsxServer *server,
+                   VsxServerSocket *ssocket)
+{
+  if (server->reserve_fd == -1)
+    {
+      stop_listening (server, ssocket);
+      return false;
+    }
+
+  vsx_close (server->reserve_fd);
+  server->reserve_fd = -1;
+
+  int client_socket = accept4 (ssocket->sock,
+                               NULL, /* addr */
+                               NULL, /* addrlen */
+                               SOCK_CLOEXEC);
+
+  if (client_socket == -1)
+    {
+      int accept_errno = errno;
+
+      open_reserve_fd (server);
+
+      if (is_would_block_error (accept_errno))
+        return false;
+
+      if (accept_errno == EINTR || accept_errno == ECONNABORTED)
+        return true;
+
+      stop_listening (server, ssocket);
+      return false;
+    }
+
+  vsx_close (client_socket);
+  open_reserve_fd (server);
+
+  server->accept_stats.n_rejected++;
+
+  vsx_log ("Too many open files, closed a new connection");
+
+  return true;
+}
+
+static VsxServerConnection *
+create_connection (VsxServerShard *shard,
+                   int client_socket,
+                   const struct vsx_netaddress *remote_address)
+{
+  VsxServerConnection *connection = vsx_alloc (sizeof *connection);
+
+  connection->shard = shard;
+  connection->client_socket = client_socket;
+  connection->source = NULL;
+
+  connection->remote_address = *remote_address;
+  connection->address_tracked = false;
+  connection->n_frames_counted = 0;
+
+  /* The VsxConnection is created once the connection reaches its
+   * shard */
+  connection->ws_connection = NULL;
+
+  connection->had_bad_input = false;
   connection->read_finished = false;
   connection->write_finished = false;
   connection->ssl_read_block = 0;
   connection->ssl_write_block = 0;
+  connection->ssl_handshake_finished = false;
+  connection->ktls_send = false;
+  connection->write_blocked = false;
+  connection->flush_queued = false;
   connection->ssl = NULL;
 
-  connection->output_length = 0;
+  vsx_metrics_add (VSX_METRICS_PLAIN_CONNECTIONS, 1);
+
+  vsx_output_chain_init (&connection->output);
 
   /* If logging is available then we'll want to store the peer
      address as a string so we've got something to refer to */
   if (vsx_log_available ())
     {
       connection->peer_address_string =
-        vsx_netaddress_to_string (&remote_address);
-      vsx_log ("Accepted WebSocket%s connection from %s",
-               ssocket->ssl_ctx ? " SSL" : "",
-               connection->peer_address_string);
+        vsx_netaddress_to_string (&connection->remote_address);
     }
   else
     connection->peer_address_string = NULL;
 
-  if (ssocket->ssl_ctx
-      && !init_connection_ssl (connection, ssocket->ssl_ctx, &error))
-    {
-      vsx_log ("SSL error for %s: %s",
-               connection->peer_address_string,
-               error->message);
-      vsx_error_free (error);
-      vsx_server_remove_connection (server, connection);
-    }
-  else if (server->gc_source == NULL)
-    {
-      server->gc_source =
-        vsx_main_context_add_timer (NULL, /* default context */
-                                    VSX_SERVER_GC_TIMEOUT,
-                                    vsx_server_gc_cb,
-                                    server);
-    }
+  return connection;
 }
 
-static int
-create_socket_for_address (const struct vsx_netaddress *address,
-                           struct vsx_error **error)
+/* Accepts one connection and passes it on. Returns false if there
+ * are no more connections to accept for now. */
+static bool
+accept_connection (VsxServerSocket *ssocket)
 {
-  struct vsx_netaddress_native native_address;
+  VsxServer *server = ssocket->server;
 
-  vsx_netaddress_to_native (address, &native_address);
+  struct vsx_netaddress_native native_address =
+    {
+      .length = offsetof (struct vsx_netaddress_native, length)
+    };
 
-  int sock = socket (native_address.sockaddr.sa_family == AF_INET6
-                     ? PF_INET6
-                     : PF_INET,
-                     SOCK_STREAM,
-                     0);
+  int client_socket = accept4 (ssocket->sock,
+                               &native_address.sockaddr,
+                               &native_address.length,
+                               SOCK_NONBLOCK | SOCK_CLOEXEC);
 
-  if (sock == -1)
+  if (client_socket == -1)
     {
-      vsx_file_error_set (error,
+      if (is_would_block_error (errno))
+        return false;
+
+      if (errno == EINTR || errno == ECONNABORTED)
+        return true;
+
+      if (errno == EMFILE || errno == ENFILE)
+        return reject_connection (server, ssocket);
+
+      /* This will cause vsx_server_run to return */
+      vsx_file_error_set (&server->fatal_error,
                           errno,
-                          "Failed to create socket: %s",
+                          "Error accepting connection: %s",
                           strerror (errno));
-      return -1;
+
+      return false;
     }
 
-  const int true_value = true;
+  if (!vsx_admission_add_connection (&server->admission))
+    {
+      vsx_log ("Too many connections, closed a new connection");
+      vsx_close (client_socket);
+      return true;
+    }
 
-  setsockopt (sock,
-              SOL_SOCKET, SO_REUSEADDR,
-              &true_value, sizeof true_value);
+  struct vsx_netaddress remote_address;
+  bool address_tracked = false;
 
-  if (!vsx_socket_set_nonblock (sock, error))
-    goto error;
+  vsx_netaddress_from_native (&remote_address, &native_address);
 
-  if (bind (sock,
-            &native_address.sockaddr,
-            native_address.length) == -1)
+  if (server->address_table
+      && !vsx_address_table_add_connection (server->address_table,
+                                            &remote_address,
+                                            &address_tracked))
     {
-      vsx_file_error_set (error,
-                          errno,
-                          "Failed to bind socket: %s",
-                          strerror (errno));
-      goto error;
+      if (vsx_log_available ())
+        {
+          char *address_string = vsx_netaddress_to_string (&remote_address);
+          vsx_log ("Too many connections from %s, closed a new connection",
+                   address_string);
+          vsx_free (address_string);
+        }
+
+      vsx_admission_remove_connection (&server->admission);
+      vsx_close (client_socket);
+      return true;
+    }
+
+  server->accept_stats.n_accepted++;
+
+  struct vsx_error *error = NULL;
+
+  /* The output is already batched up once per iteration so Nagle’s
+   * algorithm would only add latency */
+  if (native_address.sockaddr.sa_family == AF_INET
+      || native_address.sockaddr.sa_family == AF_INET6)
+    {
+      int one = 1;
+
+      if (setsockopt (client_socket,
+                      IPPROTO_TCP, TCP_NODELAY,
+                      &one, sizeof one) == -1)
+        vsx_log ("Error setting TCP_NODELAY: %s", strerror (errno));
     }
 
-  if (listen (sock, 10) == -1)
+  /* The connection is only added to the shard’s list once it reaches
+   * the shard, possibly after the SSL handshake, but the shard is
+   * picked now */
+  VsxServerShard *shard = server->shards + server->next_shard;
+
+  server->next_shard = (server->next_shard + 1) % server->n_shards;
+
+  VsxServerConnection *connection =
+    create_connection (shard, client_socket, &remote_address);
+
+  connection->address_tracked = address_tracked;
+
+  if (connection->peer_address_string)
+    {
+      vsx_log ("Accepted WebSocket%s connection from %s",
+               ssocket->ssl_ctx ? " SSL" : "",
+               connection->peer_address_string);
+    }
+
+  if (ssocket->ssl_ctx
+      && !init_connection_ssl (connection, ssocket->ssl_ctx, &error))
+    {
+      vsx_log ("SSL error for %s: %s",
+               connection->peer_address_string,
+               error->message);
+      vsx_error_free (error);
+      free_connection (connection);
+      return true;
+    }
+
+  if (connection->ssl && server->handshake_workers)
+    {
+      /* The worker will pass it on to the shard once the handshake
+       * is complete */
+      connection->accept_time = vsx_main_context_get_monotonic_clock (NULL);
+      send_connection_to_handshake_worker (server, connection);
+    }
+  else
+    {
+      send_connection_to_shard (shard, connection);
+    }
+
+  return true;
+}
+
+static void
+vsx_server_pending_connection_cb (VsxMainContextSource *source,
+                                  int fd,
+                                  VsxMainContextPollFlags flags,
+                                  void *user_data)
+{
+  VsxServerSocket *ssocket = user_data;
+
+  /* After a restart all of the clients reconnect at once, so empty
+   * the queue instead of taking one connection per iteration. The
+   * number is limited so that the shard running on the main thread
+   * still gets a chance to run. */
+  for (int i = 0; i < VSX_SERVER_MAX_ACCEPTS_PER_EVENT; i++)
+    {
+      if (!accept_connection (ssocket))
+        return;
+    }
+
+  ssocket->server->accept_stats.n_accept_limit_reached++;
+}
+
+static int
+create_socket_for_address (const struct vsx_netaddress *address,
+                           int backlog,
+                           struct vsx_error **error)
+{
+  struct vsx_netaddress_native native_address;
+
+  vsx_netaddress_to_native (address, &native_address);
+
+  int sock = socket (native_address.sockaddr.sa_family == AF_INET6
+                     ? PF_INET6
+                     : PF_INET,
+                     SOCK_STREAM,
+                     0);
+
+  if (sock == -1)
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "Failed to create socket: %s",
+                          strerror (errno));
+      return -1;
+    }
+
+  const int true_value = true;
+
+  setsockopt (sock,
+              SOL_SOCKET, SO_REUSEADDR,
+              &true_value, sizeof true_value);
+
+  if (!vsx_socket_set_nonblock (sock, error))
+    goto error;
+
+  if (bind (sock,
+            &native_address.sockaddr,
+            native_address.length) == -1)
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "Failed to bind socket: %s",
+                          strerror (errno));
+      goto error;
+    }
+
+  if (listen (sock, backlog) == -1)
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "Failed to make socket listen: %s",
+                          strerror (errno));
+      goto error;
+    }
+
+  return sock;
+
+ error:
+  vsx_close(sock);
+  return -1;
+}
+
+static int
+create_socket_for_port (int port,
+                        int backlog,
+                        struct vsx_error **error)
+{
+  struct vsx_netaddress netaddress;
+
+  memset (&netaddress, 0, sizeof netaddress);
+
+  /* First try binding it with an IPv6 address */
+  netaddress.port = port;
+  netaddress.family = AF_INET6;
+
+  struct vsx_error *local_error = NULL;
+
+  int sock = create_socket_for_address (&netaddress, backlog, &local_error);
+
+  if (sock != -1)
+    return sock;
+
+  if (local_error->domain == &vsx_file_error
+      && (local_error->code == VSX_FILE_ERROR_PFNOSUPPORT
+          || local_error->code == VSX_FILE_ERROR_AFNOSUPPORT))
+    {
+      vsx_error_free (local_error);
+    }
+  else
+    {
+      vsx_error_propagate (error, local_error);
+      return -1;
+    }
+
+  /* Some servers disable IPv6 so try IPv4 */
+  netaddress.family = AF_INET;
+
+  return create_socket_for_address (&netaddress, backlog, error);
+}
+
+static int
+create_socket_for_config (VsxConfigServer *server_config,
+                          struct vsx_error **error)
+{
+  int default_port;
+
+  if (server_config->port == -1)
+    {
+      default_port = (server_config->certificate
+                      ? DEFAULT_SSL_PORT
+                      : DEFAULT_PORT);
+    }
+  else
+    {
+      default_port = server_config->port;
+    }
+
+  if (server_config->address)
+    {
+      struct vsx_netaddress address;
+
+      if (!vsx_netaddress_from_string (&address,
+                                       server_config->address,
+                                       default_port))
+        {
+          vsx_set_error (error,
+                         &vsx_server_error,
+                         VSX_SERVER_ERROR_INVALID_ADDRESS,
+                         "Invalid address \"%s\"",
+                         server_config->address);
+          return -1;
+        }
+
+      return create_socket_for_address (&address,
+                                        server_config->backlog,
+                                        error);
+    }
+  else
+    {
+      return create_socket_for_port (default_port,
+                                     server_config->backlog,
+                                     error);
+    }
+}
+
+static int
+create_socket_for_fd (int fd, struct vsx_error **error)
+{
+  if (!vsx_socket_set_nonblock (fd, error))
+    return -1;
+
+  return fd;
+}
+
+static int
+ssl_password_cb (char *buf, int size, int rwflag, void *user_data)
+{
+  VsxConfigServer *server_config = user_data;
+
+  if (server_config->private_key_password == NULL)
+    return -1;
+
+  size_t length = strlen (server_config->private_key_password);
+
+  if (length > size)
+    return -1;
+
+  memcpy (buf, server_config->private_key_password, length);
+
+  return length;
+}
+
+static bool
+init_ssl (VsxServerSocket *ssocket,
+          const VsxConfigServer *server_config,
+          struct vsx_error **error)
+{
+  ssocket->ssl_ctx = SSL_CTX_new (TLS_server_method ());
+  if (ssocket->ssl_ctx == NULL)
+    goto error;
+
+  SSL_CTX_set_default_passwd_cb (ssocket->ssl_ctx, ssl_password_cb);
+  SSL_CTX_set_default_passwd_cb_userdata (ssocket->ssl_ctx,
+                                          (void *) server_config);
+
+  if (SSL_CTX_use_certificate_file (ssocket->ssl_ctx,
+                                    server_config->certificate,
+                                    SSL_FILETYPE_PEM) <= 0)
+    goto error;
+
+  if (SSL_CTX_use_PrivateKey_file (ssocket->ssl_ctx,
+                                   server_config->private_key,
+                                   SSL_FILETYPE_PEM) <= 0)
+    goto error;
+
+  /* Let OpenSSL free its record buffers while a connection is idle */
+  SSL_CTX_set_mode (ssocket->ssl_ctx,
+                    SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_RELEASE_BUFFERS);
+
+  /* Clients reconnect aggressively after a network blip, so let them
+   * skip the full handshake either with a session from the cache or
+   * with a ticket */
+  static const unsigned char session_id_context[] = "verda-sxtelo";
+
+  if (!SSL_CTX_set_session_id_context (ssocket->ssl_ctx,
+                                       session_id_context,
+                                       sizeof session_id_context - 1))
+    goto error;
+
+  SSL_CTX_set_timeout (ssocket->ssl_ctx, server_config->ssl_session_timeout);
+
+  if (server_config->ssl_session_cache_size > 0)
+    {
+      SSL_CTX_set_session_cache_mode (ssocket->ssl_ctx,
+                                      SSL_SESS_CACHE_SERVER);
+      SSL_CTX_sess_set_cache_size (ssocket->ssl_ctx,
+                                   server_config->ssl_session_cache_size);
+    }
+  else
+    {
+      SSL_CTX_set_session_cache_mode (ssocket->ssl_ctx, SSL_SESS_CACHE_OFF);
+    }
+
+  if (server_config->ssl_session_tickets)
+    {
+      ssocket->ticket_keys =
+        vsx_ticket_keys_new (server_config->ssl_ticket_key_lifetime);
+      vsx_ticket_keys_install (ssocket->ticket_keys, ssocket->ssl_ctx);
+    }
+  else
+    {
+      SSL_CTX_set_options (ssocket->ssl_ctx, SSL_OP_NO_TICKET);
+    }
+
+  if (server_config->ssl_ktls)
+    {
+#ifdef SSL_OP_ENABLE_KTLS
+      SSL_CTX_set_options (ssocket->ssl_ctx, SSL_OP_ENABLE_KTLS);
+#else
+      vsx_log ("kTLS was requested but OpenSSL doesn’t support it");
+#endif
+    }
+
+  return true;
+
+ error:
+  vsx_ssl_error_set (error);
+  return false;
+}
+
+bool
+vsx_server_add_config (VsxServer *server,
+                       VsxConfigServer *server_config,
+                       int fd_override,
+                       struct vsx_error **error)
+{
+  assert (error == NULL || *error == NULL);
+
+  int sock;
+
+  if (fd_override >= 0)
+    sock = create_socket_for_fd (fd_override, error);
+  else
+    sock = create_socket_for_config (server_config, error);
+
+  if (sock == -1)
+      return false;
+
+  VsxServerSocket *ssocket = vsx_calloc (sizeof *ssocket);
+
+  ssocket->server = server;
+  ssocket->sock = sock;
+
+  ssocket->source =
+    vsx_main_context_add_poll (NULL /* default context */,
+                               sock,
+                               VSX_MAIN_CONTEXT_POLL_IN,
+                               vsx_server_pending_connection_cb,
+                               ssocket);
+
+  vsx_list_insert (&server->sockets, &ssocket->link);
+
+  if (server_config->certificate
+      && !init_ssl (ssocket, server_config, error))
+    {
+      vsx_server_remove_socket (server, ssocket);
+      return false;
+    }
+
+  return true;
+}
+
+static void
+free_metrics_client (VsxServerMetricsClient *client)
+{
+  vsx_main_context_remove_source (client->source);
+  vsx_main_context_remove_source (client->timeout_source);
+  vsx_close (client->sock);
+  vsx_buffer_destroy (&client->request);
+  vsx_buffer_destroy (&client->response);
+  vsx_list_remove (&client->link);
+  client->server->n_metrics_clients--;
+  vsx_free (client);
+}
+
+static void
+append_metrics (VsxServer *server,
+                struct vsx_buffer *buffer)
+{
+  vsx_metrics_append_all (buffer);
+
+  vsx_metrics_append_value (buffer,
+                            "people",
+                            "gauge",
+                            "People in memory, including disconnected ones",
+                            atomic_load (&server->admission.n_people));
+
+  const VsxServerAcceptStats *accept_stats = &server->accept_stats;
+
+  vsx_metrics_append_value (buffer,
+                            "accepted_connections_total",
+                            "counter",
+                            "Connections accepted from the listening sockets",
+                            accept_stats->n_accepted);
+  vsx_metrics_append_value (buffer,
+                            "fd_rejected_connections_total",
+                            "counter",
+                            "Connections closed because there were no "
+                            "file descriptors left",
+                            accept_stats->n_rejected);
+  vsx_metrics_append_value (buffer,
+                            "refused_connections_total",
+                            "counter",
+                            "Connections closed because of max_connections",
+                            atomic_load (&server->admission
+                                         .n_refused_connections));
+  vsx_metrics_append_value (buffer,
+                            "shed_players_total",
+                            "counter",
+                            "New players turned away because the server "
+                            "was busy",
+                            atomic_load (&server->admission.n_shed_players));
+
+  VsxServerSslStats ssl_stats;
+
+  vsx_server_get_ssl_stats (server, &ssl_stats);
+
+  vsx_metrics_append_value (buffer,
+                            "ssl_full_handshakes_total",
+                            "counter",
+                            "SSL handshakes that did a full key exchange",
+                            ssl_stats.n_full_handshakes);
+  vsx_metrics_append_value (buffer,
+                            "ssl_resumed_handshakes_total",
+                            "counter",
+                            "SSL handshakes that resumed a session",
+                            ssl_stats.n_resumed_handshakes);
+  vsx_metrics_append_value (buffer,
+                            "ssl_handshake_queue_depth",
+                            "gauge",
+                            "Connections waiting for a handshake thread",
+                            ssl_stats.handshake_queue_depth);
+
+  vsx_metrics_append_value (buffer,
+                            "log_dropped_total",
+                            "counter",
+                            "Log messages dropped because the writer "
+                            "couldn’t keep up",
+                            vsx_log_get_n_dropped ());
+  vsx_metrics_append_value (buffer,
+                            "journal_dropped_total",
+                            "counter",
+                            "Journal records dropped because the writer "
+                            "couldn’t keep up",
+                            vsx_journal_get_n_dropped ());
+}
+
+static void
+prepare_metrics_response (VsxServerMetricsClient *client)
+{
+  static const char metrics_request[] = "GET /metrics ";
+  struct vsx_buffer *response = &client->response;
+  const char *status;
+  struct vsx_buffer body = VSX_BUFFER_STATIC_INIT;
+
+  if (client->request.length >= sizeof metrics_request - 1
+      && !memcmp (client->request.data,
+                  metrics_request,
+                  sizeof metrics_request - 1))
+    {
+      status = "200 OK";
+      append_metrics (client->server, &body);
+    }
+  else
+    {
+      status = "404 Not Found";
+      vsx_buffer_append_string (&body, "Not found\n");
+    }
+
+  vsx_buffer_append_printf (response,
+                            "HTTP/1.0 %s\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: %zu\r\n"
+                            "Connection: close\r\n"
+                            "\r\n",
+                            status,
+                            body.length);
+  vsx_buffer_append (response, body.data, body.length);
+
+  vsx_buffer_destroy (&body);
+}
+
+static void
+read_metrics_request (VsxServerMetricsClient *client)
+{
+  struct vsx_buffer *request = &client->request;
+
+  vsx_buffer_ensure_size (request, VSX_SERVER_MAX_METRICS_REQUEST + 1);
+
+  ssize_t got = read (client->sock,
+                      request->data + request->length,
+                      VSX_SERVER_MAX_METRICS_REQUEST - request->length);
+
+  if (got == -1)
+    {
+      if (!is_would_block_error (errno) && errno != EINTR)
+        free_metrics_client (client);
+      return;
+    }
+
+  if (got == 0)
+    {
+      free_metrics_client (client);
+      return;
+    }
+
+  request->length += got;
+  /* Terminate it so that strstr can be used */
+  request->data[request->length] = '\0';
+
+  if (strstr ((const char *) request->data, "\r\n\r\n") == NULL)
+    {
+      if (request->length >= VSX_SERVER_MAX_METRICS_REQUEST)
+        free_metrics_client (client);
+      return;
+    }
+
+  prepare_metrics_response (client);
+
+  vsx_main_context_modify_poll (client->source, VSX_MAIN_CONTEXT_POLL_OUT);
+}
+
+static void
+write_metrics_response (VsxServerMetricsClient *client)
+{
+  ssize_t wrote = send (client->sock,
+                        client->response.data + client->response_pos,
+                        client->response.length - client->response_pos,
+                        MSG_NOSIGNAL);
+
+  if (wrote == -1)
+    {
+      if (!is_would_block_error (errno) && errno != EINTR)
+        free_metrics_client (client);
+      return;
+    }
+
+  client->response_pos += wrote;
+
+  if (client->response_pos >= client->response.length)
+    free_metrics_client (client);
+}
+
+static void
+metrics_client_cb (VsxMainContextSource *source,
+                   int fd,
+                   VsxMainContextPollFlags flags,
+                   void *user_data)
+{
+  VsxServerMetricsClient *client = user_data;
+
+  if (flags & VSX_MAIN_CONTEXT_POLL_ERROR)
+    free_metrics_client (client);
+  else if (client->response.length > 0)
+    write_metrics_response (client);
+  else
+    read_metrics_request (client);
+}
+
+static void
+metrics_client_timeout_cb (VsxMainContextSource *source,
+                           void *user_data)
+{
+  free_metrics_client (user_data);
+}
+
+static void
+metrics_accept_cb (VsxMainContextSource *source,
+                   int fd,
+                   VsxMainContextPollFlags flags,
+                   void *user_data)
+{
+  VsxServer *server = user_data;
+
+  int sock = accept4 (fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+  if (sock == -1)
+    {
+      if (!is_would_block_error (errno) && errno != EINTR)
+        vsx_log ("Error accepting metrics connection: %s", strerror (errno));
+      return;
+    }
+
+  if (server->n_metrics_clients >= VSX_SERVER_MAX_METRICS_CLIENTS)
+    {
+      vsx_close (sock);
+      return;
+    }
+
+  VsxServerMetricsClient *client = vsx_calloc (sizeof *client);
+
+  client->server = server;
+  client->sock = sock;
+  vsx_buffer_init (&client->request);
+  vsx_buffer_init (&client->response);
+
+  client->source = vsx_main_context_add_poll (NULL, /* default context */
+                                              sock,
+                                              VSX_MAIN_CONTEXT_POLL_IN,
+                                              metrics_client_cb,
+                                              client);
+  client->timeout_source =
+    vsx_main_context_add_timeout (NULL, /* default context */
+                                  VSX_SERVER_METRICS_TIMEOUT,
+                                  metrics_client_timeout_cb,
+                                  client);
+
+  vsx_list_insert (&server->metrics_clients, &client->link);
+  server->n_metrics_clients++;
+}
+
+bool
+vsx_server_set_metrics_address (VsxServer *server,
+                                const char *address,
+                                int port,
+                                int fd_override,
+                                struct vsx_error **error)
+{
+  assert (server->metrics_sock == -1);
+
+  int sock;
+
+  if (fd_override >= 0)
+    {
+      sock = create_socket_for_fd (fd_override, error);
+    }
+  else
+    {
+      struct vsx_netaddress netaddress;
+
+      if (!vsx_netaddress_from_string (&netaddress,
+                                       address ? address : "127.0.0.1",
+                                       port))
+        {
+          vsx_set_error (error,
+                         &vsx_server_error,
+                         VSX_SERVER_ERROR_INVALID_ADDRESS,
+                         "Invalid metrics address \"%s\"",
+                         address);
+          return false;
+        }
+
+      sock = create_socket_for_address (&netaddress,
+                                        VSX_SERVER_MAX_METRICS_CLIENTS,
+                                        error);
+    }
+
+  if (sock == -1)
+    return false;
+
+  server->metrics_sock = sock;
+  server->metrics_source =
+    vsx_main_context_add_poll (NULL, /* default context */
+                               sock,
+                               VSX_MAIN_CONTEXT_POLL_IN,
+                               metrics_accept_cb,
+                               server);
+
+  vsx_metrics_enable ();
+
+  return true;
+}
+
+static void
+create_shard_sets (VsxServerShard *shard)
+{
+  VsxServer *server = shard->server;
+
+  shard->person_set = vsx_person_set_new_for_shard (shard->num,
+                                                    server->n_shards);
+  vsx_person_set_set_admission (shard->person_set, &server->admission);
+  shard->pending_conversations =
+    vsx_conversation_set_new_for_shard (shard->num, server->n_shards);
+  vsx_conversation_set_set_admission (shard->pending_conversations,
+                                      &server->admission);
+}
+
+VsxServer *
+vsx_server_new (int n_shards)
+{
+  assert (n_shards >= 1);
+
+  VsxServer *server = vsx_calloc (sizeof *server);
+
+  vsx_admission_init (&server->admission);
+
+  server->n_shards = n_shards;
+  server->shards = vsx_calloc (n_shards * sizeof *server->shards);
+
+  for (int i = 0; i < n_shards; i++)
+    {
+      VsxServerShard *shard = server->shards + i;
+
+      shard->server = server;
+      shard->num = i;
+
+      create_shard_sets (shard);
+
+      vsx_list_init (&shard->connections);
+      vsx_list_init (&shard->flush_connections);
+
+      vsx_buffer_init (&shard->upgrade_data);
+      vsx_buffer_init (&shard->upgrade_fds);
+
+      shard->inbox_fd = -1;
+      vsx_list_init (&shard->inbox);
+      pthread_mutex_init (&shard->inbox_mutex, NULL /* attr */);
+    }
+
+  vsx_list_init (&server->sockets);
+
+  server->reserve_fd = -1;
+  open_reserve_fd (server);
+
+  server->upgrade_sock = -1;
+
+  server->metrics_sock = -1;
+  vsx_list_init (&server->metrics_clients);
+
+  return server;
+}
+
+static void
+vsx_server_quit_cb (VsxMainContextSource *source,
+                    void *user_data)
+{
+  bool *quit_received_ptr = user_data;
+
+  *quit_received_ptr = true;
+
+  vsx_log ("Quit signal received");
+}
+
+static void
+log_server_listening (VsxServer *server)
+{
+  struct vsx_buffer buf = VSX_BUFFER_STATIC_INIT;
+
+  VsxServerSocket *ssocket;
+
+  vsx_list_for_each (ssocket, &server->sockets, link)
+    {
+      if (buf.length > 0)
+        {
+          if (ssocket->link.next == &server->sockets)
+            vsx_buffer_append_string (&buf, " and ");
+          else
+            vsx_buffer_append_string (&buf, ", ");
+        }
+
+      struct vsx_netaddress_native native_address =
+        {
+          .length = offsetof (struct vsx_netaddress_native, length),
+        };
+
+      if (getsockname (ssocket->sock,
+                       &native_address.sockaddr,
+                       &native_address.length) == -1)
+        {
+          vsx_buffer_append_string (&buf, "?");
+        }
+      else
+        {
+          struct vsx_netaddress address;
+          vsx_netaddress_from_native (&address, &native_address);
+
+          char *address_string = vsx_netaddress_to_string (&address);
+          vsx_buffer_append_string (&buf, address_string);
+          vsx_free (address_string);
+        }
+    }
+
+  vsx_log ("Server listening on %s", (const char *) buf.data);
+
+  vsx_buffer_destroy (&buf);
+}
+
+static void
+block_quit_signals (void)
+{
+  sigset_t sigset;
+
+  sigemptyset (&sigset);
+  sigaddset (&sigset, SIGINT);
+  sigaddset (&sigset, SIGTERM);
+
+  pthread_sigmask (SIG_BLOCK, &sigset, NULL);
+}
+
+static void
+remove_shard_connections (VsxServerShard *shard)
+{
+  while (!vsx_list_empty (&shard->connections))
+    {
+      VsxServerConnection *connection =
+        vsx_container_of (shard->connections.next, VsxServerConnection, link);
+      vsx_server_remove_connection (connection);
+    }
+}
+
+/* Connections that were handed over after the shard’s thread quit
+ * won’t have been picked up */
+static void
+free_shard_inbox (VsxServerShard *shard)
+{
+  while (!vsx_list_empty (&shard->inbox))
+    {
+      VsxServerConnection *connection =
+        vsx_container_of (shard->inbox.next, VsxServerConnection, link);
+      vsx_list_remove (&connection->link);
+      free_connection (connection);
+    }
+}
+
+static void
+free_shard_sets (VsxServerShard *shard)
+{
+  if (shard->person_set)
+    {
+      vsx_object_unref (shard->person_set);
+      shard->person_set = NULL;
+    }
+
+  if (shard->pending_conversations)
+    {
+      vsx_object_unref (shard->pending_conversations);
+      shard->pending_conversations = NULL;
+    }
+}
+
+static void
+save_shard_snapshot (VsxServerShard *shard)
+{
+  struct vsx_error *error = NULL;
+
+  if (!vsx_snapshot_save (shard->snapshot,
+                          shard->pending_conversations,
+                          shard->person_set,
+                          &error))
+    {
+      vsx_log ("Error saving the snapshot for shard %i: %s",
+               shard->num,
+               error->message);
+      vsx_error_free (error);
+    }
+}
+
+static void
+snapshot_step_cb (VsxMainContextSource *source,
+                  void *user_data);
+
+static void
+continue_shard_snapshot (VsxServerShard *shard)
+{
+  struct vsx_error *error = NULL;
+
+  if (!vsx_snapshot_continue_save (shard->snapshot,
+                                   VSX_SERVER_SNAPSHOT_STEP_TIME,
+                                   &error))
+    {
+      vsx_log ("Error saving the snapshot for shard %i: %s",
+               shard->num,
+               error->message);
+      vsx_error_free (error);
+      return;
+    }
+
+  if (!vsx_snapshot_is_saving (shard->snapshot))
+    return;
+
+  /* Let the main loop handle any other events before the next step */
+  if (shard->snapshot_step_source)
+    {
+      vsx_main_context_reset_timer (shard->snapshot_step_source,
+                                    VSX_SERVER_SNAPSHOT_STEP_DELAY);
+    }
+  else
+    {
+      shard->snapshot_step_source =
+        vsx_main_context_add_timeout (NULL, /* default context */
+                                      VSX_SERVER_SNAPSHOT_STEP_DELAY,
+                                      snapshot_step_cb,
+                                      shard);
+    }
+}
+
+static void
+snapshot_step_cb (VsxMainContextSource *source,
+                  void *user_data)
+{
+  continue_shard_snapshot (user_data);
+}
+
+static void
+snapshot_cb (VsxMainContextSource *source,
+             void *user_data)
+{
+  VsxServerShard *shard = user_data;
+
+  /* If the last snapshot is taking longer than the interval then let
+   * it finish instead of starting again */
+  if (vsx_snapshot_is_saving (shard->snapshot))
+    return;
+
+  vsx_snapshot_begin_save (shard->snapshot,
+                           shard->pending_conversations,
+                           shard->person_set);
+
+  continue_shard_snapshot (shard);
+}
+
+/* This needs to be called on the thread that will run the shard
+ * because the restored people add timers to its main context */
+static void
+start_shard_snapshot (VsxServerShard *shard)
+{
+  VsxServer *server = shard->server;
+  struct vsx_error *error = NULL;
+
+  if (server->snapshot_file == NULL)
+    return;
+
+  shard->snapshot = vsx_snapshot_new (server->snapshot_file,
+                                      shard->num,
+                                      server->n_shards,
+                                      &error);
+
+  if (shard->snapshot == NULL)
+    {
+      vsx_log ("Error opening the snapshot for shard %i: %s",
+               shard->num,
+               error->message);
+      vsx_error_free (error);
+      return;
+    }
+
+  VsxSnapshotRestoreStats stats;
+
+  if (shard->has_upgrade_state)
+    {
+      /* The games came from the old process instead. The snapshot
+       * is still used to save them. */
+    }
+  else if (!vsx_snapshot_restore (shard->snapshot,
+                             shard->pending_conversations,
+                             shard->person_set,
+                             &stats,
+                             &error))
+    {
+      vsx_log ("Error restoring the snapshot for shard %i: %s",
+               shard->num,
+               error->message);
+      vsx_error_free (error);
+    }
+  else if (stats.n_conversations + stats.n_people + stats.n_skipped > 0)
+    {
+      vsx_log ("Shard %i restored %i conversations and %i people "
+               "(%i records skipped)",
+               shard->num,
+               stats.n_conversations,
+               stats.n_people,
+               stats.n_skipped);
+    }
+
+  shard->snapshot_source =
+    vsx_main_context_add_repeating_timer (NULL, /* default context */
+                                          server->snapshot_interval
+                                          * (int64_t) 1000,
+                                          snapshot_cb,
+                                          shard);
+}
+
+/* Saves one last snapshot so that nothing is lost when the server
+ * quits normally. This must be called before free_shard_sets. */
+static void
+stop_shard_snapshot (VsxServerShard *shard)
+{
+  if (shard->snapshot == NULL)
+    return;
+
+  /* This abandons any save that is in progress and saves everything
+   * in one go */
+  if (shard->pending_conversations && shard->person_set)
+    save_shard_snapshot (shard);
+
+  vsx_main_context_remove_source (shard->snapshot_source);
+  shard->snapshot_source = NULL;
+
+  if (shard->snapshot_step_source)
+    {
+      vsx_main_context_remove_source (shard->snapshot_step_source);
+      shard->snapshot_step_source = NULL;
+    }
+
+  vsx_snapshot_free (shard->snapshot);
+  shard->snapshot = NULL;
+}
+
+static bool
+can_hand_over_connection (VsxServerConnection *connection)
+{
+  /* The SSL state can’t be moved to another process so those clients
+   * will have to reconnect */
+  return (connection->ssl == NULL
+          && !connection->had_bad_input
+          && !connection->read_finished
+          && !connection->write_finished);
+}
+
+static void
+save_connection_output (VsxServerConnection *connection,
+                        struct vsx_buffer *buf)
+{
+  const VsxOutputChain *output = &connection->output;
+
+  vsx_serial_write_u32 (buf, vsx_output_chain_get_length (output));
+
+  for (const VsxOutputSegment *segment = output->head;
+       segment;
+       segment = segment->next)
+    {
+      vsx_buffer_append (buf,
+                         segment->data + segment->start,
+                         segment->end - segment->start);
+    }
+}
+
+/* Called on the shard’s thread during an upgrade before the
+ * connections are removed. The file descriptors of the connections
+ * that can be handed over are moved to upgrade_fds. */
+static void
+save_shard_upgrade_state (VsxServerShard *shard)
+{
+  struct vsx_buffer *buf = &shard->upgrade_data;
+  size_t length_pos = buf->length;
+
+  vsx_serial_write_u32 (buf, 0);
+  vsx_snapshot_encode (shard->pending_conversations, shard->person_set, buf);
+  vsx_proto_write_uint32_t (buf->data + length_pos,
+                            buf->length - length_pos - sizeof (uint32_t));
+
+  VsxServerConnection *connection;
+
+  vsx_list_for_each (connection, &shard->connections, link)
+    {
+      if (!can_hand_over_connection (connection))
+        continue;
+
+      size_t start = buf->length;
+
+      vsx_serial_write_u32 (buf, 0);
+
+      if (!vsx_connection_save_state (connection->ws_connection, buf))
+        {
+          vsx_buffer_set_length (buf, start);
+          continue;
+        }
+
+      vsx_proto_write_uint32_t (buf->data + start,
+                                buf->length - start - sizeof (uint32_t));
+
+      save_connection_output (connection, buf);
+
+      vsx_buffer_append (&shard->upgrade_fds,
+                         &connection->client_socket,
+                         sizeof connection->client_socket);
+      connection->client_socket = -1;
+    }
+
+  shard->has_upgrade_state = true;
+}
+
+static bool
+restore_connection (VsxServerShard *shard,
+                    int fd,
+                    const uint8_t *state,
+                    size_t state_length,
+                    const uint8_t *output,
+                    size_t output_length)
+{
+  VsxServer *server = shard->server;
+  struct vsx_netaddress_native native_address =
+    {
+      .length = offsetof (struct vsx_netaddress_native, length)
+    };
+
+  if (getpeername (fd,
+                   &native_address.sockaddr,
+                   &native_address.length) == -1)
+    {
+      vsx_close (fd);
+      return false;
+    }
+
+  struct vsx_netaddress remote_address;
+
+  vsx_netaddress_from_native (&remote_address, &native_address);
+
+  /* The limits might have changed in the new config */
+  if (!vsx_admission_add_connection (&server->admission))
+    {
+      vsx_close (fd);
+      return false;
+    }
+
+  bool address_tracked = false;
+
+  if (server->address_table
+      && !vsx_address_table_add_connection (server->address_table,
+                                            &remote_address,
+                                            &address_tracked))
+    {
+      vsx_admission_remove_connection (&server->admission);
+      vsx_close (fd);
+      return false;
+    }
+
+  VsxServerConnection *connection =
+    create_connection (shard, fd, &remote_address);
+
+  connection->address_tracked = address_tracked;
+
+  adopt_connection (shard, connection);
+
+  struct vsx_error *error = NULL;
+
+  if (!vsx_connection_load_state (connection->ws_connection,
+                                  state,
+                                  state_length,
+                                  &error))
+    {
+      vsx_log ("For %s: %s", connection->peer_address_string, error->message);
+      vsx_error_free (error);
+      vsx_server_remove_connection (connection);
+      return false;
+    }
+
+  /* Anything that the old process hadn’t managed to write yet,
+   * possibly including the end of a partially written frame */
+  while (output_length > 0)
+    {
+      size_t space;
+      uint8_t *dest = vsx_output_chain_reserve (&connection->output,
+                                                1, /* min_space */
+                                                &space);
+      size_t to_copy = MIN (space, output_length);
+
+      memcpy (dest, output, to_copy);
+      vsx_output_chain_commit (&connection->output, to_copy);
+      output += to_copy;
+      output_length -= to_copy;
+    }
+
+  connection->n_frames_counted =
+    vsx_connection_get_n_frames_received (connection->ws_connection);
+
+  update_deadline (connection);
+  update_poll (connection);
+
+  return true;
+}
+
+/* Called on the shard’s thread in the new process before it starts
+ * running */
+static void
+restore_shard_upgrade_state (VsxServerShard *shard)
+{
+  VsxSerialReader reader;
+  size_t games_length;
+
+  vsx_serial_reader_init (&reader,
+                          shard->upgrade_data.data,
+                          shard->upgrade_data.length);
+
+  const uint8_t *games = vsx_serial_read_data (&reader, &games_length);
+  VsxSnapshotRestoreStats stats;
+
+  vsx_snapshot_decode (games,
+                       games_length,
+                       shard->pending_conversations,
+                       shard->person_set,
+                       &stats);
+
+  int n_fds = shard->upgrade_fds.length / sizeof (int);
+  const int *fds = (const int *) shard->upgrade_fds.data;
+  int fd_num = 0, n_restored = 0;
+
+  while (fd_num < n_fds)
+    {
+      size_t state_length, output_length;
+      const uint8_t *state = vsx_serial_read_data (&reader, &state_length);
+      const uint8_t *output = vsx_serial_read_data (&reader, &output_length);
+
+      if (reader.error)
+        break;
+
+      if (restore_connection (shard,
+                              fds[fd_num++],
+                              state,
+                              state_length,
+                              output,
+                              output_length))
+        n_restored++;
+    }
+
+  /* Close anything left over if the data was short */
+  for (; fd_num < n_fds; fd_num++)
+    vsx_close (fds[fd_num]);
+
+  vsx_log ("Shard %i took over %i conversations, %i people and "
+           "%i of %i connections",
+           shard->num,
+           stats.n_conversations,
+           stats.n_people,
+           n_restored,
+           n_fds);
+
+  vsx_buffer_set_length (&shard->upgrade_data, 0);
+  vsx_buffer_set_length (&shard->upgrade_fds, 0);
+}
+
+/* This needs to be called on the thread that will run the shard */
+static void
+start_shard (VsxServerShard *shard)
+{
+  if (shard->has_upgrade_state)
+    restore_shard_upgrade_state (shard);
+
+  start_shard_snapshot (shard);
+
+  shard->has_upgrade_state = false;
+}
+
+static void
+stop_shard (VsxServerShard *shard)
+{
+  if (shard->server->upgrade_ready)
+    save_shard_upgrade_state (shard);
+
+  /* Close the connections first so that the players are saved as
+   * disconnected */
+  remove_shard_connections (shard);
+  stop_shard_snapshot (shard);
+}
+
+static void *
+shard_thread_func (void *user_data)
+{
+  VsxServerShard *shard = user_data;
+  struct vsx_error *error = NULL;
+
+  /* The quit signals are handled by the main thread */
+  block_quit_signals ();
+
+  /* Each thread gets its own default main context */
+  VsxMainContext *mc = vsx_main_context_get_default (&error);
+
+  if (mc == NULL)
+    vsx_fatal ("Error creating main context for shard %i: %s",
+               shard->num,
+               error->message);
+
+  start_shard (shard);
+
+  shard->inbox_source =
+    vsx_main_context_add_poll (mc,
+                               shard->inbox_fd,
+                               VSX_MAIN_CONTEXT_POLL_IN,
+                               shard_inbox_cb,
+                               shard);
+
+  while (!atomic_load (&shard->quit))
+    vsx_main_context_poll (mc);
+
+  /* Everything that uses the main context needs to be freed on this
+   * thread */
+  stop_shard (shard);
+  free_shard_sets (shard);
+
+  vsx_main_context_remove_source (shard->inbox_source);
+  shard->inbox_source = NULL;
+
+  vsx_output_chain_clear_pool ();
+  vsx_connection_flush_buffer_pool ();
+
+  vsx_main_context_free (mc);
+
+  return NULL;
+}
+
+static bool
+open_inbox (int *inbox_fd,
+            struct vsx_error **error)
+{
+  *inbox_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (*inbox_fd == -1)
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "Error creating eventfd: %s",
+                          strerror (errno));
+      return false;
+    }
+
+  return true;
+}
+
+
+static bool
+start_shard_threads (VsxServer *server,
+                     struct vsx_error **error)
+{
+  /* Connections restored after an upgrade can be sent to another
+   * shard as soon as the first thread starts so every shard needs to
+   * be ready to receive them before creating any of the threads */
+  for (int i = 0; i < server->n_shards; i++)
+    {
+      VsxServerShard *shard = server->shards + i;
+
+      if (!open_inbox (&shard->inbox_fd, error))
+        return false;
+    }
+
+  /* This needs to be set before the threads start because they read
+   * it too */
+  for (int i = 0; i < server->n_shards; i++)
+    server->shards[i].has_thread = true;
+
+  for (int i = 0; i < server->n_shards; i++)
+    {
+      VsxServerShard *shard = server->shards + i;
+
+      int ret = pthread_create (&shard->thread,
+                                NULL, /* attr */
+                                shard_thread_func,
+                                shard);
+
+      if (ret)
+        {
+          for (int j = i; j < server->n_shards; j++)
+            server->shards[j].has_thread = false;
+
+          vsx_file_error_set (error,
+                              ret,
+                              "Error creating shard thread: %s",
+                              strerror (ret));
+          return false;
+        }
+    }
+
+  return true;
+}
+
+static void
+stop_shard_threads (VsxServer *server)
+{
+  for (int i = 0; i < server->n_shards; i++)
+    {
+      VsxServerShard *shard = server->shards + i;
+
+      if (!shard->has_thread)
+        continue;
+
+      atomic_store (&shard->quit, true);
+      wake_inbox (shard->inbox_fd);
+    }
+
+  for (int i = 0; i < server->n_shards; i++)
+    {
+      VsxServerShard *shard = server->shards + i;
+
+      if (!shard->has_thread)
+        continue;
+
+      pthread_join (shard->thread, NULL);
+      shard->has_thread = false;
+    }
+}
+
+static void *
+handshake_thread_func (void *user_data)
+{
+  VsxServerHandshakeWorker *worker = user_data;
+  struct vsx_error *error = NULL;
+
+  block_quit_signals ();
+
+  current_handshake_worker = worker;
+
+  VsxMainContext *mc = vsx_main_context_get_default (&error);
+
+  if (mc == NULL)
+    vsx_fatal ("Error creating main context for handshake worker %i: %s",
+               worker->num,
+               error->message);
+
+  worker->inbox_source =
+    vsx_main_context_add_poll (mc,
+                               worker->inbox_fd,
+                               VSX_MAIN_CONTEXT_POLL_IN,
+                               handshake_inbox_cb,
+                               worker);
+
+  while (!atomic_load (&worker->quit))
+    vsx_main_context_poll (mc);
+
+  while (!vsx_list_empty (&worker->connections))
+    {
+      VsxServerConnection *connection =
+        vsx_container_of (worker->connections.next,
+                          VsxServerConnection,
+                          link);
+      detach_handshake_connection (worker, connection);
+      free_connection (connection);
+    }
+
+  vsx_main_context_remove_source (worker->inbox_source);
+  worker->inbox_source = NULL;
+
+  vsx_main_context_free (mc);
+
+  return NULL;
+}
+
+static bool
+start_handshake_workers (VsxServer *server,
+                         struct vsx_error **error)
+{
+  server->handshake_workers =
+    vsx_calloc (server->n_handshake_workers
+                * sizeof *server->handshake_workers);
+
+  for (int i = 0; i < server->n_handshake_workers; i++)
+    {
+      VsxServerHandshakeWorker *worker = server->handshake_workers + i;
+
+      worker->server = server;
+      worker->num = i;
+      vsx_list_init (&worker->connections);
+      vsx_list_init (&worker->inbox);
+      pthread_mutex_init (&worker->inbox_mutex, NULL /* attr */);
+      worker->inbox_fd = -1;
+    }
+
+  for (int i = 0; i < server->n_handshake_workers; i++)
+    {
+      VsxServerHandshakeWorker *worker = server->handshake_workers + i;
+
+      if (!open_inbox (&worker->inbox_fd, error))
+        return false;
+
+      int ret = pthread_create (&worker->thread,
+                                NULL, /* attr */
+                                handshake_thread_func,
+                                worker);
+
+      if (ret)
+        {
+          vsx_file_error_set (error,
+                              ret,
+                              "Error creating handshake thread: %s",
+                              strerror (ret));
+          return false;
+        }
+
+      worker->has_thread = true;
+    }
+
+  return true;
+}
+
+static void
+stop_handshake_workers (VsxServer *server)
+{
+  if (server->handshake_workers == NULL)
+    return;
+
+  for (int i = 0; i < server->n_handshake_workers; i++)
+    {
+      VsxServerHandshakeWorker *worker = server->handshake_workers + i;
+
+      if (!worker->has_thread)
+        continue;
+
+      atomic_store (&worker->quit, true);
+      wake_inbox (worker->inbox_fd);
+    }
+
+  for (int i = 0; i < server->n_handshake_workers; i++)
+    {
+      VsxServerHandshakeWorker *worker = server->handshake_workers + i;
+
+      if (worker->has_thread)
+        pthread_join (worker->thread, NULL);
+
+      /* Connections that were sent after the thread quit */
+      while (!vsx_list_empty (&worker->inbox))
+        {
+          VsxServerConnection *connection =
+            vsx_container_of (worker->inbox.next, VsxServerConnection, link);
+          vsx_list_remove (&connection->link);
+          free_connection (connection);
+          atomic_fetch_sub (&server->ssl_handshake_queue_depth, 1);
+        }
+
+      if (worker->inbox_fd != -1)
+        vsx_close (worker->inbox_fd);
+
+      pthread_mutex_destroy (&worker->inbox_mutex);
+    }
+
+  vsx_free (server->handshake_workers);
+  server->handshake_workers = NULL;
+}
+
+static bool
+has_ssl_socket (VsxServer *server)
+{
+  VsxServerSocket *ssocket;
+
+  vsx_list_for_each (ssocket, &server->sockets, link)
+    {
+      if (ssocket->ssl_ctx)
+        return true;
+    }
+
+  return false;
+}
+
+static bool
+start_handshake_threads (VsxServer *server,
+                         struct vsx_error **error)
+{
+  if (server->n_handshake_workers <= 0 || !has_ssl_socket (server))
+    return true;
+
+  if (!start_handshake_workers (server, error))
+    return false;
+
+  /* If the shard runs on the main thread then the workers still need
+   * an inbox to send it the connections */
+  VsxServerShard *shard = server->shards;
+
+  if (!shard->has_thread)
+    {
+      if (!open_inbox (&shard->inbox_fd, error))
+        return false;
+
+      shard->inbox_source =
+        vsx_main_context_add_poll (NULL, /* default context */
+                                   shard->inbox_fd,
+                                   VSX_MAIN_CONTEXT_POLL_IN,
+                                   shard_inbox_cb,
+                                   shard);
+    }
+
+  return true;
+}
+
+static void
+abort_upgrade (VsxServer *server)
+{
+  if (server->upgrade_sock_source)
+    {
+      vsx_main_context_remove_source (server->upgrade_sock_source);
+      server->upgrade_sock_source = NULL;
+    }
+
+  if (server->upgrade_timeout_source)
+    {
+      vsx_main_context_remove_source (server->upgrade_timeout_source);
+      server->upgrade_timeout_source = NULL;
+    }
+
+  vsx_close (server->upgrade_sock);
+  server->upgrade_sock = -1;
+
+  /* The new process hasn’t acknowledged taking over anything so it is
+   * safe to kill it */
+  kill (server->upgrade_pid, SIGKILL);
+
+  while (waitpid (server->upgrade_pid, NULL, 0) == -1 && errno == EINTR);
+}
+
+static void
+upgrade_sock_cb (VsxMainContextSource *source,
+                 int fd,
+                 VsxMainContextPollFlags flags,
+                 void *user_data)
+{
+  VsxServer *server = user_data;
+  struct vsx_error *error = NULL;
+  int n_shards;
+
+  if (!vsx_upgrade_receive_ready (server->upgrade_sock, &n_shards, &error))
+    {
+      vsx_log ("Upgrade failed: %s", error->message);
+      vsx_error_free (error);
+      abort_upgrade (server);
+      return;
+    }
+
+  if (n_shards != server->n_shards)
+    {
+      vsx_log ("Upgrade failed: the new process has %i shards but this one "
+               "has %i",
+               n_shards,
+               server->n_shards);
+      abort_upgrade (server);
+      return;
+    }
+
+  vsx_main_context_remove_source (server->upgrade_sock_source);
+  server->upgrade_sock_source = NULL;
+  vsx_main_context_remove_source (server->upgrade_timeout_source);
+  server->upgrade_timeout_source = NULL;
+
+  vsx_log ("New process %i is ready, handing over", (int) server->upgrade_pid);
+
+  server->upgrade_ready = true;
+}
+
+static void
+upgrade_timeout_cb (VsxMainContextSource *source,
+                    void *user_data)
+{
+  VsxServer *server = user_data;
+
+  vsx_log ("Upgrade failed: the new process didn’t become ready in time");
+
+  abort_upgrade (server);
+}
+
+/* Sends copies of the listening sockets so that the new process can
+ * set itself up while this one carries on using them */
+static bool
+send_upgrade_sockets (VsxServer *server,
+                      struct vsx_error **error)
+{
+  struct vsx_buffer fds = VSX_BUFFER_STATIC_INIT;
+  VsxServerSocket *ssocket;
+
+  /* The sockets are in the reverse order of the config */
+  vsx_list_for_each_reverse (ssocket, &server->sockets, link)
+    vsx_buffer_append (&fds, &ssocket->sock, sizeof ssocket->sock);
+
+  /* The metrics socket goes last so that the new process can tell
+   * whether there is one */
+  if (server->metrics_sock != -1)
+    {
+      vsx_buffer_append (&fds,
+                         &server->metrics_sock,
+                         sizeof server->metrics_sock);
+    }
+
+  bool ret = vsx_upgrade_send_sockets (server->upgrade_sock,
+                                       (const int *) fds.data,
+                                       fds.length / sizeof (int),
+                                       error);
+
+  vsx_buffer_destroy (&fds);
+
+  return ret;
+}
+
+static void
+vsx_server_upgrade_cb (VsxMainContextSource *source,
+                       void *user_data)
+{
+  VsxServer *server = user_data;
+
+  if (server->upgrade_command == NULL)
+    {
+      vsx_log ("Upgrade signal received but upgrades aren’t possible");
+      return;
+    }
+
+  if (server->upgrade_sock != -1)
+    {
+      vsx_log ("Upgrade signal received but an upgrade is already running");
+      return;
+    }
+
+  struct vsx_error *error = NULL;
+
+  if (!vsx_upgrade_spawn (server->upgrade_command,
+                          &server->upgrade_sock,
+                          &server->upgrade_pid,
+                          &error))
+    {
+      vsx_log ("Upgrade failed: %s", error->message);
+      vsx_error_free (error);
+      return;
+    }
+
+  vsx_log ("Upgrade signal received, started %s as process %i",
+           server->upgrade_command[0],
+           (int) server->upgrade_pid);
+
+  if (!send_upgrade_sockets (server, &error))
+    {
+      vsx_log ("Upgrade failed: %s", error->message);
+      vsx_error_free (error);
+      abort_upgrade (server);
+      return;
+    }
+
+  server->upgrade_sock_source =
+    vsx_main_context_add_poll (NULL, /* default context */
+                               server->upgrade_sock,
+                               VSX_MAIN_CONTEXT_POLL_IN,
+                               upgrade_sock_cb,
+                               server);
+  server->upgrade_timeout_source =
+    vsx_main_context_add_timeout (NULL, /* default context */
+                                  VSX_SERVER_UPGRADE_TIMEOUT,
+                                  upgrade_timeout_cb,
+                                  server);
+}
+
+/* Sends everything that the shards saved to the new process and
+ * waits for it to take over. This is called after the shards have
+ * stopped. If it fails then the saved state is left in the shards so
+ * that this process can carry on with it. */
+static bool
+send_upgrade_state (VsxServer *server)
+{
+  VsxUpgradeState state;
+  int n_connections = 0;
+
+  vsx_upgrade_state_init (&state);
+
+  vsx_serial_write_u32 (&state.data, server->n_shards);
+
+  for (int i = 0; i < server->n_shards; i++)
+    {
+      VsxServerShard *shard = server->shards + i;
+      int n_fds = shard->upgrade_fds.length / sizeof (int);
+
+      vsx_serial_write_u32 (&state.data, n_fds);
+      vsx_serial_write_data (&state.data,
+                             shard->upgrade_data.data,
+                             shard->upgrade_data.length);
+      vsx_buffer_append (&state.fds,
+                         shard->upgrade_fds.data,
+                         shard->upgrade_fds.length);
+
+      n_connections += n_fds;
+    }
+
+  struct vsx_error *error = NULL;
+  bool ret = (vsx_upgrade_send (server->upgrade_sock, &state, &error)
+              && vsx_upgrade_receive_ack (server->upgrade_sock,
+                                          VSX_SERVER_UPGRADE_TIMEOUT,
+                                          &error));
+
+  /* The shards still own the file descriptors */
+  vsx_buffer_set_length (&state.fds, 0);
+  vsx_upgrade_state_destroy (&state);
+
+  if (ret)
+    {
+      vsx_log ("Handed over %i connections to process %i",
+               n_connections,
+               (int) server->upgrade_pid);
+
+      vsx_close (server->upgrade_sock);
+      server->upgrade_sock = -1;
+    }
+  else
+    {
+      vsx_log ("Upgrade failed after stopping, carrying on: %s",
+               error->message);
+      vsx_error_free (error);
+      abort_upgrade (server);
+    }
+
+  return ret;
+}
+
+/* Runs the shards until the server quits or is ready to upgrade */
+static void
+run_shards (VsxServer *server,
+            const bool *quit_received)
+{
+  if (server->n_shards > 1)
+    {
+      if (!start_shard_threads (server, &server->fatal_error))
+        goto done;
+    }
+  else
+    {
+      start_shard (server->shards);
+    }
+
+  if (!start_handshake_threads (server, &server->fatal_error))
+    goto done;
+
+  log_server_listening (server);
+
+  do
+    vsx_main_context_poll (NULL /* default context */);
+  while (!*quit_received && !server->fatal_error && !server->upgrade_ready);
+
+ done:
+  /* The workers send connections to the shards so they need to stop
+   * first */
+  stop_handshake_workers (server);
+  stop_shard_threads (server);
+
+  VsxServerShard *first_shard = server->shards;
+
+  if (!first_shard->has_thread && first_shard->inbox_source)
+    {
+      vsx_main_context_remove_source (first_shard->inbox_source);
+      first_shard->inbox_source = NULL;
+    }
+
+  /* The shard threads stop their own shards */
+  if (server->n_shards == 1)
+    stop_shard (first_shard);
+}
+
+/* Gets the stopped shards ready to run again with the state that
+ * they saved for the upgrade */
+static void
+prepare_shards_after_failed_upgrade (VsxServer *server)
+{
+  for (int i = 0; i < server->n_shards; i++)
+    {
+      VsxServerShard *shard = server->shards + i;
+
+      free_shard_inbox (shard);
+      free_shard_sets (shard);
+      create_shard_sets (shard);
+
+      if (shard->inbox_fd != -1)
+        {
+          vsx_close (shard->inbox_fd);
+          shard->inbox_fd = -1;
+        }
+
+      atomic_store (&shard->quit, false);
+    }
+
+  server->upgrade_ready = false;
+}
+
+bool
+vsx_server_run (VsxServer *server,
+                struct vsx_error **error)
+{
+  VsxMainContextSource *quit_source;
+  bool quit_received = false;
+
+  /* We have to make the quit source here instead of during
+     vsx_server_new because if we are daemonized then the process will
+     be different by the time we reach here so the signalfd needs to
+     be created in the new process. The same goes for the shard
+     threads. */
+  quit_source = vsx_main_context_add_quit (NULL /* default context */,
+                                           vsx_server_quit_cb,
+                                           &quit_received);
+  VsxMainContextSource *upgrade_source =
+    vsx_main_context_add_upgrade (NULL, /* default context */
+                                  vsx_server_upgrade_cb,
+                                  server);
+
+  while (true)
     {
-      vsx_file_error_set (error,
-                          errno,
-                          "Failed to make socket listen: %s",
-                          strerror (errno));
-      goto error;
-    }
-
-  return sock;
+      run_shards (server, &quit_received);
 
- error:
-  vsx_close(sock);
-  return -1;
-}
+      if (!server->upgrade_ready)
+        {
+          if (server->upgrade_sock != -1)
+            abort_upgrade (server);
+          break;
+        }
 
-static int
-create_socket_for_port (int port,
-                        struct vsx_error **error)
-{
-  struct vsx_netaddress netaddress;
+      if (send_upgrade_state (server)
+          || quit_received
+          || server->fatal_error)
+        break;
 
-  memset (&netaddress, 0, sizeof netaddress);
+      prepare_shards_after_failed_upgrade (server);
+    }
 
-  /* First try binding it with an IPv6 address */
-  netaddress.port = port;
-  netaddress.family = AF_INET6;
+  vsx_main_context_remove_source (upgrade_source);
+  vsx_main_context_remove_source (quit_source);
 
-  struct vsx_error *local_error = NULL;
+  const VsxServerAcceptStats *accept_stats = &server->accept_stats;
 
-  int sock = create_socket_for_address (&netaddress, &local_error);
+  vsx_log ("Connections: %" PRIu64 " accepted, %" PRIu64 " closed because "
+           "of too many open files, listening paused %" PRIu64 " times, "
+           "accept limit reached %" PRIu64 " times",
+           accept_stats->n_accepted,
+           accept_stats->n_rejected,
+           accept_stats->n_paused,
+           accept_stats->n_accept_limit_reached);
 
-  if (sock != -1)
-    return sock;
+  uint64_t n_refused_connections =
+    atomic_load (&server->admission.n_refused_connections);
+  uint64_t n_shed_players = atomic_load (&server->admission.n_shed_players);
 
-  if (local_error->domain == &vsx_file_error
-      && (local_error->code == VSX_FILE_ERROR_PFNOSUPPORT
-          || local_error->code == VSX_FILE_ERROR_AFNOSUPPORT))
+  if (n_refused_connections + n_shed_players > 0)
     {
-      vsx_error_free (local_error);
+      vsx_log ("Overload: %" PRIu64 " connections refused, "
+               "%" PRIu64 " new players turned away",
+               n_refused_connections,
+               n_shed_players);
     }
-  else
+
+  if (server->address_table)
     {
-      vsx_error_propagate (error, local_error);
-      return -1;
-    }
+      VsxAddressTableStats address_stats;
 
-  /* Some servers disable IPv6 so try IPv4 */
-  netaddress.family = AF_INET;
+      vsx_address_table_get_stats (server->address_table, &address_stats);
 
-  return create_socket_for_address (&netaddress, error);
-}
+      vsx_log ("Address limits: %" PRIu64 " connections refused, "
+               "%" PRIu64 " connections over the message rate, "
+               "%" PRIu64 " addresses forgotten",
+               address_stats.n_refused_connections,
+               address_stats.n_rate_limited,
+               address_stats.n_evicted);
+    }
 
-static int
-create_socket_for_config (VsxConfigServer *server_config,
-                          struct vsx_error **error)
-{
-  int default_port;
+  VsxServerSslStats ssl_stats;
 
-  if (server_config->port == -1)
+  vsx_server_get_ssl_stats (server, &ssl_stats);
+
+  if (ssl_stats.n_full_handshakes + ssl_stats.n_resumed_handshakes > 0)
     {
-      default_port = (server_config->certificate
-                      ? DEFAULT_SSL_PORT
-                      : DEFAULT_PORT);
+      vsx_log ("SSL handshakes: %" PRIu64 " full, %" PRIu64 " resumed, "
+               "%" PRIu64 " using kTLS",
+               ssl_stats.n_full_handshakes,
+               ssl_stats.n_resumed_handshakes,
+               ssl_stats.n_ktls_handshakes);
     }
-  else
+
+  if (ssl_stats.n_offloaded_handshakes > 0)
     {
-      default_port = server_config->port;
+      vsx_log ("SSL handshakes on worker threads: %" PRIu64 ", "
+               "average time %" PRIu64 "µs",
+               ssl_stats.n_offloaded_handshakes,
+               ssl_stats.offloaded_handshake_time
+               / ssl_stats.n_offloaded_handshakes);
     }
 
-  if (server_config->address)
+  if (server->fatal_error)
     {
-      struct vsx_netaddress address;
-
-      if (!vsx_netaddress_from_string (&address,
-                                       server_config->address,
-                                       default_port))
-        {
-          vsx_set_error (error,
-                         &vsx_server_error,
-                         VSX_SERVER_ERROR_INVALID_ADDRESS,
-                         "Invalid address \"%s\"",
-                         server_config->address);
-          return -1;
-        }
+      vsx_error_propagate (error, server->fatal_error);
+      server->fatal_error = NULL;
 
-      return create_socket_for_address (&address, error);
+      return false;
     }
   else
-    {
-      return create_socket_for_port (default_port, error);
-    }
+    return true;
 }
 
-static int
-create_socket_for_fd (int fd, struct vsx_error **error)
+void
+vsx_server_set_n_handshake_threads (VsxServer *server,
+                                    int n_threads)
 {
-  if (!vsx_socket_set_nonblock (fd, error))
-    return -1;
+  assert (n_threads >= 0);
+  assert (server->handshake_workers == NULL);
 
-  return fd;
+  server->n_handshake_workers = n_threads;
 }
 
-static int
-ssl_password_cb (char *buf, int size, int rwflag, void *user_data)
+void
+vsx_server_get_ssl_stats (VsxServer *server,
+                          VsxServerSslStats *stats)
 {
-  VsxConfigServer *server_config = user_data;
-
-  if (server_config->private_key_password == NULL)
-    return -1;
-
-  size_t length = strlen (server_config->private_key_password);
-
-  if (length > size)
-    return -1;
-
-  memcpy (buf, server_config->private_key_password, length);
+  stats->n_full_handshakes = atomic_load (&server->n_full_ssl_handshakes);
+  stats->n_resumed_handshakes =
+    atomic_load (&server->n_resumed_ssl_handshakes);
+  stats->n_ktls_handshakes = atomic_load (&server->n_ktls_ssl_handshakes);
+  stats->n_offloaded_handshakes =
+    atomic_load (&server->n_offloaded_ssl_handshakes);
+  stats->offloaded_handshake_time =
+    atomic_load (&server->offloaded_ssl_handshake_time);
+  stats->handshake_queue_depth =
+    atomic_load (&server->ssl_handshake_queue_depth);
+}
 
-  return length;
+VsxAdmission *
+vsx_server_get_admission (VsxServer *server)
+{
+  return &server->admission;
 }
 
-static bool
-init_ssl (VsxServerSocket *ssocket,
-          const VsxConfigServer *server_config,
-          struct vsx_error **error)
+void
+vsx_server_set_address_limits (VsxServer *server,
+                               int table_size,
+                               int max_connections,
+                               int max_messages_per_second)
 {
-  ssocket->ssl_ctx = SSL_CTX_new (TLS_server_method ());
-  if (ssocket->ssl_ctx == NULL)
-    goto error;
+  assert (server->address_table == NULL);
 
-  SSL_CTX_set_default_passwd_cb (ssocket->ssl_ctx, ssl_password_cb);
-  SSL_CTX_set_default_passwd_cb_userdata (ssocket->ssl_ctx,
-                                          (void *) server_config);
+  if (max_connections <= 0 && max_messages_per_second <= 0)
+    return;
 
-  if (SSL_CTX_use_certificate_file (ssocket->ssl_ctx,
-                                    server_config->certificate,
-                                    SSL_FILETYPE_PEM) <= 0)
-    goto error;
+  server->address_table = vsx_address_table_new (table_size,
+                                                 max_connections,
+                                                 max_messages_per_second);
+}
 
-  if (SSL_CTX_use_PrivateKey_file (ssocket->ssl_ctx,
-                                   server_config->private_key,
-                                   SSL_FILETYPE_PEM) <= 0)
-    goto error;
+bool
+vsx_server_get_address_stats (VsxServer *server,
+                              VsxAddressTableStats *stats)
+{
+  if (server->address_table == NULL)
+    return false;
 
-  SSL_CTX_set_mode (ssocket->ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+  vsx_address_table_get_stats (server->address_table, stats);
 
   return true;
+}
 
- error:
-  vsx_ssl_error_set (error);
-  return false;
+void
+vsx_server_set_snapshot (VsxServer *server,
+                         const char *snapshot_file,
+                         int interval)
+{
+  assert (interval > 0);
+
+  vsx_free (server->snapshot_file);
+  server->snapshot_file = vsx_strdup (snapshot_file);
+  server->snapshot_interval = interval;
 }
 
-bool
-vsx_server_add_config (VsxServer *server,
-                       VsxConfigServer *server_config,
-                       int fd_override,
-                       struct vsx_error **error)
+void
+vsx_server_set_upgrade_command (VsxServer *server,
+                                char *const *argv)
 {
-  assert (error == NULL || *error == NULL);
+  int n_args = 0;
 
-  int sock;
+  while (argv[n_args])
+    n_args++;
 
-  if (fd_override >= 0)
-    sock = create_socket_for_fd (fd_override, error);
-  else
-    sock = create_socket_for_config (server_config, error);
+  server->upgrade_command =
+    vsx_alloc ((n_args + 1) * sizeof *server->upgrade_command);
 
-  if (sock == -1)
-      return false;
+  for (int i = 0; i < n_args; i++)
+    server->upgrade_command[i] = vsx_strdup (argv[i]);
 
-  VsxServerSocket *ssocket = vsx_calloc (sizeof *ssocket);
+  server->upgrade_command[n_args] = NULL;
+}
 
-  ssocket->server = server;
-  ssocket->sock = sock;
+bool
+vsx_server_set_upgrade_state (VsxServer *server,
+                              VsxUpgradeState *state,
+                              struct vsx_error **error)
+{
+  VsxSerialReader reader;
+  int n_fds = vsx_upgrade_state_get_n_fds (state);
+  int *fds = vsx_upgrade_state_get_fds (state);
+  int fd_num = 0;
 
-  ssocket->source =
-    vsx_main_context_add_poll (NULL /* default context */,
-                               sock,
-                               VSX_MAIN_CONTEXT_POLL_IN,
-                               vsx_server_pending_connection_cb,
-                               ssocket);
+  vsx_serial_reader_init (&reader, state->data.data, state->data.length);
 
-  vsx_list_insert (&server->sockets, &ssocket->link);
+  if (vsx_serial_read_u32 (&reader) != server->n_shards)
+    goto error;
 
-  if (server_config->certificate
-      && !init_ssl (ssocket, server_config, error))
+  for (int i = 0; i < server->n_shards; i++)
     {
-      vsx_server_remove_socket (server, ssocket);
-      return false;
+      VsxServerShard *shard = server->shards + i;
+      uint32_t n_connections = vsx_serial_read_u32 (&reader);
+      size_t length;
+      const uint8_t *data = vsx_serial_read_data (&reader, &length);
+
+      if (reader.error || n_connections > (uint32_t) (n_fds - fd_num))
+        goto error;
+
+      vsx_buffer_append (&shard->upgrade_data, data, length);
+      vsx_buffer_append (&shard->upgrade_fds,
+                         fds + fd_num,
+                         n_connections * sizeof (int));
+      shard->has_upgrade_state = true;
+
+      /* The shard now owns the file descriptors */
+      for (uint32_t j = 0; j < n_connections; j++)
+        fds[fd_num++] = -1;
     }
 
+  if (reader.p != reader.end)
+    goto error;
+
   return true;
+
+ error:
+  vsx_set_error (error,
+                 &vsx_server_error,
+                 VSX_SERVER_ERROR_INVALID_UPGRADE_STATE,
+                 "Invalid state received from the old process");
+  return false;
 }
 
-VsxServer *
-vsx_server_new (void)
+void
+vsx_server_get_accept_stats (VsxServer *server,
+                             VsxServerAcceptStats *stats)
 {
-  VsxServer *server = vsx_calloc (sizeof *server);
-
-  server->person_set = vsx_person_set_new ();
-
-  server->pending_conversations = vsx_conversation_set_new ();
-
-  vsx_list_init (&server->sockets);
-  vsx_list_init (&server->connections);
-
-  return server;
+  *stats = server->accept_stats;
 }
 
-static void
-vsx_server_quit_cb (VsxMainContextSource *source,
-                    void *user_data)
+void
+vsx_server_free (VsxServer *server)
 {
-  bool *quit_received_ptr = user_data;
+  stop_handshake_workers (server);
+  stop_shard_threads (server);
 
-  *quit_received_ptr = true;
+  for (int i = 0; i < server->n_shards; i++)
+    {
+      VsxServerShard *shard = server->shards + i;
 
-  vsx_log ("Quit signal received");
-}
+      /* If the shard had a thread then this will have already been
+       * done on that thread */
+      remove_shard_connections (shard);
 
-static void
-log_server_listening (VsxServer *server)
-{
-  struct vsx_buffer buf = VSX_BUFFER_STATIC_INIT;
+      free_shard_inbox (shard);
+      free_shard_sets (shard);
 
-  VsxServerSocket *ssocket;
+      /* File descriptors from an upgrade that never got restored */
+      int n_upgrade_fds = shard->upgrade_fds.length / sizeof (int);
 
-  vsx_list_for_each (ssocket, &server->sockets, link)
-    {
-      if (buf.length > 0)
-        {
-          if (ssocket->link.next == &server->sockets)
-            vsx_buffer_append_string (&buf, " and ");
-          else
-            vsx_buffer_append_string (&buf, ", ");
-        }
+      for (int j = 0; j < n_upgrade_fds; j++)
+        vsx_close (((const int *) shard->upgrade_fds.data)[j]);
 
-      struct vsx_netaddress_native native_address =
-        {
-          .length = offsetof (struct vsx_netaddress_native, length),
-        };
+      vsx_buffer_destroy (&shard->upgrade_fds);
+      vsx_buffer_destroy (&shard->upgrade_data);
 
-      if (getsockname (ssocket->sock,
-                       &native_address.sockaddr,
-                       &native_address.length) == -1)
-        {
-          vsx_buffer_append_string (&buf, "?");
-        }
-      else
-        {
-          struct vsx_netaddress address;
-          vsx_netaddress_from_native (&address, &native_address);
+      if (shard->inbox_fd != -1)
+        vsx_close (shard->inbox_fd);
 
-          char *address_string = vsx_netaddress_to_string (&address);
-          vsx_buffer_append_string (&buf, address_string);
-          vsx_free (address_string);
-        }
+      pthread_mutex_destroy (&shard->inbox_mutex);
     }
 
-  vsx_log ("Server listening on %s", (const char *) buf.data);
+  vsx_free (server->shards);
 
-  vsx_buffer_destroy (&buf);
-}
+  vsx_output_chain_clear_pool ();
+  vsx_connection_flush_buffer_pool ();
 
-bool
-vsx_server_run (VsxServer *server,
-                struct vsx_error **error)
-{
-  VsxMainContextSource *quit_source;
-  bool quit_received = false;
+  if (server->relisten_source)
+    vsx_main_context_remove_source (server->relisten_source);
 
-  /* We have to make the quit source here instead of during
-     vsx_server_new because if we are daemonized then the process will
-     be different by the time we reach here so the signalfd needs to
-     be created in the new process */
-  quit_source = vsx_main_context_add_quit (NULL /* default context */,
-                                           vsx_server_quit_cb,
-                                           &quit_received);
+  while (!vsx_list_empty (&server->metrics_clients))
+    {
+      VsxServerMetricsClient *client =
+        vsx_container_of (server->metrics_clients.next,
+                          VsxServerMetricsClient,
+                          link);
+      free_metrics_client (client);
+    }
 
-  log_server_listening (server);
+  if (server->metrics_source)
+    vsx_main_context_remove_source (server->metrics_source);
 
-  do
-    vsx_main_context_poll (NULL /* default context */);
-  while (!quit_received && !server->fatal_error);
+  if (server->metrics_sock != -1)
+    vsx_close (server->metrics_sock);
 
-  vsx_main_context_remove_source (quit_source);
+  if (server->reserve_fd != -1)
+    vsx_close (server->reserve_fd);
 
-  if (server->fatal_error)
-    {
-      vsx_error_propagate (error, server->fatal_error);
-      server->fatal_error = NULL;
+  if (server->address_table)
+    vsx_address_table_free (server->address_table);
 
-      return false;
-    }
-  else
-    return true;
-}
+  vsx_free (server->snapshot_file);
 
-void
-vsx_server_free (VsxServer *server)
-{
-  while (!vsx_list_empty (&server->connections))
+  if (server->upgrade_command)
     {
-      VsxServerConnection *connection =
-        vsx_container_of (server->connections.next, VsxServerConnection, link);
-      vsx_server_remove_connection (server, connection);
+      for (char **arg = server->upgrade_command; *arg; arg++)
+        vsx_free (*arg);
+
+      vsx_free (server->upgrade_command);
     }
 
   while (!vsx_list_empty (&server->sockets))
@@ -1092,9 +3971,5 @@ vsx_server_free (VsxServer *server)
       vsx_server_remove_socket (server, ssocket);
     }
 
-  vsx_object_unref (server->person_set);
-
-  vsx_object_unref (server->pending_conversations);
-
   vsx_free (server);
 }
@@ -19,23 +19,30 @@
 #ifndef VSX_SERVER_H
 #define VSX_SERVER_H
 
+#include <stdint.h>
 #include <stdbool.h>
 
 #include "vsx-config.h"
 #include "vsx-error.h"
+#include "vsx-admission.h"
+#include "vsx-address-table.h"
+#include "vsx-upgrade.h"
 
 typedef struct _VsxServer VsxServer;
 
 typedef enum
 {
   VSX_SERVER_ERROR_INVALID_ADDRESS,
+  VSX_SERVER_ERROR_INVALID_UPGRADE_STATE,
 } VsxServerError;
 
 extern struct vsx_error_domain
 vsx_server_error;
 
+/* If n_shards is greater than one then the games will be split
+ * between that many threads. */
 VsxServer *
-vsx_server_new (void);
+vsx_server_new (int n_shards);
 
 bool
 vsx_server_add_config (VsxServer *server,
@@ -47,6 +54,114 @@ bool
 vsx_server_run (VsxServer *server,
                 struct vsx_error **error);
 
+typedef struct
+{
+  /* Connections that were accepted and passed on */
+  uint64_t n_accepted;
+  /* Connections that were accepted and closed straight away because
+   * there were no file descriptors left */
+  uint64_t n_rejected;
+  /* Times that we stopped listening because not even a connection to
+   * reject could be accepted */
+  uint64_t n_paused;
+  /* Times that the accept loop stopped at its limit for one event,
+   * possibly with more connections still waiting */
+  uint64_t n_accept_limit_reached;
+} VsxServerAcceptStats;
+
+typedef struct
+{
+  /* SSL handshakes that have completed since the server started,
+   * split into the ones that needed a full key exchange and the ones
+   * that resumed a session */
+  uint64_t n_full_handshakes;
+  uint64_t n_resumed_handshakes;
+  /* How many of those switched to kernel TLS for sending */
+  uint64_t n_ktls_handshakes;
+  /* How many of those were run on a handshake thread and the total
+   * time in microseconds that they took from accepting the
+   * connection */
+  uint64_t n_offloaded_handshakes;
+  uint64_t offloaded_handshake_time;
+  /* Connections currently waiting for a handshake thread to finish */
+  int handshake_queue_depth;
+} VsxServerSslStats;
+
+/* Sets the number of threads to run the SSL handshakes on. With zero
+ * the handshake is done on the connection’s shard. This must be
+ * called before vsx_server_run. */
+void
+vsx_server_set_n_handshake_threads (VsxServer *server,
+                                    int n_threads);
+
+void
+vsx_server_get_ssl_stats (VsxServer *server,
+                          VsxServerSslStats *stats);
+
+/* Gets the shared limits and counters. The limits must be set before
+ * vsx_server_run is called. */
+VsxAdmission *
+vsx_server_get_admission (VsxServer *server);
+
+/* Sets limits for each remote address. A limit of zero means no
+ * limit. The table only remembers table_size addresses at a time.
+ * This must be called before vsx_server_run. */
+void
+vsx_server_set_address_limits (VsxServer *server,
+                               int table_size,
+                               int max_connections,
+                               int max_messages_per_second);
+
+/* Returns false if there are no address limits */
+bool
+vsx_server_get_address_stats (VsxServer *server,
+                              VsxAddressTableStats *stats);
+
+/* Makes each shard restore its games from the snapshot files with
+ * the given prefix when the server starts and save them again every
+ * interval seconds. This must be called before vsx_server_run. */
+void
+vsx_server_set_snapshot (VsxServer *server,
+                         const char *snapshot_file,
+                         int interval);
+
+/* Serves the metrics in the Prometheus text format over HTTP at
+ * /metrics on the given address and port. If the address is NULL
+ * then only the loopback interface is used. If fd_override isn’t -1
+ * then it is used as the listening socket instead. This also starts
+ * recording the metrics so it must be called before vsx_server_run. */
+bool
+vsx_server_set_metrics_address (VsxServer *server,
+                                const char *address,
+                                int port,
+                                int fd_override,
+                                struct vsx_error **error);
+
+/* Sets the command to start a new binary when SIGUSR2 is received.
+ * The new process is given the listening sockets, the games and the
+ * connections that aren’t using SSL, and then vsx_server_run returns
+ * once it has taken them over. If the upgrade fails the server carries
+ * on running instead. argv[0] must be an absolute path. */
+void
+vsx_server_set_upgrade_command (VsxServer *server,
+                                char *const *argv);
+
+/* Takes the games and connections that were received from the old
+ * process during an upgrade. The file descriptors that the server
+ * takes are set to -1 in the state. The listening sockets are sent
+ * separately and should be passed to vsx_server_add_config and
+ * vsx_server_set_metrics_address instead. This must be called before
+ * vsx_server_run. */
+bool
+vsx_server_set_upgrade_state (VsxServer *server,
+                              VsxUpgradeState *state,
+                              struct vsx_error **error);
+
+/* This must be called from the thread running vsx_server_run */
+void
+vsx_server_get_accept_stats (VsxServer *server,
+                             VsxServerAcceptStats *stats);
+
 void
 vsx_server_free (VsxServer *mc);
 
@@ -0,0 +1,78 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_SHARD_H
+#define VSX_SHARD_H
+
+#include <stdint.h>
+
+/* When the server runs with multiple shards, every conversation and
+ * every person lives on exactly one shard. The shard is derived
+ * directly from the ID so that any thread can work out where a
+ * RECONNECT or JOIN_GAME needs to go without looking anything up.
+ * Public rooms don’t have an ID until the game is created so they
+ * are pinned by a hash of the room name instead.
+ */
+
+static inline int
+vsx_shard_for_id (uint64_t id,
+                  int n_shards)
+{
+  return id % n_shards;
+}
+
+/* Adjusts a randomly generated ID so that it maps to the given
+ * shard. This only throws away the bottom few bits of randomness.
+ */
+static inline uint64_t
+vsx_shard_pin_id (uint64_t id,
+                  int shard_num,
+                  int n_shards)
+{
+  uint64_t base = id / n_shards * n_shards;
+
+  /* Make sure adding the shard number can’t wrap around */
+  if (base > UINT64_MAX - shard_num)
+    base -= n_shards;
+
+  return base + shard_num;
+}
+
+static inline uint64_t
+vsx_shard_hash_room_name (const char *room_name)
+{
+  /* 64-bit FNV-1a */
+  uint64_t hash = UINT64_C (0xcbf29ce484222325);
+
+  for (const char *p = room_name; *p; p++)
+    {
+      hash ^= (uint8_t) *p;
+      hash *= UINT64_C (0x100000001b3);
+    }
+
+  return hash;
+}
+
+static inline int
+vsx_shard_for_room_name (const char *room_name,
+                         int n_shards)
+{
+  return vsx_shard_hash_room_name (room_name) % n_shards;
+}
+
+#endif /* VSX_SHARD_H */
@@ -0,0 +1,75 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vsx-shared-slice.h"
+
+#define VSX_SHARED_SLICE_BATCH_SIZE (VSX_SHARED_SLICE_MAGAZINE_SIZE / 2)
+
+void *
+vsx_shared_slice_alloc (struct vsx_shared_slice_allocator *allocator,
+                        struct vsx_shared_slice_magazine *magazine)
+{
+  if (magazine->n_slices <= 0)
+    {
+      pthread_mutex_lock (&allocator->mutex);
+
+      for (int i = 0; i < VSX_SHARED_SLICE_BATCH_SIZE; i++)
+        magazine->slices[i] = vsx_slice_alloc (&allocator->slice);
+
+      pthread_mutex_unlock (&allocator->mutex);
+
+      magazine->n_slices = VSX_SHARED_SLICE_BATCH_SIZE;
+    }
+
+  return magazine->slices[--magazine->n_slices];
+}
+
+static void
+return_slices (struct vsx_shared_slice_allocator *allocator,
+               struct vsx_shared_slice_magazine *magazine,
+               int n_slices)
+{
+  pthread_mutex_lock (&allocator->mutex);
+
+  for (int i = 0; i < n_slices; i++)
+    vsx_slice_free (&allocator->slice,
+                    magazine->slices[--magazine->n_slices]);
+
+  pthread_mutex_unlock (&allocator->mutex);
+}
+
+void
+vsx_shared_slice_free (struct vsx_shared_slice_allocator *allocator,
+                       struct vsx_shared_slice_magazine *magazine,
+                       void *ptr)
+{
+  if (magazine->n_slices >= VSX_SHARED_SLICE_MAGAZINE_SIZE)
+    return_slices (allocator, magazine, VSX_SHARED_SLICE_BATCH_SIZE);
+
+  magazine->slices[magazine->n_slices++] = ptr;
+}
+
+void
+vsx_shared_slice_flush (struct vsx_shared_slice_allocator *allocator,
+                        struct vsx_shared_slice_magazine *magazine)
+{
+  if (magazine->n_slices > 0)
+    return_slices (allocator, magazine, magazine->n_slices);
+}
@@ -0,0 +1,75 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_SHARED_SLICE_H
+#define VSX_SHARED_SLICE_H
+
+#include <pthread.h>
+
+#include "vsx-slice.h"
+
+/* A slice allocator that can be used from several threads and where
+ * a slice can be freed on a different thread from the one that
+ * allocated it. The slices come from a vsx_slice_allocator that is
+ * protected by a mutex. Each thread keeps a magazine of free slices
+ * so that the mutex is only taken when the magazine is empty or
+ * full, and then half of it is refilled or returned in one go.
+ */
+
+#define VSX_SHARED_SLICE_MAGAZINE_SIZE 32
+
+struct vsx_shared_slice_allocator {
+  pthread_mutex_t mutex;
+  struct vsx_slice_allocator slice;
+};
+
+/* This should be declared with __thread by the user of the
+ * allocator. It is valid when zero-initialised. */
+struct vsx_shared_slice_magazine {
+  int n_slices;
+  void *slices[VSX_SHARED_SLICE_MAGAZINE_SIZE];
+};
+
+#define VSX_SHARED_SLICE_ALLOCATOR(type, name)                          \
+  static struct vsx_shared_slice_allocator                              \
+  name = {                                                              \
+    .mutex = PTHREAD_MUTEX_INITIALIZER,                                 \
+    .slice = {                                                          \
+      .element_size = MAX (sizeof (type), sizeof (struct vsx_slice)),   \
+      .element_alignment = alignof (type),                              \
+      .magazine = NULL,                                                 \
+      .slab = VSX_SLAB_STATIC_INIT                                      \
+    }                                                                   \
+  }
+
+void *
+vsx_shared_slice_alloc (struct vsx_shared_slice_allocator *allocator,
+                        struct vsx_shared_slice_magazine *magazine);
+
+void
+vsx_shared_slice_free (struct vsx_shared_slice_allocator *allocator,
+                       struct vsx_shared_slice_magazine *magazine,
+                       void *ptr);
+
+/* Gives all of the slices in the magazine back to the allocator. This
+ * should be called before a thread with a magazine exits. */
+void
+vsx_shared_slice_flush (struct vsx_shared_slice_allocator *allocator,
+                        struct vsx_shared_slice_magazine *magazine);
+
+#endif /* VSX_SHARED_SLICE_H */
@@ -0,0 +1,1239 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vsx-snapshot.h"
+
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vsx-proto.h"
+#include "vsx-buffer.h"
+#include "vsx-serial.h"
+#include "vsx-file-error.h"
+#include "vsx-log.h"
+#include "vsx-util.h"
+
+#define VSX_SNAPSHOT_MAGIC "VSXSNAP1"
+#define VSX_SNAPSHOT_MAGIC_LENGTH (sizeof VSX_SNAPSHOT_MAGIC - 1)
+
+/* Layout of the header at the start of each file. The records follow
+ * it. All of the numbers are little-endian. */
+#define VSX_SNAPSHOT_SHARD_NUM_OFFSET 8
+#define VSX_SNAPSHOT_N_SHARDS_OFFSET 12
+#define VSX_SNAPSHOT_GENERATION_OFFSET 16
+#define VSX_SNAPSHOT_DATA_LENGTH_OFFSET 24
+#define VSX_SNAPSHOT_TIME_OFFSET 32
+#define VSX_SNAPSHOT_CHECKSUM_OFFSET 40
+#define VSX_SNAPSHOT_HEADER_SIZE 64
+
+/* Each record is a type byte and a u32 length followed by the
+ * payload */
+#define VSX_SNAPSHOT_RECORD_HEADER_SIZE 5
+
+enum
+{
+  VSX_SNAPSHOT_RECORD_CONVERSATION = 1,
+  VSX_SNAPSHOT_RECORD_PERSON,
+};
+
+/* The files grow in steps of this size */
+#define VSX_SNAPSHOT_MIN_FILE_SIZE (1024 * 1024)
+
+/* Number of records to save in between each check of the clock */
+#define VSX_SNAPSHOT_RECORDS_PER_CLOCK_CHECK 32
+
+/* Number of bytes to checksum in between each check of the clock */
+#define VSX_SNAPSHOT_CHECKSUM_STEP_SIZE (256 * 1024)
+
+typedef struct
+{
+  char *filename;
+  int fd;
+  uint8_t *map;
+  size_t map_size;
+} VsxSnapshotSlot;
+
+typedef struct
+{
+  /* NULL when encoding into a buffer with vsx_snapshot_encode */
+  VsxSnapshot *snapshot;
+  VsxConversationSet *conversation_set;
+  struct vsx_buffer *record;
+  /* Only one of these is used */
+  VsxSnapshotSlot *slot;
+  struct vsx_buffer *out;
+  VsxSnapshotSlot *prev_slot;
+  uint64_t generation;
+  size_t pos;
+  struct vsx_error *error;
+} SaveData;
+
+typedef enum
+{
+  VSX_SNAPSHOT_SAVE_NONE,
+  VSX_SNAPSHOT_SAVE_CONVERSATIONS,
+  VSX_SNAPSHOT_SAVE_PEOPLE,
+  VSX_SNAPSHOT_SAVE_CHECKSUM,
+} VsxSnapshotSaveStage;
+
+/* The data is checksummed in 32-byte blocks with four independent
+ * lanes so that the multiplications can run in parallel */
+typedef struct
+{
+  uint64_t lanes[4];
+  size_t pos;
+} VsxSnapshotChecksum;
+
+struct _VsxSnapshot
+{
+  int shard_num;
+  int n_shards;
+
+  /* The snapshot with generation n is in slot n & 1 */
+  VsxSnapshotSlot slots[2];
+
+  /* Generation of the last complete snapshot, or zero if there isn’t
+   * one */
+  uint64_t generation;
+
+  /* Slot containing the newest complete snapshot when the files were
+   * opened, or NULL if there isn’t one */
+  VsxSnapshotSlot *restore_slot;
+  /* Set if a complete snapshot was ignored because it was made with
+   * a different number of shards */
+  bool wrong_shards;
+
+  /* Reused for encoding each record */
+  struct vsx_buffer record;
+
+  /* State of the save that is in progress */
+  VsxSnapshotSaveStage save_stage;
+  SaveData save;
+  VsxPersonSet *save_person_set;
+  /* IDs of everything that was in the sets when the save started.
+   * The objects aren’t touched until they are encoded. */
+  struct vsx_buffer save_conversations;
+  struct vsx_buffer save_people;
+  size_t save_index;
+  uint8_t save_header[VSX_SNAPSHOT_HEADER_SIZE];
+  VsxSnapshotChecksum save_checksum;
+};
+
+static bool
+open_slot (VsxSnapshotSlot *slot,
+           const char *prefix,
+           int shard_num,
+           char slot_name,
+           struct vsx_error **error)
+{
+  struct vsx_buffer filename = VSX_BUFFER_STATIC_INIT;
+
+  vsx_buffer_append_printf (&filename,
+                            "%s.%i.%c",
+                            prefix,
+                            shard_num,
+                            slot_name);
+
+  slot->filename = (char *) filename.data;
+  slot->map = NULL;
+  slot->map_size = 0;
+
+  slot->fd = open (slot->filename, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+  if (slot->fd == -1)
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "%s: %s",
+                          slot->filename,
+                          strerror (errno));
+      return false;
+    }
+
+  struct stat statbuf;
+
+  if (fstat (slot->fd, &statbuf) == -1)
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "%s: %s",
+                          slot->filename,
+                          strerror (errno));
+      return false;
+    }
+
+  if (statbuf.st_size == 0)
+    return true;
+
+  void *map = mmap (NULL, /* addr */
+                    statbuf.st_size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED,
+                    slot->fd,
+                    0 /* offset */);
+
+  if (map == MAP_FAILED)
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "%s: %s",
+                          slot->filename,
+                          strerror (errno));
+      return false;
+    }
+
+  slot->map = map;
+  slot->map_size = statbuf.st_size;
+
+  return true;
+}
+
+static void
+close_slot (VsxSnapshotSlot *slot)
+{
+  if (slot->map)
+    munmap (slot->map, slot->map_size);
+
+  if (slot->fd != -1)
+    vsx_close (slot->fd);
+
+  vsx_free (slot->filename);
+}
+
+/* Makes sure the file is big enough to hold the given size. This may
+ * move the mapping. */
+static bool
+reserve (VsxSnapshotSlot *slot,
+         size_t size,
+         struct vsx_error **error)
+{
+  if (size <= slot->map_size)
+    return true;
+
+  size_t new_size = MAX (slot->map_size * 2, VSX_SNAPSHOT_MIN_FILE_SIZE);
+
+  while (new_size < size)
+    new_size *= 2;
+
+  if (ftruncate (slot->fd, new_size) == -1)
+    goto error;
+
+  void *map = mmap (NULL, /* addr */
+                    new_size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED,
+                    slot->fd,
+                    0 /* offset */);
+
+  if (map == MAP_FAILED)
+    goto error;
+
+  if (slot->map)
+    munmap (slot->map, slot->map_size);
+
+  slot->map = map;
+  slot->map_size = new_size;
+
+  return true;
+
+ error:
+  vsx_file_error_set (error,
+                      errno,
+                      "%s: %s",
+                      slot->filename,
+                      strerror (errno));
+  return false;
+}
+
+static uint64_t
+mix (uint64_t hash,
+     uint64_t value)
+{
+  hash = (hash ^ value) * UINT64_C (0x9e3779b97f4a7c15);
+
+  return hash ^ (hash >> 29);
+}
+
+static void
+checksum_init (VsxSnapshotChecksum *checksum,
+               const uint8_t *header,
+               size_t length)
+{
+  checksum->lanes[0] =
+    vsx_proto_read_uint64_t (header + VSX_SNAPSHOT_GENERATION_OFFSET);
+  checksum->lanes[1] = length;
+  checksum->lanes[2] =
+    vsx_proto_read_uint64_t (header + VSX_SNAPSHOT_TIME_OFFSET);
+  checksum->lanes[3] =
+    vsx_proto_read_uint32_t (header + VSX_SNAPSHOT_SHARD_NUM_OFFSET);
+  checksum->pos = 0;
+}
+
+/* Adds the whole blocks of the data before the end position */
+static void
+checksum_update (VsxSnapshotChecksum *checksum,
+                 const uint8_t *data,
+                 size_t end)
+{
+  uint64_t *lanes = checksum->lanes;
+
+  for (; checksum->pos + 32 <= end; checksum->pos += 32)
+    {
+      const uint8_t *block = data + checksum->pos;
+
+      for (int i = 0; i < 4; i++)
+        lanes[i] = mix (lanes[i], vsx_proto_read_uint64_t (block + i * 8));
+    }
+}
+
+static uint64_t
+checksum_finish (VsxSnapshotChecksum *checksum,
+                 const uint8_t *data,
+                 size_t length)
+{
+  checksum_update (checksum, data, length);
+
+  uint8_t tail[32] = { 0 };
+
+  memcpy (tail, data + checksum->pos, length - checksum->pos);
+
+  for (int i = 0; i < 4; i++)
+    {
+      checksum->lanes[i] = mix (checksum->lanes[i],
+                                vsx_proto_read_uint64_t (tail + i * 8));
+    }
+
+  uint64_t hash = 0;
+
+  for (int i = 0; i < 4; i++)
+    hash = mix (hash, checksum->lanes[i]);
+
+  return hash;
+}
+
+static uint64_t
+compute_checksum (const uint8_t *header,
+                  const uint8_t *data,
+                  size_t length)
+{
+  VsxSnapshotChecksum checksum;
+
+  checksum_init (&checksum, header, length);
+
+  return checksum_finish (&checksum, data, length);
+}
+
+static bool
+slot_is_valid (VsxSnapshot *snapshot,
+               VsxSnapshotSlot *slot,
+               bool *wrong_shards)
+{
+  if (slot->map_size < VSX_SNAPSHOT_HEADER_SIZE)
+    return false;
+
+  const uint8_t *header = slot->map;
+
+  if (memcmp (header, VSX_SNAPSHOT_MAGIC, VSX_SNAPSHOT_MAGIC_LENGTH))
+    return false;
+
+  uint64_t data_length =
+    vsx_proto_read_uint64_t (header + VSX_SNAPSHOT_DATA_LENGTH_OFFSET);
+
+  if (data_length > slot->map_size - VSX_SNAPSHOT_HEADER_SIZE)
+    return false;
+
+  uint64_t checksum =
+    vsx_proto_read_uint64_t (header + VSX_SNAPSHOT_CHECKSUM_OFFSET);
+
+  if (checksum != compute_checksum (header,
+                                    header + VSX_SNAPSHOT_HEADER_SIZE,
+                                    data_length))
+    return false;
+
+  if (vsx_proto_read_uint32_t (header + VSX_SNAPSHOT_SHARD_NUM_OFFSET)
+      != snapshot->shard_num
+      || vsx_proto_read_uint32_t (header + VSX_SNAPSHOT_N_SHARDS_OFFSET)
+      != snapshot->n_shards)
+    {
+      *wrong_shards = true;
+      return false;
+    }
+
+  return true;
+}
+
+static uint64_t
+get_slot_generation (VsxSnapshotSlot *slot)
+{
+  return vsx_proto_read_uint64_t (slot->map
+                                  + VSX_SNAPSHOT_GENERATION_OFFSET);
+}
+
+static void
+find_restore_slot (VsxSnapshot *snapshot)
+{
+  for (int i = 0; i < VSX_N_ELEMENTS (snapshot->slots); i++)
+    {
+      VsxSnapshotSlot *slot = snapshot->slots + i;
+
+      if (!slot_is_valid (snapshot, slot, &snapshot->wrong_shards))
+        continue;
+
+      if (snapshot->restore_slot == NULL
+          || (get_slot_generation (slot)
+              > get_slot_generation (snapshot->restore_slot)))
+        snapshot->restore_slot = slot;
+    }
+
+  /* The next snapshot needs a higher generation than anything in the
+   * files even if nothing is restored from them */
+  if (snapshot->restore_slot)
+    snapshot->generation = get_slot_generation (snapshot->restore_slot);
+}
+
+VsxSnapshot *
+vsx_snapshot_new (const char *prefix,
+                  int shard_num,
+                  int n_shards,
+                  struct vsx_error **error)
+{
+  VsxSnapshot *snapshot = vsx_calloc (sizeof *snapshot);
+
+  snapshot->shard_num = shard_num;
+  snapshot->n_shards = n_shards;
+  snapshot->slots[0].fd = -1;
+  snapshot->slots[1].fd = -1;
+  vsx_buffer_init (&snapshot->record);
+  vsx_buffer_init (&snapshot->save_conversations);
+  vsx_buffer_init (&snapshot->save_people);
+
+  for (int i = 0; i < VSX_N_ELEMENTS (snapshot->slots); i++)
+    {
+      if (!open_slot (snapshot->slots + i, prefix, shard_num, 'a' + i, error))
+        {
+          vsx_snapshot_free (snapshot);
+          return NULL;
+        }
+    }
+
+  find_restore_slot (snapshot);
+
+  return snapshot;
+}
+
+static void
+begin_record (struct vsx_buffer *buf,
+              int type)
+{
+  vsx_buffer_set_length (buf, 0);
+  vsx_serial_write_u8 (buf, type);
+  /* The length is filled in by end_record */
+  vsx_serial_write_u32 (buf, 0);
+}
+
+static void
+end_record (struct vsx_buffer *buf)
+{
+  vsx_proto_write_uint32_t (buf->data + 1,
+                            buf->length - VSX_SNAPSHOT_RECORD_HEADER_SIZE);
+}
+
+static void
+encode_conversation (struct vsx_buffer *buf,
+                     VsxConversation *conversation,
+                     const char *room_name)
+{
+  begin_record (buf, VSX_SNAPSHOT_RECORD_CONVERSATION);
+
+  vsx_serial_write_u64 (buf, conversation->hash_entry.id);
+  vsx_serial_write_u8 (buf, conversation->state);
+  vsx_serial_write_u8 (buf, conversation->tile_data - vsx_tile_data);
+  vsx_serial_write_u8 (buf, conversation->total_n_tiles);
+  vsx_serial_write_u8 (buf, conversation->n_tiles_in_play);
+  vsx_serial_write_string (buf, room_name ? room_name : "");
+
+  vsx_serial_write_u8 (buf, conversation->n_players);
+
+  for (int i = 0; i < conversation->n_players; i++)
+    {
+      const VsxPlayer *player = conversation->players[i];
+
+      vsx_serial_write_u8 (buf, player->flags);
+      vsx_serial_write_string (buf, player->name);
+    }
+
+  /* The bag of tiles is only filled when the first tile is turned */
+  if (conversation->n_tiles_in_play > 0)
+    {
+      for (int i = 0; i < VSX_TILE_DATA_N_TILES; i++)
+        {
+          const VsxTile *tile = conversation->tiles + i;
+
+          vsx_serial_write_string (buf, tile->letter);
+
+          if (i < conversation->n_tiles_in_play)
+            {
+              vsx_serial_write_u16 (buf, tile->x);
+              vsx_serial_write_u16 (buf, tile->y);
+              vsx_serial_write_u16 (buf, tile->last_player);
+            }
+        }
+    }
+
+  int n_messages = vsx_conversation_get_n_messages (conversation);
+
+  vsx_serial_write_u32 (buf, n_messages);
+
+  for (int i = 0; i < n_messages; i++)
+    {
+      const VsxConversationMessage *message =
+        vsx_conversation_get_message (conversation, i);
+
+      vsx_serial_write_u8 (buf, message->player_num);
+      vsx_serial_write_string (buf, message->text);
+    }
+
+  end_record (buf);
+}
+
+static void
+encode_person (struct vsx_buffer *buf,
+               VsxPerson *person)
+{
+  begin_record (buf, VSX_SNAPSHOT_RECORD_PERSON);
+
+  vsx_serial_write_u64 (buf, person->hash_entry.id);
+  vsx_serial_write_u64 (buf, person->conversation->hash_entry.id);
+  vsx_serial_write_u8 (buf, person->player->num);
+  vsx_serial_write_u32 (buf, person->message_offset);
+
+  end_record (buf);
+}
+
+static bool
+append_data (SaveData *data,
+             const uint8_t *record,
+             size_t length)
+{
+  if (data->error)
+    return false;
+
+  if (data->out)
+    {
+      vsx_buffer_append (data->out, record, length);
+      data->pos += length;
+      return true;
+    }
+
+  if (!reserve (data->slot, data->pos + length, &data->error))
+    return false;
+
+  memcpy (data->slot->map + data->pos, record, length);
+  data->pos += length;
+
+  return true;
+}
+
+static bool
+can_copy_conversation (SaveData *data,
+                       VsxConversation *conversation)
+{
+  VsxSnapshot *snapshot = data->snapshot;
+
+  return (snapshot
+          && snapshot->generation != 0
+          && conversation->snapshot_generation == snapshot->generation
+          && (conversation->snapshot_offset + conversation->snapshot_length
+              <= data->prev_slot->map_size));
+}
+
+static void
+save_conversation (SaveData *data,
+                   VsxConversation *conversation,
+                   const char *room_name)
+{
+  size_t offset = data->pos;
+  bool ret;
+
+  if (can_copy_conversation (data, conversation))
+    {
+      ret = append_data (data,
+                         data->prev_slot->map + conversation->snapshot_offset,
+                         conversation->snapshot_length);
+    }
+  else
+    {
+      struct vsx_buffer *record = data->record;
+
+      encode_conversation (record, conversation, room_name);
+      ret = append_data (data, record->data, record->length);
+    }
+
+  if (ret && data->snapshot)
+    {
+      conversation->snapshot_generation = data->generation;
+      conversation->snapshot_offset = offset;
+      conversation->snapshot_length = data->pos - offset;
+    }
+}
+
+static void
+save_conversation_cb (VsxConversation *conversation,
+                      const char *room_name,
+                      void *user_data)
+{
+  save_conversation (user_data, conversation, room_name);
+}
+
+static void
+save_person (SaveData *data,
+             VsxPerson *person)
+{
+  /* Skip people whose conversation has already been abandoned */
+  if (vsx_conversation_set_get_conversation (data->conversation_set,
+                                             person->conversation
+                                             ->hash_entry.id)
+      != person->conversation)
+    return;
+
+  struct vsx_buffer *record = data->record;
+
+  encode_person (record, person);
+  append_data (data, record->data, record->length);
+}
+
+static void
+save_person_cb (VsxPerson *person,
+                void *user_data)
+{
+  save_person (user_data, person);
+}
+
+static int64_t
+get_wall_time (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+
+  return ts.tv_sec * INT64_C (1000000) + ts.tv_nsec / 1000;
+}
+
+static int64_t
+get_monotonic_time (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * INT64_C (1000000) + ts.tv_nsec / 1000;
+}
+
+static void
+end_save (VsxSnapshot *snapshot)
+{
+  if (snapshot->save_stage == VSX_SNAPSHOT_SAVE_NONE)
+    return;
+
+  vsx_buffer_set_length (&snapshot->save_conversations, 0);
+  vsx_buffer_set_length (&snapshot->save_people, 0);
+
+  vsx_object_unref (snapshot->save.conversation_set);
+  vsx_object_unref (snapshot->save_person_set);
+
+  if (snapshot->save.error)
+    vsx_error_free (snapshot->save.error);
+
+  snapshot->save_stage = VSX_SNAPSHOT_SAVE_NONE;
+}
+
+void
+vsx_snapshot_begin_save (VsxSnapshot *snapshot,
+                         VsxConversationSet *conversation_set,
+                         VsxPersonSet *person_set)
+{
+  end_save (snapshot);
+
+  uint64_t generation = snapshot->generation + 1;
+
+  snapshot->save = (SaveData) {
+    .snapshot = snapshot,
+    .conversation_set = vsx_object_ref (conversation_set),
+    .record = &snapshot->record,
+    .slot = snapshot->slots + (generation & 1),
+    .out = NULL,
+    .prev_slot = snapshot->slots + (snapshot->generation & 1),
+    .generation = generation,
+    .pos = VSX_SNAPSHOT_HEADER_SIZE,
+    .error = NULL,
+  };
+  snapshot->save_person_set = vsx_object_ref (person_set);
+
+  /* Only the IDs are collected now. That can be done without
+   * touching the objects so it is much quicker than encoding them. */
+  vsx_conversation_set_get_ids (conversation_set,
+                                &snapshot->save_conversations);
+  vsx_person_set_get_ids (person_set, &snapshot->save_people);
+
+  snapshot->save_index = 0;
+  snapshot->save_stage = VSX_SNAPSHOT_SAVE_CONVERSATIONS;
+
+  /* The header of the slot that is being overwritten is left alone
+   * until the end. If we die before then its checksum won’t match and
+   * the other slot will be used instead. */
+  reserve (snapshot->save.slot,
+           VSX_SNAPSHOT_HEADER_SIZE,
+           &snapshot->save.error);
+}
+
+bool
+vsx_snapshot_is_saving (VsxSnapshot *snapshot)
+{
+  return snapshot->save_stage != VSX_SNAPSHOT_SAVE_NONE;
+}
+
+/* Returns false if there are no more conversations */
+static bool
+save_next_conversation (VsxSnapshot *snapshot)
+{
+  const VsxConversationId *ids =
+    (const VsxConversationId *) snapshot->save_conversations.data;
+  size_t n_conversations = snapshot->save_conversations.length / sizeof *ids;
+
+  if (snapshot->save_index >= n_conversations)
+    return false;
+
+  VsxConversationSet *set = snapshot->save.conversation_set;
+  VsxConversation *conversation =
+    vsx_conversation_set_get_conversation (set,
+                                           ids[snapshot->save_index++]);
+
+  /* Leave out conversations that were removed after the save
+   * started */
+  if (conversation)
+    {
+      save_conversation (&snapshot->save,
+                         conversation,
+                         vsx_conversation_set_get_room_name (set,
+                                                             conversation));
+    }
+
+  return true;
+}
+
+/* Returns false if there are no more people */
+static bool
+save_next_person (VsxSnapshot *snapshot)
+{
+  const VsxPersonId *ids = (const VsxPersonId *) snapshot->save_people.data;
+  size_t n_people = snapshot->save_people.length / sizeof *ids;
+
+  if (snapshot->save_index >= n_people)
+    return false;
+
+  VsxPerson *person =
+    vsx_person_set_get_person (snapshot->save_person_set,
+                               ids[snapshot->save_index++]);
+
+  if (person)
+    save_person (&snapshot->save, person);
+
+  return true;
+}
+
+static void
+start_checksum (VsxSnapshot *snapshot)
+{
+  uint8_t *header = snapshot->save_header;
+  size_t data_length = snapshot->save.pos - VSX_SNAPSHOT_HEADER_SIZE;
+
+  memset (header, 0, VSX_SNAPSHOT_HEADER_SIZE);
+  memcpy (header, VSX_SNAPSHOT_MAGIC, VSX_SNAPSHOT_MAGIC_LENGTH);
+  vsx_proto_write_uint32_t (header + VSX_SNAPSHOT_SHARD_NUM_OFFSET,
+                            snapshot->shard_num);
+  vsx_proto_write_uint32_t (header + VSX_SNAPSHOT_N_SHARDS_OFFSET,
+                            snapshot->n_shards);
+  vsx_proto_write_uint64_t (header + VSX_SNAPSHOT_GENERATION_OFFSET,
+                            snapshot->save.generation);
+  vsx_proto_write_uint64_t (header + VSX_SNAPSHOT_DATA_LENGTH_OFFSET,
+                            data_length);
+  vsx_proto_write_uint64_t (header + VSX_SNAPSHOT_TIME_OFFSET,
+                            get_wall_time ());
+
+  checksum_init (&snapshot->save_checksum, header, data_length);
+}
+
+/* Returns true once the whole checksum has been calculated */
+static bool
+continue_checksum (VsxSnapshot *snapshot)
+{
+  VsxSnapshotChecksum *checksum = &snapshot->save_checksum;
+  const uint8_t *data = snapshot->save.slot->map + VSX_SNAPSHOT_HEADER_SIZE;
+  size_t data_length = snapshot->save.pos - VSX_SNAPSHOT_HEADER_SIZE;
+
+  if (data_length - checksum->pos > VSX_SNAPSHOT_CHECKSUM_STEP_SIZE)
+    {
+      checksum_update (checksum,
+                       data,
+                       checksum->pos + VSX_SNAPSHOT_CHECKSUM_STEP_SIZE);
+      return false;
+    }
+
+  vsx_proto_write_uint64_t (snapshot->save_header
+                            + VSX_SNAPSHOT_CHECKSUM_OFFSET,
+                            checksum_finish (checksum, data, data_length));
+
+  return true;
+}
+
+static void
+finish_save (VsxSnapshot *snapshot)
+{
+  VsxSnapshotSlot *slot = snapshot->save.slot;
+
+  memcpy (slot->map, snapshot->save_header, VSX_SNAPSHOT_HEADER_SIZE);
+
+  /* Start writing the pages back to the disk without waiting. Even
+   * without this the data will survive the process crashing because
+   * it is already in the page cache. */
+  msync (slot->map, snapshot->save.pos, MS_ASYNC);
+
+  snapshot->generation = snapshot->save.generation;
+  snapshot->restore_slot = NULL;
+
+  end_save (snapshot);
+}
+
+static bool
+continue_save (VsxSnapshot *snapshot,
+               int64_t deadline,
+               struct vsx_error **error)
+{
+  int n_steps = 0;
+
+  assert (vsx_snapshot_is_saving (snapshot));
+
+  while (true)
+    {
+      if (snapshot->save.error)
+        {
+          vsx_error_propagate (error, snapshot->save.error);
+          snapshot->save.error = NULL;
+          end_save (snapshot);
+          return false;
+        }
+
+      switch (snapshot->save_stage)
+        {
+        case VSX_SNAPSHOT_SAVE_NONE:
+          assert (false);
+          break;
+
+        case VSX_SNAPSHOT_SAVE_CONVERSATIONS:
+          if (!save_next_conversation (snapshot))
+            {
+              snapshot->save_index = 0;
+              snapshot->save_stage = VSX_SNAPSHOT_SAVE_PEOPLE;
+            }
+          break;
+
+        case VSX_SNAPSHOT_SAVE_PEOPLE:
+          if (!save_next_person (snapshot))
+            {
+              start_checksum (snapshot);
+              snapshot->save_stage = VSX_SNAPSHOT_SAVE_CHECKSUM;
+            }
+          break;
+
+        case VSX_SNAPSHOT_SAVE_CHECKSUM:
+          if (continue_checksum (snapshot))
+            {
+              finish_save (snapshot);
+              return true;
+            }
+
+          /* Each step of the checksum is big enough to check the
+           * clock every time */
+          n_steps = VSX_SNAPSHOT_RECORDS_PER_CLOCK_CHECK;
+          break;
+        }
+
+      if (++n_steps >= VSX_SNAPSHOT_RECORDS_PER_CLOCK_CHECK)
+        {
+          if (get_monotonic_time () >= deadline)
+            return true;
+
+          n_steps = 0;
+        }
+    }
+}
+
+bool
+vsx_snapshot_continue_save (VsxSnapshot *snapshot,
+                            int64_t max_time,
+                            struct vsx_error **error)
+{
+  return continue_save (snapshot, get_monotonic_time () + max_time, error);
+}
+
+bool
+vsx_snapshot_save (VsxSnapshot *snapshot,
+                   VsxConversationSet *conversation_set,
+                   VsxPersonSet *person_set,
+                   struct vsx_error **error)
+{
+  vsx_snapshot_begin_save (snapshot, conversation_set, person_set);
+
+  return continue_save (snapshot, INT64_MAX, error);
+}
+
+void
+vsx_snapshot_encode (VsxConversationSet *conversation_set,
+                     VsxPersonSet *person_set,
+                     struct vsx_buffer *buffer)
+{
+  struct vsx_buffer record = VSX_BUFFER_STATIC_INIT;
+  SaveData data = {
+    .snapshot = NULL,
+    .conversation_set = conversation_set,
+    .record = &record,
+    .slot = NULL,
+    .out = buffer,
+    .prev_slot = NULL,
+    .generation = 0,
+    .pos = 0,
+    .error = NULL,
+  };
+
+  vsx_conversation_set_foreach (conversation_set,
+                                save_conversation_cb,
+                                &data);
+  vsx_person_set_foreach (person_set, save_person_cb, &data);
+
+  vsx_buffer_destroy (&record);
+}
+
+static VsxConversation *
+decode_conversation (VsxSerialReader *reader,
+                     const char **room_name_out)
+{
+  VsxConversationId id = vsx_serial_read_u64 (reader);
+  int state = vsx_serial_read_u8 (reader);
+  int tile_data_index = vsx_serial_read_u8 (reader);
+  int total_n_tiles = vsx_serial_read_u8 (reader);
+  int n_tiles_in_play = vsx_serial_read_u8 (reader);
+  const char *room_name = vsx_serial_read_string (reader, VSX_PROTO_MAX_PAYLOAD_SIZE);
+  int n_players = vsx_serial_read_u8 (reader);
+
+  if (reader->error
+      || (state != VSX_CONVERSATION_AWAITING_START
+          && state != VSX_CONVERSATION_IN_PROGRESS)
+      || tile_data_index >= VSX_TILE_DATA_N_ROOMS
+      || total_n_tiles < 1
+      || total_n_tiles > VSX_TILE_DATA_N_TILES
+      || n_tiles_in_play > total_n_tiles
+      || n_players < 1
+      || n_players > VSX_CONVERSATION_MAX_PLAYERS)
+    return NULL;
+
+  VsxConversation *conversation =
+    vsx_conversation_new (id, vsx_tile_data + tile_data_index);
+
+  if (state == VSX_CONVERSATION_IN_PROGRESS)
+    vsx_conversation_restore_started (conversation);
+
+  conversation->total_n_tiles = total_n_tiles;
+  conversation->n_tiles_in_play = n_tiles_in_play;
+
+  for (int i = 0; i < n_players; i++)
+    {
+      /* Nobody can be typing anymore after a restart */
+      VsxPlayerFlags flags = vsx_serial_read_u8 (reader) & ~VSX_PLAYER_TYPING;
+      const char *name = vsx_serial_read_string (reader, VSX_PROTO_MAX_PAYLOAD_SIZE);
+      VsxPlayer *player = vsx_player_new (name, i);
+
+      player->flags = flags;
+      conversation->players[conversation->n_players++] = player;
+
+      if (vsx_player_is_connected (player))
+        conversation->n_connected_players++;
+    }
+
+  if (n_tiles_in_play > 0)
+    {
+      for (int i = 0; i < VSX_TILE_DATA_N_TILES; i++)
+        {
+          VsxTile *tile = conversation->tiles + i;
+          const char *letter =
+            vsx_serial_read_string (reader, VSX_TILE_MAX_LETTER_BYTES);
+
+          strcpy (tile->letter, letter);
+
+          if (i < n_tiles_in_play)
+            {
+              tile->x = (int16_t) vsx_serial_read_u16 (reader);
+              tile->y = (int16_t) vsx_serial_read_u16 (reader);
+              tile->last_player = (int16_t) vsx_serial_read_u16 (reader);
+
+              if (tile->last_player < -1 || tile->last_player >= n_players)
+                reader->error = true;
+            }
+          else
+            {
+              tile->x = 0;
+              tile->y = 0;
+              tile->last_player = -1;
+            }
+        }
+    }
+
+  uint32_t n_messages = vsx_serial_read_u32 (reader);
+
+  /* Each message needs at least two bytes so this stops a corrupt
+   * count from allocating too much */
+  if (n_messages > (reader->end - reader->p) / 2)
+    reader->error = true;
+
+  for (uint32_t i = 0; i < n_messages && !reader->error; i++)
+    {
+      unsigned int player_num = vsx_serial_read_u8 (reader);
+      const char *text = vsx_serial_read_string (reader, VSX_PROTO_MAX_PAYLOAD_SIZE);
+
+      if (player_num >= n_players)
+        {
+          reader->error = true;
+          break;
+        }
+
+      vsx_buffer_set_length (&conversation->messages,
+                             (i + 1) * sizeof (VsxConversationMessage));
+
+      VsxConversationMessage *message =
+        vsx_conversation_get_message (conversation, i);
+
+      message->player_num = player_num;
+      message->text = vsx_strdup (text);
+    }
+
+  if (reader->error)
+    {
+      vsx_object_unref (conversation);
+      return NULL;
+    }
+
+  *room_name_out = *room_name ? room_name : NULL;
+
+  return conversation;
+}
+
+static bool
+restore_conversation (VsxSerialReader *reader,
+                      VsxConversationSet *conversation_set,
+                      uint64_t generation,
+                      size_t offset,
+                      size_t length)
+{
+  const char *room_name;
+  VsxConversation *conversation = decode_conversation (reader, &room_name);
+
+  if (conversation == NULL)
+    return false;
+
+  /* An unchanged conversation can be copied from here in the next
+   * snapshot */
+  conversation->snapshot_generation = generation;
+  conversation->snapshot_offset = offset;
+  conversation->snapshot_length = length;
+
+  bool ret = vsx_conversation_set_add_conversation (conversation_set,
+                                                    conversation,
+                                                    room_name);
+
+  vsx_object_unref (conversation);
+
+  return ret;
+}
+
+static bool
+restore_person (VsxSerialReader *reader,
+                VsxConversationSet *conversation_set,
+                VsxPersonSet *person_set)
+{
+  VsxPersonId id = vsx_serial_read_u64 (reader);
+  VsxConversationId conversation_id = vsx_serial_read_u64 (reader);
+  unsigned int player_num = vsx_serial_read_u8 (reader);
+  unsigned int message_offset = vsx_serial_read_u32 (reader);
+
+  if (reader->error)
+    return false;
+
+  VsxConversation *conversation =
+    vsx_conversation_set_get_conversation (conversation_set,
+                                           conversation_id);
+
+  if (conversation == NULL
+      || player_num >= conversation->n_players
+      || message_offset > vsx_conversation_get_n_messages (conversation))
+    return false;
+
+  VsxPerson *person = vsx_person_new_for_player (id,
+                                                 conversation,
+                                                 player_num,
+                                                 message_offset);
+
+  bool ret = vsx_person_set_add_person (person_set, person);
+
+  vsx_object_unref (person);
+
+  return ret;
+}
+
+/* The base is the start of the file that the data is in so that the
+ * offsets of the conversations’ records can be recorded */
+static void
+restore_records (const uint8_t *base,
+                 const uint8_t *data,
+                 size_t data_length,
+                 uint64_t generation,
+                 VsxConversationSet *conversation_set,
+                 VsxPersonSet *person_set,
+                 VsxSnapshotRestoreStats *stats)
+{
+  const uint8_t *p = data, *end = data + data_length;
+
+  memset (stats, 0, sizeof *stats);
+
+  while (end - p >= VSX_SNAPSHOT_RECORD_HEADER_SIZE)
+    {
+      int type = p[0];
+      size_t length = vsx_proto_read_uint32_t (p + 1);
+      size_t record_length = VSX_SNAPSHOT_RECORD_HEADER_SIZE + length;
+
+      if ((size_t) (end - p) < record_length)
+        break;
+
+      VsxSerialReader reader;
+      bool ret = false;
+
+      vsx_serial_reader_init (&reader,
+                              p + VSX_SNAPSHOT_RECORD_HEADER_SIZE,
+                              length);
+
+      switch (type)
+        {
+        case VSX_SNAPSHOT_RECORD_CONVERSATION:
+          ret = restore_conversation (&reader,
+                                      conversation_set,
+                                      generation,
+                                      p - base,
+                                      record_length);
+          if (ret)
+            stats->n_conversations++;
+          break;
+
+        case VSX_SNAPSHOT_RECORD_PERSON:
+          ret = restore_person (&reader, conversation_set, person_set);
+          if (ret)
+            stats->n_people++;
+          break;
+        }
+
+      if (!ret)
+        stats->n_skipped++;
+
+      p += record_length;
+    }
+}
+
+bool
+vsx_snapshot_restore (VsxSnapshot *snapshot,
+                      VsxConversationSet *conversation_set,
+                      VsxPersonSet *person_set,
+                      VsxSnapshotRestoreStats *stats,
+                      struct vsx_error **error)
+{
+  VsxSnapshotSlot *slot = snapshot->restore_slot;
+
+  if (slot == NULL)
+    {
+      memset (stats, 0, sizeof *stats);
+
+      if (snapshot->wrong_shards)
+        {
+          vsx_log ("Ignoring the snapshot for shard %i because it was "
+                   "made with a different number of shards",
+                   snapshot->shard_num);
+        }
+
+      return true;
+    }
+
+  restore_records (slot->map,
+                   slot->map + VSX_SNAPSHOT_HEADER_SIZE,
+                   vsx_proto_read_uint64_t (slot->map
+                                            + VSX_SNAPSHOT_DATA_LENGTH_OFFSET),
+                   snapshot->generation,
+                   conversation_set,
+                   person_set,
+                   stats);
+
+  snapshot->restore_slot = NULL;
+
+  return true;
+}
+
+void
+vsx_snapshot_decode (const uint8_t *data,
+                     size_t length,
+                     VsxConversationSet *conversation_set,
+                     VsxPersonSet *person_set,
+                     VsxSnapshotRestoreStats *stats)
+{
+  /* Generation zero means the conversations will be encoded again in
+   * the next snapshot instead of copied */
+  restore_records (data,
+                   data,
+                   length,
+                   0, /* generation */
+                   conversation_set,
+                   person_set,
+                   stats);
+}
+
+void
+vsx_snapshot_free (VsxSnapshot *snapshot)
+{
+  end_save (snapshot);
+
+  for (int i = 0; i < VSX_N_ELEMENTS (snapshot->slots); i++)
+    close_slot (snapshot->slots + i);
+
+  vsx_buffer_destroy (&snapshot->record);
+  vsx_buffer_destroy (&snapshot->save_conversations);
+  vsx_buffer_destroy (&snapshot->save_people);
+
+  vsx_free (snapshot);
+}
@@ -0,0 +1,127 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_SNAPSHOT_H
+#define VSX_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vsx-conversation-set.h"
+#include "vsx-person-set.h"
+#include "vsx-error.h"
+#include "vsx-buffer.h"
+
+/* Saves the conversations and people of one shard so that the games
+ * can carry on after the server is restarted or crashes. Each shard
+ * has two memory-mapped files and the snapshots alternate between
+ * them, so if the server dies part way through writing one then the
+ * other is still intact. A checksum in the header tells which ones
+ * are complete and the generation number tells which is newer.
+ *
+ * The snapshots are written by copying into the mapping, so saving
+ * doesn’t make any blocking system calls apart from when a file needs
+ * to grow. A conversation that hasn’t changed since the last snapshot
+ * is copied from the other file instead of being encoded again. The
+ * save can be split into short steps so that a shard with lots of
+ * games doesn’t hold up its main loop while it is written.
+ */
+
+typedef struct _VsxSnapshot VsxSnapshot;
+
+/* The files are named after the prefix with the shard number and
+ * “a” or “b”, eg /var/lib/vsx/snapshot.0.a */
+VsxSnapshot *
+vsx_snapshot_new (const char *prefix,
+                  int shard_num,
+                  int n_shards,
+                  struct vsx_error **error);
+
+typedef struct
+{
+  int n_conversations;
+  int n_people;
+  /* Records that couldn’t be restored because they were invalid or
+   * referred to something that was missing */
+  int n_skipped;
+} VsxSnapshotRestoreStats;
+
+/* Adds everything from the newest complete snapshot to the sets.
+ * Returns true without adding anything if there is no snapshot yet.
+ * A snapshot that was made with a different number of shards is
+ * ignored because the IDs would map to the wrong shards. This can
+ * only be used before the first save. */
+bool
+vsx_snapshot_restore (VsxSnapshot *snapshot,
+                      VsxConversationSet *conversation_set,
+                      VsxPersonSet *person_set,
+                      VsxSnapshotRestoreStats *stats,
+                      struct vsx_error **error);
+
+/* Starts saving a new snapshot that is written by calling
+ * vsx_snapshot_continue_save until it is finished. Only the IDs of
+ * everything in the sets are collected now. Each conversation and
+ * person is encoded when the save gets to it, so anything that
+ * changes in the meantime is saved in its newer state and anything
+ * that is removed is left out. A save that was already in progress
+ * is abandoned. */
+void
+vsx_snapshot_begin_save (VsxSnapshot *snapshot,
+                         VsxConversationSet *conversation_set,
+                         VsxPersonSet *person_set);
+
+/* Carries on with the save until it is finished or roughly max_time
+ * microseconds have passed. At least one record is saved each time so
+ * that it always makes progress. If there is an error the save is
+ * abandoned and false is returned. */
+bool
+vsx_snapshot_continue_save (VsxSnapshot *snapshot,
+                            int64_t max_time,
+                            struct vsx_error **error);
+
+bool
+vsx_snapshot_is_saving (VsxSnapshot *snapshot);
+
+/* Saves a whole snapshot in one go. A save that was already in
+ * progress is abandoned. */
+bool
+vsx_snapshot_save (VsxSnapshot *snapshot,
+                   VsxConversationSet *conversation_set,
+                   VsxPersonSet *person_set,
+                   struct vsx_error **error);
+
+void
+vsx_snapshot_free (VsxSnapshot *snapshot);
+
+/* Appends the same records that a snapshot would contain to a buffer
+ * instead of a file. This is used to pass the games on to a new
+ * process during an upgrade. */
+void
+vsx_snapshot_encode (VsxConversationSet *conversation_set,
+                     VsxPersonSet *person_set,
+                     struct vsx_buffer *buffer);
+
+/* Adds the records from vsx_snapshot_encode to the sets */
+void
+vsx_snapshot_decode (const uint8_t *data,
+                     size_t length,
+                     VsxConversationSet *conversation_set,
+                     VsxPersonSet *person_set,
+                     VsxSnapshotRestoreStats *stats);
+
+#endif /* VSX_SNAPSHOT_H */
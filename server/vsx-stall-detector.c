@@ -0,0 +1,240 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Needed for dladdr */
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include "vsx-stall-detector.h"
+
+#include <dlfcn.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+static const char *const
+type_names[VSX_STALL_DETECTOR_N_TYPES] = {
+  [VSX_STALL_DETECTOR_POLL] = "poll",
+  [VSX_STALL_DETECTOR_TIMER] = "timer",
+  [VSX_STALL_DETECTOR_QUIT] = "quit",
+  [VSX_STALL_DETECTOR_UPGRADE] = "upgrade",
+  [VSX_STALL_DETECTOR_FLUSH] = "flush",
+};
+
+static void
+reset_period (VsxStallDetector *detector)
+{
+  memset (detector->totals, 0, sizeof detector->totals);
+  detector->n_offenders = 0;
+  detector->n_untracked = 0;
+  detector->n_slow_iterations = 0;
+  detector->max_iteration_time = 0;
+}
+
+void
+vsx_stall_detector_init (VsxStallDetector *detector,
+                         int64_t threshold,
+                         int64_t report_interval,
+                         int64_t now)
+{
+  detector->threshold = threshold;
+  detector->report_interval = report_interval;
+  detector->next_report_time = now + report_interval;
+
+  reset_period (detector);
+}
+
+void
+vsx_stall_detector_add_offender (VsxStallDetector *detector,
+                                 VsxStallDetectorType type,
+                                 const void *callback,
+                                 int64_t duration)
+{
+  VsxStallDetectorOffender *offender;
+  int i;
+
+  for (i = 0; i < detector->n_offenders; i++)
+    {
+      offender = detector->offenders + i;
+
+      if (offender->callback == callback && offender->type == type)
+        goto found;
+    }
+
+  if (detector->n_offenders >= VSX_STALL_DETECTOR_MAX_OFFENDERS)
+    {
+      detector->n_untracked++;
+      return;
+    }
+
+  offender = detector->offenders + detector->n_offenders++;
+  offender->callback = callback;
+  offender->type = type;
+  offender->count = 0;
+  offender->total_time = 0;
+  offender->max_time = 0;
+
+ found:
+  offender->count++;
+  offender->total_time += duration;
+  if (duration > offender->max_time)
+    offender->max_time = duration;
+}
+
+static int
+compare_offenders (const void *pa,
+                   const void *pb)
+{
+  const VsxStallDetectorOffender *a = pa, *b = pb;
+
+  if (a->max_time > b->max_time)
+    return -1;
+  if (a->max_time < b->max_time)
+    return 1;
+  return 0;
+}
+
+static void
+append_callback_name (struct vsx_buffer *buffer,
+                      const void *callback)
+{
+  Dl_info info;
+
+  if (dladdr (callback, &info) == 0 || info.dli_fname == NULL)
+    {
+      vsx_buffer_append_printf (buffer, "%p", callback);
+      return;
+    }
+
+  /* dladdr gives the nearest exported symbol, which is the wrong one
+   * for a static function, so the name is only used if it is an
+   * exact match */
+  if (info.dli_sname && info.dli_saddr == callback)
+    {
+      vsx_buffer_append_string (buffer, info.dli_sname);
+      return;
+    }
+
+  const char *file_name = strrchr (info.dli_fname, '/');
+
+  file_name = file_name ? file_name + 1 : info.dli_fname;
+
+  vsx_buffer_append_printf (buffer,
+                            "%s+0x%" PRIxPTR,
+                            file_name,
+                            (uintptr_t) callback - (uintptr_t) info.dli_fbase);
+}
+
+static void
+append_time (struct vsx_buffer *buffer,
+             int64_t time)
+{
+  vsx_buffer_append_printf (buffer, "%.1fms", time / 1000.0);
+}
+
+bool
+vsx_stall_detector_take_report (VsxStallDetector *detector,
+                                int64_t now,
+                                struct vsx_buffer *buffer)
+{
+  bool has_report = false;
+
+  int64_t period = (now
+                    - detector->next_report_time
+                    + detector->report_interval);
+
+  detector->next_report_time = now + detector->report_interval;
+
+  int n_slow_callbacks = detector->n_offenders + detector->n_untracked;
+
+  if (n_slow_callbacks == 0 && detector->n_slow_iterations == 0)
+    goto done;
+
+  has_report = true;
+
+  vsx_buffer_append_printf (buffer,
+                            "Stalls over %.1fms in the last %" PRIi64 "s:",
+                            detector->threshold / 1000.0,
+                            period / 1000000);
+
+  qsort (detector->offenders,
+         detector->n_offenders,
+         sizeof detector->offenders[0],
+         compare_offenders);
+
+  for (int i = 0;
+       i < detector->n_offenders && i < VSX_STALL_DETECTOR_N_REPORTED;
+       i++)
+    {
+      const VsxStallDetectorOffender *offender = detector->offenders + i;
+
+      vsx_buffer_append_printf (buffer,
+                                "\n  %s callback ",
+                                type_names[offender->type]);
+      append_callback_name (buffer, offender->callback);
+      vsx_buffer_append_printf (buffer, ": %u× max ", offender->count);
+      append_time (buffer, offender->max_time);
+      vsx_buffer_append_string (buffer, " avg ");
+      append_time (buffer, offender->total_time / offender->count);
+    }
+
+  unsigned n_unreported = detector->n_untracked;
+
+  for (int i = VSX_STALL_DETECTOR_N_REPORTED; i < detector->n_offenders; i++)
+    n_unreported += detector->offenders[i].count;
+
+  if (n_unreported > 0)
+    {
+      vsx_buffer_append_printf (buffer,
+                                "\n  %u other slow callbacks",
+                                n_unreported);
+    }
+
+  if (detector->n_slow_iterations > 0)
+    {
+      vsx_buffer_append_printf (buffer,
+                                "\n  %u slow iterations, max ",
+                                detector->n_slow_iterations);
+      append_time (buffer, detector->max_iteration_time);
+    }
+
+  vsx_buffer_append_string (buffer, "\n  callback time by type:");
+
+  for (int i = 0; i < VSX_STALL_DETECTOR_N_TYPES; i++)
+    {
+      const VsxStallDetectorTotal *total = detector->totals + i;
+
+      if (total->count == 0)
+        continue;
+
+      vsx_buffer_append_printf (buffer,
+                                " %s %" PRIu64 "× ",
+                                type_names[i],
+                                total->count);
+      append_time (buffer, total->total_time);
+      vsx_buffer_append_string (buffer, " (max ");
+      append_time (buffer, total->max_time);
+      vsx_buffer_append_string (buffer, ")");
+    }
+
+ done:
+  reset_period (detector);
+
+  return has_report;
+}
@@ -0,0 +1,151 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_STALL_DETECTOR_H
+#define VSX_STALL_DETECTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vsx-buffer.h"
+
+/* Keeps track of how long the callbacks of a main context take so
+ * that the ones which hold up the loop can be found. Every callback
+ * is added to a total for its source type and any callback that takes
+ * longer than the threshold is also recorded against the address of
+ * its function. The worst ones are reported periodically. All of the
+ * times are in microseconds.
+ */
+
+typedef enum
+{
+  VSX_STALL_DETECTOR_POLL,
+  VSX_STALL_DETECTOR_TIMER,
+  VSX_STALL_DETECTOR_QUIT,
+  VSX_STALL_DETECTOR_UPGRADE,
+  VSX_STALL_DETECTOR_FLUSH,
+  VSX_STALL_DETECTOR_N_TYPES
+} VsxStallDetectorType;
+
+/* Number of different slow callbacks that are remembered in each
+ * period. Any others are only counted. */
+#define VSX_STALL_DETECTOR_MAX_OFFENDERS 16
+/* Number of slow callbacks that are listed in a report */
+#define VSX_STALL_DETECTOR_N_REPORTED 5
+
+typedef struct
+{
+  const void *callback;
+  VsxStallDetectorType type;
+  unsigned count;
+  int64_t total_time;
+  int64_t max_time;
+} VsxStallDetectorOffender;
+
+typedef struct
+{
+  uint64_t count;
+  int64_t total_time;
+  int64_t max_time;
+} VsxStallDetectorTotal;
+
+typedef struct
+{
+  int64_t threshold;
+  int64_t report_interval;
+  int64_t next_report_time;
+
+  VsxStallDetectorTotal totals[VSX_STALL_DETECTOR_N_TYPES];
+
+  int n_offenders;
+  VsxStallDetectorOffender offenders[VSX_STALL_DETECTOR_MAX_OFFENDERS];
+  /* Slow callbacks that didn’t fit in the array */
+  unsigned n_untracked;
+
+  /* Iterations of the loop that took longer than the threshold
+   * altogether */
+  unsigned n_slow_iterations;
+  int64_t max_iteration_time;
+} VsxStallDetector;
+
+void
+vsx_stall_detector_init (VsxStallDetector *detector,
+                         int64_t threshold,
+                         int64_t report_interval,
+                         int64_t now);
+
+void
+vsx_stall_detector_add_offender (VsxStallDetector *detector,
+                                 VsxStallDetectorType type,
+                                 const void *callback,
+                                 int64_t duration);
+
+/* Returns true if the callback was slow */
+static inline bool
+vsx_stall_detector_record_callback (VsxStallDetector *detector,
+                                    VsxStallDetectorType type,
+                                    const void *callback,
+                                    int64_t duration)
+{
+  VsxStallDetectorTotal *total = detector->totals + type;
+
+  total->count++;
+  total->total_time += duration;
+  if (duration > total->max_time)
+    total->max_time = duration;
+
+  if (duration <= detector->threshold)
+    return false;
+
+  vsx_stall_detector_add_offender (detector, type, callback, duration);
+
+  return true;
+}
+
+static inline void
+vsx_stall_detector_record_iteration (VsxStallDetector *detector,
+                                     int64_t duration)
+{
+  if (duration <= detector->threshold)
+    return;
+
+  detector->n_slow_iterations++;
+  if (duration > detector->max_iteration_time)
+    detector->max_iteration_time = duration;
+}
+
+static inline bool
+vsx_stall_detector_is_report_due (const VsxStallDetector *detector,
+                                  int64_t now)
+{
+  return now >= detector->next_report_time;
+}
+
+/* Appends a summary of the period since the last report to the
+ * buffer, with the slowest callbacks first, and starts a new period.
+ * The summary is made of lines separated by “\n” without a final
+ * newline. Nothing is appended and false is returned if nothing was
+ * slow. Callbacks are named with their symbol if it is exported or
+ * otherwise with the file and offset so that they can be found with
+ * addr2line. */
+bool
+vsx_stall_detector_take_report (VsxStallDetector *detector,
+                                int64_t now,
+                                struct vsx_buffer *buffer);
+
+#endif /* VSX_STALL_DETECTOR_H */
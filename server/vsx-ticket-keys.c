@@ -0,0 +1,274 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vsx-ticket-keys.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+#include "vsx-util.h"
+
+#define VSX_TICKET_KEYS_NAME_SIZE 16
+#define VSX_TICKET_KEYS_AES_KEY_SIZE 32
+#define VSX_TICKET_KEYS_HMAC_KEY_SIZE 32
+
+typedef struct
+{
+  uint8_t name[VSX_TICKET_KEYS_NAME_SIZE];
+  uint8_t aes_key[VSX_TICKET_KEYS_AES_KEY_SIZE];
+  uint8_t hmac_key[VSX_TICKET_KEYS_HMAC_KEY_SIZE];
+  /* Monotonic time in seconds when the key was made */
+  int64_t created;
+  bool valid;
+} VsxTicketKey;
+
+struct _VsxTicketKeys
+{
+  pthread_mutex_t mutex;
+  int lifetime;
+  VsxTicketKey current, previous;
+};
+
+_Static_assert (VSX_TICKET_KEYS_NAME_SIZE == 16,
+                "OpenSSL expects the ticket key name to be 16 bytes");
+
+static int64_t
+get_monotonic_seconds (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec;
+}
+
+static bool
+generate_key (VsxTicketKey *key)
+{
+  if (RAND_bytes (key->name, sizeof key->name) <= 0
+      || RAND_bytes (key->aes_key, sizeof key->aes_key) <= 0
+      || RAND_bytes (key->hmac_key, sizeof key->hmac_key) <= 0)
+    return false;
+
+  key->created = get_monotonic_seconds ();
+  key->valid = true;
+
+  return true;
+}
+
+VsxTicketKeys *
+vsx_ticket_keys_new (int lifetime_seconds)
+{
+  VsxTicketKeys *keys = vsx_calloc (sizeof *keys);
+
+  pthread_mutex_init (&keys->mutex, NULL /* attr */);
+  keys->lifetime = lifetime_seconds;
+
+  return keys;
+}
+
+/* Copies the key to use for a new ticket, replacing it first if it
+ * has expired */
+static bool
+get_current_key (VsxTicketKeys *keys,
+                 VsxTicketKey *key_out)
+{
+  bool ret = true;
+
+  pthread_mutex_lock (&keys->mutex);
+
+  if (!keys->current.valid
+      || get_monotonic_seconds () - keys->current.created >= keys->lifetime)
+    {
+      VsxTicketKey new_key;
+
+      if (generate_key (&new_key))
+        {
+          keys->previous = keys->current;
+          keys->current = new_key;
+        }
+      else if (!keys->current.valid)
+        {
+          ret = false;
+        }
+    }
+
+  if (ret)
+    *key_out = keys->current;
+
+  pthread_mutex_unlock (&keys->mutex);
+
+  return ret;
+}
+
+/* Returns 1 if the key is the current one, 2 if it is the previous
+ * one and 0 if it isn’t found. This matches the return value that
+ * OpenSSL expects from the callback. */
+static int
+find_key (VsxTicketKeys *keys,
+          const uint8_t *name,
+          VsxTicketKey *key_out)
+{
+  int ret = 0;
+
+  pthread_mutex_lock (&keys->mutex);
+
+  if (keys->current.valid
+      && !memcmp (keys->current.name, name, VSX_TICKET_KEYS_NAME_SIZE))
+    {
+      *key_out = keys->current;
+      ret = 1;
+    }
+  else if (keys->previous.valid
+           && !memcmp (keys->previous.name, name, VSX_TICKET_KEYS_NAME_SIZE)
+           && (get_monotonic_seconds () - keys->previous.created
+               < keys->lifetime * 2))
+    {
+      *key_out = keys->previous;
+      ret = 2;
+    }
+
+  pthread_mutex_unlock (&keys->mutex);
+
+  return ret;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+typedef EVP_MAC_CTX VsxTicketKeysMacCtx;
+
+static bool
+init_mac (VsxTicketKeysMacCtx *mac_ctx,
+          VsxTicketKey *key)
+{
+  OSSL_PARAM params[] =
+    {
+      OSSL_PARAM_construct_octet_string (OSSL_MAC_PARAM_KEY,
+                                         key->hmac_key,
+                                         sizeof key->hmac_key),
+      OSSL_PARAM_construct_utf8_string (OSSL_MAC_PARAM_DIGEST,
+                                        (char *) "sha256",
+                                        0),
+      OSSL_PARAM_construct_end (),
+    };
+
+  return EVP_MAC_CTX_set_params (mac_ctx, params);
+}
+
+#else /* OPENSSL_VERSION_NUMBER */
+
+typedef HMAC_CTX VsxTicketKeysMacCtx;
+
+static bool
+init_mac (VsxTicketKeysMacCtx *mac_ctx,
+          VsxTicketKey *key)
+{
+  return HMAC_Init_ex (mac_ctx,
+                       key->hmac_key,
+                       sizeof key->hmac_key,
+                       EVP_sha256 (),
+                       NULL);
+}
+
+#endif /* OPENSSL_VERSION_NUMBER */
+
+static int
+ticket_key_cb (SSL *ssl,
+               unsigned char *key_name,
+               unsigned char *iv,
+               EVP_CIPHER_CTX *cipher_ctx,
+               VsxTicketKeysMacCtx *mac_ctx,
+               int enc)
+{
+  VsxTicketKeys *keys = SSL_CTX_get_app_data (SSL_get_SSL_CTX (ssl));
+  VsxTicketKey key;
+  int ret;
+
+  if (enc)
+    {
+      if (!get_current_key (keys, &key))
+        return -1;
+
+      memcpy (key_name, key.name, sizeof key.name);
+
+      if (RAND_bytes (iv, EVP_CIPHER_iv_length (EVP_aes_256_cbc ())) <= 0
+          || !EVP_EncryptInit_ex (cipher_ctx,
+                                  EVP_aes_256_cbc (),
+                                  NULL, /* engine */
+                                  key.aes_key,
+                                  iv))
+        ret = -1;
+      else
+        ret = 1;
+    }
+  else
+    {
+      ret = find_key (keys, key_name, &key);
+
+      /* An unknown key just means the client will get a full
+       * handshake */
+      if (ret == 0)
+        return 0;
+
+      if (!EVP_DecryptInit_ex (cipher_ctx,
+                               EVP_aes_256_cbc (),
+                               NULL, /* engine */
+                               key.aes_key,
+                               iv))
+        ret = -1;
+    }
+
+  if (ret > 0 && !init_mac (mac_ctx, &key))
+    ret = -1;
+
+  OPENSSL_cleanse (&key, sizeof key);
+
+  return ret;
+}
+
+void
+vsx_ticket_keys_install (VsxTicketKeys *keys,
+                         SSL_CTX *ctx)
+{
+  SSL_CTX_set_app_data (ctx, keys);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  SSL_CTX_set_tlsext_ticket_key_evp_cb (ctx, ticket_key_cb);
+#else
+  SSL_CTX_set_tlsext_ticket_key_cb (ctx, ticket_key_cb);
+#endif
+}
+
+void
+vsx_ticket_keys_free (VsxTicketKeys *keys)
+{
+  pthread_mutex_destroy (&keys->mutex);
+  OPENSSL_cleanse (keys, sizeof *keys);
+  vsx_free (keys);
+}
@@ -0,0 +1,47 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_TICKET_KEYS_H
+#define VSX_TICKET_KEYS_H
+
+#include <openssl/ssl.h>
+
+/* Keys for encrypting stateless TLS session tickets. The keys are
+ * generated randomly in memory and a new one is made whenever the
+ * current one is older than the lifetime. Tickets made with the
+ * previous key are still accepted, and the client is given a new
+ * ticket, so a ticket stays usable for at least one lifetime after
+ * it was issued. The keys are used from every shard’s thread so
+ * access to them is protected by a mutex.
+ */
+
+typedef struct _VsxTicketKeys VsxTicketKeys;
+
+VsxTicketKeys *
+vsx_ticket_keys_new (int lifetime_seconds);
+
+/* Makes the context use the keys for its session tickets. The keys
+ * must outlive the context. */
+void
+vsx_ticket_keys_install (VsxTicketKeys *keys,
+                         SSL_CTX *ctx);
+
+void
+vsx_ticket_keys_free (VsxTicketKeys *keys);
+
+#endif /* VSX_TICKET_KEYS_H */
@@ -0,0 +1,199 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vsx-timer-wheel.h"
+
+#include <assert.h>
+
+void
+vsx_timer_wheel_init (VsxTimerWheel *wheel,
+                      int64_t now)
+{
+  wheel->now = now;
+
+  for (int level = 0; level < VSX_TIMER_WHEEL_LEVELS; level++)
+    {
+      for (int slot = 0; slot < VSX_TIMER_WHEEL_SLOTS; slot++)
+        vsx_list_init (&wheel->slots[level][slot]);
+
+      wheel->occupied[level] = 0;
+    }
+
+  vsx_list_init (&wheel->expired);
+}
+
+static int
+get_slot (int64_t expires,
+          int level)
+{
+  return (((uint64_t) expires >> (level * VSX_TIMER_WHEEL_BITS_PER_LEVEL))
+          & (VSX_TIMER_WHEEL_SLOTS - 1));
+}
+
+static void
+insert_entry (VsxTimerWheel *wheel,
+              VsxTimerWheelEntry *entry)
+{
+  if (entry->expires <= wheel->now)
+    {
+      entry->level = VSX_TIMER_WHEEL_LEVEL_EXPIRED;
+      /* Add to the end so that the entries expire in order */
+      vsx_list_insert (wheel->expired.prev, &entry->link);
+      return;
+    }
+
+  uint64_t diff = (uint64_t) entry->expires ^ (uint64_t) wheel->now;
+  int high_bit = 63 - __builtin_clzll (diff);
+  int level = high_bit / VSX_TIMER_WHEEL_BITS_PER_LEVEL;
+  int slot = get_slot (entry->expires, level);
+
+  entry->level = level;
+  vsx_list_insert (wheel->slots[level][slot].prev, &entry->link);
+  wheel->occupied[level] |= UINT64_C (1) << slot;
+}
+
+void
+vsx_timer_wheel_add (VsxTimerWheel *wheel,
+                     VsxTimerWheelEntry *entry,
+                     int64_t expires)
+{
+  if (vsx_timer_wheel_entry_is_scheduled (entry))
+    vsx_timer_wheel_remove (wheel, entry);
+
+  entry->expires = expires;
+
+  insert_entry (wheel, entry);
+}
+
+void
+vsx_timer_wheel_remove (VsxTimerWheel *wheel,
+                        VsxTimerWheelEntry *entry)
+{
+  assert (vsx_timer_wheel_entry_is_scheduled (entry));
+
+  vsx_list_remove (&entry->link);
+
+  if (entry->level != VSX_TIMER_WHEEL_LEVEL_EXPIRED)
+    {
+      int slot = get_slot (entry->expires, entry->level);
+
+      if (vsx_list_empty (&wheel->slots[entry->level][slot]))
+        wheel->occupied[entry->level] &= ~(UINT64_C (1) << slot);
+    }
+
+  entry->level = VSX_TIMER_WHEEL_LEVEL_NONE;
+}
+
+static bool
+get_next_slot (VsxTimerWheel *wheel,
+               int *level_out,
+               int64_t *time_out)
+{
+  /* Every entry in a level shares the digits of the current time
+   * above that level and has a higher digit in that level. That
+   * means the entries in lower levels always expire first and the
+   * lowest occupied slot in a level is the next one to be reached.
+   */
+  for (int level = 0; level < VSX_TIMER_WHEEL_LEVELS; level++)
+    {
+      if (wheel->occupied[level] == 0)
+        continue;
+
+      int slot = __builtin_ctzll (wheel->occupied[level]);
+      int shift = level * VSX_TIMER_WHEEL_BITS_PER_LEVEL;
+      int top_shift = shift + VSX_TIMER_WHEEL_BITS_PER_LEVEL;
+      uint64_t high_mask = top_shift >= 64 ? 0 : ~UINT64_C (0) << top_shift;
+
+      *level_out = level;
+      *time_out = (((uint64_t) wheel->now & high_mask)
+                   | ((uint64_t) slot << shift));
+
+      return true;
+    }
+
+  return false;
+}
+
+int64_t
+vsx_timer_wheel_get_next_time (VsxTimerWheel *wheel)
+{
+  if (!vsx_list_empty (&wheel->expired))
+    return wheel->now;
+
+  int level;
+  int64_t time;
+
+  if (get_next_slot (wheel, &level, &time))
+    return time;
+  else
+    return INT64_MAX;
+}
+
+static void
+cascade_slot (VsxTimerWheel *wheel,
+              int level)
+{
+  int slot = get_slot (wheel->now, level);
+  struct vsx_list entries;
+
+  vsx_list_init (&entries);
+  vsx_list_insert_list (&entries, &wheel->slots[level][slot]);
+  vsx_list_init (&wheel->slots[level][slot]);
+  wheel->occupied[level] &= ~(UINT64_C (1) << slot);
+
+  VsxTimerWheelEntry *entry, *tmp;
+
+  vsx_list_for_each_safe (entry, tmp, &entries, link)
+    {
+      /* This will either put it in the expired list or in a lower
+       * level */
+      insert_entry (wheel, entry);
+    }
+}
+
+VsxTimerWheelEntry *
+vsx_timer_wheel_pop_expired (VsxTimerWheel *wheel,
+                             int64_t now)
+{
+  while (vsx_list_empty (&wheel->expired))
+    {
+      int level;
+      int64_t next_time;
+
+      if (!get_next_slot (wheel, &level, &next_time) || next_time > now)
+        {
+          if (now > wheel->now)
+            wheel->now = now;
+          return NULL;
+        }
+
+      wheel->now = next_time;
+
+      cascade_slot (wheel, level);
+    }
+
+  VsxTimerWheelEntry *entry =
+    vsx_container_of (wheel->expired.next, VsxTimerWheelEntry, link);
+
+  vsx_list_remove (&entry->link);
+  entry->level = VSX_TIMER_WHEEL_LEVEL_NONE;
+
+  return entry;
+}
@@ -0,0 +1,113 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_TIMER_WHEEL_H
+#define VSX_TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vsx-list.h"
+
+/* A hierarchical timing wheel. Times are in arbitrary integer ticks
+ * (the main context uses milliseconds). Each level has 64 slots and
+ * an entry is stored in the level of the highest 6-bit digit where
+ * its expiry time differs from the current time. When the wheel
+ * reaches a slot in one of the higher levels, the entries in it are
+ * moved down to a lower level. Adding and removing entries is O(1)
+ * and finding the next expiry time only needs to look at a bitmask
+ * per level.
+ */
+
+#define VSX_TIMER_WHEEL_BITS_PER_LEVEL 6
+#define VSX_TIMER_WHEEL_SLOTS (1 << VSX_TIMER_WHEEL_BITS_PER_LEVEL)
+/* Enough levels to cover every bit of a 64-bit time. An expiry time
+ * that is only slightly in the future can still differ from the
+ * current time in a high digit if it crosses a boundary. */
+#define VSX_TIMER_WHEEL_LEVELS                                          \
+  ((64 + VSX_TIMER_WHEEL_BITS_PER_LEVEL - 1)                            \
+   / VSX_TIMER_WHEEL_BITS_PER_LEVEL)
+
+typedef struct
+{
+  struct vsx_list link;
+  int64_t expires;
+  /* The level that the entry is in or one of the special values
+   * below */
+  int level;
+} VsxTimerWheelEntry;
+
+#define VSX_TIMER_WHEEL_LEVEL_NONE -1
+#define VSX_TIMER_WHEEL_LEVEL_EXPIRED VSX_TIMER_WHEEL_LEVELS
+
+typedef struct
+{
+  int64_t now;
+
+  struct vsx_list slots[VSX_TIMER_WHEEL_LEVELS][VSX_TIMER_WHEEL_SLOTS];
+  uint64_t occupied[VSX_TIMER_WHEEL_LEVELS];
+
+  /* Entries whose expiry time has been reached but that haven’t
+   * been returned by vsx_timer_wheel_pop_expired yet */
+  struct vsx_list expired;
+} VsxTimerWheel;
+
+void
+vsx_timer_wheel_init (VsxTimerWheel *wheel,
+                      int64_t now);
+
+static inline void
+vsx_timer_wheel_entry_init (VsxTimerWheelEntry *entry)
+{
+  entry->level = VSX_TIMER_WHEEL_LEVEL_NONE;
+}
+
+static inline bool
+vsx_timer_wheel_entry_is_scheduled (const VsxTimerWheelEntry *entry)
+{
+  return entry->level != VSX_TIMER_WHEEL_LEVEL_NONE;
+}
+
+/* Schedules the entry to expire at the given time. If it is already
+ * scheduled then it is moved. A time that has already passed will
+ * make it expire the next time the wheel is advanced. */
+void
+vsx_timer_wheel_add (VsxTimerWheel *wheel,
+                     VsxTimerWheelEntry *entry,
+                     int64_t expires);
+
+void
+vsx_timer_wheel_remove (VsxTimerWheel *wheel,
+                        VsxTimerWheelEntry *entry);
+
+/* Returns the time when the wheel next needs to be advanced or
+ * INT64_MAX if there are no entries. This might be earlier than the
+ * next expiry time if a higher level needs to be moved down first. */
+int64_t
+vsx_timer_wheel_get_next_time (VsxTimerWheel *wheel);
+
+/* Moves the wheel forward to the given time and removes and returns
+ * one of the entries that have expired, or NULL if there are none.
+ * This should be called repeatedly until it returns NULL. The
+ * entries can be added again or any other entry can be removed in
+ * between calls. */
+VsxTimerWheelEntry *
+vsx_timer_wheel_pop_expired (VsxTimerWheel *wheel,
+                             int64_t now);
+
+#endif /* VSX_TIMER_WHEEL_H */
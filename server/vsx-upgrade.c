@@ -0,0 +1,660 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vsx-upgrade.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "vsx-serial.h"
+#include "vsx-file-error.h"
+#include "vsx-util.h"
+
+/* Maximum number of bytes of data in each 'D' packet */
+#define VSX_UPGRADE_MAX_DATA_CHUNK (64 * 1024)
+/* Maximum number of file descriptors in each 'F' packet. The kernel
+ * won’t pass more than 253 in one message. */
+#define VSX_UPGRADE_MAX_FD_CHUNK 250
+
+#define VSX_UPGRADE_MAX_PACKET_SIZE (1 + VSX_UPGRADE_MAX_DATA_CHUNK)
+
+#define VSX_UPGRADE_SOCKETS_SIZE (1 + VSX_UPGRADE_MAGIC_LENGTH + 4)
+#define VSX_UPGRADE_READY_SIZE (1 + VSX_UPGRADE_MAGIC_LENGTH + 4)
+#define VSX_UPGRADE_HEADER_SIZE (1 + VSX_UPGRADE_MAGIC_LENGTH + 4 + 8)
+#define VSX_UPGRADE_ACK_SIZE (1 + VSX_UPGRADE_MAGIC_LENGTH)
+
+extern char **environ;
+
+struct vsx_error_domain
+vsx_upgrade_error;
+
+void
+vsx_upgrade_state_init (VsxUpgradeState *state)
+{
+  vsx_buffer_init (&state->fds);
+  vsx_buffer_init (&state->data);
+}
+
+void
+vsx_upgrade_state_add_fd (VsxUpgradeState *state,
+                          int fd)
+{
+  vsx_buffer_append (&state->fds, &fd, sizeof fd);
+}
+
+void
+vsx_upgrade_state_destroy (VsxUpgradeState *state)
+{
+  int n_fds = vsx_upgrade_state_get_n_fds (state);
+  int *fds = vsx_upgrade_state_get_fds (state);
+
+  for (int i = 0; i < n_fds; i++)
+    {
+      if (fds[i] != -1)
+        vsx_close (fds[i]);
+    }
+
+  vsx_buffer_destroy (&state->fds);
+  vsx_buffer_destroy (&state->data);
+}
+
+static void
+set_protocol_error (struct vsx_error **error,
+                    const char *message)
+{
+  vsx_set_error (error,
+                 &vsx_upgrade_error,
+                 VSX_UPGRADE_ERROR_PROTOCOL,
+                 "%s",
+                 message);
+}
+
+static bool
+is_packet (const struct vsx_buffer *packet,
+           uint8_t type,
+           size_t size)
+{
+  return (packet->length == size
+          && packet->data[0] == type
+          && !memcmp (packet->data + 1,
+                      VSX_UPGRADE_MAGIC,
+                      VSX_UPGRADE_MAGIC_LENGTH));
+}
+
+static void
+write_packet_start (struct vsx_buffer *packet,
+                    uint8_t type)
+{
+  vsx_serial_write_u8 (packet, type);
+  vsx_buffer_append (packet, VSX_UPGRADE_MAGIC, VSX_UPGRADE_MAGIC_LENGTH);
+}
+
+static bool
+send_packet (int sock,
+             const uint8_t *packet,
+             size_t length,
+             const int *fds,
+             int n_fds,
+             struct vsx_error **error)
+{
+  struct iovec iov = {
+    .iov_base = (void *) packet,
+    .iov_len = length,
+  };
+  union
+  {
+    struct cmsghdr align;
+    uint8_t buf[CMSG_SPACE (VSX_UPGRADE_MAX_FD_CHUNK * sizeof (int))];
+  } control;
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+  };
+
+  if (n_fds > 0)
+    {
+      memset (&control, 0, sizeof control);
+      msg.msg_control = control.buf;
+      msg.msg_controllen = CMSG_SPACE (n_fds * sizeof (int));
+
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN (n_fds * sizeof (int));
+      memcpy (CMSG_DATA (cmsg), fds, n_fds * sizeof (int));
+    }
+
+  ssize_t wrote;
+
+  do
+    wrote = sendmsg (sock, &msg, MSG_NOSIGNAL);
+  while (wrote == -1 && errno == EINTR);
+
+  if (wrote == -1)
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "Error sending upgrade packet: %s",
+                          strerror (errno));
+      return false;
+    }
+
+  return true;
+}
+
+/* Receives one packet into the buffer. Any file descriptors that
+ * come with it are added to the state. */
+static bool
+receive_packet (int sock,
+                struct vsx_buffer *packet,
+                VsxUpgradeState *state,
+                struct vsx_error **error)
+{
+  union
+  {
+    struct cmsghdr align;
+    uint8_t buf[CMSG_SPACE (VSX_UPGRADE_MAX_FD_CHUNK * sizeof (int))];
+  } control;
+
+  vsx_buffer_ensure_size (packet, VSX_UPGRADE_MAX_PACKET_SIZE);
+
+  struct iovec iov = {
+    .iov_base = packet->data,
+    .iov_len = VSX_UPGRADE_MAX_PACKET_SIZE,
+  };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof control.buf,
+  };
+
+  ssize_t got;
+
+  do
+    got = recvmsg (sock, &msg, MSG_CMSG_CLOEXEC);
+  while (got == -1 && errno == EINTR);
+
+  if (got == -1)
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "Error receiving upgrade packet: %s",
+                          strerror (errno));
+      return false;
+    }
+
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+       cmsg;
+       cmsg = CMSG_NXTHDR (&msg, cmsg))
+    {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        continue;
+
+      int n_fds = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+      const uint8_t *data = CMSG_DATA (cmsg);
+
+      for (int i = 0; i < n_fds; i++)
+        {
+          int fd;
+
+          memcpy (&fd, data + i * sizeof fd, sizeof fd);
+          vsx_upgrade_state_add_fd (state, fd);
+        }
+    }
+
+  if (got == 0)
+    {
+      set_protocol_error (error, "The other process closed the socket");
+      return false;
+    }
+
+  if ((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+    {
+      set_protocol_error (error, "Upgrade packet was truncated");
+      return false;
+    }
+
+  packet->length = got;
+
+  return true;
+}
+
+/* Makes a copy of the environment with the variable for the socket
+ * added. The strings are shared with environ apart from the new
+ * variable which is stored in the buffer. */
+static char **
+make_environment (int fd,
+                  struct vsx_buffer *fd_variable)
+{
+  static const char prefix[] = VSX_UPGRADE_FD_VARIABLE "=";
+  int n_vars = 0;
+
+  while (environ[n_vars])
+    n_vars++;
+
+  char **envp = vsx_alloc ((n_vars + 2) * sizeof *envp);
+  int n_copied = 0;
+
+  for (int i = 0; i < n_vars; i++)
+    {
+      if (strncmp (environ[i], prefix, sizeof prefix - 1))
+        envp[n_copied++] = environ[i];
+    }
+
+  vsx_buffer_append_printf (fd_variable, "%s%i", prefix, fd);
+
+  envp[n_copied++] = (char *) fd_variable->data;
+  envp[n_copied] = NULL;
+
+  return envp;
+}
+
+bool
+vsx_upgrade_spawn (char *const *argv,
+                   int *sock_out,
+                   pid_t *pid_out,
+                   struct vsx_error **error)
+{
+  int socks[2];
+
+  if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, socks) == -1)
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "Error creating upgrade socket: %s",
+                          strerror (errno));
+      return false;
+    }
+
+  /* The environment has to be built before forking because the
+   * other threads might be holding the malloc lock */
+  struct vsx_buffer fd_variable = VSX_BUFFER_STATIC_INIT;
+  char **envp = make_environment (socks[1], &fd_variable);
+
+  pid_t pid = fork ();
+
+  if (pid == 0)
+    {
+      /* Only async-signal-safe functions can be used here */
+      int flags = fcntl (socks[1], F_GETFD);
+
+      if (flags == -1
+          || fcntl (socks[1], F_SETFD, flags & ~FD_CLOEXEC) == -1)
+        _exit (EXIT_FAILURE);
+
+      execve (argv[0], argv, envp);
+
+      _exit (EXIT_FAILURE);
+    }
+
+  int fork_errno = errno;
+
+  vsx_free (envp);
+  vsx_buffer_destroy (&fd_variable);
+  vsx_close (socks[1]);
+
+  if (pid == -1)
+    {
+      vsx_close (socks[0]);
+      vsx_file_error_set (error,
+                          fork_errno,
+                          "fork failed: %s",
+                          strerror (fork_errno));
+      return false;
+    }
+
+  *sock_out = socks[0];
+  *pid_out = pid;
+
+  return true;
+}
+
+bool
+vsx_upgrade_send_sockets (int sock,
+                          const int *fds,
+                          int n_fds,
+                          struct vsx_error **error)
+{
+  if (n_fds > VSX_UPGRADE_MAX_FD_CHUNK)
+    {
+      set_protocol_error (error, "Too many listening sockets to send");
+      return false;
+    }
+
+  struct vsx_buffer packet = VSX_BUFFER_STATIC_INIT;
+
+  write_packet_start (&packet, 'L');
+  vsx_serial_write_u32 (&packet, n_fds);
+
+  bool ret = send_packet (sock, packet.data, packet.length, fds, n_fds, error);
+
+  vsx_buffer_destroy (&packet);
+
+  return ret;
+}
+
+bool
+vsx_upgrade_receive_ready (int sock,
+                           int *n_shards_out,
+                           struct vsx_error **error)
+{
+  struct vsx_buffer packet = VSX_BUFFER_STATIC_INIT;
+  VsxUpgradeState fds;
+  bool ret = true;
+
+  /* Nothing should be sent with the packet but anything that is will
+   * be closed */
+  vsx_upgrade_state_init (&fds);
+
+  if (!receive_packet (sock, &packet, &fds, error))
+    {
+      ret = false;
+    }
+  else if (!is_packet (&packet, 'R', VSX_UPGRADE_READY_SIZE))
+    {
+      set_protocol_error (error, "Invalid READY packet received");
+      ret = false;
+    }
+  else
+    {
+      *n_shards_out =
+        vsx_proto_read_uint32_t (packet.data + 1 + VSX_UPGRADE_MAGIC_LENGTH);
+    }
+
+  vsx_upgrade_state_destroy (&fds);
+  vsx_buffer_destroy (&packet);
+
+  return ret;
+}
+
+bool
+vsx_upgrade_send (int sock,
+                  const VsxUpgradeState *state,
+                  struct vsx_error **error)
+{
+  struct vsx_buffer packet = VSX_BUFFER_STATIC_INIT;
+  int n_fds = vsx_upgrade_state_get_n_fds (state);
+  const int *fds = vsx_upgrade_state_get_fds (state);
+  bool ret = false;
+
+  write_packet_start (&packet, 'H');
+  vsx_serial_write_u32 (&packet, n_fds);
+  vsx_serial_write_u64 (&packet, state->data.length);
+
+  if (!send_packet (sock, packet.data, packet.length, NULL, 0, error))
+    goto out;
+
+  for (size_t pos = 0; pos < state->data.length;)
+    {
+      size_t chunk = MIN (state->data.length - pos,
+                          VSX_UPGRADE_MAX_DATA_CHUNK);
+
+      vsx_buffer_set_length (&packet, 0);
+      vsx_serial_write_u8 (&packet, 'D');
+      vsx_buffer_append (&packet, state->data.data + pos, chunk);
+
+      if (!send_packet (sock, packet.data, packet.length, NULL, 0, error))
+        goto out;
+
+      pos += chunk;
+    }
+
+  for (int pos = 0; pos < n_fds;)
+    {
+      int chunk = MIN (n_fds - pos, VSX_UPGRADE_MAX_FD_CHUNK);
+
+      vsx_buffer_set_length (&packet, 0);
+      vsx_serial_write_u8 (&packet, 'F');
+      vsx_serial_write_u32 (&packet, chunk);
+
+      if (!send_packet (sock,
+                        packet.data,
+                        packet.length,
+                        fds + pos,
+                        chunk,
+                        error))
+        goto out;
+
+      pos += chunk;
+    }
+
+  ret = true;
+
+ out:
+  vsx_buffer_destroy (&packet);
+
+  return ret;
+}
+
+bool
+vsx_upgrade_receive_ack (int sock,
+                         int timeout,
+                         struct vsx_error **error)
+{
+  struct pollfd pfd = { .fd = sock, .events = POLLIN };
+  int ret;
+
+  do
+    ret = poll (&pfd, 1, timeout);
+  while (ret == -1 && errno == EINTR);
+
+  if (ret == -1)
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "Error waiting for the upgrade ACK: %s",
+                          strerror (errno));
+      return false;
+    }
+
+  if (ret == 0)
+    {
+      set_protocol_error (error,
+                          "The new process didn’t take over the state in "
+                          "time");
+      return false;
+    }
+
+  struct vsx_buffer packet = VSX_BUFFER_STATIC_INIT;
+  VsxUpgradeState fds;
+  bool ok = true;
+
+  vsx_upgrade_state_init (&fds);
+
+  if (!receive_packet (sock, &packet, &fds, error))
+    {
+      ok = false;
+    }
+  else if (!is_packet (&packet, 'A', VSX_UPGRADE_ACK_SIZE))
+    {
+      set_protocol_error (error, "Invalid ACK packet received");
+      ok = false;
+    }
+
+  vsx_upgrade_state_destroy (&fds);
+  vsx_buffer_destroy (&packet);
+
+  return ok;
+}
+
+int
+vsx_upgrade_get_fd (void)
+{
+  const char *value = getenv (VSX_UPGRADE_FD_VARIABLE);
+
+  if (value == NULL)
+    return -1;
+
+  char *tail;
+  errno = 0;
+  long fd = strtol (value, &tail, 10);
+
+  unsetenv (VSX_UPGRADE_FD_VARIABLE);
+
+  if (errno || *tail || fd < 0 || fd > INT_MAX)
+    return -1;
+
+  /* Don’t leak the socket into any later upgrades */
+  int flags = fcntl (fd, F_GETFD);
+
+  if (flags == -1 || fcntl (fd, F_SETFD, flags | FD_CLOEXEC) == -1)
+    return -1;
+
+  return fd;
+}
+
+bool
+vsx_upgrade_receive_sockets (int sock,
+                             VsxUpgradeState *state,
+                             struct vsx_error **error)
+{
+  struct vsx_buffer packet = VSX_BUFFER_STATIC_INIT;
+  bool ret = true;
+
+  if (!receive_packet (sock, &packet, state, error))
+    {
+      ret = false;
+    }
+  else if (!is_packet (&packet, 'L', VSX_UPGRADE_SOCKETS_SIZE)
+           || (vsx_proto_read_uint32_t (packet.data
+                                        + 1
+                                        + VSX_UPGRADE_MAGIC_LENGTH)
+               != (uint32_t) vsx_upgrade_state_get_n_fds (state)))
+    {
+      set_protocol_error (error, "Invalid listening sockets packet received");
+      ret = false;
+    }
+
+  vsx_buffer_destroy (&packet);
+
+  return ret;
+}
+
+bool
+vsx_upgrade_send_ready (int sock,
+                        int n_shards,
+                        struct vsx_error **error)
+{
+  struct vsx_buffer packet = VSX_BUFFER_STATIC_INIT;
+
+  write_packet_start (&packet, 'R');
+  vsx_serial_write_u32 (&packet, n_shards);
+
+  bool ret = send_packet (sock, packet.data, packet.length, NULL, 0, error);
+
+  vsx_buffer_destroy (&packet);
+
+  return ret;
+}
+
+bool
+vsx_upgrade_receive (int sock,
+                     VsxUpgradeState *state,
+                     struct vsx_error **error)
+{
+  struct vsx_buffer packet = VSX_BUFFER_STATIC_INIT;
+  bool ret = false;
+
+  if (!receive_packet (sock, &packet, state, error))
+    goto out;
+
+  if (!is_packet (&packet, 'H', VSX_UPGRADE_HEADER_SIZE))
+    {
+      set_protocol_error (error, "Invalid upgrade header received");
+      goto out;
+    }
+
+  VsxSerialReader reader;
+
+  vsx_serial_reader_init (&reader,
+                          packet.data + 1 + VSX_UPGRADE_MAGIC_LENGTH,
+                          packet.length - 1 - VSX_UPGRADE_MAGIC_LENGTH);
+
+  uint32_t n_fds = vsx_serial_read_u32 (&reader);
+  uint64_t data_length = vsx_serial_read_u64 (&reader);
+
+  if (data_length > SIZE_MAX)
+    {
+      set_protocol_error (error, "Invalid upgrade header received");
+      goto out;
+    }
+
+  while (state->data.length < data_length
+         || (size_t) vsx_upgrade_state_get_n_fds (state) < n_fds)
+    {
+      if (!receive_packet (sock, &packet, state, error))
+        goto out;
+
+      switch (packet.data[0])
+        {
+        case 'D':
+          if (state->data.length + packet.length - 1 > data_length)
+            {
+              set_protocol_error (error, "Too much upgrade data received");
+              goto out;
+            }
+          vsx_buffer_append (&state->data, packet.data + 1, packet.length - 1);
+          break;
+
+        case 'F':
+          if ((size_t) vsx_upgrade_state_get_n_fds (state) > n_fds)
+            {
+              set_protocol_error (error,
+                                  "Too many file descriptors received");
+              goto out;
+            }
+          break;
+
+        default:
+          set_protocol_error (error, "Unknown upgrade packet received");
+          goto out;
+        }
+    }
+
+  ret = true;
+
+ out:
+  vsx_buffer_destroy (&packet);
+
+  return ret;
+}
+
+bool
+vsx_upgrade_send_ack (int sock,
+                      struct vsx_error **error)
+{
+  struct vsx_buffer packet = VSX_BUFFER_STATIC_INIT;
+
+  write_packet_start (&packet, 'A');
+
+  bool ret = send_packet (sock, packet.data, packet.length, NULL, 0, error);
+
+  vsx_buffer_destroy (&packet);
+
+  return ret;
+}
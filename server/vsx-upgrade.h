@@ -0,0 +1,167 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_UPGRADE_H
+#define VSX_UPGRADE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "vsx-error.h"
+#include "vsx-buffer.h"
+
+/* Hands the server over to a new binary without closing any sockets.
+ * When the old process receives SIGUSR2 it starts the new binary with
+ * one end of a Unix socket pair whose file descriptor is given in the
+ * VSX_UPGRADE_FD environment variable and straight away sends it
+ * copies of the listening sockets. The old process carries on serving
+ * while the new one loads its config and sets up the server with
+ * them. Once that has worked the new process sends a READY packet.
+ * The old process then stops, serializes its state and sends it along
+ * with the client sockets using SCM_RIGHTS. When the new process has
+ * taken ownership of the state it sends an ACK and starts running.
+ * The old process only exits once it gets the ACK. If anything goes
+ * wrong before that it kills the new process and carries on with the
+ * state that it saved.
+ *
+ * The socket is a SOCK_SEQPACKET socket and every packet starts with
+ * a type byte:
+ *
+ *  'L'  Listening sockets from the old process: magic, u32 number of
+ *       sockets, attached as SCM_RIGHTS. The metrics socket, if there
+ *       is one, comes last.
+ *  'R'  READY from the new process: magic, u32 number of shards
+ *  'H'  Header from the old process: magic, u32 number of file
+ *       descriptors, u64 length of the data
+ *  'D'  A chunk of the data
+ *  'F'  A chunk of the file descriptors, attached as SCM_RIGHTS. The
+ *       payload is the number of descriptors as a u32.
+ *  'A'  ACK from the new process: magic
+ *
+ * Everything is little-endian.
+ */
+
+#define VSX_UPGRADE_MAGIC "VSXUPGR1"
+#define VSX_UPGRADE_MAGIC_LENGTH (sizeof VSX_UPGRADE_MAGIC - 1)
+
+#define VSX_UPGRADE_FD_VARIABLE "VSX_UPGRADE_FD"
+
+typedef enum
+{
+  VSX_UPGRADE_ERROR_PROTOCOL,
+} VsxUpgradeError;
+
+extern struct vsx_error_domain
+vsx_upgrade_error;
+
+typedef struct
+{
+  /* File descriptors as ints. Any that are still in here when the
+   * state is destroyed are closed, so set them to -1 to take
+   * ownership. */
+  struct vsx_buffer fds;
+
+  struct vsx_buffer data;
+} VsxUpgradeState;
+
+void
+vsx_upgrade_state_init (VsxUpgradeState *state);
+
+static inline int
+vsx_upgrade_state_get_n_fds (const VsxUpgradeState *state)
+{
+  return state->fds.length / sizeof (int);
+}
+
+static inline int *
+vsx_upgrade_state_get_fds (const VsxUpgradeState *state)
+{
+  return (int *) state->fds.data;
+}
+
+void
+vsx_upgrade_state_add_fd (VsxUpgradeState *state,
+                          int fd);
+
+void
+vsx_upgrade_state_destroy (VsxUpgradeState *state);
+
+/* Starts the new binary. argv[0] must be an absolute path. The
+ * returned socket is used to talk to it. */
+bool
+vsx_upgrade_spawn (char *const *argv,
+                   int *sock_out,
+                   pid_t *pid_out,
+                   struct vsx_error **error);
+
+/* Sends copies of the listening sockets to the new process */
+bool
+vsx_upgrade_send_sockets (int sock,
+                          const int *fds,
+                          int n_fds,
+                          struct vsx_error **error);
+
+/* Reads the READY packet from the new process and returns its number
+ * of shards */
+bool
+vsx_upgrade_receive_ready (int sock,
+                           int *n_shards_out,
+                           struct vsx_error **error);
+
+bool
+vsx_upgrade_send (int sock,
+                  const VsxUpgradeState *state,
+                  struct vsx_error **error);
+
+/* Waits up to timeout milliseconds for the new process to report that
+ * it has taken over the state */
+bool
+vsx_upgrade_receive_ack (int sock,
+                         int timeout,
+                         struct vsx_error **error);
+
+/* Returns the socket from the environment variable and removes the
+ * variable, or -1 if this process wasn’t started for an upgrade */
+int
+vsx_upgrade_get_fd (void);
+
+/* Blocks until the listening sockets have been received. They are
+ * added to the empty state. */
+bool
+vsx_upgrade_receive_sockets (int sock,
+                             VsxUpgradeState *state,
+                             struct vsx_error **error);
+
+bool
+vsx_upgrade_send_ready (int sock,
+                        int n_shards,
+                        struct vsx_error **error);
+
+/* Blocks until the whole state has been received into the empty
+ * state */
+bool
+vsx_upgrade_receive (int sock,
+                     VsxUpgradeState *state,
+                     struct vsx_error **error);
+
+bool
+vsx_upgrade_send_ack (int sock,
+                      struct vsx_error **error);
+
+#endif /* VSX_UPGRADE_H */
@@ -0,0 +1,265 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+/* This file is only compiled in if the system has the io_uring
+ * header. See meson.build. */
+#ifdef HAVE_IO_URING
+
+#include "vsx-uring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "vsx-file-error.h"
+#include "vsx-util.h"
+
+/* The ring needs at least these features. POLL_UPDATE_EVENTS arrived
+ * in the same release as RSRC_TAGS so that is used to detect it.
+ */
+#define VSX_URING_REQUIRED_FEATURES (IORING_FEAT_NODROP         \
+                                     | IORING_FEAT_EXT_ARG      \
+                                     | IORING_FEAT_RSRC_TAGS)
+
+static void *
+map_ring (int fd,
+          size_t size,
+          off_t offset,
+          struct vsx_error **error)
+{
+  void *ptr = mmap (NULL,
+                    size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE,
+                    fd,
+                    offset);
+
+  if (ptr == MAP_FAILED)
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "Error mapping io_uring: %s",
+                          strerror (errno));
+      return NULL;
+    }
+
+  return ptr;
+}
+
+bool
+vsx_uring_init (VsxUring *ring,
+                unsigned entries,
+                struct vsx_error **error)
+{
+  struct io_uring_params params;
+
+  memset (&params, 0, sizeof params);
+  memset (ring, 0, sizeof *ring);
+
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+  params.cq_entries = entries * 4;
+
+  ring->fd = syscall (__NR_io_uring_setup, entries, &params);
+
+  if (ring->fd == -1)
+    {
+      vsx_file_error_set (error,
+                          errno,
+                          "Error creating io_uring: %s",
+                          strerror (errno));
+      return false;
+    }
+
+  if ((params.features & VSX_URING_REQUIRED_FEATURES)
+      != VSX_URING_REQUIRED_FEATURES)
+    {
+      vsx_set_error (error,
+                     &vsx_file_error,
+                     VSX_FILE_ERROR_OTHER,
+                     "The kernel’s io_uring is too old");
+      goto error;
+    }
+
+  ring->sq_ring_size = (params.sq_off.array
+                        + params.sq_entries * sizeof (unsigned));
+  ring->cq_ring_size = (params.cq_off.cqes
+                        + params.cq_entries * sizeof (struct io_uring_cqe));
+  ring->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+
+  ring->sq_ring = map_ring (ring->fd,
+                            ring->sq_ring_size,
+                            IORING_OFF_SQ_RING,
+                            error);
+  if (ring->sq_ring == NULL)
+    goto error;
+
+  ring->cq_ring = map_ring (ring->fd,
+                            ring->cq_ring_size,
+                            IORING_OFF_CQ_RING,
+                            error);
+  if (ring->cq_ring == NULL)
+    goto error;
+
+  ring->sqes = map_ring (ring->fd,
+                         ring->sqes_size,
+                         IORING_OFF_SQES,
+                         error);
+  if (ring->sqes == NULL)
+    goto error;
+
+  uint8_t *sq = ring->sq_ring;
+  ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+  ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+  ring->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+  ring->sq_entries = *(unsigned *) (sq + params.sq_off.ring_entries);
+
+  uint8_t *cq = ring->cq_ring;
+  ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  /* The array indirection is never used so make it an identity
+   * mapping up front.
+   */
+  for (unsigned i = 0; i < ring->sq_entries; i++)
+    ring->sq_array[i] = i;
+
+  return true;
+
+ error:
+  vsx_uring_destroy (ring);
+  return false;
+}
+
+static int
+enter (VsxUring *ring,
+       unsigned min_complete,
+       unsigned flags,
+       void *arg,
+       size_t arg_size)
+{
+  int ret = syscall (__NR_io_uring_enter,
+                     ring->fd,
+                     ring->n_queued,
+                     min_complete,
+                     flags,
+                     arg,
+                     arg_size);
+
+  if (ret == -1)
+    return -errno;
+
+  /* The kernel consumes the whole queue unless something went wrong
+   * in which case the next call will retry the rest.
+   */
+  ring->n_queued -= ret;
+
+  return 0;
+}
+
+struct io_uring_sqe *
+vsx_uring_get_sqe (VsxUring *ring)
+{
+  while (ring->n_queued >= ring->sq_entries)
+    {
+      int ret = enter (ring, 0, 0, NULL, 0);
+
+      if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY)
+        vsx_fatal ("io_uring submission failed: %s", strerror (-ret));
+    }
+
+  unsigned tail = *ring->sq_tail;
+  struct io_uring_sqe *sqe = ring->sqes + (tail & ring->sq_mask);
+
+  memset (sqe, 0, sizeof *sqe);
+
+  /* The kernel won’t look at the entry until the tail is updated.
+   * This is done immediately rather than when submitting because
+   * the caller fills in the entry straight away and nothing else
+   * touches the ring in between.
+   */
+  __atomic_store_n (ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  ring->n_queued++;
+
+  return sqe;
+}
+
+int
+vsx_uring_submit_and_wait (VsxUring *ring,
+                           int timeout_ms)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+
+  memset (&arg, 0, sizeof arg);
+
+  if (timeout_ms >= 0)
+    {
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = timeout_ms % 1000 * 1000000;
+      arg.ts = (uintptr_t) &ts;
+    }
+
+  return enter (ring,
+                1, /* min_complete */
+                IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                &arg,
+                sizeof arg);
+}
+
+unsigned
+vsx_uring_cq_ready (VsxUring *ring)
+{
+  return (__atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE)
+          - *ring->cq_head);
+}
+
+void
+vsx_uring_pop_cqe (VsxUring *ring,
+                   struct io_uring_cqe *cqe_out)
+{
+  unsigned head = *ring->cq_head;
+
+  *cqe_out = ring->cqes[head & ring->cq_mask];
+
+  __atomic_store_n (ring->cq_head, head + 1, __ATOMIC_RELEASE);
+}
+
+void
+vsx_uring_destroy (VsxUring *ring)
+{
+  if (ring->sqes)
+    munmap (ring->sqes, ring->sqes_size);
+  if (ring->cq_ring)
+    munmap (ring->cq_ring, ring->cq_ring_size);
+  if (ring->sq_ring)
+    munmap (ring->sq_ring, ring->sq_ring_size);
+
+  if (ring->fd != -1)
+    close (ring->fd);
+}
+
+#endif /* HAVE_IO_URING */
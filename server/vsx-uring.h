@@ -0,0 +1,90 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2026  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSX_URING_H
+#define VSX_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+#include "vsx-error.h"
+
+/* A minimal wrapper around the io_uring system calls so that we don’t
+ * need to depend on liburing. It only covers what VsxMainContext
+ * needs.
+ */
+
+typedef struct
+{
+  int fd;
+
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_array;
+  unsigned sq_mask;
+  unsigned sq_entries;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+
+  /* Number of SQEs that have been queued but not yet submitted */
+  unsigned n_queued;
+} VsxUring;
+
+bool
+vsx_uring_init (VsxUring *ring,
+                unsigned entries,
+                struct vsx_error **error);
+
+/* Returns a cleared SQE. If the submission queue is full then the
+ * queued entries are submitted first so this never fails.
+ */
+struct io_uring_sqe *
+vsx_uring_get_sqe (VsxUring *ring);
+
+/* Submits everything that is queued and waits until at least one
+ * completion is available or the timeout expires. A negative timeout
+ * waits forever. Returns zero or a negative errno value.
+ */
+int
+vsx_uring_submit_and_wait (VsxUring *ring,
+                           int timeout_ms);
+
+/* Number of completions waiting to be read */
+unsigned
+vsx_uring_cq_ready (VsxUring *ring);
+
+/* Copies the next completion and removes it from the queue. */
+void
+vsx_uring_pop_cqe (VsxUring *ring,
+                   struct io_uring_cqe *cqe_out);
+
+void
+vsx_uring_destroy (VsxUring *ring);
+
+#endif /* VSX_URING_H */
@@ -514,6 +514,12 @@ vsx_ws_parser_get_key_hash (VsxWsParser *parser,
   return parser->key_hash;
 }
 
+size_t
+vsx_ws_parser_get_size (void)
+{
+  return sizeof (VsxWsParser);
+}
+
 void
 vsx_ws_parser_free (VsxWsParser *parser)
 {
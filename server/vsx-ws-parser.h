@@ -54,6 +54,10 @@ const uint8_t *
 vsx_ws_parser_get_key_hash (VsxWsParser *parser,
                             size_t *key_hash_size);
 
+/* Size of the memory allocated for a parser */
+size_t
+vsx_ws_parser_get_size (void);
+
 void vsx_ws_parser_free (VsxWsParser *parser);
 
 #endif /* VSX_WS_PARSER_H */
@@ -108,6 +108,8 @@ function ChatSession (playerName)
   this.connected = false;
   this.reconnectTimeout = null;
   this.reconnectCount = 0;
+  /* Number of times in a row that the server has said it is too busy */
+  this.busyCount = 0;
   this.keepAliveTimeout = null;
 
   this.playerName = playerName || "ludanto";
@@ -1166,6 +1168,7 @@ ChatSession.prototype.handlePlayerId = function (mr)
 
   /* If we get a player ID then we can assume the connection was worked */
   this.reconnectCount = 0;
+  this.busyCount = 0;
 
   this.setState ("in-progress");
 };
@@ -1320,6 +1323,22 @@ ChatSession.prototype.handleConversationFull = function (mr)
   this.setError ("@CONVERSATION_FULL@");
 };
 
+ChatSession.prototype.handleServerBusy = function (mr)
+{
+  /* The server is overloaded so try again later, waiting longer each
+   * time. The random part stops all of the clients that were turned
+   * away at the same time from coming back together. */
+  var delay = Math.min (15000 * Math.pow (2, this.busyCount), 8 * 60 * 1000);
+
+  this.busyCount++;
+  this.disconnect ();
+  this.setState ("connecting");
+
+  this.reconnectTimeout =
+    setTimeout (this.reconnectTimeoutCb.bind (this),
+                delay + Math.floor (Math.random () * delay / 2));
+};
+
 ChatSession.prototype.handleConversationId = function (mr)
 {
   var id = this.encodeId (mr.getUint64 ());
@@ -1370,6 +1389,8 @@ ChatSession.prototype.messageCb = function (e)
     this.handleBadConversationId (mr);
   else if (msgType == 0x0d)
     this.handleConversationFull (mr);
+  else if (msgType == 0x0e)
+    this.handleServerBusy (mr);
 };
 
 ChatSession.prototype.unloadCb = function ()